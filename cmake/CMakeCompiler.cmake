@@ -0,0 +1,14 @@
+cmake_minimum_required (VERSION 3.10)
+
+# Sets the compiler options we use for every target
+macro(setup_default_compiler_flags _project_name)
+	set_target_properties(${_project_name} PROPERTIES
+		CXX_STANDARD 17
+		CXX_STANDARD_REQUIRED ON
+		CXX_EXTENSIONS OFF)
+
+	target_compile_options(${_project_name} PRIVATE -Wall -Wextra -Wshadow -Werror)
+	target_compile_options(${_project_name} PRIVATE -fno-exceptions -fno-rtti)
+
+	target_include_directories(${_project_name} PRIVATE "${VMEMPROF_INCLUDE_DIR}")
+endmacro()
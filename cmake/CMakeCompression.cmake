@@ -0,0 +1,21 @@
+cmake_minimum_required (VERSION 3.10)
+
+# Traces can be compressed with zstd when it is found, the in-tree LZ codec is always available
+if(VMEMPROF_USE_ZSTD)
+	find_path(ZSTD_INCLUDE_DIR zstd.h)
+	find_library(ZSTD_LIBRARY zstd)
+
+	if(ZSTD_INCLUDE_DIR AND ZSTD_LIBRARY)
+		message(STATUS "vmemprof: zstd compression enabled")
+		set(VMEMPROF_ZSTD_FOUND ON)
+	endif()
+endif()
+
+# Every target that reads or writes traces compiles the codecs
+macro(setup_trace_compression _project_name)
+	if(VMEMPROF_ZSTD_FOUND)
+		target_compile_definitions(${_project_name} PRIVATE VMEMPROF_USE_ZSTD)
+		target_include_directories(${_project_name} PRIVATE ${ZSTD_INCLUDE_DIR})
+		target_link_libraries(${_project_name} PRIVATE ${ZSTD_LIBRARY})
+	endif()
+endmacro()
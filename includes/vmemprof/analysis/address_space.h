@@ -0,0 +1,774 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/analysis/vma_region.h"
+#include "vmemprof/core/event.h"
+
+#include <cstdint>
+#include <sys/mman.h>
+#include <utility>
+#include <vector>
+
+namespace vmemprof
+{
+	namespace address_space_impl
+	{
+		////////////////////////////////////////////////////////////////////////////////
+		// A node of a persistent treap ordered by region start.
+		//
+		// Nodes are shared between versions of the tree and reference counted. A node
+		// is only mutated in place while a single version references it, every other
+		// update copies the path from the root. Taking a snapshot is a root copy.
+		////////////////////////////////////////////////////////////////////////////////
+		struct region_node
+		{
+			vma_region		region;
+			region_node*	left;
+			region_node*	right;
+			uint32_t		priority;
+			uint32_t		reference_count;
+		};
+
+		// Derived from the address so that replaying a trace always builds the same tree
+		inline uint32_t compute_priority(uint64_t address)
+		{
+			address ^= address >> 33;
+			address *= 0xFF51AFD7ED558CCDULL;
+			address ^= address >> 33;
+			return uint32_t(address);
+		}
+
+		inline region_node* acquire(region_node* node)
+		{
+			if (node != nullptr)
+				node->reference_count++;
+			return node;
+		}
+
+		inline void release(region_node* node)
+		{
+			while (node != nullptr && --node->reference_count == 0)
+			{
+				region_node* right = node->right;
+				release(node->left);
+				delete node;
+				node = right;
+			}
+		}
+
+		inline region_node* allocate(const vma_region& region)
+		{
+			return new region_node{ region, nullptr, nullptr, compute_priority(region.start), 1 };
+		}
+
+		// Consumes a reference and returns a node that only the caller references
+		inline region_node* make_unique(region_node* node)
+		{
+			if (node->reference_count == 1)
+				return node;
+
+			region_node* copy = new region_node{ node->region, acquire(node->left), acquire(node->right), node->priority, 1 };
+			node->reference_count--;
+			return copy;
+		}
+
+		// Consumes 'node' and returns the nodes that start before 'address' and the rest
+		inline std::pair<region_node*, region_node*> split(region_node* node, uint64_t address)
+		{
+			if (node == nullptr)
+				return { nullptr, nullptr };
+
+			node = make_unique(node);
+			if (node->region.start < address)
+			{
+				const std::pair<region_node*, region_node*> halves = split(node->right, address);
+				node->right = halves.first;
+				return { node, halves.second };
+			}
+			else
+			{
+				const std::pair<region_node*, region_node*> halves = split(node->left, address);
+				node->left = halves.second;
+				return { halves.first, node };
+			}
+		}
+
+		// Consumes both trees, every region of 'lhs' must precede every region of 'rhs'
+		inline region_node* merge(region_node* lhs, region_node* rhs)
+		{
+			if (lhs == nullptr)
+				return rhs;
+			if (rhs == nullptr)
+				return lhs;
+
+			if (lhs->priority > rhs->priority)
+			{
+				lhs = make_unique(lhs);
+				lhs->right = merge(lhs->right, rhs);
+				return lhs;
+			}
+			else
+			{
+				rhs = make_unique(rhs);
+				rhs->left = merge(lhs, rhs->left);
+				return rhs;
+			}
+		}
+
+		inline const vma_region* peek_first(const region_node* node)
+		{
+			if (node == nullptr)
+				return nullptr;
+			while (node->left != nullptr)
+				node = node->left;
+			return &node->region;
+		}
+
+		inline const vma_region* peek_last(const region_node* node)
+		{
+			if (node == nullptr)
+				return nullptr;
+			while (node->right != nullptr)
+				node = node->right;
+			return &node->region;
+		}
+
+		// Consumes the tree and returns it without its first region
+		inline region_node* remove_first(region_node* node)
+		{
+			node = make_unique(node);
+			if (node->left == nullptr)
+			{
+				region_node* right = acquire(node->right);
+				release(node);
+				return right;
+			}
+
+			node->left = remove_first(node->left);
+			return node;
+		}
+
+		// Consumes the tree and returns it without its last region
+		inline region_node* remove_last(region_node* node)
+		{
+			node = make_unique(node);
+			if (node->right == nullptr)
+			{
+				region_node* left = acquire(node->left);
+				release(node);
+				return left;
+			}
+
+			node->right = remove_last(node->right);
+			return node;
+		}
+
+		// In address order, stops and returns false when the function returns false
+		template<typename function_type>
+		inline bool for_each_region(const region_node* node, uint64_t start, uint64_t end, function_type&& function)
+		{
+			while (node != nullptr)
+			{
+				// Regions on the left end before this one starts
+				if (start < node->region.start && !for_each_region(node->left, start, end, function))
+					return false;
+
+				if (node->region.start >= end)
+					return true;
+
+				if (node->region.end > start && !function(node->region))
+					return false;
+
+				// Regions on the right start after this one ends
+				node = node->right;
+			}
+
+			return true;
+		}
+
+		inline void append_region(std::vector<vma_region>& regions, const vma_region& region)
+		{
+			if (!regions.empty() && are_regions_coalescable(regions.back(), region))
+				regions.back().end = region.end;
+			else
+				regions.push_back(region);
+		}
+
+		inline vma_region clip_region(const vma_region& region, uint64_t start, uint64_t end)
+		{
+			vma_region clipped = region;
+			if (clipped.start < start)
+			{
+				clipped.offset += start - clipped.start;
+				clipped.start = start;
+			}
+			if (clipped.end > end)
+				clipped.end = end;
+			return clipped;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Aggregate statistics of an address space, maintained incrementally.
+	////////////////////////////////////////////////////////////////////////////////
+	struct address_space_stats
+	{
+		uint64_t	num_vmas = 0;			// As the kernel counts them, see are_regions_kernel_mergeable
+		uint64_t	num_regions = 0;
+		uint64_t	mapped_bytes = 0;
+		uint64_t	inaccessible_bytes = 0;	// PROT_NONE reservations
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// The reconstructed address space of a process.
+	//
+	// Events are applied exactly as the kernel applies them: mmap overlays existing
+	// ranges (MAP_FIXED), munmap/mprotect/madvise and userfaultfd registration split
+	// the regions they partially cover, mremap moves, grows and shrinks ranges and the
+	// program break grows and shrinks the heap. Lengths are rounded up to pages like
+	// the kernel does.
+	//
+	// The regions live in a persistent treap: every update costs O(log n) and copying
+	// an address_space is O(1), copies share their nodes until either one changes.
+	////////////////////////////////////////////////////////////////////////////////
+	class address_space
+	{
+	public:
+		static constexpr uint64_t k_page_size = 4096;
+
+		address_space() = default;
+		~address_space() { address_space_impl::release(m_root); }
+
+		address_space(const address_space& other)
+			: m_root(address_space_impl::acquire(other.m_root))
+			, m_stats(other.m_stats)
+			, m_next_mapping_id(other.m_next_mapping_id)
+		{
+		}
+
+		address_space& operator=(const address_space& other)
+		{
+			if (this != &other)
+			{
+				address_space_impl::region_node* root = address_space_impl::acquire(other.m_root);
+				address_space_impl::release(m_root);
+				m_root = root;
+				m_stats = other.m_stats;
+				m_next_mapping_id = other.m_next_mapping_id;
+			}
+			return *this;
+		}
+
+		void clear()
+		{
+			address_space_impl::release(m_root);
+			m_root = nullptr;
+			m_stats = address_space_stats();
+			m_next_mapping_id = 1;
+		}
+
+		const address_space_stats& get_stats() const { return m_stats; }
+
+		//////////////////////////////////////////////////////////////////////////
+		// Updates
+
+		void apply(const vm_event& event)
+		{
+			switch (event.type)
+			{
+			case event_type::mmap:		apply_mmap(event); break;
+			case event_type::munmap:	unmap(event.address, event.address + align_to_page(event.size)); break;
+			case event_type::mremap:	apply_mremap(event); break;
+			case event_type::mprotect:	apply_mprotect(event); break;
+			case event_type::madvise:	apply_madvise(event); break;
+			case event_type::brk:
+			case event_type::sbrk:		apply_break(event); break;
+			case event_type::uffd_register:
+			case event_type::uffd_unregister:	apply_uffd_registration(event); break;
+			default:					break;
+			}
+		}
+
+		// Maps a region, replacing whatever overlaps it
+		void map(const vma_region& region)
+		{
+			std::vector<vma_region>& new_regions = m_scratch_new_regions;
+			new_regions.clear();
+			new_regions.push_back(region);
+			replace_range(region.start, region.end, new_regions);
+		}
+
+		void unmap(uint64_t start, uint64_t end)
+		{
+			m_scratch_new_regions.clear();
+			replace_range(start, end, m_scratch_new_regions);
+		}
+
+		// Replaces everything in [start, end) with sorted regions that lie within that range
+		void assign_range(uint64_t start, uint64_t end, const std::vector<vma_region>& regions)
+		{
+			replace_range(start, end, regions);
+		}
+
+		// Appends the regions of a space that lies entirely at or after our last region, shares its nodes
+		void append(const address_space& other)
+		{
+			using namespace address_space_impl;
+
+			const vma_region* last = peek_last(m_root);
+			const vma_region* first = peek_first(other.m_root);
+			if (first == nullptr)
+				return;
+
+			m_stats.num_vmas += other.m_stats.num_vmas;
+			m_stats.num_regions += other.m_stats.num_regions;
+			m_stats.mapped_bytes += other.m_stats.mapped_bytes;
+			m_stats.inaccessible_bytes += other.m_stats.inaccessible_bytes;
+
+			region_node* right = acquire(other.m_root);
+			if (last != nullptr && are_regions_kernel_mergeable(*last, *first))
+				m_stats.num_vmas--;
+
+			if (last != nullptr && are_regions_coalescable(*last, *first))
+			{
+				vma_region region = *last;
+				region.end = first->end;
+				m_root = remove_last(m_root);
+				right = merge(allocate(region), remove_first(right));
+				m_stats.num_regions--;
+			}
+
+			m_root = merge(m_root, right);
+		}
+
+		// Mappings are numbered in creation order, a replay that skips some events numbers them itself
+		uint64_t get_next_mapping_id() const { return m_next_mapping_id; }
+		void set_next_mapping_id(uint64_t mapping_id) { m_next_mapping_id = mapping_id; }
+
+		//////////////////////////////////////////////////////////////////////////
+		// Queries
+
+		// Returns the region that contains an address or nullptr
+		const vma_region* find_region(uint64_t address) const
+		{
+			const address_space_impl::region_node* node = m_root;
+			while (node != nullptr)
+			{
+				if (address < node->region.start)
+					node = node->left;
+				else if (address >= node->region.end)
+					node = node->right;
+				else
+					return &node->region;
+			}
+
+			return nullptr;
+		}
+
+		// Returns the last region that starts before an address or nullptr
+		const vma_region* find_previous_region(uint64_t address) const
+		{
+			const address_space_impl::region_node* node = m_root;
+			const vma_region* previous = nullptr;
+			while (node != nullptr)
+			{
+				if (node->region.start < address)
+				{
+					previous = &node->region;
+					node = node->right;
+				}
+				else
+					node = node->left;
+			}
+
+			return previous;
+		}
+
+		// Calls 'bool(const vma_region&)' for every region that intersects [start, end) in address order, stops when it returns false
+		template<typename function_type>
+		void for_each_region(uint64_t start, uint64_t end, function_type function) const
+		{
+			address_space_impl::for_each_region(m_root, start, end, function);
+		}
+
+		template<typename function_type>
+		void for_each_region(function_type function) const
+		{
+			address_space_impl::for_each_region(m_root, 0, UINT64_MAX, function);
+		}
+
+		// Calls 'bool(const vma_region& first, uint64_t end)' for every kernel VMA, the first region carries its attributes
+		template<typename function_type>
+		void for_each_vma(function_type function) const
+		{
+			bool has_vma = false;
+			bool is_done = false;
+			vma_region first;
+			vma_region last;
+
+			for_each_region([&](const vma_region& region)
+				{
+					if (has_vma && are_regions_kernel_mergeable(last, region))
+					{
+						last = region;
+						return true;
+					}
+
+					if (has_vma && !function(first, last.end))
+					{
+						is_done = true;
+						return false;
+					}
+
+					first = region;
+					last = region;
+					has_vma = true;
+					return true;
+				});
+
+			if (has_vma && !is_done)
+				function(first, last.end);
+		}
+
+		static uint64_t align_to_page(uint64_t value) { return (value + k_page_size - 1) & ~(k_page_size - 1); }
+
+	private:
+		void apply_mmap(const vm_event& event)
+		{
+			vma_region region;
+			region.start = event.address;
+			region.end = event.address + align_to_page(event.size);
+			region.offset = (event.flags & MAP_ANONYMOUS) != 0 ? 0 : event.arg1;
+			region.mapping_id = m_next_mapping_id++;
+			region.mapping_size = region.end - region.start;
+			region.timestamp = event.timestamp;
+			region.fd = (event.flags & MAP_ANONYMOUS) != 0 ? -1 : int32_t(int64_t(event.arg0));
+			region.stack_id = event.stack_id;
+			region.thread_id = event.thread_id;
+			region.protection = event.protection & (PROT_READ | PROT_WRITE | PROT_EXEC);
+			region.map_flags = event.flags;
+			region.advice_flags = 0;
+
+			map(region);
+		}
+
+		void apply_mremap(const vm_event& event)
+		{
+			const uint64_t old_start = event.arg0;
+			const uint64_t old_size = align_to_page(event.arg1);
+			const uint64_t old_end = old_start + old_size;
+			const uint64_t new_start = event.address;
+			const uint64_t new_size = align_to_page(event.size);
+			const uint64_t new_end = new_start + new_size;
+
+			// The moved regions keep their identity, only their range changes
+			std::vector<vma_region>& moved_regions = m_scratch_moved_regions;
+			moved_regions.clear();
+
+			// An old size of zero duplicates a shared mapping
+			const uint64_t copied_end = old_size == 0 ? old_start + new_size : (old_size < new_size ? old_end : old_start + new_size);
+			for_each_region(old_start, copied_end, [&](const vma_region& region)
+				{
+					vma_region moved = address_space_impl::clip_region(region, old_start, copied_end);
+					moved.start = moved.start - old_start + new_start;
+					moved.end = moved.end - old_start + new_start;
+					moved_regions.push_back(moved);
+					return true;
+				});
+
+			// MREMAP_FIXED unmaps whatever the destination held first, like MAP_FIXED, even
+			// when the source was not sampled. The kernel rejects overlapping ranges.
+			if ((event.flags & MREMAP_FIXED) != 0)
+				unmap(new_start, new_end);
+
+			if (moved_regions.empty())
+				return;
+
+			// Growing extends the last region
+			if (new_size > copied_end - old_start)
+				moved_regions.back().end = new_end;
+
+			if (old_size != 0 && (new_start != old_start || new_size < old_size))
+			{
+				if ((event.flags & MREMAP_DONTUNMAP) != 0)
+				{
+					// The old range stays mapped, its pages moved away
+				}
+				else if (new_start == old_start)
+					unmap(new_end, old_end);
+				else
+					unmap(old_start, old_end);
+			}
+
+			if (old_size != new_size)
+			{
+				replace_range(new_start, new_end, moved_regions);
+				return;
+			}
+
+			// A move of the same size can span several VMAs, the holes between them are
+			// left untouched at the destination unless MREMAP_FIXED cleared it
+			std::vector<vma_region>& run_regions = m_scratch_new_regions;
+			size_t run_start_index = 0;
+			for (size_t region_index = 1; region_index <= moved_regions.size(); ++region_index)
+			{
+				if (region_index < moved_regions.size() && moved_regions[region_index - 1].end == moved_regions[region_index].start)
+					continue;
+
+				run_regions.assign(moved_regions.begin() + run_start_index, moved_regions.begin() + region_index);
+				replace_range(run_regions.front().start, run_regions.back().end, run_regions);
+				run_start_index = region_index;
+			}
+		}
+
+		void apply_mprotect(const vm_event& event)
+		{
+			const uint64_t start = event.address;
+			uint64_t end = event.address + align_to_page(event.size);
+
+			// mprotect stops at the first hole, everything before it was updated
+			if ((event.flags & k_event_flag_partial) != 0)
+				end = find_contiguous_end(start, end);
+
+			const uint32_t protection = event.protection & (PROT_READ | PROT_WRITE | PROT_EXEC);
+			update_range(start, end, [protection](vma_region& region) { region.protection = protection; });
+		}
+
+		void apply_madvise(const vm_event& event)
+		{
+			// Most advices do not touch the VMA flags, they do not split anything
+			uint32_t advice_flags = 0;
+			if (!apply_madvise_advice(uint32_t(event.arg0), advice_flags))
+				return;
+
+			const uint32_t advice = uint32_t(event.arg0);
+			update_range(event.address, event.address + align_to_page(event.size), [advice](vma_region& region) { apply_madvise_advice(advice, region.advice_flags); });
+		}
+
+		void apply_uffd_registration(const vm_event& event)
+		{
+			const uint32_t uffd_flags = event.type == event_type::uffd_register ? get_uffd_advice_flags(event.arg0) : 0;
+			update_range(event.address, event.address + align_to_page(event.size), [uffd_flags](vma_region& region) { region.advice_flags = (region.advice_flags & ~k_vma_advice_uffd_mask) | uffd_flags; });
+		}
+
+		void apply_break(const vm_event& event)
+		{
+			const uint64_t old_break = align_to_page(event.arg0);
+			const uint64_t new_break = align_to_page(event.address);
+
+			if (new_break < old_break)
+			{
+				unmap(new_break, old_break);
+				return;
+			}
+
+			if (new_break == old_break)
+				return;
+
+			vma_region region;
+			region.start = old_break;
+			region.end = new_break;
+			region.offset = 0;
+			region.mapping_id = m_next_mapping_id++;
+			region.mapping_size = new_break - old_break;
+			region.timestamp = event.timestamp;
+			region.fd = -1;
+			region.stack_id = event.stack_id;
+			region.thread_id = event.thread_id;
+			region.protection = PROT_READ | PROT_WRITE;
+			region.map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+			region.advice_flags = 0;
+
+			map(region);
+		}
+
+		// Returns where the mapped range that starts at 'start' ends, 'start' if it is not mapped
+		uint64_t find_contiguous_end(uint64_t start, uint64_t end) const
+		{
+			uint64_t contiguous_end = start;
+			for_each_region(start, end, [&contiguous_end](const vma_region& region)
+				{
+					if (region.start > contiguous_end)
+						return false;
+
+					contiguous_end = region.end;
+					return true;
+				});
+
+			return contiguous_end < end ? contiguous_end : end;
+		}
+
+		// Applies a function to the mapped parts of [start, end), holes are skipped like madvise does
+		template<typename function_type>
+		void update_range(uint64_t start, uint64_t end, function_type function)
+		{
+			std::vector<vma_region>& new_regions = m_scratch_new_regions;
+			new_regions.clear();
+
+			for_each_region(start, end, [&](const vma_region& region)
+				{
+					vma_region updated = address_space_impl::clip_region(region, start, end);
+					function(updated);
+					address_space_impl::append_region(new_regions, updated);
+					return true;
+				});
+
+			if (!new_regions.empty())
+				replace_range(new_regions.front().start, new_regions.back().end, new_regions);
+		}
+
+		// Number of regions that start a new kernel VMA in 'regions', bounded by the regions that precede and follow them
+		static uint64_t count_vmas(const vma_region* previous, const std::vector<vma_region>& regions, const vma_region* next)
+		{
+			uint64_t num_vmas = 0;
+			for (const vma_region& region : regions)
+			{
+				if (previous == nullptr || !are_regions_kernel_mergeable(*previous, region))
+					num_vmas++;
+				previous = &region;
+			}
+
+			if (next != nullptr && (previous == nullptr || !are_regions_kernel_mergeable(*previous, *next)))
+				num_vmas++;
+
+			return num_vmas;
+		}
+
+		void remove_stats(const std::vector<vma_region>& regions)
+		{
+			for (const vma_region& region : regions)
+			{
+				m_stats.num_regions--;
+				m_stats.mapped_bytes -= region.get_size();
+				if (region.protection == PROT_NONE)
+					m_stats.inaccessible_bytes -= region.get_size();
+			}
+		}
+
+		void add_stats(const std::vector<vma_region>& regions)
+		{
+			for (const vma_region& region : regions)
+			{
+				m_stats.num_regions++;
+				m_stats.mapped_bytes += region.get_size();
+				if (region.protection == PROT_NONE)
+					m_stats.inaccessible_bytes += region.get_size();
+			}
+		}
+
+		// Replaces everything in [start, end) with the sorted regions provided, which must lie within that range
+		void replace_range(uint64_t start, uint64_t end, const std::vector<vma_region>& new_regions)
+		{
+			using namespace address_space_impl;
+
+			if (start >= end)
+				return;
+
+			std::vector<vma_region>& old_window = m_scratch_old_window;
+			std::vector<vma_region>& new_window = m_scratch_new_window;
+			old_window.clear();
+			new_window.clear();
+
+			// Split the tree in three, regions that straddle the boundaries are cut
+			std::pair<region_node*, region_node*> halves = split(m_root, start);
+			region_node* left = halves.first;
+			halves = split(halves.second, end);
+			region_node* middle = halves.first;
+			region_node* right = halves.second;
+
+			const vma_region* straddling = peek_last(left);
+			if (straddling != nullptr && straddling->end > start)
+			{
+				const vma_region region = *straddling;
+				left = remove_last(left);
+				left = merge(left, allocate(clip_region(region, region.start, start)));
+				old_window.push_back(clip_region(region, start, end));
+				m_stats.num_regions++;
+
+				if (region.end > end)
+				{
+					right = merge(allocate(clip_region(region, end, region.end)), right);
+					m_stats.num_regions++;
+				}
+			}
+
+			address_space_impl::for_each_region(middle, 0, UINT64_MAX, [&](const vma_region& region) { old_window.push_back(region); return true; });
+			release(middle);
+
+			if (!old_window.empty() && old_window.back().end > end)
+			{
+				const vma_region region = old_window.back();
+				old_window.back().end = end;
+				right = merge(allocate(clip_region(region, end, region.end)), right);
+				m_stats.num_regions++;
+			}
+
+			// Pull the neighbours in when they coalesce with the new regions
+			const vma_region* previous = peek_last(left);
+			if (previous != nullptr && !new_regions.empty() && are_regions_coalescable(*previous, new_regions.front()))
+			{
+				old_window.insert(old_window.begin(), *previous);
+				new_window.push_back(*previous);
+				left = remove_last(left);
+				previous = peek_last(left);
+			}
+
+			for (const vma_region& region : new_regions)
+				append_region(new_window, region);
+
+			const vma_region* next = peek_first(right);
+			if (next != nullptr && !new_window.empty() && are_regions_coalescable(new_window.back(), *next))
+			{
+				old_window.push_back(*next);
+				new_window.back().end = next->end;
+				right = remove_first(right);
+				next = peek_first(right);
+			}
+
+			// Cut pieces are kernel mergeable with each other, counting on the cut tree is equivalent
+			m_stats.num_vmas -= count_vmas(previous, old_window, next);
+			m_stats.num_vmas += count_vmas(previous, new_window, next);
+			remove_stats(old_window);
+			add_stats(new_window);
+
+			region_node* replacement = nullptr;
+			for (const vma_region& region : new_window)
+				replacement = merge(replacement, allocate(region));
+
+			m_root = merge(merge(left, replacement), right);
+		}
+
+		address_space_impl::region_node*	m_root = nullptr;
+		address_space_stats					m_stats;
+		uint64_t							m_next_mapping_id = 1;
+
+		// Scratch memory reused across updates
+		std::vector<vma_region>				m_scratch_new_regions;
+		std::vector<vma_region>				m_scratch_moved_regions;
+		std::vector<vma_region>				m_scratch_old_window;
+		std::vector<vma_region>				m_scratch_new_window;
+	};
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/analysis/sharded_replay.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/worker_pool.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Reconstructs the address space of a traced process at any timestamp.
+	//
+	// Initialization replays the whole trace once and keeps a snapshot every few
+	// event chunks. Snapshots share the unchanged parts of the address space with
+	// each other. Seeking restores the closest snapshot in O(log n) and replays the
+	// events that follow it, at most one snapshot interval worth of events.
+	//
+	// With a worker pool, initialization shards the address space and replays every
+	// snapshot interval on the workers, see sharded_replay.
+	////////////////////////////////////////////////////////////////////////////////
+	class address_space_replay
+	{
+	public:
+		static constexpr uint32_t k_default_snapshot_interval = 16;
+		static constexpr uint32_t k_shards_per_thread = 4;
+
+		error_result initialize(const trace_reader& reader, uint32_t snapshot_interval = k_default_snapshot_interval, worker_pool* pool = nullptr)
+		{
+			m_reader = &reader;
+			m_snapshots.clear();
+
+			if (snapshot_interval == 0)
+				snapshot_interval = 1;
+
+			if (pool != nullptr && pool->get_num_workers() != 0)
+				return initialize_sharded(reader, snapshot_interval, *pool);
+
+			address_space space;
+
+			const uint32_t num_event_chunks = reader.get_num_event_chunks();
+			for (uint32_t event_chunk_index = 0; event_chunk_index < num_event_chunks; ++event_chunk_index)
+			{
+				const chunk_view chunk = reader.get_chunk(reader.get_event_chunk_index(event_chunk_index));
+
+				if (event_chunk_index % snapshot_interval == 0)
+					m_snapshots.push_back(snapshot{ chunk.header->first_timestamp, event_chunk_index, space });
+
+				const error_result result = for_each_event_in_chunk(chunk, [&space](const vm_event& event) { space.apply(event); return true; });
+				if (result.any())
+					return result;
+			}
+
+			m_final_space = space;
+			return error_result();
+		}
+
+		uint32_t get_num_snapshots() const { return uint32_t(m_snapshots.size()); }
+
+		// The address space once every event has been applied
+		const address_space& get_final_space() const { return m_final_space; }
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Reconstructs the address space once every event at or before 'timestamp' has
+		// been applied.
+		////////////////////////////////////////////////////////////////////////////////
+		error_result seek(uint64_t timestamp, address_space& out_space) const
+		{
+			// Find the last snapshot taken before the timestamp
+			uint32_t low = 0;
+			uint32_t high = uint32_t(m_snapshots.size());
+			while (low < high)
+			{
+				const uint32_t middle = low + (high - low) / 2;
+				if (m_snapshots[middle].timestamp <= timestamp)
+					low = middle + 1;
+				else
+					high = middle;
+			}
+
+			if (low == 0)
+			{
+				// Before the first event
+				out_space.clear();
+				return error_result();
+			}
+
+			const snapshot& start_snapshot = m_snapshots[low - 1];
+			out_space = start_snapshot.space;
+
+			bool is_done = false;
+			const uint32_t num_event_chunks = m_reader->get_num_event_chunks();
+			for (uint32_t event_chunk_index = start_snapshot.event_chunk_index; event_chunk_index < num_event_chunks && !is_done; ++event_chunk_index)
+			{
+				const chunk_view chunk = m_reader->get_chunk(m_reader->get_event_chunk_index(event_chunk_index));
+				const error_result result = for_each_event_in_chunk(chunk, [&](const vm_event& event)
+					{
+						if (event.timestamp > timestamp)
+						{
+							is_done = true;
+							return false;
+						}
+
+						out_space.apply(event);
+						return true;
+					});
+
+				if (result.any())
+					return result;
+			}
+
+			return error_result();
+		}
+
+	private:
+		error_result initialize_sharded(const trace_reader& reader, uint32_t snapshot_interval, worker_pool& pool)
+		{
+			// More shards than threads balances the shards that receive more events
+			sharded_replay replay;
+			replay.initialize(reader, (pool.get_num_workers() + 1) * k_shards_per_thread);
+
+			address_space space;
+
+			const uint32_t num_event_chunks = reader.get_num_event_chunks();
+			for (uint32_t event_chunk_index = 0; event_chunk_index < num_event_chunks; event_chunk_index += snapshot_interval)
+			{
+				// The workers decompress the chunks, the index has the timestamp we need
+				const chunk_index_entry& entry = reader.get_chunk_entry(reader.get_event_chunk_index(event_chunk_index));
+				replay.merge(space);
+				m_snapshots.push_back(snapshot{ entry.first_timestamp, event_chunk_index, space });
+
+				const error_result result = replay.replay(event_chunk_index, std::min(snapshot_interval, num_event_chunks - event_chunk_index), pool);
+				if (result.any())
+					return result;
+			}
+
+			replay.merge(m_final_space);
+			return error_result();
+		}
+
+		struct snapshot
+		{
+			uint64_t		timestamp;			// First event of the chunk, not applied yet
+			uint32_t		event_chunk_index;
+			address_space	space;
+		};
+
+		const trace_reader*		m_reader = nullptr;
+		std::vector<snapshot>	m_snapshots;
+		address_space			m_final_space;
+	};
+}
@@ -0,0 +1,444 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/analysis/range_call_map.h"
+#include "vmemprof/analysis/sample_scaler.h"
+#include "vmemprof/core/allocator_sample.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/trace/stack_codec.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Keeps the most recent sample of every allocator arena.
+	////////////////////////////////////////////////////////////////////////////////
+	class allocator_sample_map
+	{
+	public:
+		void clear() { m_samples.clear(); }
+
+		void add_sample(const allocator_sample& sample)
+		{
+			m_samples[get_key(sample.allocator, sample.arena)] = sample;
+		}
+
+		// Calls 'void(const allocator_sample&)' for every arena, by allocator then arena
+		template<typename function_type>
+		void for_each_sample(function_type function) const
+		{
+			for (const auto& entry : m_samples)
+				function(entry.second);
+		}
+
+		uint64_t get_num_samples() const { return m_samples.size(); }
+
+	private:
+		static uint64_t get_key(allocator_kind allocator, uint32_t arena) { return (uint64_t(allocator) << 32) | arena; }
+
+		std::map<uint64_t, allocator_sample>	m_samples;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// The extents allocator arenas hold. Extents are recorded as range calls:
+	// arg0 is the arena, arg1 the size of the extent when it was obtained, its
+	// size class, and flags the allocator. Active extents back allocations,
+	// retained extents stay mapped once the arena returned them.
+	////////////////////////////////////////////////////////////////////////////////
+	struct allocator_extent_state
+	{
+		range_call_map	active;
+		range_call_map	retained;
+
+		void clear()
+		{
+			active.clear();
+			retained.clear();
+		}
+
+		void apply(const vm_event& event)
+		{
+			if (event.type != event_type::allocator_extent)
+			{
+				active.apply_mapping_change(event);
+				retained.apply_mapping_change(event);
+				return;
+			}
+
+			const uint64_t end = event.address + address_space::align_to_page(event.size);
+			switch (allocator_extent_op(event.arg1))
+			{
+			case allocator_extent_op::alloc:
+			{
+				vm_event extent = event;
+				extent.arg1 = event.size;
+				retained.erase(event.address, end);
+				active.record(extent);
+				break;
+			}
+			case allocator_extent_op::retain:
+			{
+				// Retaining keeps the size class the extent had while it was active
+				vm_event extent = event;
+				extent.arg1 = event.size;
+				active.for_each_call(event.address, end, [&extent](const range_call& call) { extent.arg1 = call.arg1; });
+				active.erase(event.address, end);
+				retained.record(extent);
+				break;
+			}
+			case allocator_extent_op::dalloc:
+			case allocator_extent_op::destroy:
+				active.erase(event.address, end);
+				retained.erase(event.address, end);
+				break;
+			default:
+				// Commits and purges are madvise and mmap calls, the address space replay sees them
+				break;
+			}
+		}
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Replays a trace up to a timestamp and returns the tracked address space, the
+	// extents of the hooked allocators and the latest sample of every arena.
+	////////////////////////////////////////////////////////////////////////////////
+	inline error_result read_allocator_state(const trace_reader& reader, uint64_t until_timestamp, address_space& out_space, allocator_extent_state& out_extents, allocator_sample_map& out_samples)
+	{
+		out_space.clear();
+		out_extents.clear();
+		out_samples.clear();
+
+		event_cursor events(reader);
+		vm_event event;
+		while (events.next(event) && event.timestamp <= until_timestamp)
+		{
+			out_space.apply(event);
+			out_extents.apply(event);
+		}
+
+		if (events.is_corrupted())
+			return error_result("Corrupted event chunk");
+
+		const uint32_t num_allocator_chunks = reader.get_num_allocator_chunks();
+		for (uint32_t allocator_chunk_index = 0; allocator_chunk_index < num_allocator_chunks; ++allocator_chunk_index)
+		{
+			const chunk_view chunk = reader.get_chunk(reader.get_allocator_chunk_index(allocator_chunk_index));
+			if (chunk.header->first_timestamp > until_timestamp)
+				break;
+
+			const error_result result = for_each_allocator_sample_in_chunk(chunk, [&out_samples, until_timestamp](const allocator_sample& sample)
+				{
+					if (sample.timestamp > until_timestamp)
+						return false;
+
+					out_samples.add_sample(sample);
+					return true;
+				});
+
+			if (result.any())
+				return result;
+		}
+
+		return error_result();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Finds the allocator that mapped a region from its callstack: the mmap was
+	// called from a jemalloc or tcmalloc shared object. Allocators linked
+	// statically into the executable are not recognized.
+	////////////////////////////////////////////////////////////////////////////////
+	class allocator_stack_classifier
+	{
+	public:
+		explicit allocator_stack_classifier(const trace_reader& reader)
+			: m_reader(reader)
+		{
+			const uint32_t num_module_chunks = reader.get_num_module_chunks();
+			for (uint32_t module_chunk_index = 0; module_chunk_index < num_module_chunks; ++module_chunk_index)
+			{
+				const chunk_view chunk = reader.get_chunk(reader.get_module_chunk_index(module_chunk_index));
+				for_each_module_in_chunk(chunk, [this](const module_info& module)
+					{
+						allocator_kind allocator;
+						if (get_module_allocator(module, allocator))
+							m_modules.push_back(allocator_module{ module.start, module.end, allocator });
+						return true;
+					});
+			}
+		}
+
+		bool has_allocator_modules() const { return !m_modules.empty(); }
+
+		// Returns false if no frame of the stack belongs to an allocator
+		bool classify(uint32_t stack_id, allocator_kind& out_allocator)
+		{
+			if (m_modules.empty() || stack_id == k_invalid_stack_id)
+				return false;
+
+			auto it = m_stack_allocators.find(stack_id);
+			if (it == m_stack_allocators.end())
+				it = m_stack_allocators.emplace(stack_id, find_stack_allocator(stack_id)).first;
+
+			if (it->second == allocator_kind::count)
+				return false;
+
+			out_allocator = it->second;
+			return true;
+		}
+
+	private:
+		struct allocator_module
+		{
+			uint64_t		start;
+			uint64_t		end;
+			allocator_kind	allocator;
+		};
+
+		static bool get_module_allocator(const module_info& module, allocator_kind& out_allocator)
+		{
+			const char* name = module.path;
+			for (uint32_t char_index = 0; char_index < module.path_length; ++char_index)
+			{
+				if (module.path[char_index] == '/')
+					name = module.path + char_index + 1;
+			}
+
+			const uint32_t name_length = uint32_t(module.path + module.path_length - name);
+			if (name_length >= 11 && std::memcmp(name, "libjemalloc", 11) == 0)
+				out_allocator = allocator_kind::jemalloc;
+			else if (name_length >= 11 && std::memcmp(name, "libtcmalloc", 11) == 0)
+				out_allocator = allocator_kind::tcmalloc;
+			else
+				return false;
+
+			return true;
+		}
+
+		allocator_kind find_stack_allocator(uint32_t stack_id) const
+		{
+			uint64_t frames[k_max_stack_frames];
+			uint32_t num_frames;
+			if (!m_reader.get_stack(stack_id, frames, num_frames))
+				return allocator_kind::count;
+
+			for (uint32_t frame_index = 0; frame_index < num_frames; ++frame_index)
+			{
+				for (const allocator_module& module : m_modules)
+				{
+					if (frames[frame_index] >= module.start && frames[frame_index] < module.end)
+						return module.allocator;
+				}
+			}
+
+			return allocator_kind::count;
+		}
+
+		const trace_reader&							m_reader;
+		std::vector<allocator_module>				m_modules;
+		std::unordered_map<uint32_t, allocator_kind>	m_stack_allocators;		// allocator_kind::count when none
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// The tracked mappings of an allocator arena.
+	//
+	// Extent bytes back the allocations of the arena, retained bytes are extents
+	// it returned but kept mapped and uncarved bytes are mapped by the arena but
+	// not handed out as extents yet. Mappings attributed by their callstack have
+	// no extents, they only count mapped bytes under k_allocator_unknown_arena.
+	////////////////////////////////////////////////////////////////////////////////
+	struct allocator_arena_mappings
+	{
+		allocator_kind	allocator;
+		uint32_t		arena;
+		uint64_t		num_regions;
+		uint64_t		mapped_bytes;
+		uint64_t		extent_bytes;
+		uint64_t		retained_bytes;
+		uint64_t		uncarved_bytes;
+
+		// What the arena holds without using it
+		uint64_t get_unused_bytes() const { return retained_bytes + uncarved_bytes; }
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// The active extents of an arena of a given size class. Allocators pick the
+	// extent size from the size class of the allocations it serves.
+	////////////////////////////////////////////////////////////////////////////////
+	struct allocator_size_class_mappings
+	{
+		allocator_kind	allocator;
+		uint32_t		arena;
+		uint64_t		size_class;
+		uint64_t		num_extents;
+		uint64_t		extent_bytes;
+		uint32_t		stack_id;		// Callstack of the largest extent
+		uint64_t		largest_extent_bytes;
+	};
+
+	struct allocator_report
+	{
+		std::vector<allocator_sample>				samples;			// Latest sample of every arena, by allocator then arena
+		std::vector<allocator_arena_mappings>		arenas;				// By allocator then arena
+		std::vector<allocator_size_class_mappings>	size_classes;		// By allocator, arena then size class
+
+		uint64_t	num_unattributed_regions = 0;
+		uint64_t	unattributed_bytes = 0;		// Anonymous mappings no allocator claimed
+	};
+
+	namespace allocator_report_impl
+	{
+		inline uint64_t get_arena_key(allocator_kind allocator, uint32_t arena) { return (uint64_t(allocator) << 32) | arena; }
+
+		inline allocator_arena_mappings& get_arena(std::map<uint64_t, allocator_arena_mappings>& arenas, allocator_kind allocator, uint32_t arena)
+		{
+			auto it = arenas.find(get_arena_key(allocator, arena));
+			if (it == arenas.end())
+				it = arenas.emplace(get_arena_key(allocator, arena), allocator_arena_mappings{ allocator, arena, 0, 0, 0, 0, 0 }).first;
+
+			return it->second;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Attributes the tracked mappings to the allocator arenas that requested them.
+	//
+	// Extents recorded by the allocator hooks come first: the bytes of a region
+	// covered by extents belong to their arena and the rest of a region with
+	// extents is mapped by that arena but not carved yet. Anonymous regions
+	// without extents are attributed to the allocator whose code mapped them, if
+	// any. In sampled traces the bytes of regions are scaled, extents are always
+	// recorded and are not.
+	////////////////////////////////////////////////////////////////////////////////
+	inline void build_allocator_report(const trace_reader& reader, const address_space& space, const allocator_extent_state& extents, const allocator_sample_map& samples, allocator_report& out_report)
+	{
+		using namespace allocator_report_impl;
+
+		out_report = allocator_report();
+		samples.for_each_sample([&out_report](const allocator_sample& sample) { out_report.samples.push_back(sample); });
+
+		std::map<uint64_t, allocator_arena_mappings> arenas;
+		std::map<uint64_t, std::map<uint64_t, allocator_size_class_mappings>> size_classes;		// By arena key then size class
+
+		extents.active.for_each_call(0, UINT64_MAX, [&](const range_call& extent)
+			{
+				const allocator_kind allocator = allocator_kind(extent.flags);
+				const uint32_t arena = uint32_t(extent.arg0);
+				get_arena(arenas, allocator, arena).extent_bytes += extent.end - extent.start;
+
+				std::map<uint64_t, allocator_size_class_mappings>& arena_size_classes = size_classes[get_arena_key(allocator, arena)];
+				auto it = arena_size_classes.find(extent.arg1);
+				if (it == arena_size_classes.end())
+					it = arena_size_classes.emplace(extent.arg1, allocator_size_class_mappings{ allocator, arena, extent.arg1, 0, 0, k_invalid_stack_id, 0 }).first;
+
+				allocator_size_class_mappings& size_class = it->second;
+				size_class.num_extents++;
+				size_class.extent_bytes += extent.end - extent.start;
+				if (extent.end - extent.start > size_class.largest_extent_bytes)
+				{
+					size_class.largest_extent_bytes = extent.end - extent.start;
+					size_class.stack_id = extent.stack_id;
+				}
+			});
+
+		extents.retained.for_each_call(0, UINT64_MAX, [&](const range_call& extent)
+			{
+				get_arena(arenas, allocator_kind(extent.flags), uint32_t(extent.arg0)).retained_bytes += extent.end - extent.start;
+			});
+
+		const sample_scaler scaler(reader.get_sampling_interval());
+		allocator_stack_classifier classifier(reader);
+
+		space.for_each_region([&](const vma_region& region)
+			{
+				// The first extent over the region tells the arena that mapped it
+				bool has_extents = false;
+				allocator_kind allocator = allocator_kind::count;
+				uint32_t arena = 0;
+				uint64_t extent_bytes = 0;
+
+				const auto add_extent = [&](const range_call& extent)
+					{
+						if (!has_extents)
+						{
+							allocator = allocator_kind(extent.flags);
+							arena = uint32_t(extent.arg0);
+							has_extents = true;
+						}
+
+						extent_bytes += extent.end - extent.start;
+					};
+
+				extents.active.for_each_call(region.start, region.end, add_extent);
+				extents.retained.for_each_call(region.start, region.end, add_extent);
+
+				const uint64_t other_bytes = scaler.scale(region, region.get_size() - std::min(extent_bytes, region.get_size()));
+				if (has_extents)
+				{
+					allocator_arena_mappings& mappings = get_arena(arenas, allocator, arena);
+					mappings.num_regions++;
+					mappings.uncarved_bytes += other_bytes;
+				}
+				else if (region.is_anonymous())
+				{
+					if (classifier.classify(region.stack_id, allocator))
+					{
+						allocator_arena_mappings& mappings = get_arena(arenas, allocator, k_allocator_unknown_arena);
+						mappings.num_regions++;
+						mappings.mapped_bytes += other_bytes;
+					}
+					else
+					{
+						out_report.num_unattributed_regions++;
+						out_report.unattributed_bytes += other_bytes;
+					}
+				}
+
+				return true;
+			});
+
+		for (auto& entry : arenas)
+		{
+			allocator_arena_mappings& mappings = entry.second;
+			mappings.mapped_bytes += mappings.extent_bytes + mappings.retained_bytes + mappings.uncarved_bytes;
+			out_report.arenas.push_back(mappings);
+		}
+
+		for (const auto& arena_entry : size_classes)
+		{
+			for (const auto& size_class_entry : arena_entry.second)
+				out_report.size_classes.push_back(size_class_entry.second);
+		}
+	}
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/analysis/fault_attribution.h"
+#include "vmemprof/analysis/residency_map.h"
+#include "vmemprof/analysis/sample_scaler.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/fault_sample.h"
+#include "vmemprof/trace/stack_codec.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace vmemprof
+{
+	// What the samples of an exported profile count
+	enum class profile_weight
+	{
+		reserved,			// Mapped bytes of the regions, by the stack that mapped them
+		committed,			// Committed bytes of the regions, by the stack that mapped them
+		resident,			// Resident bytes of the regions, by the stack that mapped them
+		faults,				// Fault samples, by the stack that faulted
+		allocation_faults,	// Fault samples, by the stack that mapped the memory that faulted
+	};
+
+	inline const char* get_profile_weight_name(profile_weight weight)
+	{
+		switch (weight)
+		{
+		case profile_weight::reserved:			return "reserved";
+		case profile_weight::committed:			return "committed";
+		case profile_weight::resident:			return "resident";
+		case profile_weight::faults:			return "faults";
+		case profile_weight::allocation_faults:	return "alloc-faults";
+		default:								return "<unknown>";
+		}
+	}
+
+	inline bool parse_profile_weight(const char* str, profile_weight& out_weight)
+	{
+		for (profile_weight weight : { profile_weight::reserved, profile_weight::committed, profile_weight::resident, profile_weight::faults, profile_weight::allocation_faults })
+		{
+			if (std::strcmp(str, get_profile_weight_name(weight)) == 0)
+			{
+				out_weight = weight;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	inline bool is_byte_weight(profile_weight weight) { return weight == profile_weight::reserved || weight == profile_weight::committed || weight == profile_weight::resident; }
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Adds the weight of every region of an address space to the stack that mapped
+	// it. Only regions mapped at or after 'since_timestamp' count, byte weights are
+	// scaled back to the whole process when mappings were sampled.
+	////////////////////////////////////////////////////////////////////////////////
+	inline void add_region_weights(const address_space& space, const residency_map& residency, const sample_scaler& scaler, profile_weight weight,
+		uint64_t since_timestamp, std::vector<uint64_t>& inout_stack_weights)
+	{
+		space.for_each_region([&](const vma_region& region)
+			{
+				if (region.timestamp < since_timestamp)
+					return true;
+
+				uint64_t value;
+				if (weight == profile_weight::reserved)
+					value = scaler.scale(region, region.get_size());
+				else
+				{
+					const residency_estimate estimate = scaler.scale(region, residency.estimate(region));
+					value = weight == profile_weight::committed ? estimate.committed_bytes : estimate.resident_bytes;
+				}
+
+				if (region.stack_id >= inout_stack_weights.size())
+					inout_stack_weights.resize(region.stack_id + 1, 0);
+
+				inout_stack_weights[region.stack_id] += value;
+				return true;
+			});
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Counts the fault samples taken in [start_timestamp, end_timestamp] per stack,
+	// the stack that faulted or the stack that mapped the memory that faulted.
+	////////////////////////////////////////////////////////////////////////////////
+	inline error_result add_fault_weights(const trace_reader& reader, uint64_t start_timestamp, uint64_t end_timestamp, bool by_allocation_stack, std::vector<uint64_t>& inout_stack_weights)
+	{
+		const auto add_fault = [&inout_stack_weights](uint32_t stack_id)
+		{
+			if (stack_id >= inout_stack_weights.size())
+				inout_stack_weights.resize(stack_id + 1, 0);
+
+			inout_stack_weights[stack_id]++;
+		};
+
+		if (by_allocation_stack)
+		{
+			return attribute_faults(reader, [&](const fault_sample& sample, const vma_region* region)
+				{
+					if (sample.timestamp > end_timestamp)
+						return false;
+
+					if (sample.timestamp >= start_timestamp)
+						add_fault(region != nullptr ? region->stack_id : k_invalid_stack_id);
+					return true;
+				});
+		}
+
+		const uint32_t num_fault_chunks = reader.get_num_fault_chunks();
+		for (uint32_t fault_chunk_index = 0; fault_chunk_index < num_fault_chunks; ++fault_chunk_index)
+		{
+			const chunk_view chunk = reader.get_chunk(reader.get_fault_chunk_index(fault_chunk_index));
+			if (chunk.header->first_timestamp > end_timestamp)
+				break;
+
+			const error_result result = for_each_fault_sample_in_chunk(chunk, [&](const fault_sample& sample)
+				{
+					if (sample.timestamp > end_timestamp)
+						return false;
+
+					if (sample.timestamp >= start_timestamp)
+						add_fault(sample.stack_id);
+					return true;
+				});
+
+			if (result.any())
+				return result;
+		}
+
+		return error_result();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// A tree of callstacks, from the outermost caller to the leaf, weighted by the
+	// stacks that end at each node.
+	//
+	// It is built from a weight per stack id: every interned stack with a weight
+	// is decoded once and inserted, whatever the number of events or regions that
+	// were added to it. Stacks that are unknown hang from the root as a single
+	// frame at address zero.
+	////////////////////////////////////////////////////////////////////////////////
+	class callstack_tree
+	{
+	public:
+		static constexpr uint32_t k_root = 0;
+		static constexpr uint32_t k_no_node = ~0U;
+
+		struct node
+		{
+			uint64_t	address;			// Return address of the frame, zero for the root and unknown stacks
+			uint64_t	self_weight;		// Of the stacks that end here
+			uint64_t	total_weight;		// Of this node and its descendants
+			uint32_t	parent;
+			uint32_t	first_child;
+			uint32_t	next_sibling;
+		};
+
+		void build(const trace_reader& reader, const std::vector<uint64_t>& stack_weights)
+		{
+			m_nodes.clear();
+			m_children.clear();
+			m_nodes.push_back(node{ 0, 0, 0, k_no_node, k_no_node, k_no_node });
+
+			uint64_t frames[k_max_stack_frames];
+			for (uint32_t stack_id = 0; stack_id < stack_weights.size(); ++stack_id)
+			{
+				const uint64_t weight = stack_weights[stack_id];
+				if (weight == 0)
+					continue;
+
+				uint32_t num_frames;
+				if (stack_id == k_invalid_stack_id || !reader.get_stack(stack_id, frames, num_frames) || num_frames == 0)
+				{
+					frames[0] = 0;
+					num_frames = 1;
+				}
+
+				// Frames are leaf first
+				uint32_t node_index = k_root;
+				m_nodes[k_root].total_weight += weight;
+				for (uint32_t frame_index = num_frames; frame_index-- > 0;)
+				{
+					node_index = find_or_add_child(node_index, frames[frame_index]);
+					m_nodes[node_index].total_weight += weight;
+				}
+
+				m_nodes[node_index].self_weight += weight;
+			}
+		}
+
+		uint32_t get_num_nodes() const { return uint32_t(m_nodes.size()); }
+		const node& get_node(uint32_t node_index) const { return m_nodes[node_index]; }
+		uint64_t get_total_weight() const { return m_nodes[k_root].total_weight; }
+
+	private:
+		struct child_key
+		{
+			uint64_t	address;
+			uint32_t	parent;
+
+			bool operator==(const child_key& other) const { return address == other.address && parent == other.parent; }
+		};
+
+		struct child_key_hash
+		{
+			size_t operator()(const child_key& key) const { return size_t((key.address * 0x9E3779B97F4A7C15ULL) ^ key.parent); }
+		};
+
+		uint32_t find_or_add_child(uint32_t parent, uint64_t address)
+		{
+			const auto result = m_children.emplace(child_key{ address, parent }, uint32_t(m_nodes.size()));
+			if (!result.second)
+				return result.first->second;
+
+			m_nodes.push_back(node{ address, 0, 0, parent, k_no_node, m_nodes[parent].first_child });
+			m_nodes[parent].first_child = result.first->second;
+			return result.first->second;
+		}
+
+		std::vector<node>										m_nodes;		// The root first
+		std::unordered_map<child_key, uint32_t, child_key_hash>	m_children;		// Node of every frame under its parent
+	};
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/fault_sample.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <cstdint>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Joins every fault sample with the region that contained its address when it
+	// faulted. The region carries the mapping identity and allocation callstack.
+	//
+	// Faults and events are both sorted by timestamp, they are merged in a single
+	// pass: the events that precede a fault are applied to an address space and
+	// the fault is looked up in it. The cost is O((events + faults) * log(regions)).
+	//
+	// The callback has the signature 'bool(const fault_sample&, const vma_region*)'
+	// and returns false to stop early. The region is null when the address was not
+	// in a tracked region, e.g. memory mapped before the capture started.
+	////////////////////////////////////////////////////////////////////////////////
+	template<typename callback_type>
+	error_result attribute_faults(const trace_reader& reader, callback_type callback)
+	{
+		address_space space;
+		event_cursor events(reader);
+
+		vm_event event;
+		bool has_event = events.next(event);
+		bool is_done = false;
+
+		const uint32_t num_fault_chunks = reader.get_num_fault_chunks();
+		for (uint32_t fault_chunk_index = 0; fault_chunk_index < num_fault_chunks && !is_done; ++fault_chunk_index)
+		{
+			const chunk_view chunk = reader.get_chunk(reader.get_fault_chunk_index(fault_chunk_index));
+			const error_result result = for_each_fault_sample_in_chunk(chunk, [&](const fault_sample& sample)
+				{
+					// A fault cannot precede the mapping it touches, events at the same time are applied first
+					while (has_event && event.timestamp <= sample.timestamp)
+					{
+						space.apply(event);
+						has_event = events.next(event);
+					}
+
+					is_done = !callback(sample, space.find_region(sample.address));
+					return !is_done;
+				});
+
+			if (result.any())
+				return result;
+		}
+
+		if (events.is_corrupted())
+			return error_result("Corrupted event chunk");
+
+		return error_result();
+	}
+}
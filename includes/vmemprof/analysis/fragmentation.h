@@ -0,0 +1,235 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace vmemprof
+{
+	// Hole sizes are bucketed by powers of two from 4 KB, the last bucket is open ended
+	constexpr uint32_t k_num_hole_size_buckets = 36;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns the histogram bucket of a hole size: bucket i holds the holes in
+	// [4 KB << i, 4 KB << (i + 1)).
+	////////////////////////////////////////////////////////////////////////////////
+	inline uint32_t get_hole_size_bucket(uint64_t size)
+	{
+		const uint64_t num_pages = size >> 12;
+		if (num_pages <= 1)
+			return 0;
+
+		const uint32_t bucket = 63 - uint32_t(__builtin_clzll(num_pages));
+		return bucket < k_num_hole_size_buckets ? bucket : k_num_hole_size_buckets - 1;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// How much the mappings created by a callstack fragment the address space.
+	////////////////////////////////////////////////////////////////////////////////
+	struct fragmentation_contributor
+	{
+		uint32_t	stack_id;			// Callstack that created the mappings
+		uint64_t	num_vmas;
+		uint64_t	num_islands;		// VMAs with a hole on both sides
+		uint64_t	mapped_bytes;
+		uint64_t	stranded_bytes;		// Share of the neighbouring holes too small for large mappings
+	};
+
+	struct fragmentation_settings
+	{
+		// Holes smaller than this count as stranded, they cannot host a huge page or a large mapping
+		uint64_t	large_hole_size = 2 * 1024 * 1024;
+
+		// Contributors cost a hash lookup per VMA, timelines skip them
+		bool		is_contributors_enabled = true;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// The fragmentation of an address space at a point in time.
+	//
+	// Holes are the gaps between tracked mappings, from the lowest mapped address
+	// to the highest one. Memory mapped before the capture started is not tracked
+	// and shows up as free.
+	////////////////////////////////////////////////////////////////////////////////
+	struct fragmentation_report
+	{
+		uint64_t	span_start = 0;
+		uint64_t	span_end = 0;
+
+		uint64_t	num_vmas = 0;
+		uint64_t	mapped_bytes = 0;
+
+		uint64_t	num_holes = 0;
+		uint64_t	free_bytes = 0;
+		uint64_t	stranded_bytes = 0;
+		uint64_t	largest_hole_start = 0;
+		uint64_t	largest_hole_size = 0;
+
+		uint64_t	hole_counts[k_num_hole_size_buckets] = { 0 };
+		uint64_t	hole_bytes[k_num_hole_size_buckets] = { 0 };
+
+		// Sorted by stranded bytes then island count, largest first
+		std::vector<fragmentation_contributor> contributors;
+
+		// Zero when all the free space is a single hole, close to one when it is scattered
+		double get_fragmentation() const { return free_bytes != 0 ? 1.0 - double(largest_hole_size) / double(free_bytes) : 0.0; }
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Measures the fragmentation of an address space in a single sweep over its
+	// VMAs in address order: O(VMAs), plus sorting the contributors.
+	////////////////////////////////////////////////////////////////////////////////
+	inline void analyze_fragmentation(const address_space& space, const fragmentation_settings& settings, fragmentation_report& out_report)
+	{
+		out_report = fragmentation_report();
+
+		std::unordered_map<uint32_t, uint32_t> contributor_indices;
+		auto get_contributor = [&](uint32_t stack_id) -> fragmentation_contributor&
+		{
+			const auto insert_result = contributor_indices.emplace(stack_id, uint32_t(out_report.contributors.size()));
+			if (insert_result.second)
+				out_report.contributors.push_back(fragmentation_contributor{ stack_id, 0, 0, 0, 0 });
+
+			return out_report.contributors[insert_result.first->second];
+		};
+
+		// The previous VMA is only updated once we know whether a hole follows it
+		bool has_previous = false;
+		uint64_t previous_end = 0;
+		uint32_t previous_stack_id = 0;
+		bool is_previous_after_hole = false;
+
+		space.for_each_vma([&](const vma_region& first, uint64_t end)
+			{
+				const uint64_t hole_size = has_previous ? first.start - previous_end : 0;
+
+				if (hole_size != 0)
+				{
+					const uint32_t bucket = get_hole_size_bucket(hole_size);
+					out_report.hole_counts[bucket]++;
+					out_report.hole_bytes[bucket] += hole_size;
+					out_report.num_holes++;
+					out_report.free_bytes += hole_size;
+
+					if (hole_size > out_report.largest_hole_size)
+					{
+						out_report.largest_hole_start = previous_end;
+						out_report.largest_hole_size = hole_size;
+					}
+
+					const bool is_stranded = hole_size < settings.large_hole_size;
+					if (is_stranded)
+						out_report.stranded_bytes += hole_size;
+
+					if (settings.is_contributors_enabled)
+					{
+						fragmentation_contributor& previous = get_contributor(previous_stack_id);
+						if (is_previous_after_hole)
+							previous.num_islands++;
+
+						// Both neighbours of a stranded hole share the blame
+						if (is_stranded)
+						{
+							previous.stranded_bytes += hole_size / 2;
+							get_contributor(first.stack_id).stranded_bytes += hole_size - hole_size / 2;
+						}
+					}
+				}
+
+				if (!has_previous)
+					out_report.span_start = first.start;
+
+				out_report.num_vmas++;
+				out_report.mapped_bytes += end - first.start;
+
+				if (settings.is_contributors_enabled)
+				{
+					fragmentation_contributor& contributor = get_contributor(first.stack_id);
+					contributor.num_vmas++;
+					contributor.mapped_bytes += end - first.start;
+				}
+
+				has_previous = true;
+				previous_end = end;
+				previous_stack_id = first.stack_id;
+				is_previous_after_hole = hole_size != 0;
+				return true;
+			});
+
+		out_report.span_end = previous_end;
+
+		std::sort(out_report.contributors.begin(), out_report.contributors.end(), [](const fragmentation_contributor& lhs, const fragmentation_contributor& rhs)
+			{
+				if (lhs.stranded_bytes != rhs.stranded_bytes)
+					return lhs.stranded_bytes > rhs.stranded_bytes;
+				if (lhs.num_islands != rhs.num_islands)
+					return lhs.num_islands > rhs.num_islands;
+				return lhs.stack_id < rhs.stack_id;
+			});
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Measures the fragmentation at every timestamp of a sorted list, the events
+	// are replayed once. The callback has the signature
+	// 'bool(uint64_t timestamp, const fragmentation_report&)' and returns false to
+	// stop early. The cost is O(events * log(regions) + timestamps * VMAs).
+	////////////////////////////////////////////////////////////////////////////////
+	template<typename callback_type>
+	error_result analyze_fragmentation_over_time(const trace_reader& reader, const uint64_t* timestamps, uint32_t num_timestamps, const fragmentation_settings& settings, callback_type callback)
+	{
+		address_space space;
+		event_cursor events(reader);
+		fragmentation_report report;
+
+		vm_event event;
+		bool has_event = events.next(event);
+
+		for (uint32_t timestamp_index = 0; timestamp_index < num_timestamps; ++timestamp_index)
+		{
+			const uint64_t timestamp = timestamps[timestamp_index];
+			while (has_event && event.timestamp <= timestamp)
+			{
+				space.apply(event);
+				has_event = events.next(event);
+			}
+
+			analyze_fragmentation(space, settings, report);
+			if (!callback(timestamp, report))
+				break;
+		}
+
+		if (events.is_corrupted())
+			return error_result("Corrupted event chunk");
+
+		return error_result();
+	}
+}
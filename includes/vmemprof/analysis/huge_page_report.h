@@ -0,0 +1,233 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/analysis/range_call_map.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/huge_page_sample.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <sys/mman.h>
+#include <vector>
+
+namespace vmemprof
+{
+	// Transparent huge pages are PMD sized
+	constexpr uint64_t k_huge_page_size = 2 * 1024 * 1024;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Keeps the most recent huge page sample of every VMA.
+	////////////////////////////////////////////////////////////////////////////////
+	class huge_page_map
+	{
+	public:
+		void clear() { m_samples.clear(); }
+
+		void add_sample(const huge_page_sample& sample)
+		{
+			if ((sample.flags & huge_page_sample_removed) != 0)
+			{
+				// Newer samples of an overlapping VMA already replaced it when its range changed
+				auto it = m_samples.find(sample.start);
+				if (it != m_samples.end() && it->second.end == sample.end)
+					m_samples.erase(it);
+				return;
+			}
+
+			auto it = m_samples.lower_bound(sample.start);
+			if (it != m_samples.begin() && std::prev(it)->second.end > sample.start)
+				--it;
+
+			while (it != m_samples.end() && it->first < sample.end)
+				it = m_samples.erase(it);
+
+			m_samples.emplace_hint(it, sample.start, sample);
+		}
+
+		// Calls 'void(const huge_page_sample&)' for every VMA in address order
+		template<typename function_type>
+		void for_each_sample(function_type function) const
+		{
+			for (const auto& entry : m_samples)
+				function(entry.second);
+		}
+
+		uint64_t get_num_samples() const { return m_samples.size(); }
+
+	private:
+		std::map<uint64_t, huge_page_sample>	m_samples;		// Keyed by start, samples do not overlap
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Replays a trace up to a timestamp and returns the tracked address space, the
+	// madvise(MADV_HUGEPAGE) or madvise(MADV_NOHUGEPAGE) call in effect over every
+	// range and the latest huge page sample of every VMA.
+	////////////////////////////////////////////////////////////////////////////////
+	inline error_result read_huge_page_state(const trace_reader& reader, uint64_t until_timestamp, address_space& out_space, range_call_map& out_advice, huge_page_map& out_samples)
+	{
+		out_space.clear();
+		out_advice.clear();
+		out_samples.clear();
+
+		event_cursor events(reader);
+		vm_event event;
+		while (events.next(event) && event.timestamp <= until_timestamp)
+		{
+			out_space.apply(event);
+
+			if (event.type == event_type::madvise && (event.arg0 == MADV_HUGEPAGE || event.arg0 == MADV_NOHUGEPAGE))
+				out_advice.record(event);
+			else
+				out_advice.apply_mapping_change(event);
+		}
+
+		if (events.is_corrupted())
+			return error_result("Corrupted event chunk");
+
+		const uint32_t num_huge_page_chunks = reader.get_num_huge_page_chunks();
+		for (uint32_t huge_page_chunk_index = 0; huge_page_chunk_index < num_huge_page_chunks; ++huge_page_chunk_index)
+		{
+			const chunk_view chunk = reader.get_chunk(reader.get_huge_page_chunk_index(huge_page_chunk_index));
+			if (chunk.header->first_timestamp > until_timestamp)
+				break;
+
+			const error_result result = for_each_huge_page_sample_in_chunk(chunk, [&out_samples, until_timestamp](const huge_page_sample& sample)
+				{
+					if (sample.timestamp > until_timestamp)
+						return false;
+
+					out_samples.add_sample(sample);
+					return true;
+				});
+
+			if (result.any())
+				return result;
+		}
+
+		return error_result();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// How well a VMA is backed by huge pages.
+	//
+	// Transparent huge pages can only back the 2 MB aligned blocks that fit
+	// entirely in a VMA. The kernel does not report which blocks are huge, only
+	// how many bytes are: unbacked bytes are the eligible blocks minus
+	// AnonHugePages. Unaligned bytes are the head and tail outside of the blocks,
+	// they cost a whole block when the VMA could have held one more if it was
+	// aligned.
+	////////////////////////////////////////////////////////////////////////////////
+	struct huge_page_vma_report
+	{
+		huge_page_sample	sample;
+
+		uint64_t			block_start;		// First 2 MB aligned block
+		uint64_t			block_end;			// End of the last block, block_start when none fits
+		uint64_t			eligible_bytes;		// Size of the blocks if the VMA is THP eligible
+		uint64_t			unbacked_bytes;		// Eligible bytes not backed by huge pages
+		uint64_t			unaligned_bytes;	// Head and tail that no block covers
+		bool				is_misaligned;		// Aligning the VMA would fit one more block
+
+		bool				is_tracked;			// A tracked region starts or overlaps the VMA
+		uint32_t			stack_id;			// Callstack that mapped the first tracked region
+	};
+
+	struct huge_page_report
+	{
+		uint64_t	num_vmas = 0;
+		uint64_t	mapped_bytes = 0;
+		uint64_t	resident_bytes = 0;
+		uint64_t	anon_huge_bytes = 0;
+		uint64_t	eligible_bytes = 0;
+		uint64_t	unbacked_bytes = 0;
+		uint64_t	hugetlb_mapped_bytes = 0;
+		uint64_t	hugetlb_bytes = 0;
+		uint64_t	num_misaligned_vmas = 0;
+		uint64_t	num_advised_vmas = 0;			// MADV_HUGEPAGE set
+		uint64_t	num_advised_unbacked_vmas = 0;	// MADV_HUGEPAGE set, eligible blocks but no huge page
+
+		std::vector<huge_page_vma_report> vmas;		// In address order
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Builds the huge page report of every sampled VMA and attributes VMAs to the
+	// first tracked region they overlap.
+	////////////////////////////////////////////////////////////////////////////////
+	inline void build_huge_page_report(const address_space& space, const huge_page_map& samples, huge_page_report& out_report)
+	{
+		out_report = huge_page_report();
+		out_report.vmas.reserve(samples.get_num_samples());
+
+		samples.for_each_sample([&](const huge_page_sample& sample)
+			{
+				huge_page_vma_report vma;
+				vma.sample = sample;
+				vma.block_start = (sample.start + k_huge_page_size - 1) & ~(k_huge_page_size - 1);
+				vma.block_end = sample.end & ~(k_huge_page_size - 1);
+				if (vma.block_end < vma.block_start)
+					vma.block_end = vma.block_start;
+
+				const bool is_hugetlb = (sample.flags & huge_page_sample_hugetlb) != 0;
+				const uint64_t block_bytes = vma.block_end - vma.block_start;
+				vma.eligible_bytes = (sample.flags & huge_page_sample_thp_eligible) != 0 && !is_hugetlb ? block_bytes : 0;
+				vma.unbacked_bytes = vma.eligible_bytes > sample.anon_huge_bytes ? vma.eligible_bytes - sample.anon_huge_bytes : 0;
+				vma.unaligned_bytes = is_hugetlb ? 0 : sample.get_size() - block_bytes;
+				vma.is_misaligned = !is_hugetlb && block_bytes / k_huge_page_size < sample.get_size() / k_huge_page_size;
+
+				vma.is_tracked = false;
+				vma.stack_id = k_invalid_stack_id;
+				space.for_each_region(sample.start, sample.end, [&vma](const vma_region& region)
+					{
+						vma.is_tracked = true;
+						vma.stack_id = region.stack_id;
+						return false;
+					});
+
+				out_report.num_vmas++;
+				out_report.mapped_bytes += sample.get_size();
+				out_report.resident_bytes += sample.resident_bytes;
+				out_report.anon_huge_bytes += sample.anon_huge_bytes;
+				out_report.eligible_bytes += vma.eligible_bytes;
+				out_report.unbacked_bytes += vma.unbacked_bytes;
+				out_report.hugetlb_mapped_bytes += is_hugetlb ? sample.get_size() : 0;
+				out_report.hugetlb_bytes += sample.hugetlb_bytes;
+				out_report.num_misaligned_vmas += vma.is_misaligned && vma.eligible_bytes != 0 ? 1 : 0;
+
+				if ((sample.flags & huge_page_sample_hugepage) != 0)
+				{
+					out_report.num_advised_vmas++;
+					out_report.num_advised_unbacked_vmas += vma.eligible_bytes != 0 && sample.anon_huge_bytes == 0 ? 1 : 0;
+				}
+
+				out_report.vmas.push_back(vma);
+			});
+	}
+}
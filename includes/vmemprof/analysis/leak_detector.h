@@ -0,0 +1,402 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/analysis/residency_map.h"
+#include "vmemprof/analysis/sample_scaler.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/residency_sample.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace vmemprof
+{
+	struct leak_detector_settings
+	{
+		uint64_t	interval_ns = 10000000000ULL;		// Time between two observations
+		uint32_t	num_windows = 30;					// Observations kept per callstack, the sliding window
+		uint32_t	min_windows = 6;					// Observations a callstack needs before it can be flagged
+		uint32_t	max_decreases = 0;					// Decreases tolerated within the window, noise in the committed bytes
+		uint32_t	min_count_growth = 2;				// Mappings the live count must grow by over the window
+		uint64_t	min_committed_growth = 1 << 20;		// Bytes the committed memory must grow by over the window
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// A callstack whose live mappings or committed bytes kept growing over the
+	// window. Rates are the slope of a least squares fit over the window.
+	////////////////////////////////////////////////////////////////////////////////
+	struct leak_suspect
+	{
+		uint32_t	stack_id;
+		uint32_t	num_windows;				// Observations in the window
+
+		uint32_t	live_count;					// Latest observation
+		uint64_t	mapped_bytes;
+		uint64_t	committed_bytes;
+
+		int64_t		count_growth;				// Over the window
+		int64_t		committed_growth;
+		double		count_rate;					// Per second
+		double		committed_rate;				// Bytes per second
+
+		bool		is_count_growing;
+		bool		is_committed_growing;
+
+		uint64_t	first_flagged_timestamp;	// First observation that flagged the callstack
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Flags the callstacks whose memory grows steadily.
+	//
+	// Every interval the live regions are swept once and summarized per callstack:
+	// live mappings, mapped bytes and committed bytes. Each callstack keeps its
+	// last num_windows observations in a ring, so memory is bounded by the number
+	// of unique callstacks whatever the length of the capture. A callstack is
+	// flagged when its live count or its committed bytes grew by at least the
+	// configured amount over the window and decreased at most max_decreases
+	// times. Leaks rarely unmap anything, allocations that are only slow to be
+	// released do and are not flagged.
+	//
+	// The live count counts mappings, not regions: a mapping split by mprotect
+	// or madvise still counts once as long as its regions are adjacent. Bytes of
+	// sampled traces are scaled to estimates, mappings are counted as recorded.
+	////////////////////////////////////////////////////////////////////////////////
+	class leak_detector
+	{
+	public:
+		explicit leak_detector(const leak_detector_settings& settings = leak_detector_settings())
+			: m_settings(settings)
+		{
+			m_settings.num_windows = std::max(m_settings.num_windows, 2U);
+			m_settings.min_windows = std::min(std::max(m_settings.min_windows, 2U), m_settings.num_windows);
+			m_timestamps.assign(m_settings.num_windows, 0);
+		}
+
+		void reset()
+		{
+			m_timestamps.assign(m_settings.num_windows, 0);
+			m_num_observations = 0;
+			m_next_timestamp = 0;
+			m_stacks.clear();
+			m_points.clear();
+		}
+
+		const leak_detector_settings& get_settings() const { return m_settings; }
+		uint64_t get_num_observations() const { return m_num_observations; }
+
+		// True when an interval elapsed since the last observation
+		bool is_observation_due(uint64_t timestamp) const { return timestamp >= m_next_timestamp; }
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Summarizes the live regions per callstack and appends an observation to
+		// every callstack seen so far. O(regions + callstacks).
+		////////////////////////////////////////////////////////////////////////////////
+		void observe(uint64_t timestamp, const address_space& space, const residency_map& residency, const sample_scaler& scaler = sample_scaler())
+		{
+			const uint32_t window_index = uint32_t(m_num_observations % m_settings.num_windows);
+			m_timestamps[window_index] = timestamp;
+			m_num_observations++;
+			m_next_timestamp = timestamp + m_settings.interval_ns;
+
+			for (stack_state& stack : m_stacks)
+				stack.current = stack_point{ 0, 0, 0 };
+
+			uint64_t previous_mapping_id = ~0ULL;
+			uint64_t previous_end = 0;
+			space.for_each_region([&](const vma_region& region)
+				{
+					stack_state& stack = get_stack(region.stack_id);
+					const residency_estimate estimate = scaler.scale(region, residency.estimate(region));
+
+					if (region.mapping_id != previous_mapping_id || region.start != previous_end)
+						stack.current.live_count++;
+
+					stack.current.mapped_bytes += scaler.scale(region, region.get_size());
+					stack.current.committed_bytes += estimate.committed_bytes;
+
+					previous_mapping_id = region.mapping_id;
+					previous_end = region.end;
+					return true;
+				});
+
+			for (uint32_t stack_id = 0; stack_id < m_stacks.size(); ++stack_id)
+			{
+				stack_state& stack = m_stacks[stack_id];
+				if (!stack.is_known)
+					continue;
+
+				m_points[size_t(stack_id) * m_settings.num_windows + window_index] = stack.current;
+				stack.num_windows = std::min(stack.num_windows + 1, m_settings.num_windows);
+
+				// A callstack that stops growing is flagged anew if it starts again
+				leak_suspect suspect;
+				if (!evaluate(stack_id, suspect))
+					stack.first_flagged_timestamp = 0;
+				else if (stack.first_flagged_timestamp == 0)
+					stack.first_flagged_timestamp = timestamp;
+			}
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Returns the callstacks flagged by the latest observation, fastest growing
+		// committed memory first.
+		////////////////////////////////////////////////////////////////////////////////
+		void get_suspects(std::vector<leak_suspect>& out_suspects) const
+		{
+			out_suspects.clear();
+
+			for (uint32_t stack_id = 0; stack_id < m_stacks.size(); ++stack_id)
+			{
+				leak_suspect suspect;
+				if (m_stacks[stack_id].is_known && evaluate(stack_id, suspect))
+					out_suspects.push_back(suspect);
+			}
+
+			std::sort(out_suspects.begin(), out_suspects.end(), [](const leak_suspect& lhs, const leak_suspect& rhs)
+				{
+					if (lhs.committed_rate != rhs.committed_rate)
+						return lhs.committed_rate > rhs.committed_rate;
+					if (lhs.count_rate != rhs.count_rate)
+						return lhs.count_rate > rhs.count_rate;
+					return lhs.stack_id < rhs.stack_id;
+				});
+		}
+
+	private:
+		struct stack_point
+		{
+			uint32_t	live_count;
+			uint64_t	mapped_bytes;
+			uint64_t	committed_bytes;
+		};
+
+		struct stack_state
+		{
+			stack_point	current;					// Scratch while observing
+			uint32_t	num_windows;				// Observations in the ring
+			uint64_t	first_flagged_timestamp;	// Zero until flagged
+			bool		is_known;
+		};
+
+		stack_state& get_stack(uint32_t stack_id)
+		{
+			// Stack ids are dense, a vector indexed by id is bounded by the number of unique callstacks
+			if (stack_id >= m_stacks.size())
+			{
+				m_stacks.resize(size_t(stack_id) + 1, stack_state{ stack_point{ 0, 0, 0 }, 0, 0, false });
+				m_points.resize(m_stacks.size() * m_settings.num_windows, stack_point{ 0, 0, 0 });
+			}
+
+			stack_state& stack = m_stacks[stack_id];
+			stack.is_known = true;
+			return stack;
+		}
+
+		bool evaluate(uint32_t stack_id, leak_suspect& out_suspect) const
+		{
+			const stack_state& stack = m_stacks[stack_id];
+			if (stack.num_windows < m_settings.min_windows)
+				return false;
+
+			// Oldest to newest
+			const uint32_t num_windows = stack.num_windows;
+			const uint64_t newest_index = m_num_observations - 1;
+			const stack_point* points = &m_points[size_t(stack_id) * m_settings.num_windows];
+			const auto get_index = [&](uint32_t point_index) { return uint32_t((newest_index - (num_windows - 1) + point_index) % m_settings.num_windows); };
+
+			uint32_t num_count_decreases = 0;
+			uint32_t num_committed_decreases = 0;
+			for (uint32_t point_index = 1; point_index < num_windows; ++point_index)
+			{
+				const stack_point& previous = points[get_index(point_index - 1)];
+				const stack_point& current = points[get_index(point_index)];
+				num_count_decreases += current.live_count < previous.live_count ? 1 : 0;
+				num_committed_decreases += current.committed_bytes < previous.committed_bytes ? 1 : 0;
+			}
+
+			const stack_point& first = points[get_index(0)];
+			const stack_point& last = points[get_index(num_windows - 1)];
+
+			out_suspect.stack_id = stack_id;
+			out_suspect.num_windows = num_windows;
+			out_suspect.live_count = last.live_count;
+			out_suspect.mapped_bytes = last.mapped_bytes;
+			out_suspect.committed_bytes = last.committed_bytes;
+			out_suspect.count_growth = int64_t(last.live_count) - int64_t(first.live_count);
+			out_suspect.committed_growth = int64_t(last.committed_bytes - first.committed_bytes);
+
+			out_suspect.is_count_growing = num_count_decreases <= m_settings.max_decreases && out_suspect.count_growth >= int64_t(m_settings.min_count_growth);
+			out_suspect.is_committed_growing = num_committed_decreases <= m_settings.max_decreases && out_suspect.committed_growth >= int64_t(m_settings.min_committed_growth);
+			if (!out_suspect.is_count_growing && !out_suspect.is_committed_growing)
+				return false;
+
+			// Least squares slopes, time relative to the oldest observation
+			const uint64_t first_timestamp = m_timestamps[get_index(0)];
+			double sum_t = 0.0;
+			double sum_tt = 0.0;
+			double sum_count = 0.0;
+			double sum_t_count = 0.0;
+			double sum_committed = 0.0;
+			double sum_t_committed = 0.0;
+			for (uint32_t point_index = 0; point_index < num_windows; ++point_index)
+			{
+				const uint32_t index = get_index(point_index);
+				const double t = double(m_timestamps[index] - first_timestamp) * 1.0e-9;
+				sum_t += t;
+				sum_tt += t * t;
+				sum_count += double(points[index].live_count);
+				sum_t_count += t * double(points[index].live_count);
+				sum_committed += double(points[index].committed_bytes);
+				sum_t_committed += t * double(points[index].committed_bytes);
+			}
+
+			const double n = double(num_windows);
+			const double denominator = n * sum_tt - sum_t * sum_t;
+			out_suspect.count_rate = denominator > 0.0 ? (n * sum_t_count - sum_t * sum_count) / denominator : 0.0;
+			out_suspect.committed_rate = denominator > 0.0 ? (n * sum_t_committed - sum_t * sum_committed) / denominator : 0.0;
+			out_suspect.first_flagged_timestamp = stack.first_flagged_timestamp != 0 ? stack.first_flagged_timestamp : m_timestamps[get_index(num_windows - 1)];
+			return true;
+		}
+
+		leak_detector_settings		m_settings;
+
+		std::vector<uint64_t>		m_timestamps;			// Ring of observation timestamps
+		uint64_t					m_num_observations = 0;
+		uint64_t					m_next_timestamp = 0;
+
+		std::vector<stack_state>	m_stacks;				// Indexed by stack id
+		std::vector<stack_point>	m_points;				// num_windows ring entries per stack
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Runs a leak detector over a trace as if it watched the capture live: events
+	// and residency samples are merged in timestamp order and the detector
+	// observes the address space every interval up to the end of the trace.
+	////////////////////////////////////////////////////////////////////////////////
+	inline error_result detect_leaks(const trace_reader& reader, leak_detector& detector)
+	{
+		const trace_header& header = reader.get_header();
+		const sample_scaler scaler(reader.get_sampling_interval());
+		const uint64_t interval_ns = std::max<uint64_t>(detector.get_settings().interval_ns, 1);
+
+		address_space space;
+		residency_map residency(header.page_size);
+
+		std::vector<residency_sample> pending_samples;
+		size_t pending_sample_index = 0;
+		uint32_t next_residency_chunk_index = 0;
+
+		// Adds the residency samples taken up to a timestamp
+		const auto add_samples = [&](uint64_t until_timestamp) -> error_result
+			{
+				for (;;)
+				{
+					for (; pending_sample_index < pending_samples.size(); ++pending_sample_index)
+					{
+						if (pending_samples[pending_sample_index].timestamp > until_timestamp)
+							return error_result();
+
+						residency.add_sample(pending_samples[pending_sample_index]);
+					}
+
+					if (next_residency_chunk_index >= reader.get_num_residency_chunks())
+						return error_result();
+
+					pending_samples.clear();
+					pending_sample_index = 0;
+
+					const chunk_view chunk = reader.get_chunk(reader.get_residency_chunk_index(next_residency_chunk_index++));
+					const error_result result = for_each_residency_sample_in_chunk(chunk, [&pending_samples](const residency_sample& sample) { pending_samples.push_back(sample); return true; });
+					if (result.any())
+						return result;
+				}
+			};
+
+		uint64_t observation_timestamp = header.start_timestamp + interval_ns;
+		uint64_t last_timestamp = header.start_timestamp;
+
+		event_cursor events(reader);
+		vm_event event;
+		while (events.next(event))
+		{
+			while (event.timestamp > observation_timestamp)
+			{
+				const error_result result = add_samples(observation_timestamp);
+				if (result.any())
+					return result;
+
+				detector.observe(observation_timestamp, space, residency, scaler);
+				observation_timestamp += interval_ns;
+			}
+
+			// Moves and populations update the samples taken before them
+			if (residency_map::affects_residency(event))
+			{
+				const error_result result = add_samples(event.timestamp);
+				if (result.any())
+					return result;
+
+				residency.apply(event);
+			}
+
+			space.apply(event);
+			last_timestamp = std::max(last_timestamp, event.timestamp);
+		}
+
+		if (events.is_corrupted())
+			return error_result("Corrupted event chunk");
+
+		// Samples can outlive the last event, a final observation covers them
+		const uint32_t num_residency_chunks = reader.get_num_residency_chunks();
+		if (num_residency_chunks != 0)
+			last_timestamp = std::max(last_timestamp, reader.get_chunk_entry(reader.get_residency_chunk_index(num_residency_chunks - 1)).last_timestamp);
+
+		while (observation_timestamp <= last_timestamp)
+		{
+			const error_result result = add_samples(observation_timestamp);
+			if (result.any())
+				return result;
+
+			detector.observe(observation_timestamp, space, residency, scaler);
+			observation_timestamp += interval_ns;
+		}
+
+		if (detector.get_num_observations() != 0 && last_timestamp == observation_timestamp - interval_ns)
+			return error_result();
+
+		// The end of the trace, or the only observation of a trace shorter than an interval
+		const error_result result = add_samples(last_timestamp);
+		if (result.any())
+			return result;
+
+		detector.observe(last_timestamp, space, residency, scaler);
+		return error_result();
+	}
+}
@@ -0,0 +1,385 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/analysis/leak_detector.h"
+#include "vmemprof/analysis/residency_map.h"
+#include "vmemprof/analysis/sample_scaler.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/fault_sample.h"
+#include "vmemprof/core/module_info.h"
+#include "vmemprof/core/residency_sample.h"
+#include "vmemprof/trace/stack_codec.h"
+#include "vmemprof/trace/trace_format.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Counts entries per second over a rolling window of up to k_num_buckets seconds.
+	////////////////////////////////////////////////////////////////////////////////
+	class rate_window
+	{
+	public:
+		static constexpr uint32_t k_num_buckets = 64;
+
+		void add(uint64_t timestamp, uint64_t count = 1)
+		{
+			const uint64_t second = timestamp / 1000000000ULL;
+			const uint32_t bucket_index = uint32_t(second % k_num_buckets);
+
+			// Entries older than the window are ignored
+			if (second < m_seconds[bucket_index])
+				return;
+
+			if (second != m_seconds[bucket_index])
+			{
+				m_seconds[bucket_index] = second;
+				m_counts[bucket_index] = 0;
+			}
+
+			m_counts[bucket_index] += count;
+		}
+
+		// Entries in the 'num_seconds' seconds that end with the one containing 'timestamp'
+		uint64_t get_count(uint64_t timestamp, uint32_t num_seconds) const
+		{
+			const uint64_t last_second = timestamp / 1000000000ULL;
+			num_seconds = std::min(num_seconds, k_num_buckets);
+
+			uint64_t count = 0;
+			for (uint32_t bucket_index = 0; bucket_index < k_num_buckets; ++bucket_index)
+			{
+				if (m_seconds[bucket_index] <= last_second && last_second - m_seconds[bucket_index] < num_seconds)
+					count += m_counts[bucket_index];
+			}
+
+			return count;
+		}
+
+	private:
+		uint64_t	m_seconds[k_num_buckets] = {};		// The second counted by each bucket
+		uint64_t	m_counts[k_num_buckets] = {};
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Memory mapped by the live regions of a callstack.
+	////////////////////////////////////////////////////////////////////////////////
+	struct live_stack_usage
+	{
+		uint32_t	stack_id;
+		uint32_t	num_regions;
+		uint64_t	mapped_bytes;
+		uint64_t	sampled_bytes;		// Bytes covered by residency samples taken since their region was mapped
+		uint64_t	committed_bytes;
+		uint64_t	resident_bytes;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// A module of the profiled process, owning its path.
+	////////////////////////////////////////////////////////////////////////////////
+	struct live_module
+	{
+		uint64_t		start;
+		uint64_t		end;
+		uint64_t		load_address;
+		std::string		path;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Maintains rolling aggregates of a trace while it is being streamed.
+	//
+	// Chunks are applied as they arrive: events update the address space and the
+	// counters right away, residency samples replace the older samples of their
+	// range and stacks and modules are kept to print stacks. Committed bytes per
+	// callstack join every region with the residency samples, mappings and samples
+	// change independently so the join is rebuilt by refresh_stack_usage() rather
+	// than on every chunk. The leak detector observes the same join on its own,
+	// less frequent, schedule. Rates count entries per second of CLOCK_MONOTONIC
+	// time, the clock of the profiled process.
+	////////////////////////////////////////////////////////////////////////////////
+	class live_aggregator
+	{
+	public:
+		explicit live_aggregator(const leak_detector_settings& leak_settings = leak_detector_settings())
+			: m_leaks(leak_settings)
+		{
+		}
+
+		void reset(const trace_header& header)
+		{
+			m_header = header;
+			m_space.clear();
+			m_residency = residency_map(header.page_size);
+			m_scaler = sample_scaler();
+			m_event_rate = rate_window();
+			m_fault_rate = rate_window();
+			m_num_events = 0;
+			m_num_dropped_events = 0;
+			m_num_fault_samples = 0;
+			m_num_lost_faults = 0;
+			m_last_timestamp = header.start_timestamp;
+			m_stack_data.clear();
+			m_stack_entries.clear();
+			m_modules.clear();
+			m_stack_usage.clear();
+			m_totals = live_stack_usage();
+			m_is_stack_usage_stale = false;
+			m_leaks.reset();
+		}
+
+		error_result apply_chunk(const chunk_view& chunk)
+		{
+			const chunk_header& header = *chunk.header;
+			if (header.last_timestamp > m_last_timestamp)
+				m_last_timestamp = header.last_timestamp;
+
+			switch (header.type)
+			{
+			case chunk_type::events:
+				m_num_events += header.num_entries;
+				m_is_stack_usage_stale = true;
+				return for_each_event_in_chunk(chunk, [this](const vm_event& event)
+					{
+						m_space.apply(event);
+						m_residency.apply(event);
+						m_event_rate.add(event.timestamp);
+						return true;
+					});
+			case chunk_type::residency:
+				m_is_stack_usage_stale = true;
+				return for_each_residency_sample_in_chunk(chunk, [this](const residency_sample& sample) { m_residency.add_sample(sample); return true; });
+			case chunk_type::faults:
+				m_num_fault_samples += header.num_entries;
+				return for_each_fault_sample_in_chunk(chunk, [this](const fault_sample& sample) { m_fault_rate.add(sample.timestamp); return true; });
+			case chunk_type::stacks:
+				return add_stacks(chunk);
+			case chunk_type::modules:
+				return for_each_module_in_chunk(chunk, [this](const module_info& module) { add_module(module); return true; });
+			case chunk_type::sampling:
+			{
+				if (header.payload_size < sizeof(sampling_payload))
+					return error_result("Corrupted sampling chunk");
+
+				sampling_payload payload;
+				std::memcpy(&payload, chunk.payload, sizeof(payload));
+				m_scaler = sample_scaler(payload.sampling_interval);
+				return error_result();
+			}
+			case chunk_type::dropped_events:
+			case chunk_type::lost_faults:
+			{
+				if (header.payload_size < sizeof(dropped_events_payload))
+					return error_result("Corrupted drop chunk");
+
+				dropped_events_payload payload;
+				std::memcpy(&payload, chunk.payload, sizeof(payload));
+				if (header.type == chunk_type::dropped_events)
+					m_num_dropped_events += payload.num_dropped;
+				else
+					m_num_lost_faults += payload.num_dropped;
+				return error_result();
+			}
+			default:
+				// Huge page and NUMA samples are only analyzed offline
+				return error_result();
+			}
+		}
+
+		// Joins the regions with the latest residency samples, sorted by committed bytes. Bytes are scaled when mappings are sampled.
+		void refresh_stack_usage()
+		{
+			std::unordered_map<uint32_t, uint32_t> usage_indices;
+			m_stack_usage.clear();
+			m_totals = live_stack_usage();
+			m_totals.stack_id = k_invalid_stack_id;
+
+			m_space.for_each_region([&](const vma_region& region)
+				{
+					const residency_estimate estimate = m_scaler.scale(region, m_residency.estimate(region));
+					const uint64_t mapped_bytes = m_scaler.scale(region, region.get_size());
+
+					const auto insert_result = usage_indices.emplace(region.stack_id, uint32_t(m_stack_usage.size()));
+					if (insert_result.second)
+						m_stack_usage.push_back(live_stack_usage{ region.stack_id, 0, 0, 0, 0, 0 });
+
+					live_stack_usage* usages[2] = { &m_stack_usage[insert_result.first->second], &m_totals };
+					for (live_stack_usage* usage : usages)
+					{
+						usage->num_regions++;
+						usage->mapped_bytes += mapped_bytes;
+						usage->sampled_bytes += estimate.sampled_bytes;
+						usage->committed_bytes += estimate.committed_bytes;
+						usage->resident_bytes += estimate.resident_bytes;
+					}
+
+					return true;
+				});
+
+			std::sort(m_stack_usage.begin(), m_stack_usage.end(), [](const live_stack_usage& lhs, const live_stack_usage& rhs)
+				{
+					if (lhs.committed_bytes != rhs.committed_bytes)
+						return lhs.committed_bytes > rhs.committed_bytes;
+					return lhs.mapped_bytes > rhs.mapped_bytes;
+				});
+
+			m_is_stack_usage_stale = false;
+		}
+
+		// Observes the address space for the leak detector when an interval elapsed, returns true if it did
+		bool observe_leaks(uint64_t timestamp)
+		{
+			if (!m_leaks.is_observation_due(timestamp))
+				return false;
+
+			m_leaks.observe(timestamp, m_space, m_residency, m_scaler);
+			return true;
+		}
+
+		const leak_detector& get_leak_detector() const { return m_leaks; }
+
+		// True when events or residency samples arrived since the last refresh
+		bool is_stack_usage_stale() const { return m_is_stack_usage_stale; }
+		const std::vector<live_stack_usage>& get_stack_usage() const { return m_stack_usage; }
+		const live_stack_usage& get_total_usage() const { return m_totals; }
+
+		const trace_header& get_header() const { return m_header; }
+		const address_space& get_space() const { return m_space; }
+		const sample_scaler& get_scaler() const { return m_scaler; }
+		uint64_t get_last_timestamp() const { return m_last_timestamp; }
+
+		uint64_t get_num_events() const { return m_num_events; }
+		uint64_t get_num_dropped_events() const { return m_num_dropped_events; }
+		uint64_t get_num_fault_samples() const { return m_num_fault_samples; }
+		uint64_t get_num_lost_faults() const { return m_num_lost_faults; }
+
+		// Entries in the 'num_seconds' seconds up to 'timestamp'
+		uint64_t get_event_count(uint64_t timestamp, uint32_t num_seconds) const { return m_event_rate.get_count(timestamp, num_seconds); }
+		uint64_t get_fault_count(uint64_t timestamp, uint32_t num_seconds) const { return m_fault_rate.get_count(timestamp, num_seconds); }
+
+		// Decodes a stack, out_frames must have room for k_max_stack_frames. Returns false if the stack is unknown.
+		bool get_stack(uint32_t stack_id, uint64_t* out_frames, uint32_t& out_num_frames) const
+		{
+			if (stack_id >= m_stack_entries.size() || m_stack_entries[stack_id].size == 0)
+				return false;
+
+			const stack_entry& entry = m_stack_entries[stack_id];
+			const uint8_t* entry_data = m_stack_data.data() + entry.offset;
+			uint32_t decoded_stack_id;
+			return decode_stack(entry_data, entry_data + entry.size, decoded_stack_id, out_frames, out_num_frames) != nullptr;
+		}
+
+		// Returns the module that contains an address, nullptr if none does
+		const live_module* find_module(uint64_t address) const
+		{
+			const auto module_it = std::upper_bound(m_modules.begin(), m_modules.end(), address, [](uint64_t value, const live_module& module) { return value < module.start; });
+			if (module_it == m_modules.begin() || address >= std::prev(module_it)->end)
+				return nullptr;
+
+			return &*std::prev(module_it);
+		}
+
+	private:
+		struct stack_entry
+		{
+			uint64_t	offset;			// In m_stack_data
+			uint32_t	size;			// Zero for unknown stacks
+		};
+
+		error_result add_stacks(const chunk_view& chunk)
+		{
+			// Entries are kept encoded, like the trace reader does
+			const size_t data_offset = m_stack_data.size();
+			m_stack_data.insert(m_stack_data.end(), chunk.payload, chunk.payload_end);
+
+			uint64_t frames[k_max_stack_frames];
+			const uint8_t* entry = m_stack_data.data() + data_offset;
+			const uint8_t* data_end = m_stack_data.data() + m_stack_data.size();
+			for (uint32_t stack_index = 0; stack_index < chunk.header->num_entries; ++stack_index)
+			{
+				uint32_t stack_id;
+				uint32_t num_frames;
+				const uint8_t* entry_end = decode_stack(entry, data_end, stack_id, frames, num_frames);
+				if (entry_end == nullptr)
+					return error_result("Corrupted stack chunk");
+
+				if (stack_id >= m_stack_entries.size())
+					m_stack_entries.resize(stack_id + 1, stack_entry{ 0, 0 });
+
+				m_stack_entries[stack_id] = stack_entry{ uint64_t(entry - m_stack_data.data()), uint32_t(entry_end - entry) };
+				entry = entry_end;
+			}
+
+			return error_result();
+		}
+
+		void add_module(const module_info& module)
+		{
+			// Modules are listed again when the dynamic linker list changes, a module at the same address replaces the previous one
+			const auto module_it = std::lower_bound(m_modules.begin(), m_modules.end(), module.start, [](const live_module& entry, uint64_t value) { return entry.start < value; });
+			if (module_it != m_modules.end() && module_it->start == module.start)
+			{
+				module_it->end = module.end;
+				module_it->load_address = module.load_address;
+				module_it->path.assign(module.path, module.path_length);
+				return;
+			}
+
+			m_modules.insert(module_it, live_module{ module.start, module.end, module.load_address, std::string(module.path, module.path_length) });
+		}
+
+		trace_header					m_header = {};
+		address_space					m_space;
+		residency_map					m_residency;
+		sample_scaler					m_scaler;
+
+		rate_window						m_event_rate;
+		rate_window						m_fault_rate;
+		uint64_t						m_num_events = 0;
+		uint64_t						m_num_dropped_events = 0;
+		uint64_t						m_num_fault_samples = 0;
+		uint64_t						m_num_lost_faults = 0;
+		uint64_t						m_last_timestamp = 0;
+
+		std::vector<uint8_t>			m_stack_data;
+		std::vector<stack_entry>		m_stack_entries;		// Indexed by stack id
+		std::vector<live_module>		m_modules;				// Sorted by start
+
+		std::vector<live_stack_usage>	m_stack_usage;
+		live_stack_usage				m_totals = {};
+		bool							m_is_stack_usage_stale = false;
+
+		leak_detector					m_leaks;
+	};
+}
@@ -0,0 +1,286 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/analysis/fault_attribution.h"
+#include "vmemprof/analysis/range_call_map.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/fault_sample.h"
+#include "vmemprof/core/numa_sample.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns the name of an MPOL_* mode, mode flags are ignored.
+	////////////////////////////////////////////////////////////////////////////////
+	inline const char* get_memory_policy_name(uint64_t mode)
+	{
+		switch (mode & 0xFF)
+		{
+		case 0:		return "default";
+		case 1:		return "preferred";
+		case 2:		return "bind";
+		case 3:		return "interleave";
+		case 4:		return "local";
+		case 5:		return "preferred_many";
+		case 6:		return "weighted_interleave";
+		default:	return "<unknown>";
+		}
+	}
+
+	enum class numa_grouping
+	{
+		mapping,			// The mapping that contains the pages
+		allocation_stack,	// The callstack that mapped the pages
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Where the pages of a mapping or callstack are and where the threads that
+	// fault them in run.
+	//
+	// Faults are compared with the home node, the node that holds most of the
+	// sampled pages. A fault from a CPU of another node is remote: the thread
+	// that first touched the memory does not run where the memory is, because of
+	// a policy, a migration or a thread that moved.
+	////////////////////////////////////////////////////////////////////////////////
+	struct numa_group
+	{
+		uint64_t				key;
+		vma_region				region;				// The first region seen
+		bool					has_region;
+
+		std::vector<uint64_t>	page_counts;		// Sampled pages per node
+		std::vector<uint64_t>	fault_counts;		// Faults per node of the faulting CPU
+		uint64_t				num_pages;
+		uint64_t				num_faults;			// Faults with a known CPU
+
+		uint32_t				home_node;
+		uint64_t				num_remote_faults;
+
+		double get_remote_fraction() const { return num_faults != 0 ? double(num_remote_faults) / double(num_faults) : 0.0; }
+	};
+
+	struct numa_report
+	{
+		uint32_t					num_nodes = 0;
+		bool						is_fake_topology = false;
+
+		std::vector<uint64_t>		page_counts;		// Sampled pages per node
+		std::vector<uint64_t>		fault_counts;		// Faults per node of the faulting CPU
+		uint64_t					num_unknown_cpu_faults = 0;
+
+		std::vector<numa_group>		groups;				// Sorted by remote faults, then sampled pages
+
+		range_call_map				bindings;			// mbind call in effect over every range
+		std::vector<range_call>		thread_policies;	// Latest set_mempolicy call of every thread that made one
+	};
+
+	namespace numa_report_impl
+	{
+		struct page_state
+		{
+			uint64_t	timestamp;
+			uint32_t	node;
+		};
+
+		inline numa_group& get_group(std::unordered_map<uint64_t, numa_group>& groups, uint64_t key, const vma_region* region, uint32_t num_nodes)
+		{
+			auto insert_result = groups.emplace(key, numa_group());
+			numa_group& group = insert_result.first->second;
+			if (insert_result.second)
+			{
+				group.key = key;
+				group.has_region = false;
+				group.page_counts.assign(num_nodes, 0);
+				group.fault_counts.assign(num_nodes, 0);
+				group.num_pages = 0;
+				group.num_faults = 0;
+				group.home_node = 0;
+				group.num_remote_faults = 0;
+			}
+
+			if (!group.has_region && region != nullptr)
+			{
+				group.region = *region;
+				group.has_region = true;
+			}
+
+			return group;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Builds the NUMA report of a trace at a timestamp.
+	//
+	// The events are replayed once to the timestamp. The latest node of every
+	// sampled page is joined with the region that holds it at that time, samples
+	// older than their region are dropped. Faults are attributed to the region
+	// they touched when they happened and mapped to the node of their CPU with
+	// the topology recorded in the trace. O((events + faults) * log(regions) +
+	// samples).
+	////////////////////////////////////////////////////////////////////////////////
+	inline error_result build_numa_report(const trace_reader& reader, uint64_t until_timestamp, numa_grouping grouping, numa_report& out_report)
+	{
+		using namespace numa_report_impl;
+
+		out_report = numa_report();
+
+		numa_topology_header topology;
+		const uint16_t* cpu_nodes = nullptr;
+		if (!reader.get_numa_topology(topology, cpu_nodes))
+			return error_result("The trace has no NUMA topology");
+
+		const uint32_t num_nodes = std::max(topology.num_nodes, 1U);
+		out_report.num_nodes = num_nodes;
+		out_report.is_fake_topology = (topology.flags & k_numa_topology_fake) != 0;
+		out_report.page_counts.assign(num_nodes, 0);
+		out_report.fault_counts.assign(num_nodes, 0);
+
+		// Address space, bindings and thread policies at the report time
+		address_space space;
+		std::unordered_map<uint32_t, range_call> thread_policies;
+		{
+			event_cursor events(reader);
+			vm_event event;
+			while (events.next(event) && event.timestamp <= until_timestamp)
+			{
+				space.apply(event);
+
+				if (event.type == event_type::mbind)
+					out_report.bindings.record(event);
+				else if (event.type == event_type::set_mempolicy)
+					thread_policies[event.thread_id] = range_call{ 0, 0, event.timestamp, event.arg0, event.arg1, event.stack_id, event.thread_id, event.flags };
+				else
+					out_report.bindings.apply_mapping_change(event);
+			}
+
+			if (events.is_corrupted())
+				return error_result("Corrupted event chunk");
+		}
+
+		for (const auto& policy : thread_policies)
+			out_report.thread_policies.push_back(policy.second);
+
+		std::sort(out_report.thread_policies.begin(), out_report.thread_policies.end(), [](const range_call& lhs, const range_call& rhs) { return lhs.thread_id < rhs.thread_id; });
+
+		// Latest node of every sampled page
+		std::unordered_map<uint64_t, page_state> pages;
+		const uint32_t num_numa_page_chunks = reader.get_num_numa_page_chunks();
+		for (uint32_t numa_page_chunk_index = 0; numa_page_chunk_index < num_numa_page_chunks; ++numa_page_chunk_index)
+		{
+			const chunk_view chunk = reader.get_chunk(reader.get_numa_page_chunk_index(numa_page_chunk_index));
+			if (chunk.header->first_timestamp > until_timestamp)
+				break;
+
+			const error_result result = for_each_numa_page_sample_in_chunk(chunk, [&pages, until_timestamp](const numa_page_sample& sample)
+				{
+					if (sample.timestamp > until_timestamp)
+						return false;
+
+					pages[sample.address] = page_state{ sample.timestamp, sample.node };
+					return true;
+				});
+
+			if (result.any())
+				return result;
+		}
+
+		std::unordered_map<uint64_t, numa_group> groups;
+		const auto get_key = [grouping](const vma_region& region) { return grouping == numa_grouping::mapping ? region.mapping_id : uint64_t(region.stack_id); };
+
+		for (const auto& page : pages)
+		{
+			const vma_region* region = space.find_region(page.first);
+			if (region == nullptr || page.second.timestamp < region->timestamp || page.second.node >= num_nodes)
+				continue;
+
+			numa_group& group = get_group(groups, get_key(*region), region, num_nodes);
+			group.page_counts[page.second.node]++;
+			group.num_pages++;
+			out_report.page_counts[page.second.node]++;
+		}
+
+		const error_result result = attribute_faults(reader, [&](const fault_sample& sample, const vma_region* region)
+			{
+				if (sample.timestamp > until_timestamp)
+					return false;
+
+				if (sample.cpu == k_unknown_cpu || sample.cpu >= topology.num_cpus)
+				{
+					out_report.num_unknown_cpu_faults++;
+					return true;
+				}
+
+				const uint32_t node = std::min<uint32_t>(cpu_nodes[sample.cpu], num_nodes - 1);
+				out_report.fault_counts[node]++;
+
+				if (region != nullptr)
+				{
+					numa_group& group = get_group(groups, get_key(*region), region, num_nodes);
+					group.fault_counts[node]++;
+					group.num_faults++;
+				}
+
+				return true;
+			});
+
+		if (result.any())
+			return result;
+
+		out_report.groups.reserve(groups.size());
+		for (auto& entry : groups)
+		{
+			numa_group& group = entry.second;
+
+			// Without sampled pages the faults cannot be compared with anything
+			if (group.num_pages != 0)
+			{
+				group.home_node = uint32_t(std::max_element(group.page_counts.begin(), group.page_counts.end()) - group.page_counts.begin());
+				group.num_remote_faults = group.num_faults - group.fault_counts[group.home_node];
+			}
+
+			out_report.groups.push_back(std::move(group));
+		}
+
+		std::sort(out_report.groups.begin(), out_report.groups.end(), [](const numa_group& lhs, const numa_group& rhs)
+			{
+				if (lhs.num_remote_faults != rhs.num_remote_faults)
+					return lhs.num_remote_faults > rhs.num_remote_faults;
+				if (lhs.num_pages != rhs.num_pages)
+					return lhs.num_pages > rhs.num_pages;
+				return lhs.key < rhs.key;
+			});
+
+		return error_result();
+	}
+}
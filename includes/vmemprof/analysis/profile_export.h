@@ -0,0 +1,396 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "vmemprof/analysis/callstack_tree.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/module_info.h"
+#include "vmemprof/symbols/symbol_file.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace vmemprof
+{
+	namespace profile_export_impl
+	{
+		////////////////////////////////////////////////////////////////////////////////
+		// A protocol buffer message being encoded, fields are appended in any order.
+		// Zero varints are omitted like proto3 does.
+		////////////////////////////////////////////////////////////////////////////////
+		class protobuf_message
+		{
+		public:
+			void clear() { m_bytes.clear(); }
+			const std::vector<uint8_t>& get_bytes() const { return m_bytes; }
+
+			void add_varint(uint32_t field, uint64_t value)
+			{
+				if (value == 0)
+					return;
+
+				write_varint(uint64_t(field) << 3);
+				write_varint(value);
+			}
+
+			void add_bytes(uint32_t field, const void* data, size_t size)
+			{
+				write_varint((uint64_t(field) << 3) | 2);
+				write_varint(size);
+				m_bytes.insert(m_bytes.end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+			}
+
+			void add_message(uint32_t field, const protobuf_message& message) { add_bytes(field, message.m_bytes.data(), message.m_bytes.size()); }
+
+			void add_packed(uint32_t field, const std::vector<uint64_t>& values)
+			{
+				protobuf_message packed;
+				for (uint64_t value : values)
+					packed.write_varint(value);
+
+				add_message(field, packed);
+			}
+
+		private:
+			void write_varint(uint64_t value)
+			{
+				while (value >= 0x80)
+				{
+					m_bytes.push_back(uint8_t(value | 0x80));
+					value >>= 7;
+				}
+				m_bytes.push_back(uint8_t(value));
+			}
+
+			std::vector<uint8_t>	m_bytes;
+		};
+	}
+
+	// Describes the profile written by profile_exporter::write_pprof
+	struct pprof_profile_info
+	{
+		profile_weight	weight = profile_weight::committed;
+		uint64_t		time_ns = 0;			// CLOCK_REALTIME of the end of the profiled window
+		uint64_t		duration_ns = 0;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Writes a callstack tree as folded stacks or as a pprof profile.
+	//
+	// Folded stacks are one line per stack, 'caller;...;leaf weight', the input
+	// of flamegraph.pl and most flame graph viewers. pprof profiles are the
+	// uncompressed protocol buffer that 'pprof' and compatible viewers read.
+	//
+	// Frames are named once per unique address: the function from the symbol file
+	// when the trace was symbolized, otherwise the module and offset, otherwise the
+	// raw address. Every other step only walks the tree.
+	////////////////////////////////////////////////////////////////////////////////
+	class profile_exporter
+	{
+	public:
+		error_result initialize(const trace_reader& reader, const symbol_file& symbols)
+		{
+			m_symbols = &symbols;
+			m_frames.clear();
+			m_frame_indices.clear();
+			return read_modules(reader);
+		}
+
+		error_result write_folded(const callstack_tree& tree, FILE* file)
+		{
+			std::string line;
+			for (uint32_t node_index = tree.get_node(callstack_tree::k_root).first_child; node_index != callstack_tree::k_no_node; node_index = tree.get_node(node_index).next_sibling)
+				write_folded_node(tree, node_index, line, file);
+
+			return ferror(file) == 0 ? error_result() : error_result("Failed to write the profile");
+		}
+
+		error_result write_pprof(const callstack_tree& tree, const pprof_profile_info& info, FILE* file)
+		{
+			using namespace profile_export_impl;
+
+			m_strings.clear();
+			m_string_indices.clear();
+			get_string_index("");
+
+			protobuf_message profile;
+			protobuf_message message;
+			protobuf_message line;
+
+			// Profile.sample_type and period_type, ValueType { type = 1, unit = 2 }
+			const char* unit = is_byte_weight(info.weight) ? "bytes" : "count";
+			message.add_varint(1, get_string_index(get_profile_weight_name(info.weight)));
+			message.add_varint(2, get_string_index(unit));
+			profile.add_message(1, message);
+			profile.add_message(11, message);
+			profile.add_varint(12, 1);
+
+			// Profile.sample, Sample { location_id = 1 (leaf first), value = 2 }
+			std::vector<uint64_t> location_ids;
+			std::vector<bool> is_location_used;
+			for (uint32_t node_index = 1; node_index < tree.get_num_nodes(); ++node_index)
+			{
+				const callstack_tree::node& node = tree.get_node(node_index);
+				if (node.self_weight == 0)
+					continue;
+
+				location_ids.clear();
+				for (uint32_t frame_node_index = node_index; frame_node_index != callstack_tree::k_root; frame_node_index = tree.get_node(frame_node_index).parent)
+				{
+					const uint32_t frame_index = get_frame_index(tree.get_node(frame_node_index).address);
+					if (frame_index >= is_location_used.size())
+						is_location_used.resize(frame_index + 1, false);
+
+					is_location_used[frame_index] = true;
+					location_ids.push_back(frame_index + 1);
+				}
+
+				message.clear();
+				message.add_packed(1, location_ids);
+				message.add_packed(2, std::vector<uint64_t>{ node.self_weight });
+				profile.add_message(2, message);
+			}
+
+			// Profile.mapping, Mapping { id = 1, memory_start = 2, memory_limit = 3, file_offset = 4, filename = 5, build_id = 6, has_functions = 7, has_filenames = 8, has_line_numbers = 9 }
+			const bool has_symbols = m_symbols->is_open();
+			for (uint32_t module_index = 0; module_index < m_modules.size(); ++module_index)
+			{
+				const export_module& module = m_modules[module_index];
+				message.clear();
+				message.add_varint(1, module_index + 1);
+				message.add_varint(2, module.start);
+				message.add_varint(3, module.end);
+				// The range starts at the first PT_LOAD segment, which maps the file from its start with the ELF header
+				message.add_varint(4, 0);
+				message.add_varint(5, get_string_index(module.path));
+				message.add_varint(6, get_string_index(module.build_id));
+				message.add_varint(7, 1);
+				message.add_varint(8, has_symbols ? 1 : 0);
+				message.add_varint(9, has_symbols ? 1 : 0);
+				profile.add_message(3, message);
+			}
+
+			// Profile.location, Location { id = 1, mapping_id = 2, address = 3, line = 4 }, Line { function_id = 1, line = 2 }
+			// Profile.function, Function { id = 1, name = 2, system_name = 3, filename = 4 }
+			std::unordered_map<std::string, uint64_t> function_ids;
+			std::string function_key;
+			for (uint32_t frame_index = 0; frame_index < m_frames.size(); ++frame_index)
+			{
+				if (frame_index >= is_location_used.size() || !is_location_used[frame_index])
+					continue;
+
+				const export_frame& frame = m_frames[frame_index];
+
+				function_key = frame.name;
+				function_key.push_back('\0');
+				function_key.append(frame.file);
+				const auto function_it = function_ids.emplace(function_key, function_ids.size() + 1);
+				if (function_it.second)
+				{
+					const uint64_t name_index = get_string_index(frame.name);
+					message.clear();
+					message.add_varint(1, function_it.first->second);
+					message.add_varint(2, name_index);
+					message.add_varint(3, name_index);
+					message.add_varint(4, get_string_index(frame.file));
+					profile.add_message(5, message);
+				}
+
+				line.clear();
+				line.add_varint(1, function_it.first->second);
+				line.add_varint(2, frame.line);
+
+				message.clear();
+				message.add_varint(1, frame_index + 1);
+				message.add_varint(2, frame.module_index != k_unknown_module ? frame.module_index + 1 : 0);
+				message.add_varint(3, frame.address);
+				message.add_message(4, line);
+				profile.add_message(4, message);
+			}
+
+			profile.add_varint(9, info.time_ns);
+			profile.add_varint(10, info.duration_ns);
+
+			// Profile.string_table, every index was assigned above
+			for (const std::string& string : m_strings)
+				profile.add_bytes(6, string.data(), string.size());
+
+			const std::vector<uint8_t>& bytes = profile.get_bytes();
+			if (fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size() || ferror(file) != 0)
+				return error_result("Failed to write the profile");
+
+			return error_result();
+		}
+
+	private:
+		static constexpr uint32_t k_unknown_module = ~0U;
+
+		struct export_module
+		{
+			uint64_t		start;
+			uint64_t		end;
+			uint64_t		load_address;
+			std::string		path;
+			std::string		build_id;		// Hexadecimal
+		};
+
+		struct export_frame
+		{
+			uint64_t		address;
+			uint32_t		module_index;	// k_unknown_module when no module contains the address
+			uint32_t		line;			// Zero when unknown
+			std::string		name;
+			std::string		file;
+		};
+
+		error_result read_modules(const trace_reader& reader)
+		{
+			m_modules.clear();
+
+			for (uint32_t module_chunk_index = 0; module_chunk_index < reader.get_num_module_chunks(); ++module_chunk_index)
+			{
+				const chunk_view chunk = reader.get_chunk(reader.get_module_chunk_index(module_chunk_index));
+				const error_result result = for_each_module_in_chunk(chunk, [this](const module_info& module)
+					{
+						export_module entry;
+						entry.start = module.start;
+						entry.end = module.end;
+						entry.load_address = module.load_address;
+						entry.path = module.path_length != 0 ? std::string(module.path, module.path_length) : std::string("[anonymous module]");
+
+						char hex[3];
+						for (uint32_t byte_index = 0; byte_index < module.build_id_size; ++byte_index)
+						{
+							snprintf(hex, sizeof(hex), "%02x", module.build_id[byte_index]);
+							entry.build_id.append(hex);
+						}
+
+						m_modules.push_back(std::move(entry));
+						return true;
+					});
+
+				if (result.any())
+					return result;
+			}
+
+			// A range reused after an unload resolves to the module loaded last
+			std::stable_sort(m_modules.begin(), m_modules.end(), [](const export_module& lhs, const export_module& rhs) { return lhs.start < rhs.start; });
+			return error_result();
+		}
+
+		uint32_t find_module(uint64_t address) const
+		{
+			const auto module_it = std::upper_bound(m_modules.begin(), m_modules.end(), address, [](uint64_t value, const export_module& module) { return value < module.start; });
+			if (module_it == m_modules.begin() || address >= module_it[-1].end)
+				return k_unknown_module;
+
+			return uint32_t(module_it - m_modules.begin() - 1);
+		}
+
+		uint32_t get_frame_index(uint64_t address)
+		{
+			const auto result = m_frame_indices.emplace(address, uint32_t(m_frames.size()));
+			if (!result.second)
+				return result.first->second;
+
+			export_frame frame;
+			frame.address = address;
+			frame.module_index = address != 0 ? find_module(address) : k_unknown_module;
+			frame.line = 0;
+
+			symbol_file_frame symbol;
+			char name[64];
+			if (address == 0)
+				frame.name = "[unknown stack]";
+			else if (m_symbols->is_open() && m_symbols->find(address, symbol) && symbol.function[0] != '\0')
+			{
+				frame.name = symbol.function;
+				frame.file = symbol.file;
+				frame.line = symbol.line;
+			}
+			else if (frame.module_index != k_unknown_module)
+			{
+				const export_module& module = m_modules[frame.module_index];
+				const size_t separator = module.path.rfind('/');
+				snprintf(name, sizeof(name), "+0x%" PRIx64, address - module.load_address);
+				frame.name = module.path.substr(separator != std::string::npos ? separator + 1 : 0);
+				frame.name.append(name);
+			}
+			else
+			{
+				snprintf(name, sizeof(name), "0x%" PRIx64, address);
+				frame.name = name;
+			}
+
+			m_frames.push_back(std::move(frame));
+			return result.first->second;
+		}
+
+		uint64_t get_string_index(const std::string& string)
+		{
+			const auto result = m_string_indices.emplace(string, m_strings.size());
+			if (result.second)
+				m_strings.push_back(string);
+
+			return result.first->second;
+		}
+
+		void write_folded_node(const callstack_tree& tree, uint32_t node_index, std::string& line, FILE* file)
+		{
+			const callstack_tree::node& node = tree.get_node(node_index);
+			const size_t line_size = line.size();
+
+			// Separators and line breaks in names would break the format
+			if (line_size != 0)
+				line.push_back(';');
+			for (char character : m_frames[get_frame_index(node.address)].name)
+				line.push_back(character == ';' ? ':' : (character == '\n' ? ' ' : character));
+
+			if (node.self_weight != 0)
+				fprintf(file, "%s %" PRIu64 "\n", line.c_str(), node.self_weight);
+
+			for (uint32_t child_index = node.first_child; child_index != callstack_tree::k_no_node; child_index = tree.get_node(child_index).next_sibling)
+				write_folded_node(tree, child_index, line, file);
+
+			line.resize(line_size);
+		}
+
+		const symbol_file*							m_symbols = nullptr;
+		std::vector<export_module>					m_modules;			// Sorted by start
+		std::vector<export_frame>					m_frames;
+		std::unordered_map<uint64_t, uint32_t>		m_frame_indices;	// Frame of every address
+
+		std::vector<std::string>					m_strings;			// pprof string table, empty string first
+		std::unordered_map<std::string, uint64_t>	m_string_indices;
+	};
+}
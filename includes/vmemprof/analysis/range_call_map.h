@@ -0,0 +1,189 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/core/event.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <sys/mman.h>
+#include <vector>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// A call that set an attribute over a range and the part of its range it
+	// still covers, e.g. a madvise or an mbind.
+	////////////////////////////////////////////////////////////////////////////////
+	struct range_call
+	{
+		uint64_t	start;
+		uint64_t	end;
+		uint64_t	timestamp;
+		uint64_t	arg0;
+		uint64_t	arg1;
+		uint32_t	stack_id;
+		uint32_t	thread_id;
+		uint32_t	flags;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Tracks which call is in effect over every range, for attributes the kernel
+	// keeps in the VMA flags or policy.
+	//
+	// A newer call replaces the older ones over its range, unmapping or mapping
+	// over a range clears it and mremap moves the calls along with the pages.
+	////////////////////////////////////////////////////////////////////////////////
+	class range_call_map
+	{
+	public:
+		void clear() { m_ranges.clear(); }
+
+		// Records a call over [address, address + size)
+		void record(const vm_event& event)
+		{
+			const uint64_t end = event.address + address_space::align_to_page(event.size);
+			if (event.address >= end)
+				return;
+
+			erase(event.address, end);
+			m_ranges.emplace(event.address, range_call{ event.address, end, event.timestamp, event.arg0, event.arg1, event.stack_id, event.thread_id, event.flags });
+		}
+
+		// Follows the mapping events, other events are ignored
+		void apply_mapping_change(const vm_event& event)
+		{
+			switch (event.type)
+			{
+			case event_type::mmap:
+			case event_type::munmap:
+				erase(event.address, event.address + address_space::align_to_page(event.size));
+				break;
+
+			case event_type::brk:
+			case event_type::sbrk:
+				if (event.address < event.arg0)
+					erase(address_space::align_to_page(event.address), address_space::align_to_page(event.arg0));
+				break;
+
+			case event_type::mremap:
+				apply_mremap(event);
+				break;
+
+			default:
+				break;
+			}
+		}
+
+		// Calls 'void(const range_call&)' for the calls in effect over [start, end), clipped to it
+		template<typename function_type>
+		void for_each_call(uint64_t start, uint64_t end, function_type function) const
+		{
+			auto it = m_ranges.upper_bound(start);
+			if (it != m_ranges.begin())
+				--it;
+
+			for (; it != m_ranges.end() && it->first < end; ++it)
+			{
+				if (it->second.end > start)
+					function(clip(it->second, start, end));
+			}
+		}
+
+		uint64_t get_num_ranges() const { return m_ranges.size(); }
+
+		// Drops the calls over [start, end)
+		void erase(uint64_t start, uint64_t end)
+		{
+			auto it = m_ranges.lower_bound(start);
+			if (it != m_ranges.begin())
+			{
+				// The previous range can straddle our start, keep its head and maybe its tail
+				auto previous_it = std::prev(it);
+				const range_call previous = previous_it->second;
+				if (previous.end > start)
+				{
+					previous_it->second.end = start;
+					if (previous.end > end)
+						m_ranges.emplace(end, clip(previous, end, previous.end));
+				}
+			}
+
+			while (it != m_ranges.end() && it->first < end)
+			{
+				const range_call next = it->second;
+				it = m_ranges.erase(it);
+
+				if (next.end > end)
+				{
+					m_ranges.emplace_hint(it, end, clip(next, end, next.end));
+					break;
+				}
+			}
+		}
+
+	private:
+		static range_call clip(const range_call& call, uint64_t start, uint64_t end)
+		{
+			range_call clipped = call;
+			clipped.start = std::max(call.start, start);
+			clipped.end = std::min(call.end, end);
+			return clipped;
+		}
+
+		void apply_mremap(const vm_event& event)
+		{
+			const uint64_t old_start = event.arg0;
+			const uint64_t old_size = address_space::align_to_page(event.arg1);
+			const uint64_t new_start = event.address;
+			const uint64_t new_size = address_space::align_to_page(event.size);
+
+			// An old size of zero duplicates a shared mapping
+			const uint64_t moved_size = old_size == 0 ? new_size : std::min(old_size, new_size);
+
+			m_scratch_moved.clear();
+			for_each_call(old_start, old_start + moved_size, [this, old_start, new_start](const range_call& call)
+				{
+					range_call moved = call;
+					moved.start = call.start - old_start + new_start;
+					moved.end = call.end - old_start + new_start;
+					m_scratch_moved.push_back(moved);
+				});
+
+			if (old_size != 0 && (event.flags & MREMAP_DONTUNMAP) == 0)
+				erase(old_start, old_start + old_size);
+
+			erase(new_start, new_start + new_size);
+			for (const range_call& moved : m_scratch_moved)
+				m_ranges.emplace(moved.start, moved);
+		}
+
+		std::map<uint64_t, range_call>	m_ranges;			// Keyed by start, ranges do not overlap
+		std::vector<range_call>			m_scratch_moved;
+	};
+}
@@ -0,0 +1,344 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/analysis/vma_region.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/residency_sample.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <vector>
+
+namespace vmemprof
+{
+	struct residency_estimate
+	{
+		uint64_t	sampled_bytes;		// Bytes covered by samples
+		uint64_t	committed_bytes;
+		uint64_t	resident_bytes;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Keeps the most recent residency sample of every range.
+	//
+	// Samples are added in timestamp order, a sample replaces the parts of older
+	// samples it overlaps. Page counts are assumed uniform within a sample, when
+	// only part of a sample is kept or queried its counts are prorated.
+	////////////////////////////////////////////////////////////////////////////////
+	class residency_map
+	{
+	public:
+		explicit residency_map(uint64_t page_size = 4096) : m_page_size(page_size) {}
+
+		void clear() { m_samples.clear(); }
+
+		void add_sample(const residency_sample& sample)
+		{
+			if (sample.size == 0)
+				return;
+
+			erase(sample.address, sample.address + sample.size);
+			m_samples.emplace(sample.address, sample);
+		}
+
+		// Returns true if an event moves or populates memory, see apply()
+		static bool affects_residency(const vm_event& event)
+		{
+			return event.type == event_type::mremap || event.type == event_type::uffd_populate;
+		}
+
+		//////////////////////////////////////////////////////////////////////////
+		// Updates the samples with what an event did to the pages, other events are ignored.
+		//
+		// mremap moves the pages with the mapping, their samples follow them and whatever
+		// was sampled at the destination is dropped. A range populated by a userfaultfd is
+		// fully committed and resident at that time: it is added as a sample. A run of
+		// consecutive populations is kept as a single sample with the timestamp of its
+		// last population so that lazily populated regions do not fragment the map.
+		//////////////////////////////////////////////////////////////////////////
+		void apply(const vm_event& event)
+		{
+			if (event.type == event_type::mremap)
+				apply_mremap(event);
+			else if (event.type == event_type::uffd_populate)
+				apply_population(event);
+		}
+
+		// Returns the range whose estimates applying an event changes
+		void get_affected_range(const vm_event& event, uint64_t& out_start, uint64_t& out_end) const
+		{
+			out_start = 0;
+			out_end = 0;
+			if (event.type != event_type::uffd_populate)
+				return;
+
+			get_affected_range(event.address, event.address + align_to_page(event.size), out_start, out_end);
+
+			// The run of populations it extends is updated too
+			auto it = m_samples.lower_bound(event.address);
+			if (out_start < out_end && it != m_samples.begin() && std::prev(it)->second.address + std::prev(it)->second.size == event.address)
+				out_start = std::prev(it)->second.address;
+		}
+
+		// Returns the range whose estimates adding a sample changes: the sample and the older samples it cuts
+		void get_affected_range(const residency_sample& sample, uint64_t& out_start, uint64_t& out_end) const
+		{
+			get_affected_range(sample.address, sample.address + sample.size, out_start, out_end);
+		}
+
+		void get_affected_range(uint64_t start, uint64_t end, uint64_t& out_start, uint64_t& out_end) const
+		{
+			out_start = start;
+			out_end = end;
+			if (start >= end)
+				return;
+
+			auto it = m_samples.lower_bound(start);
+			if (it != m_samples.begin())
+			{
+				const residency_sample& previous = std::prev(it)->second;
+				if (previous.address + previous.size > start)
+				{
+					out_start = previous.address;
+					out_end = std::max(out_end, previous.address + previous.size);
+				}
+			}
+
+			it = m_samples.lower_bound(end);
+			if (it != m_samples.begin())
+			{
+				const residency_sample& last = std::prev(it)->second;
+				out_end = std::max(out_end, last.address + last.size);
+			}
+		}
+
+		// Only samples taken since the region was mapped are considered
+		residency_estimate estimate(const vma_region& region) const
+		{
+			residency_estimate result = { 0, 0, 0 };
+
+			auto it = m_samples.upper_bound(region.start);
+			if (it != m_samples.begin())
+				--it;
+
+			for (; it != m_samples.end() && it->first < region.end; ++it)
+			{
+				const residency_sample& sample = it->second;
+				const uint64_t sample_end = sample.address + sample.size;
+				if (sample_end <= region.start || sample.timestamp < region.timestamp)
+					continue;
+
+				const residency_sample clipped = clip_sample(sample, std::max(sample.address, region.start), std::min(sample_end, region.end));
+				result.sampled_bytes += clipped.size;
+				result.committed_bytes += uint64_t(clipped.num_committed_pages) * m_page_size;
+				result.resident_bytes += uint64_t(clipped.num_resident_pages) * m_page_size;
+			}
+
+			return result;
+		}
+
+		uint64_t get_num_samples() const { return m_samples.size(); }
+
+	private:
+		uint64_t align_to_page(uint64_t value) const { return (value + m_page_size - 1) & ~(m_page_size - 1); }
+
+		// Drops the samples over [start, end), the ones straddling it are clipped
+		void erase(uint64_t start, uint64_t end)
+		{
+			auto it = m_samples.lower_bound(start);
+			if (it != m_samples.begin())
+			{
+				// The previous sample can straddle our start, keep its head and maybe its tail
+				auto previous_it = std::prev(it);
+				const residency_sample previous = previous_it->second;
+				const uint64_t previous_end = previous.address + previous.size;
+				if (previous_end > start)
+				{
+					previous_it->second = clip_sample(previous, previous.address, start);
+					if (previous_end > end)
+						m_samples.emplace(end, clip_sample(previous, end, previous_end));
+				}
+			}
+
+			while (it != m_samples.end() && it->first < end)
+			{
+				const residency_sample next = it->second;
+				const uint64_t next_end = next.address + next.size;
+				it = m_samples.erase(it);
+
+				if (next_end > end)
+				{
+					m_samples.emplace_hint(it, end, clip_sample(next, end, next_end));
+					break;
+				}
+			}
+		}
+
+		void apply_mremap(const vm_event& event)
+		{
+			const uint64_t old_start = event.arg0;
+			const uint64_t old_size = align_to_page(event.arg1);
+			const uint64_t new_start = event.address;
+			const uint64_t new_size = align_to_page(event.size);
+
+			// An old size of zero duplicates a shared mapping, it shares the pages of the source
+			const uint64_t moved_size = old_size == 0 ? new_size : std::min(old_size, new_size);
+
+			m_scratch_moved.clear();
+			auto it = m_samples.upper_bound(old_start);
+			if (it != m_samples.begin())
+				--it;
+
+			for (; it != m_samples.end() && it->first < old_start + moved_size; ++it)
+			{
+				const residency_sample& sample = it->second;
+				const uint64_t sample_end = sample.address + sample.size;
+				if (sample_end <= old_start)
+					continue;
+
+				residency_sample moved = clip_sample(sample, std::max(sample.address, old_start), std::min(sample_end, old_start + moved_size));
+				moved.address = moved.address - old_start + new_start;
+				m_scratch_moved.push_back(moved);
+			}
+
+			// MREMAP_DONTUNMAP keeps the source mapped but its pages moved away
+			if (old_size != 0)
+				erase(old_start, old_start + old_size);
+
+			erase(new_start, new_start + new_size);
+			for (const residency_sample& moved : m_scratch_moved)
+				m_samples.emplace(moved.address, moved);
+		}
+
+		void apply_population(const vm_event& event)
+		{
+			residency_sample sample;
+			sample.timestamp = event.timestamp;
+			sample.address = event.address;
+			sample.size = align_to_page(event.size);
+			sample.num_committed_pages = uint32_t(sample.size / m_page_size);
+			sample.num_resident_pages = sample.num_committed_pages;
+			if (sample.size == 0)
+				return;
+
+			auto it = m_samples.lower_bound(sample.address);
+			if (it != m_samples.begin())
+			{
+				// Extend the run of populated pages that ends at our start
+				residency_sample& previous = std::prev(it)->second;
+				const bool is_fully_populated = uint64_t(previous.num_resident_pages) * m_page_size == previous.size;
+				if (previous.address + previous.size == sample.address && is_fully_populated)
+				{
+					const uint64_t num_pages = (previous.size + sample.size) / m_page_size;
+					if (num_pages <= UINT32_MAX)
+					{
+						erase(sample.address, sample.address + sample.size);
+						previous.timestamp = sample.timestamp;
+						previous.size += sample.size;
+						previous.num_committed_pages = uint32_t(num_pages);
+						previous.num_resident_pages = uint32_t(num_pages);
+						return;
+					}
+				}
+			}
+
+			add_sample(sample);
+		}
+
+		static residency_sample clip_sample(const residency_sample& sample, uint64_t start, uint64_t end)
+		{
+			residency_sample clipped = sample;
+			clipped.address = start;
+			clipped.size = end - start;
+
+			if (clipped.size != sample.size)
+			{
+				clipped.num_committed_pages = uint32_t(uint64_t(sample.num_committed_pages) * clipped.size / sample.size);
+				clipped.num_resident_pages = uint32_t(uint64_t(sample.num_resident_pages) * clipped.size / sample.size);
+			}
+
+			return clipped;
+		}
+
+		uint64_t								m_page_size;
+		std::map<uint64_t, residency_sample>	m_samples;		// Keyed by address, samples do not overlap
+		std::vector<residency_sample>			m_scratch_moved;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Adds every residency sample of a trace taken at or before a timestamp.
+	//
+	// The events that move or populate memory are merged in timestamp order, see
+	// residency_map::apply.
+	////////////////////////////////////////////////////////////////////////////////
+	inline error_result read_residency_samples(const trace_reader& reader, uint64_t until_timestamp, residency_map& out_map)
+	{
+		event_cursor events(reader);
+		vm_event event;
+		bool has_event = events.next(event);
+
+		// Applies the events that precede a timestamp
+		const auto apply_events = [&](uint64_t timestamp)
+			{
+				for (; has_event && event.timestamp <= timestamp; has_event = events.next(event))
+				{
+					if (residency_map::affects_residency(event))
+						out_map.apply(event);
+				}
+			};
+
+		const uint32_t num_residency_chunks = reader.get_num_residency_chunks();
+		for (uint32_t residency_chunk_index = 0; residency_chunk_index < num_residency_chunks; ++residency_chunk_index)
+		{
+			const chunk_view chunk = reader.get_chunk(reader.get_residency_chunk_index(residency_chunk_index));
+			if (chunk.header->first_timestamp > until_timestamp)
+				break;
+
+			const error_result result = for_each_residency_sample_in_chunk(chunk, [&out_map, &apply_events, until_timestamp](const residency_sample& sample)
+				{
+					if (sample.timestamp > until_timestamp)
+						return false;
+
+					apply_events(sample.timestamp);
+					out_map.add_sample(sample);
+					return true;
+				});
+
+			if (result.any())
+				return result;
+		}
+
+		apply_events(until_timestamp);
+		if (events.is_corrupted())
+			return error_result("Corrupted event chunk");
+
+		return error_result();
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/analysis/residency_map.h"
+#include "vmemprof/analysis/vma_region.h"
+
+#include <cmath>
+#include <cstdint>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns the probability that a mapping of 'size' bytes was recorded by a
+	// capture that samples one mapping every 'sampling_interval' bytes on average.
+	////////////////////////////////////////////////////////////////////////////////
+	inline double get_sample_probability(uint64_t size, uint64_t sampling_interval)
+	{
+		if (sampling_interval == 0)
+			return 1.0;
+
+		// 1 - exp(-x) without the cancellation for small mappings
+		return -std::expm1(-double(size) / double(sampling_interval));
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Scales what sampled mappings hold back to unbiased estimates of the whole
+	// process.
+	//
+	// Every recorded mapping stands for 1 / p mappings like it, p being the
+	// probability it had to be recorded, so the sum of the scaled sizes has the
+	// expectation of the sum over every mapping. Regions carry the size of the
+	// call that created them: a region split or trimmed later keeps the weight of
+	// its mapping. Traces that recorded every mapping have a weight of 1.
+	////////////////////////////////////////////////////////////////////////////////
+	class sample_scaler
+	{
+	public:
+		explicit sample_scaler(uint64_t sampling_interval = 0) : m_sampling_interval(sampling_interval) {}
+
+		bool is_sampled() const { return m_sampling_interval != 0; }
+		uint64_t get_sampling_interval() const { return m_sampling_interval; }
+
+		double get_weight(const vma_region& region) const
+		{
+			if (m_sampling_interval == 0)
+				return 1.0;
+
+			const double probability = get_sample_probability(region.mapping_size, m_sampling_interval);
+			return probability > 0.0 ? 1.0 / probability : 1.0;
+		}
+
+		uint64_t scale(const vma_region& region, uint64_t bytes) const
+		{
+			return m_sampling_interval == 0 ? bytes : uint64_t(double(bytes) * get_weight(region) + 0.5);
+		}
+
+		residency_estimate scale(const vma_region& region, const residency_estimate& estimate) const
+		{
+			if (m_sampling_interval == 0)
+				return estimate;
+
+			const double weight = get_weight(region);
+			return residency_estimate{ uint64_t(double(estimate.sampled_bytes) * weight + 0.5), uint64_t(double(estimate.committed_bytes) * weight + 0.5), uint64_t(double(estimate.resident_bytes) * weight + 0.5) };
+		}
+
+	private:
+		uint64_t	m_sampling_interval;
+	};
+}
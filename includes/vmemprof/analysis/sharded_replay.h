@@ -0,0 +1,430 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/worker_pool.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Replays the events of a trace on several threads by splitting the address
+	// space into shards.
+	//
+	// Every shard owns a contiguous address range and its own address_space. The
+	// events of a batch of chunks are decoded in parallel and routed to the shards
+	// their range touches, then every shard applies its events in trace order on
+	// its own thread. Mappings are numbered globally from the creations that each
+	// chunk contains, the events that straddle a shard only keep the part inside.
+	//
+	// An mremap that reads from or writes to more than one shard, and a partial
+	// mprotect that spans shards, depend on the state of several shards. They are
+	// barriers: the shards replay up to them, the event is applied serially to a
+	// copy of the ranges it touches and the result is written back to each shard.
+	//
+	// Shards are concatenated in address order to produce the address space, the
+	// regions and stats are identical to a serial replay regardless of the number
+	// of shards or threads.
+	////////////////////////////////////////////////////////////////////////////////
+	class sharded_replay
+	{
+	public:
+		static constexpr uint32_t k_max_sampled_chunks = 64;
+
+		// Splits the address space in up to num_shards ranges that receive a similar number of events
+		void initialize(const trace_reader& reader, uint32_t num_shards)
+		{
+			m_reader = &reader;
+			m_next_mapping_id = 1;
+			m_boundaries.clear();
+			m_shards.clear();
+
+			// The events of a few chunks spread over the trace are representative enough
+			std::vector<uint64_t> addresses;
+			const uint32_t num_event_chunks = reader.get_num_event_chunks();
+			const uint32_t num_sampled_chunks = std::min(num_event_chunks, k_max_sampled_chunks);
+			for (uint32_t sample_index = 0; sample_index < num_sampled_chunks; ++sample_index)
+			{
+				const uint32_t event_chunk_index = uint32_t(uint64_t(sample_index) * num_event_chunks / num_sampled_chunks);
+				const chunk_view chunk = reader.get_chunk(reader.get_event_chunk_index(event_chunk_index));
+				for_each_event_in_chunk(chunk, [&addresses](const vm_event& event)
+					{
+						uint64_t start;
+						uint64_t end;
+						if (get_event_range(event, start, end))
+							addresses.push_back(start);
+						return true;
+					});
+			}
+
+			std::sort(addresses.begin(), addresses.end());
+
+			m_boundaries.push_back(0);
+			for (uint32_t shard_index = 1; shard_index < num_shards && !addresses.empty(); ++shard_index)
+			{
+				const uint64_t boundary = addresses[uint64_t(shard_index) * addresses.size() / num_shards] & ~(address_space::k_page_size - 1);
+				if (boundary > m_boundaries.back())
+					m_boundaries.push_back(boundary);
+			}
+			m_boundaries.push_back(UINT64_MAX);
+
+			m_shards.resize(m_boundaries.size() - 1);
+		}
+
+		uint32_t get_num_shards() const { return uint32_t(m_shards.size()); }
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Applies the events of a range of event chunks, they must follow the chunks
+		// replayed so far.
+		////////////////////////////////////////////////////////////////////////////////
+		error_result replay(uint32_t first_event_chunk_index, uint32_t num_chunks, worker_pool& pool)
+		{
+			if (m_batch.size() < num_chunks)
+				m_batch.resize(num_chunks);
+
+			const uint32_t num_shards = get_num_shards();
+			pool.run(num_chunks, [&](uint32_t chunk_index) { route_chunk(first_event_chunk_index + chunk_index, m_batch[chunk_index]); });
+
+			// Mapping identifiers follow the order of creation across chunks
+			for (uint32_t chunk_index = 0; chunk_index < num_chunks; ++chunk_index)
+			{
+				batch_chunk& chunk = m_batch[chunk_index];
+				if (chunk.result.any())
+					return chunk.result;
+
+				chunk.first_mapping_id = m_next_mapping_id;
+				m_next_mapping_id += chunk.num_creations;
+			}
+
+			for (shard_state& shard : m_shards)
+			{
+				shard.chunk_index = 0;
+				shard.entry_index = 0;
+			}
+
+			for (uint32_t chunk_index = 0; chunk_index < num_chunks; ++chunk_index)
+			{
+				for (uint32_t event_index : m_batch[chunk_index].barriers)
+				{
+					pool.run(num_shards, [&](uint32_t shard_index) { replay_shard(shard_index, num_chunks, chunk_index, event_index); });
+					apply_barrier(m_batch[chunk_index].events[event_index]);
+				}
+			}
+
+			pool.run(num_shards, [&](uint32_t shard_index) { replay_shard(shard_index, num_chunks, num_chunks, 0); });
+			return error_result();
+		}
+
+		// Builds the address space once every replayed event has been applied
+		void merge(address_space& out_space) const
+		{
+			out_space.clear();
+			for (const shard_state& shard : m_shards)
+				out_space.append(shard.space);
+
+			out_space.set_next_mapping_id(m_next_mapping_id);
+		}
+
+	private:
+		struct routed_event
+		{
+			uint32_t	event_index;
+			uint32_t	creation_index;		// Within its chunk, k_not_a_creation otherwise
+		};
+
+		struct batch_chunk
+		{
+			std::vector<vm_event>					events;
+			std::vector<std::vector<routed_event>>	shard_events;	// Indexed by shard
+			std::vector<uint32_t>					barriers;		// Events applied serially
+			uint32_t								num_creations = 0;
+			uint64_t								first_mapping_id = 0;
+			error_result							result;
+		};
+
+		struct shard_state
+		{
+			address_space	space;
+
+			// Next routed event to apply in the current batch
+			uint32_t		chunk_index = 0;
+			uint32_t		entry_index = 0;
+		};
+
+		static constexpr uint32_t k_not_a_creation = UINT32_MAX;
+
+		// Returns the range an event updates, false if it does not touch the address space
+		static bool get_event_range(const vm_event& event, uint64_t& out_start, uint64_t& out_end)
+		{
+			switch (event.type)
+			{
+			case event_type::mmap:
+			case event_type::munmap:
+			case event_type::mprotect:
+			case event_type::madvise:
+			case event_type::mremap:
+			case event_type::uffd_register:
+			case event_type::uffd_unregister:
+				out_start = event.address;
+				out_end = event.address + address_space::align_to_page(event.size);
+				break;
+			case event_type::brk:
+			case event_type::sbrk:
+				out_start = std::min(address_space::align_to_page(event.arg0), address_space::align_to_page(event.address));
+				out_end = std::max(address_space::align_to_page(event.arg0), address_space::align_to_page(event.address));
+				break;
+			default:
+				return false;
+			}
+
+			return out_start < out_end;
+		}
+
+		// Creations consume a mapping identifier even when they end up mapping nothing
+		static bool is_creation(const vm_event& event)
+		{
+			if (event.type == event_type::mmap)
+				return true;
+
+			if (event.type == event_type::brk || event.type == event_type::sbrk)
+				return address_space::align_to_page(event.address) > address_space::align_to_page(event.arg0);
+
+			return false;
+		}
+
+		// The range an mremap reads from, see address_space::apply_mremap
+		static void get_mremap_source_range(const vm_event& event, uint64_t& out_start, uint64_t& out_end)
+		{
+			const uint64_t old_size = address_space::align_to_page(event.arg1);
+			const uint64_t new_size = address_space::align_to_page(event.size);
+			out_start = event.arg0;
+			out_end = event.arg0 + (old_size != 0 ? old_size : new_size);
+		}
+
+		uint32_t find_shard(uint64_t address) const
+		{
+			return uint32_t(std::upper_bound(m_boundaries.begin() + 1, m_boundaries.end() - 1, address) - (m_boundaries.begin() + 1));
+		}
+
+		void route_chunk(uint32_t event_chunk_index, batch_chunk& out_chunk) const
+		{
+			const uint32_t num_shards = get_num_shards();
+			out_chunk.events.clear();
+			out_chunk.barriers.clear();
+			out_chunk.shard_events.resize(num_shards);
+			for (std::vector<routed_event>& shard_events : out_chunk.shard_events)
+				shard_events.clear();
+			out_chunk.num_creations = 0;
+
+			const chunk_view chunk = m_reader->get_chunk(m_reader->get_event_chunk_index(event_chunk_index));
+			out_chunk.result = for_each_event_in_chunk(chunk, [this, &out_chunk](const vm_event& event)
+				{
+					const uint32_t event_index = uint32_t(out_chunk.events.size());
+					out_chunk.events.push_back(event);
+
+					const uint32_t creation_index = is_creation(event) ? out_chunk.num_creations++ : k_not_a_creation;
+
+					uint64_t start;
+					uint64_t end;
+					if (!get_event_range(event, start, end))
+						return true;
+
+					uint32_t first_shard = find_shard(start);
+					uint32_t last_shard = find_shard(end - 1);
+
+					if (event.type == event_type::mremap)
+					{
+						// Local only when the source and the destination live in the same shard
+						uint64_t source_start;
+						uint64_t source_end;
+						get_mremap_source_range(event, source_start, source_end);
+						if (source_start < source_end)
+						{
+							first_shard = std::min(first_shard, find_shard(source_start));
+							last_shard = std::max(last_shard, find_shard(source_end - 1));
+						}
+
+						if (first_shard != last_shard)
+						{
+							out_chunk.barriers.push_back(event_index);
+							return true;
+						}
+					}
+					else if (event.type == event_type::mprotect && (event.flags & k_event_flag_partial) != 0 && first_shard != last_shard)
+					{
+						// Where it stopped depends on the holes of every shard it spans
+						out_chunk.barriers.push_back(event_index);
+						return true;
+					}
+
+					for (uint32_t shard_index = first_shard; shard_index <= last_shard; ++shard_index)
+						out_chunk.shard_events[shard_index].push_back(routed_event{ event_index, creation_index });
+
+					return true;
+				});
+		}
+
+		// Applies the routed events of a shard that precede an event of the batch
+		void replay_shard(uint32_t shard_index, uint32_t num_chunks, uint32_t end_chunk_index, uint32_t end_event_index)
+		{
+			shard_state& shard = m_shards[shard_index];
+			const uint64_t shard_start = m_boundaries[shard_index];
+			const uint64_t shard_end = m_boundaries[shard_index + 1];
+
+			for (; shard.chunk_index < num_chunks; shard.chunk_index++, shard.entry_index = 0)
+			{
+				if (shard.chunk_index > end_chunk_index)
+					return;
+
+				const batch_chunk& chunk = m_batch[shard.chunk_index];
+				const std::vector<routed_event>& entries = chunk.shard_events[shard_index];
+				for (; shard.entry_index < entries.size(); shard.entry_index++)
+				{
+					const routed_event& entry = entries[shard.entry_index];
+					if (shard.chunk_index == end_chunk_index && entry.event_index >= end_event_index)
+						return;
+
+					const vm_event& event = chunk.events[entry.event_index];
+					if (entry.creation_index == k_not_a_creation)
+					{
+						shard.space.apply(event);
+						continue;
+					}
+
+					// Mapping identifiers are global, the parts outside the shard belong to its neighbours
+					shard.space.set_next_mapping_id(chunk.first_mapping_id + entry.creation_index);
+					shard.space.apply(event);
+
+					uint64_t start = 0;
+					uint64_t end = 0;
+					get_event_range(event, start, end);
+					if (start < shard_start)
+						shard.space.unmap(start, shard_start);
+					if (end > shard_end)
+						shard.space.unmap(shard_end, end);
+				}
+			}
+		}
+
+		// Applies an event that spans shards once every shard replayed the events before it
+		void apply_barrier(const vm_event& event)
+		{
+			struct address_range
+			{
+				uint64_t	start;
+				uint64_t	end;
+			};
+
+			address_range ranges[2];
+			uint32_t num_ranges = 0;
+
+			uint64_t start;
+			uint64_t end;
+			if (get_event_range(event, start, end))
+				ranges[num_ranges++] = address_range{ start, end };
+
+			if (event.type == event_type::mremap)
+			{
+				get_mremap_source_range(event, start, end);
+				if (start < end)
+				{
+					if (num_ranges != 0 && start <= ranges[0].end && end >= ranges[0].start)
+						ranges[0] = address_range{ std::min(start, ranges[0].start), std::max(end, ranges[0].end) };
+					else
+						ranges[num_ranges++] = address_range{ start, end };
+				}
+			}
+
+			if (num_ranges == 2 && ranges[1].start < ranges[0].start)
+				std::swap(ranges[0], ranges[1]);
+
+			// Gather the ranges from their shards, apply the event and scatter them back
+			std::vector<vma_region>& regions = m_scratch_regions;
+			address_space& space = m_barrier_space;
+			space.clear();
+
+			for (uint32_t range_index = 0; range_index < num_ranges; ++range_index)
+			{
+				const address_range range = ranges[range_index];
+				regions.clear();
+				for_each_shard(range.start, range.end, [&](shard_state& shard, uint64_t shard_start, uint64_t shard_end)
+					{
+						shard.space.for_each_region(shard_start, shard_end, [&](const vma_region& region)
+							{
+								regions.push_back(address_space_impl::clip_region(region, shard_start, shard_end));
+								return true;
+							});
+					});
+
+				space.assign_range(range.start, range.end, regions);
+			}
+
+			space.apply(event);
+
+			for (uint32_t range_index = 0; range_index < num_ranges; ++range_index)
+			{
+				const address_range range = ranges[range_index];
+				for_each_shard(range.start, range.end, [&](shard_state& shard, uint64_t shard_start, uint64_t shard_end)
+					{
+						regions.clear();
+						space.for_each_region(shard_start, shard_end, [&](const vma_region& region)
+							{
+								regions.push_back(address_space_impl::clip_region(region, shard_start, shard_end));
+								return true;
+							});
+
+						shard.space.assign_range(shard_start, shard_end, regions);
+					});
+			}
+		}
+
+		// Calls 'void(shard_state&, uint64_t start, uint64_t end)' with the part of [start, end) every shard owns
+		template<typename function_type>
+		void for_each_shard(uint64_t start, uint64_t end, function_type function)
+		{
+			const uint32_t last_shard = find_shard(end - 1);
+			for (uint32_t shard_index = find_shard(start); shard_index <= last_shard; ++shard_index)
+				function(m_shards[shard_index], std::max(start, m_boundaries[shard_index]), std::min(end, m_boundaries[shard_index + 1]));
+		}
+
+		const trace_reader*			m_reader = nullptr;
+		std::vector<uint64_t>		m_boundaries;		// Shard i owns [m_boundaries[i], m_boundaries[i + 1])
+		std::vector<shard_state>	m_shards;
+		uint64_t					m_next_mapping_id = 1;
+
+		// Reused across batches
+		std::vector<batch_chunk>	m_batch;
+		address_space				m_barrier_space;
+		std::vector<vma_region>		m_scratch_regions;
+	};
+}
@@ -0,0 +1,394 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/analysis/residency_map.h"
+#include "vmemprof/analysis/sample_scaler.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/module_info.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace vmemprof
+{
+	enum class diff_grouping
+	{
+		stack,			// The callstack that mapped the regions
+		module,			// The module of the first frame of that callstack
+		mapping,		// The module file the regions map, or the kind of memory
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// What the regions of a group held in one snapshot. Bytes of sampled traces
+	// are scaled to estimates of the whole process, regions are counted as
+	// recorded.
+	////////////////////////////////////////////////////////////////////////////////
+	struct diff_usage
+	{
+		uint32_t	num_regions;
+		uint64_t	mapped_bytes;
+		uint64_t	committed_bytes;
+		uint64_t	resident_bytes;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// A group present in either snapshot.
+	//
+	// Stacks are reported with the id they have in each trace, k_invalid_stack_id
+	// on the side where the group has no region.
+	////////////////////////////////////////////////////////////////////////////////
+	struct diff_entry
+	{
+		std::string		name;				// Module path or mapping name, empty when grouping by stack
+		uint32_t		stack_ids[2];		// Before and after, when grouping by stack
+		diff_usage		usages[2];			// Before and after
+
+		int64_t get_mapped_delta() const { return int64_t(usages[1].mapped_bytes - usages[0].mapped_bytes); }
+		int64_t get_committed_delta() const { return int64_t(usages[1].committed_bytes - usages[0].committed_bytes); }
+		int64_t get_resident_delta() const { return int64_t(usages[1].resident_bytes - usages[0].resident_bytes); }
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// An address space at some point of a trace and the residency known then.
+	////////////////////////////////////////////////////////////////////////////////
+	struct diff_snapshot
+	{
+		const trace_reader*		reader;
+		const address_space*	space;
+		const residency_map*	residency;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Compares two snapshots of the same trace or of two traces.
+	//
+	// Every region is assigned a group key, groups are matched across the
+	// snapshots by key. Within a trace stack ids are interned already and used
+	// as is. Across traces the same callstack has unrelated ids and addresses
+	// that moved with ASLR, each stack is canonicalized once into its frames
+	// relative to their module, identified by path and build id, and interned in
+	// a dictionary shared by both traces. Matching is linear in the number of
+	// regions plus the number of frames of the stacks they reference, only the
+	// final sort of the groups is not.
+	////////////////////////////////////////////////////////////////////////////////
+	class snapshot_diff
+	{
+	public:
+		error_result build(const diff_snapshot& before, const diff_snapshot& after, diff_grouping grouping)
+		{
+			m_grouping = grouping;
+			m_is_same_trace = before.reader == after.reader;
+			m_entries.clear();
+			m_names.clear();
+			m_canonical_stacks.clear();
+			m_module_keys.clear();
+			m_totals[0] = m_totals[1] = diff_usage{ 0, 0, 0, 0 };
+
+			const diff_snapshot* snapshots[2] = { &before, &after };
+			for (uint32_t side = 0; side < 2; ++side)
+			{
+				trace_state& state = m_states[side];
+				if (side == 1 && m_is_same_trace)
+				{
+					// Same stack ids and modules on both sides
+					state.stack_keys.swap(m_states[0].stack_keys);
+					state.modules.swap(m_states[0].modules);
+				}
+				else
+				{
+					state.stack_keys.assign(snapshots[side]->reader->get_num_stacks(), k_invalid_key);
+					const error_result result = read_modules(*snapshots[side]->reader, state.modules);
+					if (result.any())
+						return result;
+				}
+
+				add_snapshot(*snapshots[side], side, state);
+			}
+
+			return error_result();
+		}
+
+		diff_grouping get_grouping() const { return m_grouping; }
+
+		// Every group in no particular order
+		const std::vector<diff_entry>& get_entries() const { return m_entries; }
+		std::vector<diff_entry>& get_entries() { return m_entries; }
+
+		const diff_usage& get_total(uint32_t side) const { return m_totals[side]; }
+
+	private:
+		static constexpr uint32_t k_invalid_key = ~0U;
+		static constexpr uint32_t k_unknown_module = ~0U;
+
+		struct trace_module
+		{
+			uint64_t		start;
+			uint64_t		end;
+			uint64_t		load_address;
+			uint32_t		key;			// Interned path and build id
+			std::string		path;
+		};
+
+		struct trace_state
+		{
+			std::vector<uint32_t>		stack_keys;		// Group key of every stack id, when grouping by stack
+			std::vector<trace_module>	modules;		// Sorted by start
+		};
+
+		static error_result read_modules(const trace_reader& reader, std::vector<trace_module>& out_modules)
+		{
+			out_modules.clear();
+
+			for (uint32_t module_chunk_index = 0; module_chunk_index < reader.get_num_module_chunks(); ++module_chunk_index)
+			{
+				const chunk_view chunk = reader.get_chunk(reader.get_module_chunk_index(module_chunk_index));
+				const error_result result = for_each_module_in_chunk(chunk, [&out_modules](const module_info& module)
+					{
+						trace_module entry;
+						entry.start = module.start;
+						entry.end = module.end;
+						entry.load_address = module.load_address;
+						entry.key = k_invalid_key;
+						entry.path.assign(module.path, module.path_length);
+
+						// The build id tells apart two builds at the same path
+						for (uint32_t byte_index = 0; byte_index < module.build_id_size; ++byte_index)
+							entry.path.push_back(char(module.build_id[byte_index]));
+
+						entry.path.push_back(char(module.build_id_size));
+						out_modules.push_back(std::move(entry));
+						return true;
+					});
+
+				if (result.any())
+					return result;
+			}
+
+			// A range reused after an unload resolves to the module loaded last
+			std::stable_sort(out_modules.begin(), out_modules.end(), [](const trace_module& lhs, const trace_module& rhs) { return lhs.start < rhs.start; });
+			return error_result();
+		}
+
+		const trace_module* find_module(const trace_state& state, uint64_t address) const
+		{
+			const auto module_it = std::upper_bound(state.modules.begin(), state.modules.end(), address, [](uint64_t value, const trace_module& module) { return value < module.start; });
+			if (module_it == state.modules.begin() || address >= module_it[-1].end)
+				return nullptr;
+
+			return &module_it[-1];
+		}
+
+		// The module key is the interned path and build id, module paths are stored with their build id appended
+		uint32_t get_module_key(const trace_module& module)
+		{
+			const auto insert_result = m_module_keys.emplace(module.path, uint32_t(m_module_keys.size()));
+			return insert_result.first->second;
+		}
+
+		static std::string get_module_name(const trace_module& module)
+		{
+			// Strip the build id appended by read_modules()
+			const size_t build_id_size = size_t(uint8_t(module.path.back()));
+			const size_t path_length = module.path.size() - build_id_size - 1;
+			return path_length != 0 ? module.path.substr(0, path_length) : std::string("[anonymous module]");
+		}
+
+		uint32_t add_entry(const std::string& name)
+		{
+			const diff_usage empty_usage = { 0, 0, 0, 0 };
+			m_entries.push_back(diff_entry{ name, { k_invalid_stack_id, k_invalid_stack_id }, { empty_usage, empty_usage } });
+			return uint32_t(m_entries.size() - 1);
+		}
+
+		uint32_t get_named_key(const std::string& name)
+		{
+			const auto insert_result = m_names.emplace(name, uint32_t(m_entries.size()));
+			if (insert_result.second)
+				add_entry(name);
+
+			return insert_result.first->second;
+		}
+
+		uint32_t get_stack_key(const trace_reader& reader, trace_state& state, uint32_t stack_id)
+		{
+			const bool is_known = stack_id < state.stack_keys.size();
+			if (is_known && state.stack_keys[stack_id] != k_invalid_key)
+				return state.stack_keys[stack_id];
+
+			uint32_t key;
+			if (m_is_same_trace || !is_known)
+			{
+				key = add_entry(std::string());
+			}
+			else
+			{
+				// Each frame becomes its module key and offset, frames outside every module keep their address
+				uint64_t frames[k_max_stack_frames];
+				uint32_t num_frames = 0;
+				if (!reader.get_stack(stack_id, frames, num_frames))
+					num_frames = 0;
+
+				std::string canonical_stack;
+				canonical_stack.reserve(num_frames * (sizeof(uint32_t) + sizeof(uint64_t)));
+				for (uint32_t frame_index = 0; frame_index < num_frames; ++frame_index)
+				{
+					const trace_module* module = find_module(state, frames[frame_index]);
+					const uint32_t module_key = module != nullptr ? get_module_key(*module) : k_unknown_module;
+					const uint64_t offset = module != nullptr ? frames[frame_index] - module->load_address : frames[frame_index];
+					canonical_stack.append(reinterpret_cast<const char*>(&module_key), sizeof(module_key));
+					canonical_stack.append(reinterpret_cast<const char*>(&offset), sizeof(offset));
+				}
+
+				const auto insert_result = m_canonical_stacks.emplace(std::move(canonical_stack), uint32_t(m_entries.size()));
+				if (insert_result.second)
+					add_entry(std::string());
+
+				key = insert_result.first->second;
+			}
+
+			if (is_known)
+				state.stack_keys[stack_id] = key;
+
+			return key;
+		}
+
+		std::string get_mapping_name(const trace_state& state, const vma_region& region) const
+		{
+			if ((region.map_flags & MAP_HUGETLB) != 0)
+				return region.is_shared() ? "[hugetlb shared]" : "[hugetlb]";
+
+			if ((region.map_flags & MAP_GROWSDOWN) != 0)
+				return "[stack]";
+
+			if (region.is_anonymous())
+				return region.is_shared() ? "[anonymous shared]" : "[anonymous]";
+
+			// File paths are not captured, only the files of modules are known
+			const trace_module* module = find_module(state, region.start);
+			if (module != nullptr)
+				return get_module_name(*module);
+
+			return region.is_shared() ? "[file shared]" : "[file]";
+		}
+
+		void add_snapshot(const diff_snapshot& snapshot, uint32_t side, trace_state& state)
+		{
+			diff_usage& total = m_totals[side];
+			const sample_scaler scaler(snapshot.reader->get_sampling_interval());
+
+			snapshot.space->for_each_region([&](const vma_region& region)
+				{
+					uint32_t key;
+					switch (m_grouping)
+					{
+					default:
+					case diff_grouping::stack:
+						key = get_stack_key(*snapshot.reader, state, region.stack_id);
+						break;
+					case diff_grouping::module:
+						key = get_named_key(get_caller_module_name(*snapshot.reader, state, region.stack_id));
+						break;
+					case diff_grouping::mapping:
+						key = get_named_key(get_mapping_name(state, region));
+						break;
+					}
+
+					const residency_estimate estimate = scaler.scale(region, snapshot.residency->estimate(region));
+					const uint64_t mapped_bytes = scaler.scale(region, region.get_size());
+
+					diff_entry& entry = m_entries[key];
+					if (m_grouping == diff_grouping::stack)
+						entry.stack_ids[side] = region.stack_id;
+
+					diff_usage& usage = entry.usages[side];
+					usage.num_regions++;
+					usage.mapped_bytes += mapped_bytes;
+					usage.committed_bytes += estimate.committed_bytes;
+					usage.resident_bytes += estimate.resident_bytes;
+
+					total.num_regions++;
+					total.mapped_bytes += mapped_bytes;
+					total.committed_bytes += estimate.committed_bytes;
+					total.resident_bytes += estimate.resident_bytes;
+					return true;
+				});
+		}
+
+		std::string get_caller_module_name(const trace_reader& reader, const trace_state& state, uint32_t stack_id) const
+		{
+			uint64_t frames[k_max_stack_frames];
+			uint32_t num_frames;
+			if (stack_id == k_invalid_stack_id || !reader.get_stack(stack_id, frames, num_frames) || num_frames == 0)
+				return "[unknown stack]";
+
+			const trace_module* module = find_module(state, frames[0]);
+			return module != nullptr ? get_module_name(*module) : std::string("[unknown module]");
+		}
+
+		std::vector<diff_entry>						m_entries;				// Indexed by group key
+		std::unordered_map<std::string, uint32_t>	m_names;				// Group key of every name
+		std::unordered_map<std::string, uint32_t>	m_canonical_stacks;		// Group key of every canonical stack
+		std::unordered_map<std::string, uint32_t>	m_module_keys;			// Key of every module path and build id
+
+		trace_state									m_states[2];
+		diff_usage									m_totals[2] = {};
+
+		diff_grouping								m_grouping = diff_grouping::stack;
+		bool										m_is_same_trace = false;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Sorts the groups by how much their committed memory changed, then how much
+	// their mapped memory changed, largest changes in either direction first.
+	////////////////////////////////////////////////////////////////////////////////
+	inline void sort_diff_entries(std::vector<diff_entry>& entries)
+	{
+		const auto magnitude = [](int64_t value) { return value < 0 ? uint64_t(-value) : uint64_t(value); };
+
+		std::sort(entries.begin(), entries.end(), [&magnitude](const diff_entry& lhs, const diff_entry& rhs)
+			{
+				const uint64_t lhs_committed = magnitude(lhs.get_committed_delta());
+				const uint64_t rhs_committed = magnitude(rhs.get_committed_delta());
+				if (lhs_committed != rhs_committed)
+					return lhs_committed > rhs_committed;
+
+				const uint64_t lhs_mapped = magnitude(lhs.get_mapped_delta());
+				const uint64_t rhs_mapped = magnitude(rhs.get_mapped_delta());
+				if (lhs_mapped != rhs_mapped)
+					return lhs_mapped > rhs_mapped;
+
+				if (lhs.name != rhs.name)
+					return lhs.name < rhs.name;
+				return lhs.stack_ids[1] != rhs.stack_ids[1] ? lhs.stack_ids[1] < rhs.stack_ids[1] : lhs.stack_ids[0] < rhs.stack_ids[0];
+			});
+	}
+}
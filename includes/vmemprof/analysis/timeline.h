@@ -0,0 +1,577 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/analysis/residency_map.h"
+#include "vmemprof/analysis/sample_scaler.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/module_info.h"
+#include "vmemprof/core/residency_sample.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace vmemprof
+{
+	// Rollups are kept at this many resolutions at most
+	constexpr uint32_t k_max_timeline_levels = 8;
+
+	enum class timeline_grouping : uint32_t
+	{
+		none,			// Only the whole process
+		stack,			// The callstack that mapped the regions
+		module,			// The module of the first frame of that callstack
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// What the regions of a series hold. Bytes of sampled traces are scaled to
+	// estimates of the whole process, VMAs are counted as recorded.
+	////////////////////////////////////////////////////////////////////////////////
+	struct timeline_value
+	{
+		uint64_t	reserved_bytes;
+		uint64_t	committed_bytes;
+		uint64_t	resident_bytes;
+		uint64_t	num_vmas;			// Kernel VMAs, each one counts in the series of its first region
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// A time bucket in which a series changed. Buckets without a change are not
+	// stored, the series keeps the last value of the bucket before them.
+	////////////////////////////////////////////////////////////////////////////////
+	struct timeline_bucket
+	{
+		uint64_t		index;			// Resolutions elapsed since the start of the capture
+		timeline_value	minimum;		// Over the bucket, including the value it started with
+		timeline_value	maximum;
+		timeline_value	last;			// At the end of the bucket
+	};
+
+	static_assert(sizeof(timeline_bucket) == 104, "Unexpected timeline bucket size");
+
+	struct timeline_settings
+	{
+		uint64_t			resolutions[k_max_timeline_levels] = { 1000000ULL, 1000000000ULL, 60000000000ULL };		// Bucket durations, finest first
+		uint32_t			num_levels = 3;
+		timeline_grouping	grouping = timeline_grouping::none;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// The process, or one of its groups, at every resolution.
+	////////////////////////////////////////////////////////////////////////////////
+	struct timeline_series
+	{
+		uint32_t						stack_id;		// When grouping by stack
+		std::string						name;			// Module path when grouping by module
+		timeline_value					peak;			// Largest value of each field over the trace
+		std::vector<timeline_bucket>	buckets[k_max_timeline_levels];
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Builds multi-resolution rollups of the reserved, committed and resident
+	// bytes and of the VMA count, for the process and per group, in a single pass.
+	//
+	// Events and residency samples are merged in timestamp order. Every update
+	// only touches the regions around the range it changes: what they held is
+	// subtracted from their series before the update and added back after it,
+	// so each series stays exact without sweeping the address space. The regions
+	// that end or start one byte outside the range are included because they
+	// can be cut or coalesced, and so are the samples a new residency sample
+	// cuts. A series then updates the open bucket of every resolution, a bucket
+	// is stored once the series changes in a later one. Series that did not
+	// change in a bucket store nothing for it, a quiet process costs nothing.
+	//
+	// Series 0 is the whole process, the others are the groups in the order
+	// they were first mapped.
+	////////////////////////////////////////////////////////////////////////////////
+	class timeline_builder
+	{
+	public:
+		error_result build(const trace_reader& reader, const timeline_settings& settings)
+		{
+			if (settings.num_levels == 0 || settings.num_levels > k_max_timeline_levels)
+				return error_result("Invalid number of timeline resolutions");
+
+			for (uint32_t level_index = 0; level_index < settings.num_levels; ++level_index)
+			{
+				if (settings.resolutions[level_index] == 0 || (level_index != 0 && settings.resolutions[level_index] <= settings.resolutions[level_index - 1]))
+					return error_result("Timeline resolutions must increase");
+			}
+
+			const trace_header& header = reader.get_header();
+			m_reader = &reader;
+			m_settings = settings;
+			m_start_timestamp = header.start_timestamp;
+			m_end_timestamp = header.start_timestamp;
+			m_space.clear();
+			m_residency = residency_map(header.page_size);
+			m_scaler = sample_scaler(reader.get_sampling_interval());
+			m_series.clear();
+			m_series_states.clear();
+			m_stack_series.clear();
+			m_module_series.clear();
+			m_dirty_series.clear();
+
+			add_series(k_invalid_stack_id, std::string());
+
+			if (settings.grouping == timeline_grouping::module)
+			{
+				const error_result result = read_modules();
+				if (result.any())
+					return result;
+			}
+
+			std::vector<residency_sample> pending_samples;
+			size_t pending_sample_index = 0;
+			uint32_t next_residency_chunk_index = 0;
+
+			// Adds the residency samples taken up to a timestamp
+			const auto add_samples = [&](uint64_t until_timestamp) -> error_result
+				{
+					for (;;)
+					{
+						for (; pending_sample_index < pending_samples.size(); ++pending_sample_index)
+						{
+							if (pending_samples[pending_sample_index].timestamp > until_timestamp)
+								return error_result();
+
+							apply_sample(pending_samples[pending_sample_index]);
+						}
+
+						if (next_residency_chunk_index >= reader.get_num_residency_chunks())
+							return error_result();
+
+						pending_samples.clear();
+						pending_sample_index = 0;
+
+						const chunk_view chunk = reader.get_chunk(reader.get_residency_chunk_index(next_residency_chunk_index++));
+						const error_result result = for_each_residency_sample_in_chunk(chunk, [&pending_samples](const residency_sample& sample) { pending_samples.push_back(sample); return true; });
+						if (result.any())
+							return result;
+					}
+				};
+
+			event_cursor events(reader);
+			vm_event event;
+			while (events.next(event))
+			{
+				const error_result result = add_samples(event.timestamp);
+				if (result.any())
+					return result;
+
+				apply_event(event);
+			}
+
+			if (events.is_corrupted())
+				return error_result("Corrupted event chunk");
+
+			const error_result result = add_samples(UINT64_MAX);
+			if (result.any())
+				return result;
+
+			// Close the buckets still open
+			for (uint32_t series_index = 0; series_index < m_series.size(); ++series_index)
+			{
+				series_state& state = m_series_states[series_index];
+				for (uint32_t level_index = 0; level_index < get_num_levels(); ++level_index)
+				{
+					if (state.is_bucket_open[level_index])
+						m_series[series_index].buckets[level_index].push_back(state.open_buckets[level_index]);
+				}
+			}
+
+			return error_result();
+		}
+
+		uint32_t get_num_levels() const { return m_settings.num_levels; }
+		uint64_t get_resolution(uint32_t level_index) const { return m_settings.resolutions[level_index]; }
+		timeline_grouping get_grouping() const { return m_settings.grouping; }
+
+		// The capture start and the last event or sample
+		uint64_t get_start_timestamp() const { return m_start_timestamp; }
+		uint64_t get_end_timestamp() const { return m_end_timestamp; }
+
+		const std::vector<timeline_series>& get_series() const { return m_series; }
+
+	private:
+		static constexpr uint32_t k_invalid_series = ~0U;
+
+		struct builder_module
+		{
+			uint64_t		start;
+			uint64_t		end;
+			std::string		path;
+		};
+
+		struct series_state
+		{
+			timeline_value	current;
+			timeline_bucket	open_buckets[k_max_timeline_levels];
+			bool			is_bucket_open[k_max_timeline_levels];
+			bool			is_dirty;
+		};
+
+		struct address_range
+		{
+			uint64_t	start;
+			uint64_t	end;
+		};
+
+		error_result read_modules()
+		{
+			m_modules.clear();
+
+			for (uint32_t module_chunk_index = 0; module_chunk_index < m_reader->get_num_module_chunks(); ++module_chunk_index)
+			{
+				const chunk_view chunk = m_reader->get_chunk(m_reader->get_module_chunk_index(module_chunk_index));
+				const error_result result = for_each_module_in_chunk(chunk, [this](const module_info& module)
+					{
+						m_modules.push_back(builder_module{ module.start, module.end, module.path_length != 0 ? std::string(module.path, module.path_length) : std::string("[anonymous module]") });
+						return true;
+					});
+
+				if (result.any())
+					return result;
+			}
+
+			// A range reused after an unload resolves to the module loaded last
+			std::stable_sort(m_modules.begin(), m_modules.end(), [](const builder_module& lhs, const builder_module& rhs) { return lhs.start < rhs.start; });
+			return error_result();
+		}
+
+		uint32_t add_series(uint32_t stack_id, std::string name)
+		{
+			timeline_series series;
+			series.stack_id = stack_id;
+			series.name = std::move(name);
+			series.peak = timeline_value{ 0, 0, 0, 0 };
+			m_series.push_back(std::move(series));
+
+			series_state state;
+			state.current = timeline_value{ 0, 0, 0, 0 };
+			for (uint32_t level_index = 0; level_index < k_max_timeline_levels; ++level_index)
+				state.is_bucket_open[level_index] = false;
+			state.is_dirty = false;
+			m_series_states.push_back(state);
+
+			return uint32_t(m_series.size() - 1);
+		}
+
+		std::string get_caller_module_name(uint32_t stack_id) const
+		{
+			uint64_t frames[k_max_stack_frames];
+			uint32_t num_frames;
+			if (stack_id == k_invalid_stack_id || !m_reader->get_stack(stack_id, frames, num_frames) || num_frames == 0)
+				return "[unknown stack]";
+
+			const auto module_it = std::upper_bound(m_modules.begin(), m_modules.end(), frames[0], [](uint64_t value, const builder_module& module) { return value < module.start; });
+			if (module_it == m_modules.begin() || frames[0] >= module_it[-1].end)
+				return "[unknown module]";
+
+			return module_it[-1].path;
+		}
+
+		// The group series of a stack, resolved once per stack id
+		uint32_t get_group_series(uint32_t stack_id)
+		{
+			if (stack_id >= m_stack_series.size())
+				m_stack_series.resize(size_t(stack_id) + 1, k_invalid_series);
+
+			uint32_t& series_index = m_stack_series[stack_id];
+			if (series_index != k_invalid_series)
+				return series_index;
+
+			if (m_settings.grouping == timeline_grouping::stack)
+				series_index = add_series(stack_id, std::string());
+			else
+			{
+				std::string name = get_caller_module_name(stack_id);
+				const auto module_it = m_module_series.find(name);
+				if (module_it != m_module_series.end())
+					series_index = module_it->second;
+				else
+				{
+					series_index = add_series(k_invalid_stack_id, name);
+					m_module_series.emplace(std::move(name), series_index);
+				}
+			}
+
+			return series_index;
+		}
+
+		void update_series(uint32_t series_index, const timeline_value& value, bool is_added)
+		{
+			series_state& state = m_series_states[series_index];
+			if (is_added)
+			{
+				state.current.reserved_bytes += value.reserved_bytes;
+				state.current.committed_bytes += value.committed_bytes;
+				state.current.resident_bytes += value.resident_bytes;
+				state.current.num_vmas += value.num_vmas;
+			}
+			else
+			{
+				// Exact: every value subtracted was added before
+				state.current.reserved_bytes -= value.reserved_bytes;
+				state.current.committed_bytes -= value.committed_bytes;
+				state.current.resident_bytes -= value.resident_bytes;
+				state.current.num_vmas -= value.num_vmas;
+			}
+
+			if (!state.is_dirty)
+			{
+				state.is_dirty = true;
+				m_dirty_series.push_back(series_index);
+			}
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Adds or subtracts what the regions that intersect sorted, disjoint ranges
+		// hold. A region that spans two ranges is only counted in the first one.
+		////////////////////////////////////////////////////////////////////////////////
+		void accumulate(const address_range* ranges, uint32_t num_ranges, bool is_added)
+		{
+			uint64_t visited_end = 0;
+			for (uint32_t range_index = 0; range_index < num_ranges; ++range_index)
+			{
+				const vma_region* previous = nullptr;
+				bool is_first = true;
+
+				m_space.for_each_region(ranges[range_index].start, ranges[range_index].end, [&](const vma_region& region)
+					{
+						if (is_first)
+						{
+							previous = m_space.find_previous_region(region.start);
+							is_first = false;
+						}
+
+						if (region.start >= visited_end)
+						{
+							const residency_estimate estimate = m_scaler.scale(region, m_residency.estimate(region));
+
+							timeline_value value;
+							value.reserved_bytes = m_scaler.scale(region, region.get_size());
+							value.committed_bytes = estimate.committed_bytes;
+							value.resident_bytes = estimate.resident_bytes;
+							value.num_vmas = previous == nullptr || !are_regions_kernel_mergeable(*previous, region) ? 1 : 0;
+
+							update_series(0, value, is_added);
+							if (m_settings.grouping != timeline_grouping::none)
+								update_series(get_group_series(region.stack_id), value, is_added);
+						}
+
+						previous = &region;
+						return true;
+					});
+
+				visited_end = ranges[range_index].end;
+			}
+		}
+
+		// Updates the open bucket of every resolution of the series that changed
+		void record(uint64_t timestamp)
+		{
+			m_end_timestamp = std::max(m_end_timestamp, timestamp);
+			const uint64_t elapsed = timestamp > m_start_timestamp ? timestamp - m_start_timestamp : 0;
+
+			for (const uint32_t series_index : m_dirty_series)
+			{
+				series_state& state = m_series_states[series_index];
+				timeline_series& series = m_series[series_index];
+				const timeline_value& value = state.current;
+				state.is_dirty = false;
+
+				for (uint32_t level_index = 0; level_index < get_num_levels(); ++level_index)
+				{
+					const uint64_t bucket_index = elapsed / m_settings.resolutions[level_index];
+					timeline_bucket& bucket = state.open_buckets[level_index];
+
+					if (!state.is_bucket_open[level_index] || bucket.index != bucket_index)
+					{
+						// The new bucket starts with the value the previous one ended with
+						const timeline_value start_value = state.is_bucket_open[level_index] ? bucket.last : timeline_value{ 0, 0, 0, 0 };
+						if (state.is_bucket_open[level_index])
+							series.buckets[level_index].push_back(bucket);
+
+						bucket.index = bucket_index;
+						bucket.minimum = start_value;
+						bucket.maximum = start_value;
+						state.is_bucket_open[level_index] = true;
+					}
+
+					bucket.minimum.reserved_bytes = std::min(bucket.minimum.reserved_bytes, value.reserved_bytes);
+					bucket.minimum.committed_bytes = std::min(bucket.minimum.committed_bytes, value.committed_bytes);
+					bucket.minimum.resident_bytes = std::min(bucket.minimum.resident_bytes, value.resident_bytes);
+					bucket.minimum.num_vmas = std::min(bucket.minimum.num_vmas, value.num_vmas);
+					bucket.maximum.reserved_bytes = std::max(bucket.maximum.reserved_bytes, value.reserved_bytes);
+					bucket.maximum.committed_bytes = std::max(bucket.maximum.committed_bytes, value.committed_bytes);
+					bucket.maximum.resident_bytes = std::max(bucket.maximum.resident_bytes, value.resident_bytes);
+					bucket.maximum.num_vmas = std::max(bucket.maximum.num_vmas, value.num_vmas);
+					bucket.last = value;
+				}
+
+				series.peak.reserved_bytes = std::max(series.peak.reserved_bytes, value.reserved_bytes);
+				series.peak.committed_bytes = std::max(series.peak.committed_bytes, value.committed_bytes);
+				series.peak.resident_bytes = std::max(series.peak.resident_bytes, value.resident_bytes);
+				series.peak.num_vmas = std::max(series.peak.num_vmas, value.num_vmas);
+			}
+
+			m_dirty_series.clear();
+		}
+
+		// Widens the ranges by a byte on each side, sorts them and merges the ones that touch
+		static uint32_t prepare_ranges(address_range (&ranges)[2], uint32_t num_ranges)
+		{
+			for (uint32_t range_index = 0; range_index < num_ranges; ++range_index)
+			{
+				address_range& range = ranges[range_index];
+				range.start = range.start != 0 ? range.start - 1 : 0;
+				range.end = range.end != UINT64_MAX ? range.end + 1 : UINT64_MAX;
+			}
+
+			// At most two ranges, from mremap
+			if (num_ranges == 2 && ranges[1].start < ranges[0].start)
+				std::swap(ranges[0], ranges[1]);
+
+			uint32_t num_merged = 0;
+			for (uint32_t range_index = 0; range_index < num_ranges; ++range_index)
+			{
+				if (num_merged != 0 && ranges[range_index].start <= ranges[num_merged - 1].end)
+					ranges[num_merged - 1].end = std::max(ranges[num_merged - 1].end, ranges[range_index].end);
+				else
+					ranges[num_merged++] = ranges[range_index];
+			}
+
+			return num_merged;
+		}
+
+		void apply_event(const vm_event& event)
+		{
+			address_range ranges[2];
+			uint32_t num_ranges = 0;
+
+			switch (event.type)
+			{
+			case event_type::mmap:
+			case event_type::munmap:
+			case event_type::mprotect:
+			case event_type::uffd_register:
+			case event_type::uffd_unregister:
+				ranges[num_ranges++] = address_range{ event.address, event.address + address_space::align_to_page(event.size) };
+				break;
+			case event_type::madvise:
+			{
+				// Most advices do not touch the VMA flags
+				uint32_t advice_flags = 0;
+				if (apply_madvise_advice(uint32_t(event.arg0), advice_flags))
+					ranges[num_ranges++] = address_range{ event.address, event.address + address_space::align_to_page(event.size) };
+				break;
+			}
+			case event_type::mremap:
+				// Samples that straddle either range are clipped, their estimates change on both sides
+				m_residency.get_affected_range(event.arg0, event.arg0 + address_space::align_to_page(event.arg1), ranges[0].start, ranges[0].end);
+				m_residency.get_affected_range(event.address, event.address + address_space::align_to_page(event.size), ranges[1].start, ranges[1].end);
+				num_ranges = 2;
+				break;
+			case event_type::brk:
+			case event_type::sbrk:
+			{
+				const uint64_t old_break = address_space::align_to_page(event.arg0);
+				const uint64_t new_break = address_space::align_to_page(event.address);
+				ranges[num_ranges++] = address_range{ std::min(old_break, new_break), std::max(old_break, new_break) };
+				break;
+			}
+			case event_type::uffd_populate:
+				m_residency.get_affected_range(event, ranges[0].start, ranges[0].end);
+				num_ranges++;
+				break;
+			default:
+				break;
+			}
+
+			// Drop empty ranges, like the address space ignores them
+			uint32_t num_valid_ranges = 0;
+			for (uint32_t range_index = 0; range_index < num_ranges; ++range_index)
+			{
+				if (ranges[range_index].start < ranges[range_index].end)
+					ranges[num_valid_ranges++] = ranges[range_index];
+			}
+
+			if (num_valid_ranges == 0)
+			{
+				m_space.apply(event);
+				m_residency.apply(event);
+				m_end_timestamp = std::max(m_end_timestamp, event.timestamp);
+				return;
+			}
+
+			num_valid_ranges = prepare_ranges(ranges, num_valid_ranges);
+			accumulate(ranges, num_valid_ranges, false);
+			m_space.apply(event);
+			m_residency.apply(event);
+			accumulate(ranges, num_valid_ranges, true);
+			record(event.timestamp);
+		}
+
+		void apply_sample(const residency_sample& sample)
+		{
+			address_range range;
+			m_residency.get_affected_range(sample, range.start, range.end);
+			if (range.start >= range.end)
+			{
+				m_end_timestamp = std::max(m_end_timestamp, sample.timestamp);
+				return;
+			}
+
+			accumulate(&range, 1, false);
+			m_residency.add_sample(sample);
+			accumulate(&range, 1, true);
+			record(sample.timestamp);
+		}
+
+		const trace_reader*								m_reader = nullptr;
+		timeline_settings								m_settings;
+		uint64_t										m_start_timestamp = 0;
+		uint64_t										m_end_timestamp = 0;
+
+		address_space									m_space;
+		residency_map									m_residency;
+		sample_scaler									m_scaler;
+
+		std::vector<timeline_series>					m_series;
+		std::vector<series_state>						m_series_states;		// Parallel to m_series
+		std::vector<uint32_t>							m_dirty_series;			// Changed by the current update
+
+		std::vector<uint32_t>							m_stack_series;			// Group series of every stack id
+		std::unordered_map<std::string, uint32_t>		m_module_series;		// Group series of every module name
+		std::vector<builder_module>						m_modules;				// Sorted by start
+	};
+}
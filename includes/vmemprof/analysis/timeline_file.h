@@ -0,0 +1,436 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "vmemprof/analysis/timeline.h"
+#include "vmemprof/core/error_result.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+// Timeline file layout
+//
+// The rollups of a trace are written next to it so that later queries do not
+// replay the trace:
+//    timeline_file_header
+//    uint64_t[num_levels]						resolution of every level, finest first
+//    timeline_file_series[num_series]
+//    timeline_file_range[num_series * num_levels]	buckets of each series at each level
+//    timeline_bucket[num_buckets]					sorted by index within a range
+//    char[strings_size]							null terminated strings, offset zero is empty
+//
+// The header records the size and start of the trace it was built from, a
+// file that does not match its trace is stale and rebuilt.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	constexpr uint32_t k_timeline_file_magic = 0x4C504D56;	// 'VMPL'
+	constexpr uint32_t k_timeline_file_version = 2;		// 2: residency samples follow mremap
+
+	// Analysis commands look for the timeline of '<trace>' in '<trace><k_timeline_file_suffix>'
+	constexpr const char* k_timeline_file_suffix = ".timeline";
+
+	struct timeline_file_header
+	{
+		uint32_t	magic;					// k_timeline_file_magic
+		uint32_t	version;				// k_timeline_file_version
+		uint64_t	trace_size;				// The trace the rollups were built from
+		uint64_t	trace_start_timestamp;
+		uint64_t	start_timestamp;		// Bucket zero starts here
+		uint64_t	end_timestamp;			// The last event or sample
+		uint32_t	num_levels;
+		uint32_t	num_series;
+		uint64_t	num_buckets;
+		uint64_t	strings_size;
+		uint32_t	grouping;				// timeline_grouping
+		uint32_t	padding;
+	};
+
+	static_assert(sizeof(timeline_file_header) == 72, "Unexpected timeline file header size");
+
+	struct timeline_file_series
+	{
+		uint32_t		stack_id;
+		uint32_t		name_offset;
+		timeline_value	peak;
+	};
+
+	static_assert(sizeof(timeline_file_series) == 40, "Unexpected timeline file series size");
+
+	struct timeline_file_range
+	{
+		uint64_t	first_bucket;
+		uint64_t	num_buckets;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// A bucket of a time range query, buckets without a change repeat the value
+	// the series had.
+	////////////////////////////////////////////////////////////////////////////////
+	struct timeline_point
+	{
+		uint64_t		timestamp;		// Start of the bucket
+		timeline_value	minimum;
+		timeline_value	maximum;
+		timeline_value	last;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Serializes the rollups built from a trace of 'trace_size' bytes in the
+	// timeline file layout. The write function takes a pointer and a size and
+	// returns false when it fails, serializing stops at the first failure.
+	////////////////////////////////////////////////////////////////////////////////
+	template<typename write_func_type>
+	inline bool serialize_timeline(const timeline_builder& builder, const trace_header& trace, uint64_t trace_size, write_func_type write_func)
+	{
+		const std::vector<timeline_series>& series = builder.get_series();
+		const uint32_t num_levels = builder.get_num_levels();
+
+		std::vector<char> strings(1, '\0');
+		std::vector<uint64_t> resolutions;
+		std::vector<timeline_file_series> file_series;
+		std::vector<timeline_file_range> ranges;
+		uint64_t num_buckets = 0;
+
+		for (uint32_t level_index = 0; level_index < num_levels; ++level_index)
+			resolutions.push_back(builder.get_resolution(level_index));
+
+		for (const timeline_series& entry : series)
+		{
+			timeline_file_series file_entry;
+			file_entry.stack_id = entry.stack_id;
+			file_entry.name_offset = 0;
+			file_entry.peak = entry.peak;
+
+			// Names are unique per series, they are not shared
+			if (!entry.name.empty())
+			{
+				file_entry.name_offset = uint32_t(strings.size());
+				strings.insert(strings.end(), entry.name.c_str(), entry.name.c_str() + entry.name.size() + 1);
+			}
+
+			file_series.push_back(file_entry);
+
+			for (uint32_t level_index = 0; level_index < num_levels; ++level_index)
+			{
+				ranges.push_back(timeline_file_range{ num_buckets, entry.buckets[level_index].size() });
+				num_buckets += entry.buckets[level_index].size();
+			}
+		}
+
+		timeline_file_header header;
+		header.magic = k_timeline_file_magic;
+		header.version = k_timeline_file_version;
+		header.trace_size = trace_size;
+		header.trace_start_timestamp = trace.start_timestamp;
+		header.start_timestamp = builder.get_start_timestamp();
+		header.end_timestamp = builder.get_end_timestamp();
+		header.num_levels = num_levels;
+		header.num_series = uint32_t(series.size());
+		header.num_buckets = num_buckets;
+		header.strings_size = strings.size();
+		header.grouping = uint32_t(builder.get_grouping());
+		header.padding = 0;
+
+		bool is_written = write_func(&header, sizeof(header));
+		is_written = is_written && write_func(resolutions.data(), resolutions.size() * sizeof(uint64_t));
+		is_written = is_written && (file_series.empty() || write_func(file_series.data(), file_series.size() * sizeof(timeline_file_series)));
+		is_written = is_written && (ranges.empty() || write_func(ranges.data(), ranges.size() * sizeof(timeline_file_range)));
+
+		for (const timeline_series& entry : series)
+		{
+			for (uint32_t level_index = 0; level_index < num_levels && is_written; ++level_index)
+			{
+				const std::vector<timeline_bucket>& buckets = entry.buckets[level_index];
+				is_written = buckets.empty() || write_func(buckets.data(), buckets.size() * sizeof(timeline_bucket));
+			}
+		}
+
+		return is_written && write_func(strings.data(), strings.size());
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Writes the rollups built from a trace of 'trace_size' bytes. They are
+	// written to a temporary file renamed over the path, readers that mapped the
+	// previous file keep reading it.
+	////////////////////////////////////////////////////////////////////////////////
+	inline error_result write_timeline_file(const char* path, const timeline_builder& builder, const trace_header& trace, uint64_t trace_size)
+	{
+		// Concurrent writers have their own temporary file, the last rename wins
+		char temporary_path[PATH_MAX];
+		if (snprintf(temporary_path, sizeof(temporary_path), "%s.%d.tmp", path, int(getpid())) >= int(sizeof(temporary_path)))
+			return error_result("The timeline file path is too long");
+
+		FILE* file = fopen(temporary_path, "wb");
+		if (file == nullptr)
+			return error_result("Failed to create the timeline file");
+
+		bool is_written = serialize_timeline(builder, trace, trace_size, [file](const void* data, size_t size) { return fwrite(data, 1, size, file) == size; });
+		is_written = fclose(file) == 0 && is_written;
+		is_written = is_written && rename(temporary_path, path) == 0;
+
+		if (!is_written)
+		{
+			unlink(temporary_path);
+			return error_result("Failed to write the timeline file");
+		}
+
+		return error_result();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Memory maps a timeline file, or holds the same layout in memory, and answers
+	// time range queries.
+	//
+	// A query at a level finds the first bucket in view with a binary search and
+	// then reads the buckets in view, its cost does not depend on the length of
+	// the trace.
+	////////////////////////////////////////////////////////////////////////////////
+	class timeline_file
+	{
+	public:
+		timeline_file() = default;
+		~timeline_file() { close(); }
+
+		timeline_file(const timeline_file&) = delete;
+		timeline_file& operator=(const timeline_file&) = delete;
+
+		error_result open(const char* path)
+		{
+			close();
+
+			const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				return error_result("Failed to open the timeline file");
+
+			struct stat file_stat;
+			if (fstat(fd, &file_stat) != 0 || file_stat.st_size < off_t(sizeof(timeline_file_header)))
+			{
+				::close(fd);
+				return error_result("Invalid timeline file");
+			}
+
+			void* data = mmap(nullptr, size_t(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);
+
+			if (data == MAP_FAILED)
+				return error_result("Failed to map the timeline file");
+
+			m_data = static_cast<const uint8_t*>(data);
+			m_size = uint64_t(file_stat.st_size);
+			return validate();
+		}
+
+		// Keeps the rollups in memory, when they cannot be written next to the trace
+		error_result open(const timeline_builder& builder, const trace_header& trace, uint64_t trace_size)
+		{
+			close();
+
+			serialize_timeline(builder, trace, trace_size, [this](const void* data, size_t size)
+				{
+					m_storage.insert(m_storage.end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+					return true;
+				});
+
+			m_data = m_storage.data();
+			m_size = m_storage.size();
+			return validate();
+		}
+
+		void close()
+		{
+			if (m_data != nullptr && m_storage.empty())
+				munmap(const_cast<uint8_t*>(m_data), m_size);
+
+			m_storage.clear();
+			m_storage.shrink_to_fit();
+			m_data = nullptr;
+			m_size = 0;
+			m_header = nullptr;
+			m_resolutions = nullptr;
+			m_series = nullptr;
+			m_ranges = nullptr;
+			m_buckets = nullptr;
+			m_strings = nullptr;
+		}
+
+		bool is_open() const { return m_data != nullptr; }
+
+		// True when the file was built from a trace of this size and start
+		bool is_built_from(const trace_header& trace, uint64_t trace_size) const
+		{
+			return m_header->trace_size == trace_size && m_header->trace_start_timestamp == trace.start_timestamp;
+		}
+
+		uint64_t get_start_timestamp() const { return m_header->start_timestamp; }
+		uint64_t get_end_timestamp() const { return m_header->end_timestamp; }
+		timeline_grouping get_grouping() const { return timeline_grouping(m_header->grouping); }
+
+		uint32_t get_num_levels() const { return m_header->num_levels; }
+		uint64_t get_resolution(uint32_t level_index) const { return m_resolutions[level_index]; }
+
+		uint32_t get_num_series() const { return m_header->num_series; }
+		uint32_t get_series_stack_id(uint32_t series_index) const { return m_series[series_index].stack_id; }
+		const char* get_series_name(uint32_t series_index) const { return get_string(m_series[series_index].name_offset); }
+		const timeline_value& get_series_peak(uint32_t series_index) const { return m_series[series_index].peak; }
+
+		// The finest level that covers [start, end) in at most 'max_buckets' buckets, the coarsest one otherwise
+		uint32_t find_level(uint64_t start_timestamp, uint64_t end_timestamp, uint64_t max_buckets) const
+		{
+			const uint64_t duration = end_timestamp > start_timestamp ? end_timestamp - start_timestamp : 0;
+			for (uint32_t level_index = 0; level_index < get_num_levels(); ++level_index)
+			{
+				if (duration / m_resolutions[level_index] + 1 <= max_buckets)
+					return level_index;
+			}
+
+			return get_num_levels() - 1;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Returns every bucket of a level that overlaps [start, end), O(log buckets
+		// of the series + buckets in view).
+		////////////////////////////////////////////////////////////////////////////////
+		void query(uint32_t series_index, uint32_t level_index, uint64_t start_timestamp, uint64_t end_timestamp, std::vector<timeline_point>& out_points) const
+		{
+			out_points.clear();
+
+			const uint64_t resolution = m_resolutions[level_index];
+			const uint64_t origin = m_header->start_timestamp;
+			if (end_timestamp <= start_timestamp || end_timestamp <= origin)
+				return;
+
+			const uint64_t first_index = start_timestamp > origin ? (start_timestamp - origin) / resolution : 0;
+			const uint64_t last_index = (end_timestamp - 1 - origin) / resolution;
+
+			const timeline_file_range& range = m_ranges[uint64_t(series_index) * m_header->num_levels + level_index];
+			const timeline_bucket* buckets = m_buckets + range.first_bucket;
+			const timeline_bucket* buckets_end = buckets + range.num_buckets;
+			const timeline_bucket* bucket = std::lower_bound(buckets, buckets_end, first_index, [](const timeline_bucket& value, uint64_t key) { return value.index < key; });
+
+			// The series holds what the last bucket before the view ended with
+			timeline_value value = bucket != buckets ? bucket[-1].last : timeline_value{ 0, 0, 0, 0 };
+
+			out_points.reserve(size_t(last_index - first_index + 1));
+			for (uint64_t index = first_index; index <= last_index; ++index)
+			{
+				timeline_point point;
+				point.timestamp = origin + index * resolution;
+
+				if (bucket != buckets_end && bucket->index == index)
+				{
+					point.minimum = bucket->minimum;
+					point.maximum = bucket->maximum;
+					point.last = bucket->last;
+					value = bucket->last;
+					++bucket;
+				}
+				else
+				{
+					point.minimum = value;
+					point.maximum = value;
+					point.last = value;
+				}
+
+				out_points.push_back(point);
+			}
+		}
+
+	private:
+		const char* get_string(uint32_t offset) const { return offset < m_header->strings_size ? m_strings + offset : ""; }
+
+		error_result validate()
+		{
+			if (m_size < sizeof(timeline_file_header))
+			{
+				close();
+				return error_result("Invalid timeline file");
+			}
+
+			m_header = reinterpret_cast<const timeline_file_header*>(m_data);
+
+			const timeline_file_header& header = *m_header;
+			const bool is_header_valid = header.magic == k_timeline_file_magic && header.version == k_timeline_file_version
+				&& header.num_levels != 0 && header.num_levels <= k_max_timeline_levels && header.num_series != 0
+				&& header.num_buckets <= m_size / sizeof(timeline_bucket) && header.strings_size != 0 && header.strings_size <= m_size;
+
+			const uint64_t tables_size = header.num_levels * sizeof(uint64_t) + uint64_t(header.num_series) * sizeof(timeline_file_series)
+				+ uint64_t(header.num_series) * header.num_levels * sizeof(timeline_file_range);
+
+			if (!is_header_valid || sizeof(header) + tables_size + header.num_buckets * sizeof(timeline_bucket) + header.strings_size != m_size || m_data[m_size - 1] != '\0')
+			{
+				close();
+				return error_result("Invalid timeline file");
+			}
+
+			m_resolutions = reinterpret_cast<const uint64_t*>(m_data + sizeof(header));
+			m_series = reinterpret_cast<const timeline_file_series*>(m_resolutions + header.num_levels);
+			m_ranges = reinterpret_cast<const timeline_file_range*>(m_series + header.num_series);
+			m_buckets = reinterpret_cast<const timeline_bucket*>(m_ranges + uint64_t(header.num_series) * header.num_levels);
+			m_strings = reinterpret_cast<const char*>(m_buckets + header.num_buckets);
+
+			// Queries divide by the resolutions
+			for (uint32_t level_index = 0; level_index < header.num_levels; ++level_index)
+			{
+				if (m_resolutions[level_index] == 0)
+				{
+					close();
+					return error_result("Invalid timeline file");
+				}
+			}
+
+			for (uint64_t range_index = 0; range_index < uint64_t(header.num_series) * header.num_levels; ++range_index)
+			{
+				const timeline_file_range& range = m_ranges[range_index];
+				if (range.first_bucket > header.num_buckets || range.num_buckets > header.num_buckets - range.first_bucket)
+				{
+					close();
+					return error_result("Invalid timeline file");
+				}
+			}
+
+			return error_result();
+		}
+
+		std::vector<uint8_t>			m_storage;		// Holds the rollups when they are kept in memory, empty when mapped
+		const uint8_t*					m_data = nullptr;
+		uint64_t						m_size = 0;
+
+		const timeline_file_header*		m_header = nullptr;
+		const uint64_t*					m_resolutions = nullptr;
+		const timeline_file_series*		m_series = nullptr;
+		const timeline_file_range*		m_ranges = nullptr;
+		const timeline_bucket*			m_buckets = nullptr;
+		const char*						m_strings = nullptr;
+	};
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include <sys/mman.h>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// VMA flags set by madvise and userfaultfd registration. Changing them splits VMAs in the kernel.
+	////////////////////////////////////////////////////////////////////////////////
+	enum vma_advice_flags : uint32_t
+	{
+		vma_advice_hugepage			= 1 << 0,
+		vma_advice_no_hugepage		= 1 << 1,
+		vma_advice_dont_fork		= 1 << 2,
+		vma_advice_wipe_on_fork		= 1 << 3,
+		vma_advice_dont_dump		= 1 << 4,
+		vma_advice_mergeable		= 1 << 5,
+		vma_advice_uffd_missing		= 1 << 6,	// Missing pages are populated by a userfaultfd
+		vma_advice_uffd_wp			= 1 << 7,
+		vma_advice_uffd_minor		= 1 << 8,
+	};
+
+	constexpr uint32_t k_vma_advice_uffd_mask = vma_advice_uffd_missing | vma_advice_uffd_wp | vma_advice_uffd_minor;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Converts UFFDIO_REGISTER_MODE_* bits to vma_advice_flags.
+	////////////////////////////////////////////////////////////////////////////////
+	inline uint32_t get_uffd_advice_flags(uint64_t register_mode)
+	{
+		// The modes are part of the kernel ABI, we avoid including its header
+		uint32_t advice_flags = 0;
+		if ((register_mode & 1) != 0)
+			advice_flags |= vma_advice_uffd_missing;
+		if ((register_mode & 2) != 0)
+			advice_flags |= vma_advice_uffd_wp;
+		if ((register_mode & 4) != 0)
+			advice_flags |= vma_advice_uffd_minor;
+		return advice_flags;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Applies a MADV_* advice to a set of vma_advice_flags.
+	// Returns false if the advice does not change the VMA flags (e.g. MADV_DONTNEED).
+	////////////////////////////////////////////////////////////////////////////////
+	inline bool apply_madvise_advice(uint32_t advice, uint32_t& inout_advice_flags)
+	{
+		switch (advice)
+		{
+		case MADV_HUGEPAGE:		inout_advice_flags = (inout_advice_flags & ~uint32_t(vma_advice_no_hugepage)) | vma_advice_hugepage; return true;
+		case MADV_NOHUGEPAGE:	inout_advice_flags = (inout_advice_flags & ~uint32_t(vma_advice_hugepage)) | vma_advice_no_hugepage; return true;
+		case MADV_DONTFORK:		inout_advice_flags |= vma_advice_dont_fork; return true;
+		case MADV_DOFORK:		inout_advice_flags &= ~uint32_t(vma_advice_dont_fork); return true;
+		case MADV_WIPEONFORK:	inout_advice_flags |= vma_advice_wipe_on_fork; return true;
+		case MADV_KEEPONFORK:	inout_advice_flags &= ~uint32_t(vma_advice_wipe_on_fork); return true;
+		case MADV_DONTDUMP:		inout_advice_flags |= vma_advice_dont_dump; return true;
+		case MADV_DODUMP:		inout_advice_flags &= ~uint32_t(vma_advice_dont_dump); return true;
+		case MADV_MERGEABLE:	inout_advice_flags |= vma_advice_mergeable; return true;
+		case MADV_UNMERGEABLE:	inout_advice_flags &= ~uint32_t(vma_advice_mergeable); return true;
+		default:				return false;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// A range of the reconstructed address space with uniform attributes.
+	//
+	// Regions are finer grained than kernel VMAs: two adjacent regions that the
+	// kernel would merge into a single VMA are kept apart when they come from
+	// different mappings so that each range keeps the callstack that created it.
+	////////////////////////////////////////////////////////////////////////////////
+	struct vma_region
+	{
+		uint64_t	start;
+		uint64_t	end;
+		uint64_t	offset;			// File offset of 'start'
+		uint64_t	mapping_id;		// Unique per mmap or brk call, follows the range when mremap moves it
+		uint64_t	mapping_size;	// Bytes mapped by that call, sampled traces weigh regions with it
+		uint64_t	timestamp;		// When the mapping was created
+		int32_t		fd;				// -1 for anonymous mappings
+		uint32_t	stack_id;		// Callstack that created the mapping
+		uint32_t	thread_id;		// Thread that created the mapping
+		uint32_t	protection;		// PROT_* bits
+		uint32_t	map_flags;		// MAP_* flags
+		uint32_t	advice_flags;	// vma_advice_flags
+
+		uint64_t get_size() const { return end - start; }
+		bool is_anonymous() const { return fd < 0 || (map_flags & MAP_ANONYMOUS) != 0; }
+		bool is_shared() const { return (map_flags & MAP_SHARED) != 0; }
+	};
+
+	// The MAP_* flags that end up as VMA flags, mappings that differ in other flags can merge
+	constexpr uint32_t k_vma_map_flags_mask = MAP_SHARED | MAP_PRIVATE | MAP_GROWSDOWN | MAP_LOCKED | MAP_NORESERVE | MAP_HUGETLB;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns true if two adjacent regions belong to the same mapping and share every attribute.
+	////////////////////////////////////////////////////////////////////////////////
+	inline bool are_regions_coalescable(const vma_region& lhs, const vma_region& rhs)
+	{
+		return lhs.end == rhs.start
+			&& lhs.mapping_id == rhs.mapping_id
+			&& lhs.offset + lhs.get_size() == rhs.offset
+			&& lhs.timestamp == rhs.timestamp
+			&& lhs.fd == rhs.fd
+			&& lhs.stack_id == rhs.stack_id
+			&& lhs.thread_id == rhs.thread_id
+			&& lhs.protection == rhs.protection
+			&& lhs.map_flags == rhs.map_flags
+			&& lhs.advice_flags == rhs.advice_flags;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns true if the kernel keeps two adjacent regions in a single VMA.
+	//
+	// This mirrors vma_merge(): identical protection and VMA flags, and either both
+	// private anonymous or the same file at contiguous offsets. Shared anonymous
+	// memory is backed by a distinct shmem file per mapping. We only know files by
+	// their descriptor at mapping time, and private anonymous memory is assumed to
+	// be untouched when it moves (the kernel then relocates its page offset), both
+	// are close approximations.
+	////////////////////////////////////////////////////////////////////////////////
+	inline bool are_regions_kernel_mergeable(const vma_region& lhs, const vma_region& rhs)
+	{
+		if (lhs.end != rhs.start || lhs.protection != rhs.protection || lhs.advice_flags != rhs.advice_flags)
+			return false;
+
+		if ((lhs.map_flags & k_vma_map_flags_mask) != (rhs.map_flags & k_vma_map_flags_mask))
+			return false;
+
+		if (lhs.is_anonymous() != rhs.is_anonymous())
+			return false;
+
+		if (lhs.is_anonymous())
+			return !lhs.is_shared() || lhs.mapping_id == rhs.mapping_id;
+
+		return lhs.fd == rhs.fd && lhs.offset + lhs.get_size() == rhs.offset;
+	}
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// The allocators we know how to query or hook.
+	////////////////////////////////////////////////////////////////////////////////
+	enum class allocator_kind : uint8_t
+	{
+		glibc,
+		jemalloc,
+		tcmalloc,
+
+		count,
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// What an allocator did with one of its extents, the arg1 of allocator_extent
+	// events. An extent is a range of pages an arena obtains as a whole.
+	////////////////////////////////////////////////////////////////////////////////
+	enum class allocator_extent_op : uint8_t
+	{
+		alloc,			// The arena obtained the extent, it is committed unless a commit follows
+		dalloc,			// The arena returned the extent, it was unmapped
+		retain,			// The arena returned the extent but it stays mapped, it can be reused later
+		destroy,		// A retained extent was unmapped
+		commit,			// Pages of the extent were committed
+		decommit,		// Pages of the extent were decommitted, they no longer count against the commit charge
+		purge,			// Pages of the extent were given back to the kernel, they stay mapped
+
+		count,
+	};
+
+	// Arena of glibc's chunks that were mapped on their own
+	constexpr uint32_t k_allocator_direct_mmap_arena = UINT32_MAX - 1;
+
+	// Arena of mappings attributed to an allocator by their callstack, the allocator did not tell us its arena
+	constexpr uint32_t k_allocator_unknown_arena = UINT32_MAX;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// The memory an allocator arena holds, as reported by the allocator itself.
+	//
+	// Mapped bytes are the address space the arena obtained from the kernel and
+	// did not give back. They are split between allocated bytes, which include
+	// the allocator overhead, free bytes the arena keeps committed for later
+	// allocations and released bytes whose pages went back to the kernel while
+	// the arena kept their address space. Free and released bytes are what the
+	// allocator retains without using it.
+	////////////////////////////////////////////////////////////////////////////////
+	struct allocator_sample
+	{
+		uint64_t		timestamp;
+		uint64_t		mapped_bytes;
+		uint64_t		allocated_bytes;
+		uint64_t		free_bytes;
+		uint64_t		released_bytes;
+		uint32_t		arena;					// Zero for allocators without arenas
+		allocator_kind	allocator;
+
+		uint64_t get_unused_bytes() const { return free_bytes + released_bytes; }
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns a human readable name for an allocator.
+	////////////////////////////////////////////////////////////////////////////////
+	inline const char* get_allocator_name(allocator_kind allocator)
+	{
+		switch (allocator)
+		{
+		case allocator_kind::glibc:		return "glibc";
+		case allocator_kind::jemalloc:	return "jemalloc";
+		case allocator_kind::tcmalloc:	return "tcmalloc";
+		default:						return "<unknown>";
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns a human readable name for an extent operation.
+	////////////////////////////////////////////////////////////////////////////////
+	inline const char* get_allocator_extent_op_name(allocator_extent_op op)
+	{
+		switch (op)
+		{
+		case allocator_extent_op::alloc:	return "alloc";
+		case allocator_extent_op::dalloc:	return "dalloc";
+		case allocator_extent_op::retain:	return "retain";
+		case allocator_extent_op::destroy:	return "destroy";
+		case allocator_extent_op::commit:	return "commit";
+		case allocator_extent_op::decommit:	return "decommit";
+		case allocator_extent_op::purge:	return "purge";
+		default:							return "<unknown>";
+		}
+	}
+}
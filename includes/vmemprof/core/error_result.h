@@ -0,0 +1,46 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Holds the result of an operation that can fail.
+	// The error message must point to a string with static storage duration.
+	////////////////////////////////////////////////////////////////////////////////
+	class error_result
+	{
+	public:
+		constexpr error_result() : m_error(nullptr) {}
+		explicit constexpr error_result(const char* error) : m_error(error) {}
+
+		constexpr bool any() const { return m_error != nullptr; }
+		void reset() { m_error = nullptr; }
+		const char* c_str() const { return m_error != nullptr ? m_error : "None"; }
+
+	private:
+		const char* m_error;
+	};
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+
+namespace vmemprof
+{
+	// Stack ids are interned by the capture, zero means no callstack
+	constexpr uint32_t k_invalid_stack_id = 0;
+
+	// Set in the flags of mprotect and madvise events that failed with ENOMEM because their
+	// range has holes. The kernel still applied them to part of the range.
+	constexpr uint32_t k_event_flag_partial = 1U << 31;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// The virtual memory operations we capture.
+	////////////////////////////////////////////////////////////////////////////////
+	enum class event_type : uint8_t
+	{
+		mmap,
+		munmap,
+		mremap,
+		mprotect,
+		madvise,
+		brk,
+		sbrk,
+		mbind,
+		set_mempolicy,
+		allocator_extent,
+		uffd_register,
+		uffd_unregister,
+		uffd_populate,
+
+		count,
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// How a userfaultfd populated a range, the ioctl that resolved the faults.
+	////////////////////////////////////////////////////////////////////////////////
+	enum class uffd_populate_op : uint8_t
+	{
+		copy,		// UFFDIO_COPY
+		zeropage,	// UFFDIO_ZEROPAGE
+		cont,		// UFFDIO_CONTINUE, maps pages already in the page cache
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// A single captured virtual memory operation.
+	//
+	// Only calls that changed the address space are recorded. The meaning of the generic fields depends
+	// on the event type:
+	//    mmap:      address/size is the new mapping, arg0 is the fd, arg1 the file offset
+	//    munmap:    address/size is the unmapped range
+	//    mremap:    address/size is the new range, arg0/arg1 is the old address/size
+	//    mprotect:  address/size is the affected range, protection holds the new PROT_* bits
+	//    madvise:   address/size is the affected range, arg0 is the MADV_* advice
+	//    brk, sbrk: address is the new program break, arg0 is the previous break
+	//    mbind:     address/size is the affected range, arg0 is the MPOL_* mode and mode flags,
+	//               arg1 the first 64 nodes of the node mask, flags the MPOL_MF_* flags
+	//    set_mempolicy: the calling thread's policy, arg0 is the mode and arg1 the node mask
+	//    allocator_extent: address/size is an extent of an allocator arena, arg0 is the arena,
+	//               arg1 the allocator_extent_op and flags the allocator_kind
+	//    uffd_register: address/size is the range registered with a userfaultfd, arg0 is the
+	//               UFFDIO_REGISTER_MODE_* bits and arg1 the userfaultfd
+	//    uffd_unregister: address/size is the range unregistered, arg1 is the userfaultfd
+	//    uffd_populate: address/size is the range a userfaultfd populated, arg0 is the
+	//               uffd_populate_op and arg1 the userfaultfd
+	////////////////////////////////////////////////////////////////////////////////
+	struct vm_event
+	{
+		uint64_t	timestamp;		// CLOCK_MONOTONIC nanoseconds
+		uint64_t	address;
+		uint64_t	size;
+		uint64_t	arg0;
+		uint64_t	arg1;
+
+		uint32_t	thread_id;
+		uint32_t	stack_id;		// Interned callstack, k_invalid_stack_id if none was captured
+		uint32_t	flags;			// MAP_* or MREMAP_* flags
+		uint32_t	protection;		// PROT_* bits
+		event_type	type;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns a human readable name for an event type.
+	////////////////////////////////////////////////////////////////////////////////
+	inline const char* get_event_type_name(event_type type)
+	{
+		switch (type)
+		{
+		case event_type::mmap:		return "mmap";
+		case event_type::munmap:	return "munmap";
+		case event_type::mremap:	return "mremap";
+		case event_type::mprotect:	return "mprotect";
+		case event_type::madvise:	return "madvise";
+		case event_type::brk:		return "brk";
+		case event_type::sbrk:		return "sbrk";
+		case event_type::mbind:		return "mbind";
+		case event_type::set_mempolicy:	return "set_mempolicy";
+		case event_type::allocator_extent:	return "extent";
+		case event_type::uffd_register:		return "uffd_register";
+		case event_type::uffd_unregister:	return "uffd_unregister";
+		case event_type::uffd_populate:		return "uffd_populate";
+		default:					return "<unknown>";
+		}
+	}
+
+	inline const char* get_uffd_populate_op_name(uffd_populate_op op)
+	{
+		switch (op)
+		{
+		case uffd_populate_op::copy:		return "copy";
+		case uffd_populate_op::zeropage:	return "zeropage";
+		case uffd_populate_op::cont:		return "continue";
+		default:							return "<unknown>";
+		}
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+
+namespace vmemprof
+{
+	// The CPU of fault samples recorded before CPUs were tracked
+	constexpr uint32_t k_unknown_cpu = ~0U;
+
+	enum class fault_sample_flags : uint32_t
+	{
+		none		= 0,
+		major		= 1 << 0,		// The fault required I/O, otherwise it is a minor fault
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// A sampled page fault.
+	//
+	// The address is the data address that faulted and the instruction pointer the
+	// code that touched it, the stack is the faulting callstack (leaf first).
+	////////////////////////////////////////////////////////////////////////////////
+	struct fault_sample
+	{
+		uint64_t	timestamp;
+		uint64_t	address;
+		uint64_t	instruction_pointer;
+		uint32_t	thread_id;
+		uint32_t	stack_id;
+		uint32_t	flags;				// fault_sample_flags values
+		uint32_t	cpu;				// CPU the thread ran on, k_unknown_cpu if not recorded
+	};
+
+	inline bool is_major_fault(const fault_sample& sample) { return (sample.flags & uint32_t(fault_sample_flags::major)) != 0; }
+}
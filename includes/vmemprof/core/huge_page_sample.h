@@ -0,0 +1,60 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+
+namespace vmemprof
+{
+	enum huge_page_sample_flags : uint32_t
+	{
+		huge_page_sample_removed			= 1 << 0,		// The VMA is gone, its range was unmapped or split
+		huge_page_sample_thp_eligible		= 1 << 1,		// THPeligible, the kernel may back the VMA with transparent huge pages
+		huge_page_sample_hugepage			= 1 << 2,		// MADV_HUGEPAGE is set
+		huge_page_sample_no_hugepage		= 1 << 3,		// MADV_NOHUGEPAGE is set
+		huge_page_sample_hugetlb			= 1 << 4,		// hugetlbfs or MAP_HUGETLB mapping
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// The huge page backing of a kernel VMA as reported by /proc/self/smaps.
+	//
+	// A sample describes a whole VMA and replaces every older sample it overlaps.
+	// VMAs are sampled again when their range, flags or backing change and a
+	// removed sample is written when they disappear, it only drops the sample of
+	// that exact range. Sizes are in bytes.
+	////////////////////////////////////////////////////////////////////////////////
+	struct huge_page_sample
+	{
+		uint64_t	timestamp;
+		uint64_t	start;
+		uint64_t	end;
+		uint64_t	resident_bytes;			// Rss
+		uint64_t	anon_huge_bytes;		// AnonHugePages, transparent huge pages
+		uint64_t	hugetlb_bytes;			// Private_Hugetlb + Shared_Hugetlb
+		uint32_t	flags;					// huge_page_sample_flags
+
+		uint64_t get_size() const { return end - start; }
+	};
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+
+namespace vmemprof
+{
+	// GNU build ids are 20 bytes (SHA-1) but other lengths are allowed
+	constexpr uint32_t k_max_build_id_size = 32;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// A module (executable or shared object) loaded in the profiled process.
+	//
+	// Captured stacks hold raw return addresses, the module map lets them be
+	// symbolized offline: an address maps to the ELF virtual address
+	// 'address - load_address' of the module whose range contains it.
+	////////////////////////////////////////////////////////////////////////////////
+	struct module_info
+	{
+		uint64_t		timestamp;				// When the module was first seen loaded
+		uint64_t		load_address;			// Offset added to the ELF virtual addresses
+		uint64_t		start;					// Range spanned by the loaded segments
+		uint64_t		end;
+
+		const char*		path;					// Not null terminated, empty for anonymous modules (e.g. the vDSO)
+		uint32_t		path_length;
+
+		uint32_t		build_id_size;			// Zero when the module has no build id
+		uint8_t			build_id[k_max_build_id_size];
+
+		bool contains(uint64_t address) const { return address >= start && address < end; }
+	};
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// The NUMA node a sampled page was on.
+	//
+	// Pages of the tracked regions are sampled at a fixed stride and looked up
+	// with move_pages. Only present pages are recorded, a page that is not sampled
+	// again keeps its last node until its region is unmapped.
+	////////////////////////////////////////////////////////////////////////////////
+	struct numa_page_sample
+	{
+		uint64_t	timestamp;
+		uint64_t	address;
+		uint32_t	node;
+	};
+
+	// The topology of the machine, written once per trace in a numa_topology chunk
+	constexpr uint32_t k_numa_topology_fake = 1 << 0;		// Made up by VMEMPROF_NUMA_FAKE_NODES
+
+	struct numa_topology_header
+	{
+		uint32_t	num_nodes;
+		uint32_t	num_cpus;
+		uint32_t	flags;			// k_numa_topology_* values
+		uint32_t	padding;
+		// Followed by num_cpus uint16_t node ids, indexed by CPU
+	};
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/compiler_utils.h"
+
+#include <atomic>
+#include <cstdint>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// A bounded single producer, single consumer ring buffer over caller provided storage.
+	//
+	// The producer and consumer indices live on separate cache lines and the producer
+	// caches the last consumer index it observed: a push only touches the consumer's
+	// cache line when the buffer appears full.
+	// The capacity must be a power of two.
+	////////////////////////////////////////////////////////////////////////////////
+	template<typename element_type>
+	class spsc_ring_buffer
+	{
+	public:
+		spsc_ring_buffer() = default;
+		spsc_ring_buffer(const spsc_ring_buffer&) = delete;
+		spsc_ring_buffer& operator=(const spsc_ring_buffer&) = delete;
+
+		void initialize(element_type* storage, uint32_t capacity)
+		{
+			m_storage = storage;
+			m_capacity = capacity;
+			m_mask = capacity - 1;
+			reset();
+		}
+
+		// Discards the content, must not be called while a producer or consumer is active
+		void reset()
+		{
+			m_head.store(0, std::memory_order_relaxed);
+			m_cached_tail = 0;
+			m_tail.store(0, std::memory_order_relaxed);
+		}
+
+		uint32_t get_capacity() const { return m_capacity; }
+
+		//////////////////////////////////////////////////////////////////////////
+		// Producer side
+
+		// Returns false if the buffer is full
+		VMEMPROF_FORCE_INLINE bool try_push(const element_type& value)
+		{
+			const uint64_t head = m_head.load(std::memory_order_relaxed);
+			if (VMEMPROF_UNLIKELY(head - m_cached_tail >= m_capacity))
+			{
+				m_cached_tail = m_tail.load(std::memory_order_acquire);
+				if (head - m_cached_tail >= m_capacity)
+					return false;
+			}
+
+			m_storage[head & m_mask] = value;
+			m_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		//////////////////////////////////////////////////////////////////////////
+		// Consumer side
+
+		// Pops up to 'max_values' values and returns how many were written
+		uint32_t pop(element_type* out_values, uint32_t max_values)
+		{
+			const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+			const uint64_t head = m_head.load(std::memory_order_acquire);
+
+			const uint64_t num_available = head - tail;
+			const uint32_t num_values = num_available < max_values ? uint32_t(num_available) : max_values;
+
+			for (uint32_t value_index = 0; value_index < num_values; ++value_index)
+				out_values[value_index] = m_storage[(tail + value_index) & m_mask];
+
+			m_tail.store(tail + num_values, std::memory_order_release);
+			return num_values;
+		}
+
+		bool is_empty() const
+		{
+			return m_tail.load(std::memory_order_relaxed) == m_head.load(std::memory_order_acquire);
+		}
+
+	private:
+		// Producer owned
+		alignas(VMEMPROF_CACHE_LINE_SIZE) std::atomic<uint64_t> m_head{ 0 };
+		uint64_t m_cached_tail = 0;
+
+		// Consumer owned
+		alignas(VMEMPROF_CACHE_LINE_SIZE) std::atomic<uint64_t> m_tail{ 0 };
+
+		// Read-only after initialization
+		alignas(VMEMPROF_CACHE_LINE_SIZE) element_type* m_storage = nullptr;
+		uint32_t m_capacity = 0;
+		uint32_t m_mask = 0;
+	};
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// A small pool of threads that run the tasks of one job at a time.
+	//
+	// run() hands out task indices to the workers and to the calling thread, which
+	// takes part, and returns once every task completed. A pool without workers
+	// runs every task on the calling thread. Jobs are meant for a handful of large
+	// tasks, e.g. one chunk each, tasks are not load balanced beyond taking the
+	// next index.
+	////////////////////////////////////////////////////////////////////////////////
+	class worker_pool
+	{
+	public:
+		worker_pool() = default;
+		~worker_pool() { stop(); }
+
+		worker_pool(const worker_pool&) = delete;
+		worker_pool& operator=(const worker_pool&) = delete;
+
+		// The initializer runs first on every worker, e.g. to flag it as internal
+		void start(uint32_t num_workers, void (*thread_initializer)() = nullptr)
+		{
+			stop();
+
+			// Workers start waiting for the first generation
+			m_is_stop_requested = false;
+			m_job_generation = 0;
+			m_thread_initializer = thread_initializer;
+			for (uint32_t worker_index = 0; worker_index < num_workers; ++worker_index)
+				m_workers.emplace_back([this]() { worker_main(); });
+		}
+
+		void stop()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_is_stop_requested = true;
+			}
+
+			m_job_condition.notify_all();
+			for (std::thread& worker : m_workers)
+				worker.join();
+
+			m_workers.clear();
+		}
+
+		uint32_t get_num_workers() const { return uint32_t(m_workers.size()); }
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Calls 'void(uint32_t task_index)' for every index below num_tasks and waits
+		// for them to complete. Only one job runs at a time.
+		////////////////////////////////////////////////////////////////////////////////
+		template<typename function_type>
+		void run(uint32_t num_tasks, function_type function)
+		{
+			if (m_workers.empty() || num_tasks <= 1)
+			{
+				for (uint32_t task_index = 0; task_index < num_tasks; ++task_index)
+					function(task_index);
+
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_job_function = [](void* context, uint32_t task_index) { (*static_cast<function_type*>(context))(task_index); };
+				m_job_context = &function;
+				m_num_tasks = num_tasks;
+				m_next_task_index.store(0, std::memory_order_relaxed);
+				m_num_busy_workers = uint32_t(m_workers.size());
+				m_job_generation++;
+			}
+
+			m_job_condition.notify_all();
+			run_tasks(m_job_function, m_job_context, num_tasks);
+
+			// The function lives on our stack, wait until no worker can still call it
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_done_condition.wait(lock, [this]() { return m_num_busy_workers == 0; });
+			m_job_function = nullptr;
+			m_job_context = nullptr;
+		}
+
+	private:
+		using job_function = void (*)(void* context, uint32_t task_index);
+
+		void run_tasks(job_function function, void* context, uint32_t num_tasks)
+		{
+			while (true)
+			{
+				const uint32_t task_index = m_next_task_index.fetch_add(1, std::memory_order_relaxed);
+				if (task_index >= num_tasks)
+					return;
+
+				function(context, task_index);
+			}
+		}
+
+		void worker_main()
+		{
+			if (m_thread_initializer != nullptr)
+				m_thread_initializer();
+
+			uint64_t last_job_generation = 0;
+			while (true)
+			{
+				job_function function;
+				void* context;
+				uint32_t num_tasks;
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_job_condition.wait(lock, [this, last_job_generation]() { return m_is_stop_requested || m_job_generation != last_job_generation; });
+					if (m_is_stop_requested)
+						return;
+
+					last_job_generation = m_job_generation;
+					function = m_job_function;
+					context = m_job_context;
+					num_tasks = m_num_tasks;
+				}
+
+				run_tasks(function, context, num_tasks);
+
+				bool is_last = false;
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					is_last = --m_num_busy_workers == 0;
+				}
+
+				if (is_last)
+					m_done_condition.notify_one();
+			}
+		}
+
+		std::vector<std::thread>	m_workers;
+		void						(*m_thread_initializer)() = nullptr;
+
+		std::mutex					m_mutex;
+		std::condition_variable		m_job_condition;
+		std::condition_variable		m_done_condition;
+
+		// The current job, guarded by the mutex
+		job_function				m_job_function = nullptr;
+		void*						m_job_context = nullptr;
+		uint32_t					m_num_tasks = 0;
+		uint32_t					m_num_busy_workers = 0;
+		uint64_t					m_job_generation = 0;
+		bool						m_is_stop_requested = false;
+
+		std::atomic<uint32_t>		m_next_task_index{ 0 };
+	};
+}
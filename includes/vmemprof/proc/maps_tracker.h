@@ -0,0 +1,163 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/proc/smaps_poller.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <sys/mman.h>
+#include <vector>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Reconstructs virtual memory events from successive polls of a maps file,
+	// for processes whose calls we cannot observe.
+	//
+	// Polling only sees the VMAs as they are when we look: mappings created and
+	// released between two polls are missed, the kernel merges adjacent mappings
+	// into a single VMA and events carry no thread or callstack. The first poll
+	// reports every existing VMA as mapped.
+	//
+	// A VMA that disappeared or shrank is reported as an munmap, a new or resized
+	// one as an mmap over its whole range and a VMA whose protection alone changed
+	// as an mprotect. Every munmap of a poll is reported before its mmaps, a VMA
+	// that grew by absorbing its neighbor is not unmapped again by the neighbor.
+	////////////////////////////////////////////////////////////////////////////////
+	class maps_tracker
+	{
+	public:
+		error_result open(const char* path)
+		{
+			m_previous_entries.clear();
+			return m_poller.open(path);
+		}
+
+		void close()
+		{
+			m_poller.close();
+			m_previous_entries.clear();
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Reads the maps file and calls 'void(const vm_event& event)' for every event
+		// that brings the previous poll up to date, in the order they must be applied.
+		// Every event carries the timestamp of the poll.
+		////////////////////////////////////////////////////////////////////////////////
+		template<typename callback_type>
+		error_result poll(uint64_t timestamp, callback_type callback)
+		{
+			m_unmaps.clear();
+			m_updates.clear();
+
+			const error_result result = m_poller.poll([this, timestamp](const smaps_entry& entry, smaps_change change)
+				{
+					if (change == smaps_change::removed)
+						m_unmaps.push_back(make_event(event_type::munmap, timestamp, entry.start, entry.end));
+					else if (change == smaps_change::added)
+						m_updates.push_back(make_mmap_event(timestamp, entry));
+					else
+						add_changed_entry(timestamp, entry);
+				});
+
+			if (result.any())
+				return result;
+
+			for (const vm_event& event : m_unmaps)
+				callback(event);
+
+			for (const vm_event& event : m_updates)
+				callback(event);
+
+			m_previous_entries = m_poller.get_entries();
+			return error_result();
+		}
+
+		// VMAs of the last poll in address order, paths point into the poller's buffer
+		const std::vector<smaps_entry>& get_entries() const { return m_poller.get_entries(); }
+
+	private:
+		static vm_event make_event(event_type type, uint64_t timestamp, uint64_t start, uint64_t end)
+		{
+			vm_event event = {};
+			event.timestamp = timestamp;
+			event.address = start;
+			event.size = end - start;
+			event.stack_id = k_invalid_stack_id;
+			event.type = type;
+			return event;
+		}
+
+		static vm_event make_mmap_event(uint64_t timestamp, const smaps_entry& entry)
+		{
+			// The descriptor the range was mapped from is unknown, anonymous VMAs have no inode
+			vm_event event = make_event(event_type::mmap, timestamp, entry.start, entry.end);
+			event.arg0 = uint64_t(int64_t(-1));
+			event.arg1 = entry.inode != 0 ? entry.offset : 0;
+			event.flags = uint32_t((entry.is_shared ? MAP_SHARED : MAP_PRIVATE) | (entry.inode == 0 ? MAP_ANONYMOUS : 0));
+			event.protection = entry.protection;
+			return event;
+		}
+
+		void add_changed_entry(uint64_t timestamp, const smaps_entry& entry)
+		{
+			// Changed VMAs start where they used to
+			const auto previous_it = std::lower_bound(m_previous_entries.begin(), m_previous_entries.end(), entry.start, [](const smaps_entry& previous, uint64_t start) { return previous.start < start; });
+			if (previous_it == m_previous_entries.end() || previous_it->start != entry.start)
+			{
+				m_updates.push_back(make_mmap_event(timestamp, entry));
+				return;
+			}
+
+			const smaps_entry& previous = *previous_it;
+			if (previous.end == entry.end && previous.offset == entry.offset && previous.inode == entry.inode && previous.is_shared == entry.is_shared)
+			{
+				if (previous.protection != entry.protection)
+				{
+					vm_event event = make_event(event_type::mprotect, timestamp, entry.start, entry.end);
+					event.protection = entry.protection;
+					m_updates.push_back(event);
+				}
+
+				return;
+			}
+
+			if (previous.end > entry.end)
+				m_unmaps.push_back(make_event(event_type::munmap, timestamp, entry.end, previous.end));
+
+			m_updates.push_back(make_mmap_event(timestamp, entry));
+		}
+
+		smaps_poller				m_poller;
+		std::vector<smaps_entry>	m_previous_entries;
+
+		// Events of the poll in progress
+		std::vector<vm_event>		m_unmaps;
+		std::vector<vm_event>		m_updates;
+	};
+}
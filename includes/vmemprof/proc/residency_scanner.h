@@ -0,0 +1,190 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/residency_sample.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Samples how much of the regions of an address space is committed and
+	// resident by reading the pagemap of a process.
+	//
+	// Each tick scans at most a budget of pages, resuming where the previous tick
+	// stopped and wrapping around at the end. Regions larger than the budget are
+	// scanned over several ticks. The calling process can be scanned with mincore
+	// when its pagemap cannot be read, swapped out pages are then not counted.
+	////////////////////////////////////////////////////////////////////////////////
+	class residency_scanner
+	{
+	public:
+		residency_scanner() = default;
+		~residency_scanner() { close(); }
+
+		residency_scanner(const residency_scanner&) = delete;
+		residency_scanner& operator=(const residency_scanner&) = delete;
+
+		// A zero pid scans the calling process
+		error_result open(uint32_t pid, uint32_t page_budget)
+		{
+			close();
+
+			char path[64];
+			if (pid == 0)
+				snprintf(path, sizeof(path), "/proc/self/pagemap");
+			else
+				snprintf(path, sizeof(path), "/proc/%u/pagemap", pid);
+
+			m_pagemap_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+			if (m_pagemap_fd < 0 && pid != 0)
+				return error_result("Failed to open pagemap");
+
+			m_page_budget = page_budget;
+			m_page_size = uint64_t(sysconf(_SC_PAGESIZE));
+			m_cursor = 0;
+			return error_result();
+		}
+
+		void close()
+		{
+			if (m_pagemap_fd >= 0)
+				::close(m_pagemap_fd);
+
+			m_pagemap_fd = -1;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Scans the regions of the address space from where the previous tick
+		// stopped. The scan stops once the page budget is spent or the output is
+		// full. Returns the number of samples written.
+		////////////////////////////////////////////////////////////////////////////////
+		uint32_t sample(const address_space& space, uint64_t timestamp, residency_sample* out_samples, uint32_t max_samples)
+		{
+			uint64_t num_remaining_pages = m_page_budget;
+			uint32_t num_samples = 0;
+
+			const auto scan_range = [&](uint64_t range_start, uint64_t range_end)
+			{
+				space.for_each_region(range_start, range_end, [&](const vma_region& region)
+					{
+						const uint64_t start = std::max(region.start, range_start);
+						const uint64_t num_pages = std::min((std::min(region.end, range_end) - start) / m_page_size, num_remaining_pages);
+						const uint64_t end = start + num_pages * m_page_size;
+
+						residency_sample& sample = out_samples[num_samples];
+						if (num_pages != 0 && count_pages(start, end, sample.num_committed_pages, sample.num_resident_pages))
+						{
+							sample.timestamp = timestamp;
+							sample.address = start;
+							sample.size = end - start;
+							num_samples++;
+						}
+
+						num_remaining_pages -= num_pages;
+						m_cursor = end;
+						return num_remaining_pages != 0 && num_samples < max_samples;
+					});
+
+				return num_remaining_pages != 0 && num_samples < max_samples;
+			};
+
+			// Resume where the previous tick stopped and wrap around once at the end
+			const uint64_t tick_start = m_cursor;
+			if (num_remaining_pages != 0 && max_samples != 0 && scan_range(tick_start, UINT64_MAX))
+			{
+				m_cursor = 0;
+				scan_range(0, tick_start);
+			}
+
+			return num_samples;
+		}
+
+	private:
+		// Pages looked up per pagemap read or mincore call
+		static constexpr uint32_t k_batch_num_pages = 4096;
+
+		// Bits of a pagemap entry, see Documentation/admin-guide/mm/pagemap.rst
+		static constexpr uint64_t k_pagemap_present_bit = uint64_t(1) << 63;
+		static constexpr uint64_t k_pagemap_swapped_bit = uint64_t(1) << 62;
+
+		// Counts the pages of [start, end), returns false if the range could not be scanned
+		bool count_pages(uint64_t start, uint64_t end, uint32_t& out_num_committed, uint32_t& out_num_resident) const
+		{
+			uint32_t num_committed = 0;
+			uint32_t num_resident = 0;
+
+			for (uint64_t batch_start = start; batch_start < end; batch_start += k_batch_num_pages * m_page_size)
+			{
+				const uint64_t batch_num_pages = std::min<uint64_t>((end - batch_start) / m_page_size, k_batch_num_pages);
+
+				if (m_pagemap_fd >= 0)
+				{
+					uint64_t entries[k_batch_num_pages];
+					const size_t batch_size = batch_num_pages * sizeof(uint64_t);
+					if (pread(m_pagemap_fd, entries, batch_size, off_t(batch_start / m_page_size * sizeof(uint64_t))) != ssize_t(batch_size))
+						return false;
+
+					for (uint64_t page_index = 0; page_index < batch_num_pages; ++page_index)
+					{
+						num_committed += (entries[page_index] & (k_pagemap_present_bit | k_pagemap_swapped_bit)) != 0 ? 1 : 0;
+						num_resident += (entries[page_index] & k_pagemap_present_bit) != 0 ? 1 : 0;
+					}
+				}
+				else
+				{
+					// mincore does not report swapped out pages, committed is a lower bound
+					unsigned char residency[k_batch_num_pages];
+					if (mincore(reinterpret_cast<void*>(batch_start), batch_num_pages * m_page_size, residency) != 0)
+						return false;
+
+					for (uint64_t page_index = 0; page_index < batch_num_pages; ++page_index)
+						num_resident += residency[page_index] & 1;
+
+					num_committed = num_resident;
+				}
+			}
+
+			out_num_committed = num_committed;
+			out_num_resident = num_resident;
+			return true;
+		}
+
+		int			m_pagemap_fd = -1;
+		uint32_t	m_page_budget = 0;
+		uint64_t	m_page_size = 0;
+
+		// Where the next tick resumes
+		uint64_t	m_cursor = 0;
+	};
+}
@@ -0,0 +1,364 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/compiler_utils.h"
+#include "vmemprof/core/error_result.h"
+
+#include <cstdint>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// /proc/<pid>/smaps and smaps_rollup parsing
+//
+// Every VMA starts with a header line formatted like /proc/<pid>/maps followed
+// by one 'Key: value kB' line per field and a final 'VmFlags:' line. The rollup
+// has a single pseudo VMA that spans the whole address space and sums every
+// field, it also has the Pss_Anon/Pss_File/Pss_Shmem breakdown.
+//
+// The parser works on a buffer that holds the whole file. It never allocates
+// and never copies: the path of an entry points into the buffer. Header lines
+// start with a lowercase hex digit and field names with an uppercase letter,
+// a single character tells them apart.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	// The VmFlags we keep, see show_smap_vma_flags() in the kernel for the full list
+	enum class smaps_vm_flags : uint32_t
+	{
+		none				= 0,
+		locked				= 1 << 0,		// lo
+		dont_copy			= 1 << 1,		// dc, MADV_DONTFORK
+		wipe_on_fork		= 1 << 2,		// wf
+		dont_dump			= 1 << 3,		// dd
+		mergeable			= 1 << 4,		// mg, MADV_MERGEABLE
+		hugepage			= 1 << 5,		// hg, MADV_HUGEPAGE
+		no_hugepage			= 1 << 6,		// nh, MADV_NOHUGEPAGE
+		hugetlb				= 1 << 7,		// ht
+		account				= 1 << 8,		// ac, counted against the commit limit
+		no_reserve			= 1 << 9,		// nr, MAP_NORESERVE
+		uffd_missing		= 1 << 10,		// um
+		uffd_wp				= 1 << 11,		// uw
+	};
+
+	struct smaps_entry
+	{
+		uint64_t		start;
+		uint64_t		end;
+		uint64_t		offset;
+		uint64_t		inode;
+		uint64_t		device;					// As built by makedev()
+
+		const char*		path;					// Points into the parsed buffer, not null terminated
+		uint32_t		path_length;
+
+		uint32_t		protection;				// PROT_* values
+		bool			is_shared;
+		bool			is_thp_eligible;
+		uint32_t		vm_flags;				// smaps_vm_flags values
+
+		// Sizes in KB as reported by the kernel, zero when a field is missing
+		uint64_t		size;
+		uint64_t		kernel_page_size;
+		uint64_t		mmu_page_size;
+		uint64_t		rss;
+		uint64_t		pss;
+		uint64_t		pss_dirty;
+		uint64_t		pss_anon;				// smaps_rollup only
+		uint64_t		pss_file;				// smaps_rollup only
+		uint64_t		pss_shmem;				// smaps_rollup only
+		uint64_t		shared_clean;
+		uint64_t		shared_dirty;
+		uint64_t		private_clean;
+		uint64_t		private_dirty;
+		uint64_t		referenced;
+		uint64_t		anonymous;
+		uint64_t		lazy_free;
+		uint64_t		anon_huge_pages;
+		uint64_t		shmem_pmd_mapped;
+		uint64_t		file_pmd_mapped;
+		uint64_t		shared_hugetlb;
+		uint64_t		private_hugetlb;
+		uint64_t		swap;
+		uint64_t		swap_pss;
+		uint64_t		locked;
+	};
+
+	namespace smaps_parser_impl
+	{
+		struct field_description
+		{
+			const char*	name;
+			uint32_t	name_length;
+			uint64_t	smaps_entry::*member;
+		};
+
+		#define VMEMPROF_SMAPS_FIELD(name, member) { name, sizeof(name) - 1, &smaps_entry::member }
+
+		// Sorted by first character so a lookup only compares a handful of names
+		constexpr field_description k_fields[] =
+		{
+			VMEMPROF_SMAPS_FIELD("AnonHugePages", anon_huge_pages),
+			VMEMPROF_SMAPS_FIELD("Anonymous", anonymous),
+			VMEMPROF_SMAPS_FIELD("FilePmdMapped", file_pmd_mapped),
+			VMEMPROF_SMAPS_FIELD("KernelPageSize", kernel_page_size),
+			VMEMPROF_SMAPS_FIELD("LazyFree", lazy_free),
+			VMEMPROF_SMAPS_FIELD("Locked", locked),
+			VMEMPROF_SMAPS_FIELD("MMUPageSize", mmu_page_size),
+			VMEMPROF_SMAPS_FIELD("Private_Clean", private_clean),
+			VMEMPROF_SMAPS_FIELD("Private_Dirty", private_dirty),
+			VMEMPROF_SMAPS_FIELD("Private_Hugetlb", private_hugetlb),
+			VMEMPROF_SMAPS_FIELD("Pss", pss),
+			VMEMPROF_SMAPS_FIELD("Pss_Anon", pss_anon),
+			VMEMPROF_SMAPS_FIELD("Pss_Dirty", pss_dirty),
+			VMEMPROF_SMAPS_FIELD("Pss_File", pss_file),
+			VMEMPROF_SMAPS_FIELD("Pss_Shmem", pss_shmem),
+			VMEMPROF_SMAPS_FIELD("Referenced", referenced),
+			VMEMPROF_SMAPS_FIELD("Rss", rss),
+			VMEMPROF_SMAPS_FIELD("Shared_Clean", shared_clean),
+			VMEMPROF_SMAPS_FIELD("Shared_Dirty", shared_dirty),
+			VMEMPROF_SMAPS_FIELD("Shared_Hugetlb", shared_hugetlb),
+			VMEMPROF_SMAPS_FIELD("ShmemPmdMapped", shmem_pmd_mapped),
+			VMEMPROF_SMAPS_FIELD("Size", size),
+			VMEMPROF_SMAPS_FIELD("Swap", swap),
+			VMEMPROF_SMAPS_FIELD("SwapPss", swap_pss),
+		};
+
+		#undef VMEMPROF_SMAPS_FIELD
+
+		constexpr uint32_t k_num_fields = sizeof(k_fields) / sizeof(k_fields[0]);
+
+		struct vm_flag_description
+		{
+			char			name[2];
+			smaps_vm_flags	flag;
+		};
+
+		constexpr vm_flag_description k_vm_flags[] =
+		{
+			{ { 'l', 'o' }, smaps_vm_flags::locked },
+			{ { 'd', 'c' }, smaps_vm_flags::dont_copy },
+			{ { 'w', 'f' }, smaps_vm_flags::wipe_on_fork },
+			{ { 'd', 'd' }, smaps_vm_flags::dont_dump },
+			{ { 'm', 'g' }, smaps_vm_flags::mergeable },
+			{ { 'h', 'g' }, smaps_vm_flags::hugepage },
+			{ { 'n', 'h' }, smaps_vm_flags::no_hugepage },
+			{ { 'h', 't' }, smaps_vm_flags::hugetlb },
+			{ { 'a', 'c' }, smaps_vm_flags::account },
+			{ { 'n', 'r' }, smaps_vm_flags::no_reserve },
+			{ { 'u', 'm' }, smaps_vm_flags::uffd_missing },
+			{ { 'u', 'w' }, smaps_vm_flags::uffd_wp },
+		};
+
+		// Index of the first field per first character, built once
+		struct field_lookup_table
+		{
+			uint8_t		first_field[27];	// 'A' to 'Z', the last entry is the end
+
+			constexpr field_lookup_table() : first_field()
+			{
+				uint32_t field_index = 0;
+				for (uint32_t letter = 0; letter < 26; ++letter)
+				{
+					while (field_index < k_num_fields && uint32_t(k_fields[field_index].name[0] - 'A') < letter)
+						field_index++;
+					first_field[letter] = uint8_t(field_index);
+				}
+				first_field[26] = uint8_t(k_num_fields);
+			}
+		};
+
+		constexpr field_lookup_table k_field_lookup;
+
+		VMEMPROF_FORCE_INLINE bool is_hex_digit(char value)
+		{
+			return (value >= '0' && value <= '9') || (value >= 'a' && value <= 'f');
+		}
+
+		VMEMPROF_FORCE_INLINE const char* parse_hex(const char* input, const char* input_end, uint64_t& out_value)
+		{
+			uint64_t value = 0;
+			for (; input < input_end; ++input)
+			{
+				const char digit = *input;
+				if (digit >= '0' && digit <= '9')
+					value = (value << 4) | uint64_t(digit - '0');
+				else if (digit >= 'a' && digit <= 'f')
+					value = (value << 4) | uint64_t(digit - 'a' + 10);
+				else
+					break;
+			}
+
+			out_value = value;
+			return input;
+		}
+
+		VMEMPROF_FORCE_INLINE const char* parse_decimal(const char* input, const char* input_end, uint64_t& out_value)
+		{
+			uint64_t value = 0;
+			for (; input < input_end && uint32_t(*input - '0') < 10; ++input)
+				value = value * 10 + uint64_t(*input - '0');
+
+			out_value = value;
+			return input;
+		}
+
+		VMEMPROF_FORCE_INLINE const char* skip_spaces(const char* input, const char* input_end)
+		{
+			while (input < input_end && *input == ' ')
+				input++;
+			return input;
+		}
+
+		inline const field_description* find_field(const char* name, size_t name_length)
+		{
+			const uint32_t letter = uint32_t(name[0] - 'A');
+			if (letter >= 26)
+				return nullptr;
+
+			for (uint32_t field_index = k_field_lookup.first_field[letter]; field_index < k_field_lookup.first_field[letter + 1]; ++field_index)
+			{
+				const field_description& field = k_fields[field_index];
+				if (field.name_length == name_length && std::memcmp(field.name, name, name_length) == 0)
+					return &field;
+			}
+
+			return nullptr;
+		}
+
+		// Parses '<start>-<end> <perms> <offset> <major>:<minor> <inode> <path>'
+		inline bool parse_header(const char* line, const char* line_end, smaps_entry& out_entry)
+		{
+			std::memset(&out_entry, 0, sizeof(out_entry));
+
+			const char* input = parse_hex(line, line_end, out_entry.start);
+			if (input == line_end || *input != '-')
+				return false;
+
+			input = parse_hex(input + 1, line_end, out_entry.end);
+			if (line_end - input < 6)
+				return false;
+
+			out_entry.protection = (input[1] == 'r' ? PROT_READ : 0) | (input[2] == 'w' ? PROT_WRITE : 0) | (input[3] == 'x' ? PROT_EXEC : 0);
+			out_entry.is_shared = input[4] == 's';
+
+			input = parse_hex(skip_spaces(input + 5, line_end), line_end, out_entry.offset);
+
+			uint64_t major;
+			uint64_t minor;
+			input = parse_hex(skip_spaces(input, line_end), line_end, major);
+			if (input == line_end || *input != ':')
+				return false;
+
+			input = parse_hex(input + 1, line_end, minor);
+			out_entry.device = makedev(major, minor);
+
+			input = parse_decimal(skip_spaces(input, line_end), line_end, out_entry.inode);
+			input = skip_spaces(input, line_end);
+
+			out_entry.path = input;
+			out_entry.path_length = uint32_t(line_end - input);
+			return true;
+		}
+
+		inline void parse_vm_flags(const char* input, const char* input_end, smaps_entry& out_entry)
+		{
+			uint32_t flags = 0;
+			for (input = skip_spaces(input, input_end); input + 2 <= input_end; input = skip_spaces(input + 2, input_end))
+			{
+				for (const vm_flag_description& flag : k_vm_flags)
+				{
+					if (flag.name[0] == input[0] && flag.name[1] == input[1])
+					{
+						flags |= uint32_t(flag.flag);
+						break;
+					}
+				}
+			}
+
+			out_entry.vm_flags = flags;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Parses the content of a smaps or smaps_rollup file. The callback has the
+	// signature 'bool(const smaps_entry&)' and returns false to stop early.
+	// Unknown fields are ignored, returns an error if a header is malformed.
+	////////////////////////////////////////////////////////////////////////////////
+	template<typename callback_type>
+	error_result parse_smaps(const char* data, size_t size, callback_type callback)
+	{
+		using namespace smaps_parser_impl;
+
+		const char* input = data;
+		const char* input_end = data + size;
+
+		smaps_entry entry;
+		bool has_entry = false;
+
+		while (input < input_end)
+		{
+			const char* line_end = static_cast<const char*>(std::memchr(input, '\n', size_t(input_end - input)));
+			if (line_end == nullptr)
+				line_end = input_end;
+
+			if (is_hex_digit(*input))
+			{
+				if (has_entry && !callback(entry))
+					return error_result();
+
+				if (!parse_header(input, line_end, entry))
+					return error_result("Malformed smaps header");
+
+				has_entry = true;
+			}
+			else if (has_entry)
+			{
+				const char* name_end = static_cast<const char*>(std::memchr(input, ':', size_t(line_end - input)));
+				if (name_end != nullptr && name_end != input)
+				{
+					const size_t name_length = size_t(name_end - input);
+					const field_description* field = find_field(input, name_length);
+					if (field != nullptr)
+						parse_decimal(skip_spaces(name_end + 1, line_end), line_end, entry.*field->member);
+					else if (name_length == 7 && std::memcmp(input, "VmFlags", 7) == 0)
+						parse_vm_flags(name_end + 1, line_end, entry);
+					else if (name_length == 11 && std::memcmp(input, "THPeligible", 11) == 0)
+						entry.is_thp_eligible = skip_spaces(name_end + 1, line_end) < line_end && skip_spaces(name_end + 1, line_end)[0] == '1';
+				}
+			}
+
+			input = line_end + 1;
+		}
+
+		if (has_entry)
+			callback(entry);
+
+		return error_result();
+	}
+}
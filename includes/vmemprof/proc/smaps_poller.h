@@ -0,0 +1,199 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/proc/smaps_parser.h"
+
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+namespace vmemprof
+{
+	enum class smaps_change
+	{
+		added,
+		removed,
+		changed,
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Polls a smaps or smaps_rollup file and reports what changed since the
+	// previous poll.
+	//
+	// The file stays open between polls and is read whole into a buffer. Buffers
+	// and parsed entries are double buffered and reused, once they have grown to
+	// fit the process no poll allocates. The kernel lists VMAs in address order,
+	// diffing is a single merge of the previous and current entries.
+	////////////////////////////////////////////////////////////////////////////////
+	class smaps_poller
+	{
+	public:
+		smaps_poller() = default;
+		~smaps_poller() { close(); }
+
+		smaps_poller(const smaps_poller&) = delete;
+		smaps_poller& operator=(const smaps_poller&) = delete;
+
+		error_result open(const char* path)
+		{
+			close();
+
+			m_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+			if (m_fd < 0)
+				return error_result("Failed to open smaps");
+
+			return error_result();
+		}
+
+		void close()
+		{
+			if (m_fd >= 0)
+				::close(m_fd);
+
+			m_fd = -1;
+			m_entries[0].clear();
+			m_entries[1].clear();
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Reads the file and calls 'void(const smaps_entry& entry, smaps_change change)'
+		// for every VMA that was added or removed, or whose range, protection, backing
+		// file, flags, Rss, Pss, Swap or huge page sizes changed. The first poll reports every VMA as added.
+		////////////////////////////////////////////////////////////////////////////////
+		template<typename callback_type>
+		error_result poll(callback_type callback)
+		{
+			const uint32_t buffer_index = m_current ^ 1;
+			std::vector<char>& buffer = m_buffers[buffer_index];
+
+			if (buffer.empty())
+				buffer.resize(k_initial_buffer_size);
+
+			// The kernel generates the content as we read it, a single read returns at most a page
+			size_t size = 0;
+			while (true)
+			{
+				if (size == buffer.size())
+					buffer.resize(buffer.size() * 2);
+
+				const ssize_t num_read = pread(m_fd, buffer.data() + size, buffer.size() - size, off_t(size));
+				if (num_read < 0)
+					return error_result("Failed to read smaps");
+
+				if (num_read == 0)
+					break;
+
+				size += size_t(num_read);
+			}
+
+			return update(buffer.data(), size, callback);
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Same as poll() with content read by the caller. Entries reference the
+		// content, it must stay alive until the next update.
+		////////////////////////////////////////////////////////////////////////////////
+		template<typename callback_type>
+		error_result update(const char* data, size_t size, callback_type callback)
+		{
+			const uint32_t previous_index = m_current;
+			const uint32_t current_index = m_current ^ 1;
+
+			std::vector<smaps_entry>& entries = m_entries[current_index];
+			entries.clear();
+
+			const error_result result = parse_smaps(data, size, [&entries](const smaps_entry& entry) { entries.push_back(entry); return true; });
+			if (result.any())
+				return result;
+
+			m_current = current_index;
+
+			diff(m_entries[previous_index], entries, callback);
+			return error_result();
+		}
+
+		// Entries of the last poll in address order
+		const std::vector<smaps_entry>& get_entries() const { return m_entries[m_current]; }
+
+	private:
+		static constexpr size_t k_initial_buffer_size = 64 * 1024;
+
+		static bool has_changed(const smaps_entry& previous, const smaps_entry& current)
+		{
+			return previous.end != current.end
+				|| previous.protection != current.protection
+				|| previous.offset != current.offset
+				|| previous.inode != current.inode
+				|| previous.vm_flags != current.vm_flags
+				|| previous.is_thp_eligible != current.is_thp_eligible
+				|| previous.rss != current.rss
+				|| previous.pss != current.pss
+				|| previous.swap != current.swap
+				|| previous.anon_huge_pages != current.anon_huge_pages
+				|| previous.private_hugetlb != current.private_hugetlb
+				|| previous.shared_hugetlb != current.shared_hugetlb;
+		}
+
+		template<typename callback_type>
+		static void diff(const std::vector<smaps_entry>& previous_entries, const std::vector<smaps_entry>& current_entries, callback_type& callback)
+		{
+			const smaps_entry* previous = previous_entries.data();
+			const smaps_entry* previous_end = previous + previous_entries.size();
+			const smaps_entry* current = current_entries.data();
+			const smaps_entry* current_end = current + current_entries.size();
+
+			while (previous < previous_end && current < current_end)
+			{
+				if (previous->start < current->start)
+					callback(*previous++, smaps_change::removed);
+				else if (current->start < previous->start)
+					callback(*current++, smaps_change::added);
+				else
+				{
+					if (has_changed(*previous, *current))
+						callback(*current, smaps_change::changed);
+
+					previous++;
+					current++;
+				}
+			}
+
+			for (; previous < previous_end; ++previous)
+				callback(*previous, smaps_change::removed);
+
+			for (; current < current_end; ++current)
+				callback(*current, smaps_change::added);
+		}
+
+		int							m_fd = -1;
+		uint32_t					m_current = 0;
+
+		std::vector<char>			m_buffers[2];
+		std::vector<smaps_entry>	m_entries[2];
+	};
+}
@@ -0,0 +1,544 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/symbols/elf_image.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+// DWARF line number information
+//
+// The .debug_line section holds one line program per compilation unit. Running
+// a program emits rows that map an address to a file and a line, rows apply
+// until the next row of their sequence. DWARF versions 2 to 5 are supported,
+// 32 and 64 bit units alike.
+//
+// Rows of every unit are flattened into a single table sorted by address. The
+// end of a sequence is kept as a row with line zero so that addresses between
+// sequences resolve to nothing.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// A row of a line table, it applies until the address of the next row.
+	////////////////////////////////////////////////////////////////////////////////
+	struct line_row
+	{
+		uint64_t	address;
+		uint32_t	file_index;		// Index in the line table files
+		uint32_t	line;			// Zero past the end of a sequence
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// The line rows of a module along with the source files they reference.
+	// Strings are null terminated and stored back to back.
+	////////////////////////////////////////////////////////////////////////////////
+	struct line_table
+	{
+		std::vector<line_row>	rows;
+		std::vector<uint32_t>	file_name_offsets;		// Offsets in 'strings'
+		std::vector<char>		strings;
+	};
+
+	namespace dwarf_line_table_impl
+	{
+		// Standard opcodes
+		constexpr uint8_t k_op_copy = 1;
+		constexpr uint8_t k_op_advance_pc = 2;
+		constexpr uint8_t k_op_advance_line = 3;
+		constexpr uint8_t k_op_set_file = 4;
+		constexpr uint8_t k_op_const_add_pc = 8;
+		constexpr uint8_t k_op_fixed_advance_pc = 9;
+
+		// Extended opcodes
+		constexpr uint8_t k_op_end_sequence = 1;
+		constexpr uint8_t k_op_set_address = 2;
+		constexpr uint8_t k_op_define_file = 3;
+
+		// Attribute forms used by DWARF 5 directory and file entries
+		constexpr uint64_t k_form_block = 0x09;
+		constexpr uint64_t k_form_data1 = 0x0b;
+		constexpr uint64_t k_form_data2 = 0x05;
+		constexpr uint64_t k_form_data4 = 0x06;
+		constexpr uint64_t k_form_data8 = 0x07;
+		constexpr uint64_t k_form_data16 = 0x1e;
+		constexpr uint64_t k_form_string = 0x08;
+		constexpr uint64_t k_form_strp = 0x0e;
+		constexpr uint64_t k_form_line_strp = 0x1f;
+		constexpr uint64_t k_form_udata = 0x0f;
+
+		// Content types of DWARF 5 directory and file entries
+		constexpr uint64_t k_content_path = 1;
+		constexpr uint64_t k_content_directory_index = 2;
+
+		// Linkers write these addresses for code they discarded
+		constexpr uint64_t k_min_tombstone_address = ~1ULL;
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Reads little endian values, failures are sticky and reads past the end return zero.
+		////////////////////////////////////////////////////////////////////////////////
+		class dwarf_cursor
+		{
+		public:
+			dwarf_cursor(const uint8_t* data, const uint8_t* data_end) : m_data(data), m_data_end(data_end) {}
+
+			bool is_valid() const { return !m_is_corrupted; }
+			bool is_at_end() const { return m_data >= m_data_end; }
+			const uint8_t* get_position() const { return m_data; }
+			uint64_t get_remaining() const { return uint64_t(m_data_end - m_data); }
+
+			uint64_t read_fixed(uint32_t size)
+			{
+				if (size > get_remaining() || size > 8)
+				{
+					m_is_corrupted = true;
+					m_data = m_data_end;
+					return 0;
+				}
+
+				uint64_t value = 0;
+				std::memcpy(&value, m_data, size);
+				m_data += size;
+				return value;
+			}
+
+			uint8_t read_u8() { return uint8_t(read_fixed(1)); }
+			uint16_t read_u16() { return uint16_t(read_fixed(2)); }
+			uint32_t read_u32() { return uint32_t(read_fixed(4)); }
+			uint64_t read_u64() { return read_fixed(8); }
+
+			uint64_t read_uleb128()
+			{
+				uint64_t value = 0;
+				for (uint32_t shift = 0; m_data < m_data_end; shift += 7)
+				{
+					const uint8_t byte = *m_data++;
+					if (shift < 64)
+						value |= uint64_t(byte & 0x7F) << shift;
+
+					if ((byte & 0x80) == 0)
+						return value;
+				}
+
+				m_is_corrupted = true;
+				return 0;
+			}
+
+			int64_t read_sleb128()
+			{
+				uint64_t value = 0;
+				for (uint32_t shift = 0; m_data < m_data_end; shift += 7)
+				{
+					const uint8_t byte = *m_data++;
+					if (shift < 64)
+						value |= uint64_t(byte & 0x7F) << shift;
+
+					if ((byte & 0x80) == 0)
+					{
+						if (shift + 7 < 64 && (byte & 0x40) != 0)
+							value |= ~0ULL << (shift + 7);
+						return int64_t(value);
+					}
+				}
+
+				m_is_corrupted = true;
+				return 0;
+			}
+
+			// Returns an empty string if the string is not terminated
+			const char* read_string()
+			{
+				const uint8_t* terminator = static_cast<const uint8_t*>(std::memchr(m_data, 0, get_remaining()));
+				if (terminator == nullptr)
+				{
+					m_is_corrupted = true;
+					m_data = m_data_end;
+					return "";
+				}
+
+				const char* value = reinterpret_cast<const char*>(m_data);
+				m_data = terminator + 1;
+				return value;
+			}
+
+			void skip(uint64_t size)
+			{
+				if (size > get_remaining())
+				{
+					m_is_corrupted = true;
+					m_data = m_data_end;
+				}
+				else
+					m_data += size;
+			}
+
+		private:
+			const uint8_t*	m_data;
+			const uint8_t*	m_data_end;
+			bool			m_is_corrupted = false;
+		};
+
+		inline const char* get_section_string(const elf_section* section, uint64_t offset)
+		{
+			if (section == nullptr || offset >= section->size)
+				return nullptr;
+
+			const char* value = reinterpret_cast<const char*>(section->data + offset);
+			return std::memchr(value, 0, section->size - offset) != nullptr ? value : nullptr;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Reads a DWARF 5 entry attribute. Strings are returned in out_string, anything
+		// else in out_value. Returns false for forms we cannot skip.
+		////////////////////////////////////////////////////////////////////////////////
+		inline bool read_entry_attribute(dwarf_cursor& cursor, uint64_t form, bool is_dwarf64, const elf_section* debug_str, const elf_section* debug_line_str, const char*& out_string, uint64_t& out_value)
+		{
+			out_string = nullptr;
+			out_value = 0;
+
+			switch (form)
+			{
+			case k_form_string:		out_string = cursor.read_string(); break;
+			case k_form_strp:		out_string = get_section_string(debug_str, is_dwarf64 ? cursor.read_u64() : cursor.read_u32()); break;
+			case k_form_line_strp:	out_string = get_section_string(debug_line_str, is_dwarf64 ? cursor.read_u64() : cursor.read_u32()); break;
+			case k_form_udata:		out_value = cursor.read_uleb128(); break;
+			case k_form_data1:		out_value = cursor.read_u8(); break;
+			case k_form_data2:		out_value = cursor.read_u16(); break;
+			case k_form_data4:		out_value = cursor.read_u32(); break;
+			case k_form_data8:		out_value = cursor.read_u64(); break;
+			case k_form_data16:		cursor.skip(16); break;
+			case k_form_block:		cursor.skip(cursor.read_uleb128()); break;
+			default:				return false;
+			}
+
+			return cursor.is_valid();
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Accumulates the files of a unit, their indices are translated to table files.
+		////////////////////////////////////////////////////////////////////////////////
+		class unit_files
+		{
+		public:
+			explicit unit_files(line_table& table) : m_table(table) {}
+
+			void add_directory(const char* directory) { m_directories.push_back(directory != nullptr ? directory : ""); }
+
+			void add_file(const char* name, uint64_t directory_index)
+			{
+				if (name == nullptr)
+					name = "";
+
+				const char* directory = name[0] != '/' && directory_index < m_directories.size() ? m_directories[directory_index] : "";
+				const size_t directory_length = std::strlen(directory);
+
+				m_file_indices.push_back(uint32_t(m_table.file_name_offsets.size()));
+				m_table.file_name_offsets.push_back(uint32_t(m_table.strings.size()));
+
+				if (directory_length != 0)
+				{
+					m_table.strings.insert(m_table.strings.end(), directory, directory + directory_length);
+					if (directory[directory_length - 1] != '/')
+						m_table.strings.push_back('/');
+				}
+
+				m_table.strings.insert(m_table.strings.end(), name, name + std::strlen(name) + 1);
+			}
+
+			// Returns UINT32_MAX for unknown files
+			uint32_t get_table_file_index(uint64_t unit_file_index) const
+			{
+				return unit_file_index < m_file_indices.size() ? m_file_indices[unit_file_index] : UINT32_MAX;
+			}
+
+		private:
+			line_table&					m_table;
+			std::vector<const char*>	m_directories;
+			std::vector<uint32_t>		m_file_indices;
+		};
+
+		inline bool read_v5_entries(dwarf_cursor& cursor, bool is_dwarf64, const elf_section* debug_str, const elf_section* debug_line_str, bool is_file, unit_files& files)
+		{
+			uint64_t formats[2 * 32];
+			const uint32_t num_formats = cursor.read_u8();
+			if (num_formats > 32)
+				return false;
+
+			for (uint32_t format_index = 0; format_index < num_formats; ++format_index)
+			{
+				formats[format_index * 2 + 0] = cursor.read_uleb128();
+				formats[format_index * 2 + 1] = cursor.read_uleb128();
+			}
+
+			const uint64_t num_entries = cursor.read_uleb128();
+			for (uint64_t entry_index = 0; entry_index < num_entries && cursor.is_valid(); ++entry_index)
+			{
+				const char* path = nullptr;
+				uint64_t directory_index = 0;
+
+				for (uint32_t format_index = 0; format_index < num_formats; ++format_index)
+				{
+					const char* string_value;
+					uint64_t value;
+					if (!read_entry_attribute(cursor, formats[format_index * 2 + 1], is_dwarf64, debug_str, debug_line_str, string_value, value))
+						return false;
+
+					if (formats[format_index * 2 + 0] == k_content_path)
+						path = string_value;
+					else if (formats[format_index * 2 + 0] == k_content_directory_index)
+						directory_index = value;
+				}
+
+				if (is_file)
+					files.add_file(path, directory_index);
+				else
+					files.add_directory(path);
+			}
+
+			return cursor.is_valid();
+		}
+
+		inline bool read_legacy_entries(dwarf_cursor& cursor, unit_files& files)
+		{
+			// The compilation directory is only known from .debug_info, paths relative to it are kept relative
+			files.add_directory("");
+			while (cursor.is_valid())
+			{
+				const char* directory = cursor.read_string();
+				if (directory[0] == '\0')
+					break;
+
+				files.add_directory(directory);
+			}
+
+			// File indices start at 1
+			files.add_file("", 0);
+			while (cursor.is_valid())
+			{
+				const char* name = cursor.read_string();
+				if (name[0] == '\0')
+					break;
+
+				const uint64_t directory_index = cursor.read_uleb128();
+				cursor.read_uleb128();		// Modification time
+				cursor.read_uleb128();		// File size
+				files.add_file(name, directory_index);
+			}
+
+			return cursor.is_valid();
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Parses the header and runs the line program of a single unit.
+		////////////////////////////////////////////////////////////////////////////////
+		inline bool parse_unit(dwarf_cursor& unit, bool is_dwarf64, const elf_section* debug_str, const elf_section* debug_line_str, line_table& table)
+		{
+			const uint16_t version = unit.read_u16();
+			if (version < 2 || version > 5)
+				return false;
+
+			uint32_t address_size = 8;
+			if (version >= 5)
+			{
+				address_size = unit.read_u8();
+				unit.read_u8();		// Segment selector size
+			}
+
+			const uint64_t header_length = is_dwarf64 ? unit.read_u64() : unit.read_u32();
+			if (header_length > unit.get_remaining())
+				return false;
+
+			const uint8_t* program = unit.get_position() + header_length;
+
+			const uint32_t min_instruction_length = unit.read_u8();
+			if (version >= 4)
+				unit.read_u8();		// Maximum operations per instruction, only VLIW targets use it
+
+			unit.read_u8();			// Default is_stmt, every row is kept
+			const int32_t line_base = int8_t(unit.read_u8());
+			const uint32_t line_range = unit.read_u8();
+			const uint32_t opcode_base = unit.read_u8();
+			if (line_range == 0 || opcode_base == 0)
+				return false;
+
+			uint8_t opcode_lengths[256] = { 0 };
+			for (uint32_t opcode = 1; opcode < opcode_base; ++opcode)
+				opcode_lengths[opcode] = unit.read_u8();
+
+			unit_files files(table);
+			const bool is_header_valid = version >= 5
+				? read_v5_entries(unit, is_dwarf64, debug_str, debug_line_str, false, files) && read_v5_entries(unit, is_dwarf64, debug_str, debug_line_str, true, files)
+				: read_legacy_entries(unit, files);
+
+			if (!is_header_valid || unit.get_position() > program)
+				return false;
+
+			unit.skip(uint64_t(program - unit.get_position()));
+
+			// State machine registers, only those we need
+			uint64_t address = 0;
+			uint64_t file = 1;
+			int64_t line = 1;
+			bool is_sequence_discarded = false;
+			size_t sequence_start = table.rows.size();
+
+			auto emit_row = [&](uint32_t row_line)
+			{
+				table.rows.push_back(line_row{ address, files.get_table_file_index(file), row_line });
+			};
+
+			while (!unit.is_at_end() && unit.is_valid())
+			{
+				const uint8_t opcode = unit.read_u8();
+				if (opcode >= opcode_base)
+				{
+					// Special opcode, advances both the address and the line and emits a row
+					const uint32_t adjusted_opcode = opcode - opcode_base;
+					address += uint64_t(adjusted_opcode / line_range) * min_instruction_length;
+					line += line_base + int32_t(adjusted_opcode % line_range);
+					emit_row(uint32_t(line));
+				}
+				else if (opcode == 0)
+				{
+					const uint64_t length = unit.read_uleb128();
+					if (length == 0 || length > unit.get_remaining())
+						return false;
+
+					const uint8_t* instruction_end = unit.get_position() + length;
+					const uint8_t extended_opcode = unit.read_u8();
+
+					if (extended_opcode == k_op_end_sequence)
+					{
+						emit_row(0);
+
+						// Sequences of discarded code are relocated to zero or a tombstone
+						if (is_sequence_discarded)
+							table.rows.resize(sequence_start);
+
+						sequence_start = table.rows.size();
+						address = 0;
+						file = 1;
+						line = 1;
+						is_sequence_discarded = false;
+					}
+					else if (extended_opcode == k_op_set_address)
+					{
+						address = unit.read_fixed(address_size);
+						is_sequence_discarded |= address == 0 || address >= k_min_tombstone_address;
+					}
+					else if (extended_opcode == k_op_define_file)
+					{
+						const char* name = unit.read_string();
+						const uint64_t directory_index = unit.read_uleb128();
+						files.add_file(name, directory_index);
+					}
+
+					if (unit.get_position() > instruction_end)
+						return false;
+
+					unit.skip(uint64_t(instruction_end - unit.get_position()));
+				}
+				else if (opcode == k_op_copy)
+					emit_row(uint32_t(line));
+				else if (opcode == k_op_advance_pc)
+					address += unit.read_uleb128() * min_instruction_length;
+				else if (opcode == k_op_advance_line)
+					line += unit.read_sleb128();
+				else if (opcode == k_op_set_file)
+					file = unit.read_uleb128();
+				else if (opcode == k_op_const_add_pc)
+					address += uint64_t((255 - opcode_base) / line_range) * min_instruction_length;
+				else if (opcode == k_op_fixed_advance_pc)
+					address += unit.read_u16();
+				else
+				{
+					// Other standard opcodes only update registers we do not track
+					for (uint32_t argument_index = 0; argument_index < opcode_lengths[opcode]; ++argument_index)
+						unit.read_uleb128();
+				}
+			}
+
+			// A sequence must be terminated, drop a truncated one
+			table.rows.resize(sequence_start);
+			return unit.is_valid();
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Runs every line program of a .debug_line section and appends their rows to
+	// the table, then sorts it. String forms reference .debug_str and, with
+	// DWARF 5, .debug_line_str, both are optional. Units that fail to parse are
+	// skipped, an error is only returned when no unit could be read.
+	////////////////////////////////////////////////////////////////////////////////
+	inline error_result parse_dwarf_line_table(const elf_section& debug_line, const elf_section* debug_str, const elf_section* debug_line_str, line_table& table)
+	{
+		using namespace dwarf_line_table_impl;
+
+		dwarf_cursor cursor(debug_line.data, debug_line.data + debug_line.size);
+		uint32_t num_units = 0;
+		uint32_t num_failed_units = 0;
+
+		while (!cursor.is_at_end())
+		{
+			uint64_t unit_length = cursor.read_u32();
+			const bool is_dwarf64 = unit_length == 0xFFFFFFFFULL;
+			if (is_dwarf64)
+				unit_length = cursor.read_u64();
+
+			if (!cursor.is_valid() || unit_length > cursor.get_remaining())
+				break;
+
+			dwarf_cursor unit(cursor.get_position(), cursor.get_position() + unit_length);
+			cursor.skip(unit_length);
+
+			const size_t num_rows = table.rows.size();
+			if (!parse_unit(unit, is_dwarf64, debug_str, debug_line_str, table))
+			{
+				table.rows.resize(num_rows);
+				num_failed_units++;
+			}
+
+			num_units++;
+		}
+
+		// Where a sequence ends and another starts, the end must sort first. Rows sharing an
+		// address within a sequence keep their order, the last one applies.
+		std::stable_sort(table.rows.begin(), table.rows.end(), [](const line_row& lhs, const line_row& rhs)
+			{
+				return lhs.address != rhs.address ? lhs.address < rhs.address : (lhs.line != 0) < (rhs.line != 0);
+			});
+
+		if (num_units != 0 && num_failed_units == num_units)
+			return error_result("Failed to parse the line tables");
+
+		return error_result();
+	}
+}
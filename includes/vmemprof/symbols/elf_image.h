@@ -0,0 +1,293 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/module_info.h"
+
+#include <cstdint>
+#include <cstring>
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// A section of an ELF image as it lives in the mapped file.
+	////////////////////////////////////////////////////////////////////////////////
+	struct elf_section
+	{
+		const uint8_t*	data;
+		uint64_t		size;
+		uint64_t		address;		// Virtual address when loaded, zero for debug sections
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Memory maps a 64 bit little endian ELF file and provides access to its
+	// sections. Only what symbolization and attaching need is exposed: named
+	// sections, the build id and the function symbols. Compressed sections are
+	// not supported and reported as missing.
+	////////////////////////////////////////////////////////////////////////////////
+	class elf_image
+	{
+	public:
+		elf_image() = default;
+		~elf_image() { close(); }
+
+		elf_image(const elf_image&) = delete;
+		elf_image& operator=(const elf_image&) = delete;
+
+		error_result open(const char* path)
+		{
+			close();
+
+			const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				return error_result("Failed to open the ELF file");
+
+			struct stat file_stat;
+			if (fstat(fd, &file_stat) != 0 || file_stat.st_size < off_t(sizeof(Elf64_Ehdr)))
+			{
+				::close(fd);
+				return error_result("Not an ELF file");
+			}
+
+			void* data = mmap(nullptr, size_t(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);
+
+			if (data == MAP_FAILED)
+				return error_result("Failed to map the ELF file");
+
+			m_data = static_cast<const uint8_t*>(data);
+			m_size = uint64_t(file_stat.st_size);
+
+			const error_result result = initialize();
+			if (result.any())
+				close();
+
+			return result;
+		}
+
+		void close()
+		{
+			if (m_data != nullptr)
+				munmap(const_cast<uint8_t*>(m_data), m_size);
+
+			m_data = nullptr;
+			m_size = 0;
+			m_sections = nullptr;
+			m_num_sections = 0;
+			m_section_names = nullptr;
+			m_section_names_size = 0;
+		}
+
+		bool is_open() const { return m_data != nullptr; }
+
+		// Returns false if the section is missing, has no data in the file or is compressed
+		bool find_section(const char* name, elf_section& out_section) const
+		{
+			for (uint32_t section_index = 1; section_index < m_num_sections; ++section_index)
+			{
+				const Elf64_Shdr& header = m_sections[section_index];
+				if (header.sh_name >= m_section_names_size || std::strncmp(m_section_names + header.sh_name, name, m_section_names_size - header.sh_name) != 0)
+					continue;
+
+				return get_section(header, out_section);
+			}
+
+			return false;
+		}
+
+		// Returns false if the image has no GNU build id note
+		bool get_build_id(uint8_t* out_build_id, uint32_t& out_build_id_size) const
+		{
+			elf_section notes;
+			if (!find_section(".note.gnu.build-id", notes))
+				return false;
+
+			// Names and descriptors are padded to 4 bytes
+			const uint8_t* note = notes.data;
+			const uint8_t* notes_end = notes.data + notes.size;
+			while (note + sizeof(Elf64_Nhdr) <= notes_end)
+			{
+				const Elf64_Nhdr& note_header = *reinterpret_cast<const Elf64_Nhdr*>(note);
+				const uint8_t* name = note + sizeof(Elf64_Nhdr);
+				const uint8_t* descriptor = name + ((uint64_t(note_header.n_namesz) + 3) & ~3ULL);
+				const uint8_t* next_note = descriptor + ((uint64_t(note_header.n_descsz) + 3) & ~3ULL);
+				if (next_note > notes_end)
+					break;
+
+				if (note_header.n_type == NT_GNU_BUILD_ID && note_header.n_namesz == 4 && std::memcmp(name, "GNU", 4) == 0 && note_header.n_descsz <= k_max_build_id_size)
+				{
+					out_build_id_size = note_header.n_descsz;
+					std::memcpy(out_build_id, descriptor, note_header.n_descsz);
+					return true;
+				}
+
+				note = next_note;
+			}
+
+			return false;
+		}
+
+		// True when the image has a full symbol table, stripped images only have the dynamic symbols
+		bool has_symbol_table() const { return find_section_by_type(SHT_SYMTAB) != nullptr; }
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Calls 'void(uint64_t address, uint64_t size, const char* name)' for every
+		// defined function symbol. The full symbol table is used when present, the
+		// dynamic symbols otherwise. Names point into the mapped image.
+		////////////////////////////////////////////////////////////////////////////////
+		template<typename callback_type>
+		void for_each_function_symbol(callback_type callback) const
+		{
+			const Elf64_Shdr* symbols_header = find_section_by_type(SHT_SYMTAB);
+			if (symbols_header == nullptr)
+				symbols_header = find_section_by_type(SHT_DYNSYM);
+
+			elf_section symbols;
+			elf_section names;
+			if (symbols_header == nullptr || symbols_header->sh_link >= m_num_sections || !get_section(*symbols_header, symbols) || !get_section(m_sections[symbols_header->sh_link], names))
+				return;
+
+			const Elf64_Sym* symbol = reinterpret_cast<const Elf64_Sym*>(symbols.data);
+			const Elf64_Sym* symbols_end = symbol + symbols.size / sizeof(Elf64_Sym);
+			for (; symbol < symbols_end; ++symbol)
+			{
+				const uint32_t type = ELF64_ST_TYPE(symbol->st_info);
+				if ((type != STT_FUNC && type != STT_GNU_IFUNC) || symbol->st_shndx == SHN_UNDEF || symbol->st_value == 0 || symbol->st_name >= names.size)
+					continue;
+
+				// Names are null terminated within their section
+				const char* name = reinterpret_cast<const char*>(names.data) + symbol->st_name;
+				if (std::memchr(name, '\0', names.size - symbol->st_name) == nullptr)
+					continue;
+
+				callback(uint64_t(symbol->st_value), uint64_t(symbol->st_size), name);
+			}
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Looks up a function exported by the image, the address is relative to its
+		// load address. Indirect functions are not resolved and reported as missing.
+		////////////////////////////////////////////////////////////////////////////////
+		bool find_exported_function(const char* name, uint64_t& out_address) const
+		{
+			const Elf64_Shdr* symbols_header = find_section_by_type(SHT_DYNSYM);
+
+			elf_section symbols;
+			elf_section names;
+			if (symbols_header == nullptr || symbols_header->sh_link >= m_num_sections || !get_section(*symbols_header, symbols) || !get_section(m_sections[symbols_header->sh_link], names))
+				return false;
+
+			const size_t name_size = std::strlen(name) + 1;
+
+			const Elf64_Sym* symbol = reinterpret_cast<const Elf64_Sym*>(symbols.data);
+			const Elf64_Sym* symbols_end = symbol + symbols.size / sizeof(Elf64_Sym);
+			for (; symbol < symbols_end; ++symbol)
+			{
+				const uint32_t binding = ELF64_ST_BIND(symbol->st_info);
+				if (ELF64_ST_TYPE(symbol->st_info) != STT_FUNC || (binding != STB_GLOBAL && binding != STB_WEAK) || symbol->st_shndx == SHN_UNDEF || symbol->st_value == 0)
+					continue;
+
+				if (symbol->st_name >= names.size || names.size - symbol->st_name < name_size || std::memcmp(names.data + symbol->st_name, name, name_size) != 0)
+					continue;
+
+				out_address = uint64_t(symbol->st_value);
+				return true;
+			}
+
+			return false;
+		}
+
+	private:
+		error_result initialize()
+		{
+			const Elf64_Ehdr& header = *reinterpret_cast<const Elf64_Ehdr*>(m_data);
+			if (std::memcmp(header.e_ident, ELFMAG, SELFMAG) != 0)
+				return error_result("Not an ELF file");
+
+			if (header.e_ident[EI_CLASS] != ELFCLASS64 || header.e_ident[EI_DATA] != ELFDATA2LSB)
+				return error_result("Only 64 bit little endian ELF files are supported");
+
+			if (header.e_shoff == 0 || header.e_shentsize != sizeof(Elf64_Shdr) || header.e_shoff + sizeof(Elf64_Shdr) > m_size)
+				return error_result("ELF file has no section headers");
+
+			m_sections = reinterpret_cast<const Elf64_Shdr*>(m_data + header.e_shoff);
+
+			// Large section counts and indices are stored in the first section header
+			uint64_t num_sections = header.e_shnum != 0 ? header.e_shnum : m_sections[0].sh_size;
+			const uint32_t names_index = header.e_shstrndx != SHN_XINDEX ? header.e_shstrndx : m_sections[0].sh_link;
+
+			if (num_sections > (m_size - header.e_shoff) / sizeof(Elf64_Shdr))
+				return error_result("Corrupted ELF section headers");
+
+			m_num_sections = uint32_t(num_sections);
+
+			elf_section names;
+			if (names_index >= m_num_sections || !get_section(m_sections[names_index], names))
+				return error_result("ELF file has no section names");
+
+			m_section_names = reinterpret_cast<const char*>(names.data);
+			m_section_names_size = names.size;
+			return error_result();
+		}
+
+		const Elf64_Shdr* find_section_by_type(uint32_t type) const
+		{
+			for (uint32_t section_index = 1; section_index < m_num_sections; ++section_index)
+			{
+				if (m_sections[section_index].sh_type == type)
+					return &m_sections[section_index];
+			}
+
+			return nullptr;
+		}
+
+		bool get_section(const Elf64_Shdr& header, elf_section& out_section) const
+		{
+			if (header.sh_type == SHT_NOBITS || (header.sh_flags & SHF_COMPRESSED) != 0)
+				return false;
+
+			if (header.sh_offset > m_size || header.sh_size > m_size - header.sh_offset)
+				return false;
+
+			out_section = elf_section{ m_data + header.sh_offset, header.sh_size, header.sh_addr };
+			return true;
+		}
+
+		const uint8_t*		m_data = nullptr;
+		uint64_t			m_size = 0;
+
+		const Elf64_Shdr*	m_sections = nullptr;
+		uint32_t			m_num_sections = 0;
+
+		const char*			m_section_names = nullptr;
+		uint64_t			m_section_names_size = 0;
+	};
+}
@@ -0,0 +1,350 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/module_info.h"
+#include "vmemprof/symbols/dwarf_line_table.h"
+#include "vmemprof/symbols/elf_image.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+// Symbol cache file layout
+//
+// The symbols of a module are cached on disk keyed by its build id, parsing
+// the ELF and DWARF data again is much slower than reading the flat tables:
+//    symbol_cache_header
+//    function_symbol[num_functions]		sorted by address
+//    line_row[num_rows]					sorted by address
+//    uint32_t[num_files]					offsets of the file names in the strings
+//    char[strings_size]					null terminated strings
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	constexpr uint32_t k_symbol_cache_magic = 0x53504D56;		// 'VMPS'
+	constexpr uint32_t k_symbol_cache_version = 1;
+
+	struct symbol_cache_header
+	{
+		uint32_t	magic;				// k_symbol_cache_magic
+		uint32_t	version;			// k_symbol_cache_version
+		uint64_t	num_functions;
+		uint64_t	num_rows;
+		uint64_t	num_files;
+		uint64_t	strings_size;
+	};
+
+	static_assert(sizeof(symbol_cache_header) == 40, "Unexpected symbol cache header size");
+
+	////////////////////////////////////////////////////////////////////////////////
+	// A function of a module, its name is in the module strings.
+	////////////////////////////////////////////////////////////////////////////////
+	struct function_symbol
+	{
+		uint64_t	address;
+		uint32_t	size;
+		uint32_t	name_offset;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Where an address of a module comes from. Strings are owned by the module
+	// symbols, unknown values are null (or zero for the line).
+	////////////////////////////////////////////////////////////////////////////////
+	struct source_location
+	{
+		const char*	function;			// Mangled
+		const char*	file;
+		uint32_t	line;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// The function symbols and line table of a module.
+	//
+	// Symbols are read from the ELF file, line information from its .debug_line
+	// section or from the separate debug file installed for its build id. Inlined
+	// functions are not expanded, an address resolves to its outermost function.
+	// Lookups are read-only and can run concurrently.
+	////////////////////////////////////////////////////////////////////////////////
+	class module_symbols
+	{
+	public:
+		// Separate debug files are looked up under this directory by build id
+		static constexpr const char* k_debug_file_directory = "/usr/lib/debug/.build-id";
+
+		// Parses the ELF file, expected_build_id is checked when not null to catch modules rebuilt since the capture
+		error_result build(const char* path, const uint8_t* expected_build_id, uint32_t expected_build_id_size)
+		{
+			clear();
+
+			elf_image image;
+			error_result result = image.open(path);
+			if (result.any())
+				return result;
+
+			uint8_t build_id[k_max_build_id_size];
+			uint32_t build_id_size = 0;
+			const bool has_build_id = image.get_build_id(build_id, build_id_size);
+
+			if (expected_build_id != nullptr && (!has_build_id || build_id_size != expected_build_id_size || std::memcmp(build_id, expected_build_id, build_id_size) != 0))
+				return error_result("The module changed since the capture, its build id differs");
+
+			elf_image debug_image;
+			if (has_build_id)
+			{
+				char debug_path[PATH_MAX];
+				get_debug_file_path(build_id, build_id_size, debug_path, sizeof(debug_path));
+				debug_image.open(debug_path);
+			}
+
+			// Stripped images only keep their dynamic symbols
+			const elf_image& symbol_image = !image.has_symbol_table() && debug_image.is_open() && debug_image.has_symbol_table() ? debug_image : image;
+			read_functions(symbol_image);
+
+			elf_section debug_line;
+			const elf_image* line_image = image.find_section(".debug_line", debug_line) ? &image : nullptr;
+			if (line_image == nullptr && debug_image.is_open() && debug_image.find_section(".debug_line", debug_line))
+				line_image = &debug_image;
+
+			if (line_image != nullptr)
+			{
+				elf_section debug_str;
+				elf_section debug_line_str;
+				const bool has_debug_str = line_image->find_section(".debug_str", debug_str);
+				const bool has_debug_line_str = line_image->find_section(".debug_line_str", debug_line_str);
+
+				line_table table;
+				table.strings = std::move(m_strings);
+
+				// Missing line information is not an error, functions still resolve
+				if (!parse_dwarf_line_table(debug_line, has_debug_str ? &debug_str : nullptr, has_debug_line_str ? &debug_line_str : nullptr, table).any())
+				{
+					m_rows = std::move(table.rows);
+					m_file_name_offsets = std::move(table.file_name_offsets);
+				}
+
+				m_strings = std::move(table.strings);
+			}
+
+			return error_result();
+		}
+
+		error_result load_cache(const char* path)
+		{
+			clear();
+
+			const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				return error_result("Failed to open the symbol cache");
+
+			symbol_cache_header header;
+			bool is_valid = read_all(fd, &header, sizeof(header)) && header.magic == k_symbol_cache_magic && header.version == k_symbol_cache_version;
+
+			struct stat file_stat;
+			is_valid = is_valid && fstat(fd, &file_stat) == 0;
+
+			// The sizes must add up to the file size exactly
+			const uint64_t expected_size = sizeof(header) + header.num_functions * sizeof(function_symbol) + header.num_rows * sizeof(line_row) + header.num_files * sizeof(uint32_t) + header.strings_size;
+			is_valid = is_valid && header.num_functions < (1ULL << 32) && header.num_rows < (1ULL << 40) && header.num_files < (1ULL << 32) && header.strings_size < (1ULL << 32) && uint64_t(file_stat.st_size) == expected_size;
+
+			if (is_valid)
+			{
+				m_functions.resize(header.num_functions);
+				m_rows.resize(header.num_rows);
+				m_file_name_offsets.resize(header.num_files);
+				m_strings.resize(header.strings_size);
+
+				is_valid = read_all(fd, m_functions.data(), m_functions.size() * sizeof(function_symbol))
+					&& read_all(fd, m_rows.data(), m_rows.size() * sizeof(line_row))
+					&& read_all(fd, m_file_name_offsets.data(), m_file_name_offsets.size() * sizeof(uint32_t))
+					&& read_all(fd, m_strings.data(), m_strings.size());
+			}
+
+			::close(fd);
+
+			// Every string offset must be in range and the strings terminated
+			is_valid = is_valid && (m_strings.empty() || m_strings.back() == '\0');
+			for (size_t function_index = 0; is_valid && function_index < m_functions.size(); ++function_index)
+				is_valid = m_functions[function_index].name_offset < m_strings.size();
+			for (size_t file_index = 0; is_valid && file_index < m_file_name_offsets.size(); ++file_index)
+				is_valid = m_file_name_offsets[file_index] < m_strings.size();
+
+			if (!is_valid)
+			{
+				clear();
+				return error_result("Invalid symbol cache");
+			}
+
+			return error_result();
+		}
+
+		// The cache is written to a temporary file first, concurrent symbolizers never read a partial cache
+		error_result save_cache(const char* path) const
+		{
+			char temporary_path[PATH_MAX];
+			if (snprintf(temporary_path, sizeof(temporary_path), "%s.%d.tmp", path, int(getpid())) >= int(sizeof(temporary_path)))
+				return error_result("Symbol cache path is too long");
+
+			const int fd = ::open(temporary_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if (fd < 0)
+				return error_result("Failed to create the symbol cache");
+
+			symbol_cache_header header;
+			header.magic = k_symbol_cache_magic;
+			header.version = k_symbol_cache_version;
+			header.num_functions = m_functions.size();
+			header.num_rows = m_rows.size();
+			header.num_files = m_file_name_offsets.size();
+			header.strings_size = m_strings.size();
+
+			const bool is_written = write_all(fd, &header, sizeof(header))
+				&& write_all(fd, m_functions.data(), m_functions.size() * sizeof(function_symbol))
+				&& write_all(fd, m_rows.data(), m_rows.size() * sizeof(line_row))
+				&& write_all(fd, m_file_name_offsets.data(), m_file_name_offsets.size() * sizeof(uint32_t))
+				&& write_all(fd, m_strings.data(), m_strings.size());
+
+			::close(fd);
+
+			if (!is_written || rename(temporary_path, path) != 0)
+			{
+				unlink(temporary_path);
+				return error_result("Failed to write the symbol cache");
+			}
+
+			return error_result();
+		}
+
+		// The address is an ELF virtual address of the module. Returns false if nothing is known about it.
+		bool lookup(uint64_t address, source_location& out_location) const
+		{
+			out_location = source_location{ nullptr, nullptr, 0 };
+
+			const auto function_it = std::upper_bound(m_functions.begin(), m_functions.end(), address, [](uint64_t value, const function_symbol& function) { return value < function.address; });
+			if (function_it != m_functions.begin())
+			{
+				// Assembly functions often have no size, they extend to the next function
+				const function_symbol& function = function_it[-1];
+				if (address - function.address < function.size || (function.size == 0 && (function_it == m_functions.end() || address < function_it->address)))
+					out_location.function = m_strings.data() + function.name_offset;
+			}
+
+			const auto row_it = std::upper_bound(m_rows.begin(), m_rows.end(), address, [](uint64_t value, const line_row& row) { return value < row.address; });
+			if (row_it != m_rows.begin() && row_it[-1].line != 0)
+			{
+				const line_row& row = row_it[-1];
+				out_location.line = row.line;
+				out_location.file = row.file_index < m_file_name_offsets.size() ? m_strings.data() + m_file_name_offsets[row.file_index] : nullptr;
+			}
+
+			return out_location.function != nullptr || out_location.line != 0;
+		}
+
+		size_t get_num_functions() const { return m_functions.size(); }
+		size_t get_num_rows() const { return m_rows.size(); }
+
+		// Formats '<directory>/<xx>/<rest of the build id>.debug'
+		static void get_debug_file_path(const uint8_t* build_id, uint32_t build_id_size, char* out_path, size_t out_path_size)
+		{
+			size_t length = size_t(snprintf(out_path, out_path_size, "%s/", k_debug_file_directory));
+			for (uint32_t byte_index = 0; byte_index < build_id_size && length + 4 < out_path_size; ++byte_index)
+			{
+				length += size_t(snprintf(out_path + length, out_path_size - length, "%02x", build_id[byte_index]));
+				if (byte_index == 0)
+					out_path[length++] = '/';
+			}
+
+			snprintf(out_path + length, out_path_size - length, ".debug");
+		}
+
+	private:
+		void clear()
+		{
+			m_functions.clear();
+			m_rows.clear();
+			m_file_name_offsets.clear();
+			m_strings.clear();
+		}
+
+		void read_functions(const elf_image& image)
+		{
+			image.for_each_function_symbol([this](uint64_t address, uint64_t size, const char* name)
+				{
+					const size_t name_length = std::strlen(name);
+					m_functions.push_back(function_symbol{ address, uint32_t(size < UINT32_MAX ? size : UINT32_MAX), uint32_t(m_strings.size()) });
+					m_strings.insert(m_strings.end(), name, name + name_length + 1);
+				});
+
+			// Aliases share an address, the first one is kept
+			std::stable_sort(m_functions.begin(), m_functions.end(), [](const function_symbol& lhs, const function_symbol& rhs) { return lhs.address < rhs.address; });
+			m_functions.erase(std::unique(m_functions.begin(), m_functions.end(), [](const function_symbol& lhs, const function_symbol& rhs) { return lhs.address == rhs.address; }), m_functions.end());
+		}
+
+		static bool read_all(int fd, void* data, size_t size)
+		{
+			uint8_t* bytes = static_cast<uint8_t*>(data);
+			while (size != 0)
+			{
+				const ssize_t num_read = ::read(fd, bytes, size);
+				if (num_read <= 0)
+					return false;
+
+				bytes += num_read;
+				size -= size_t(num_read);
+			}
+
+			return true;
+		}
+
+		static bool write_all(int fd, const void* data, size_t size)
+		{
+			const uint8_t* bytes = static_cast<const uint8_t*>(data);
+			while (size != 0)
+			{
+				const ssize_t num_written = ::write(fd, bytes, size);
+				if (num_written <= 0)
+					return false;
+
+				bytes += num_written;
+				size -= size_t(num_written);
+			}
+
+			return true;
+		}
+
+		std::vector<function_symbol>	m_functions;
+		std::vector<line_row>			m_rows;
+		std::vector<uint32_t>			m_file_name_offsets;
+		std::vector<char>				m_strings;
+	};
+}
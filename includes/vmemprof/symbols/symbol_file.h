@@ -0,0 +1,243 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/symbols/symbolizer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+// Symbol file layout
+//
+// The symbolizer output is written next to the trace, analysis commands read
+// it to print symbolized stacks:
+//    symbol_file_header
+//    symbol_file_entry[num_entries]		sorted by address
+//    char[strings_size]					null terminated strings, offset zero is empty
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	constexpr uint32_t k_symbol_file_magic = 0x59504D56;		// 'VMPY'
+	constexpr uint32_t k_symbol_file_version = 1;
+
+	// Analysis commands look for the symbols of '<trace>' in '<trace><k_symbol_file_suffix>'
+	constexpr const char* k_symbol_file_suffix = ".symbols";
+
+	struct symbol_file_header
+	{
+		uint32_t	magic;				// k_symbol_file_magic
+		uint32_t	version;			// k_symbol_file_version
+		uint64_t	num_entries;
+		uint64_t	strings_size;
+	};
+
+	static_assert(sizeof(symbol_file_header) == 24, "Unexpected symbol file header size");
+
+	struct symbol_file_entry
+	{
+		uint64_t	address;
+		uint32_t	function_offset;
+		uint32_t	file_offset;
+		uint32_t	module_offset;
+		uint32_t	line;
+	};
+
+	static_assert(sizeof(symbol_file_entry) == 24, "Unexpected symbol file entry size");
+
+	////////////////////////////////////////////////////////////////////////////////
+	// A frame read from a symbol file, unknown strings are empty.
+	////////////////////////////////////////////////////////////////////////////////
+	struct symbol_file_frame
+	{
+		const char*	function;
+		const char*	file;
+		const char*	module;
+		uint32_t	line;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Writes symbolized frames, they are sorted by address and strings are shared.
+	////////////////////////////////////////////////////////////////////////////////
+	inline error_result write_symbol_file(const char* path, const std::vector<symbolized_frame>& frames, const symbolizer& symbols)
+	{
+		std::vector<char> strings(1, '\0');
+		std::unordered_map<std::string, uint32_t> string_offsets;
+		auto add_string = [&](const std::string& value) -> uint32_t
+		{
+			if (value.empty())
+				return 0;
+
+			const auto insert_result = string_offsets.emplace(value, uint32_t(strings.size()));
+			if (insert_result.second)
+				strings.insert(strings.end(), value.c_str(), value.c_str() + value.size() + 1);
+
+			return insert_result.first->second;
+		};
+
+		std::vector<symbol_file_entry> entries;
+		entries.reserve(frames.size());
+		for (const symbolized_frame& frame : frames)
+		{
+			symbol_file_entry entry;
+			entry.address = frame.address;
+			entry.function_offset = add_string(frame.function);
+			entry.file_offset = add_string(frame.file);
+			entry.module_offset = frame.module_index != UINT32_MAX ? add_string(symbols.get_module_path(frame.module_index)) : 0;
+			entry.line = frame.line;
+			entries.push_back(entry);
+		}
+
+		std::sort(entries.begin(), entries.end(), [](const symbol_file_entry& lhs, const symbol_file_entry& rhs) { return lhs.address < rhs.address; });
+		entries.erase(std::unique(entries.begin(), entries.end(), [](const symbol_file_entry& lhs, const symbol_file_entry& rhs) { return lhs.address == rhs.address; }), entries.end());
+
+		symbol_file_header header;
+		header.magic = k_symbol_file_magic;
+		header.version = k_symbol_file_version;
+		header.num_entries = entries.size();
+		header.strings_size = strings.size();
+
+		FILE* file = fopen(path, "wb");
+		if (file == nullptr)
+			return error_result("Failed to create the symbol file");
+
+		bool is_written = fwrite(&header, sizeof(header), 1, file) == 1;
+		is_written = is_written && (entries.empty() || fwrite(entries.data(), sizeof(symbol_file_entry), entries.size(), file) == entries.size());
+		is_written = is_written && fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+		is_written = fclose(file) == 0 && is_written;
+
+		return is_written ? error_result() : error_result("Failed to write the symbol file");
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Memory maps a symbol file and looks up frames by address.
+	////////////////////////////////////////////////////////////////////////////////
+	class symbol_file
+	{
+	public:
+		symbol_file() = default;
+		~symbol_file() { close(); }
+
+		symbol_file(const symbol_file&) = delete;
+		symbol_file& operator=(const symbol_file&) = delete;
+
+		error_result open(const char* path)
+		{
+			close();
+
+			const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				return error_result("Failed to open the symbol file");
+
+			struct stat file_stat;
+			if (fstat(fd, &file_stat) != 0 || file_stat.st_size < off_t(sizeof(symbol_file_header)))
+			{
+				::close(fd);
+				return error_result("Invalid symbol file");
+			}
+
+			void* data = mmap(nullptr, size_t(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);
+
+			if (data == MAP_FAILED)
+				return error_result("Failed to map the symbol file");
+
+			m_data = static_cast<const uint8_t*>(data);
+			m_size = uint64_t(file_stat.st_size);
+
+			const symbol_file_header& header = *reinterpret_cast<const symbol_file_header*>(m_data);
+			const bool is_valid = header.magic == k_symbol_file_magic && header.version == k_symbol_file_version
+				&& header.num_entries <= (m_size - sizeof(header)) / sizeof(symbol_file_entry)
+				&& header.strings_size != 0 && sizeof(header) + header.num_entries * sizeof(symbol_file_entry) + header.strings_size == m_size
+				&& m_data[m_size - 1] == '\0';
+
+			if (!is_valid)
+			{
+				close();
+				return error_result("Invalid symbol file");
+			}
+
+			m_entries = reinterpret_cast<const symbol_file_entry*>(m_data + sizeof(header));
+			m_num_entries = header.num_entries;
+			m_strings = reinterpret_cast<const char*>(m_entries + m_num_entries);
+			m_strings_size = header.strings_size;
+			return error_result();
+		}
+
+		void close()
+		{
+			if (m_data != nullptr)
+				munmap(const_cast<uint8_t*>(m_data), m_size);
+
+			m_data = nullptr;
+			m_size = 0;
+			m_entries = nullptr;
+			m_num_entries = 0;
+			m_strings = nullptr;
+			m_strings_size = 0;
+		}
+
+		bool is_open() const { return m_data != nullptr; }
+		uint64_t get_num_entries() const { return m_num_entries; }
+
+		// Returns false if the address was not symbolized
+		bool find(uint64_t address, symbol_file_frame& out_frame) const
+		{
+			const symbol_file_entry* entries_end = m_entries + m_num_entries;
+			const symbol_file_entry* entry = std::lower_bound(m_entries, entries_end, address, [](const symbol_file_entry& value, uint64_t key) { return value.address < key; });
+			if (entry == entries_end || entry->address != address)
+				return false;
+
+			out_frame.function = get_string(entry->function_offset);
+			out_frame.file = get_string(entry->file_offset);
+			out_frame.module = get_string(entry->module_offset);
+			out_frame.line = entry->line;
+			return true;
+		}
+
+	private:
+		const char* get_string(uint32_t offset) const { return offset < m_strings_size ? m_strings + offset : ""; }
+
+		const uint8_t*				m_data = nullptr;
+		uint64_t					m_size = 0;
+
+		const symbol_file_entry*	m_entries = nullptr;
+		uint64_t					m_num_entries = 0;
+
+		const char*					m_strings = nullptr;
+		uint64_t					m_strings_size = 0;
+	};
+}
@@ -0,0 +1,336 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/module_info.h"
+#include "vmemprof/symbols/module_symbols.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// A symbolized return address. Empty strings and a zero line are unknown.
+	////////////////////////////////////////////////////////////////////////////////
+	struct symbolized_frame
+	{
+		uint64_t		address;
+		std::string		function;		// Demangled
+		std::string		file;
+		uint32_t		line;
+		uint32_t		module_index;	// UINT32_MAX when the address is outside every module
+	};
+
+	struct symbolizer_settings
+	{
+		// Symbols are cached per build id in this directory, null disables the cache
+		const char*		cache_directory = nullptr;
+
+		// Zero uses every hardware thread
+		uint32_t		num_threads = 0;
+	};
+
+	struct symbolizer_stats
+	{
+		uint32_t		num_cached_modules = 0;		// Loaded from the cache
+		uint32_t		num_parsed_modules = 0;		// Parsed from their ELF file
+		uint32_t		num_failed_modules = 0;		// Missing, changed or unreadable
+		uint64_t		num_symbolized_frames = 0;	// Resolved to at least a function
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Symbolizes the return addresses of a trace offline.
+	//
+	// The module map recorded by the capture tells which module each address
+	// belongs to. Modules are loaded in parallel, from the cache when their build
+	// id was seen before, then frames are resolved in parallel. Every result only
+	// depends on its address, the output is deterministic whatever the number of
+	// threads.
+	////////////////////////////////////////////////////////////////////////////////
+	class symbolizer
+	{
+	public:
+		// Frames are resolved in blocks, threads pull the next block when done
+		static constexpr size_t k_frame_block_size = 1024;
+
+		error_result initialize(const trace_reader& reader)
+		{
+			m_modules.clear();
+
+			for (uint32_t module_chunk_index = 0; module_chunk_index < reader.get_num_module_chunks(); ++module_chunk_index)
+			{
+				const chunk_view chunk = reader.get_chunk(reader.get_module_chunk_index(module_chunk_index));
+				const error_result result = for_each_module_in_chunk(chunk, [this](const module_info& info)
+					{
+						loaded_module module;
+						module.info = info;
+						module.path.assign(info.path, info.path_length);
+						module.info.path = nullptr;
+						m_modules.push_back(std::move(module));
+						return true;
+					});
+
+				if (result.any())
+					return result;
+			}
+
+			// A range reused after an unload resolves to the module loaded last
+			std::stable_sort(m_modules.begin(), m_modules.end(), [](const loaded_module& lhs, const loaded_module& rhs) { return lhs.info.start < rhs.info.start; });
+			return error_result();
+		}
+
+		uint32_t get_num_modules() const { return uint32_t(m_modules.size()); }
+		const std::string& get_module_path(uint32_t module_index) const { return m_modules[module_index].path; }
+		const char* get_module_error(uint32_t module_index) const { return m_modules[module_index].error.any() ? m_modules[module_index].error.c_str() : nullptr; }
+
+		// Returns UINT32_MAX if no module contains the address
+		uint32_t find_module(uint64_t address) const
+		{
+			const auto module_it = std::upper_bound(m_modules.begin(), m_modules.end(), address, [](uint64_t value, const loaded_module& module) { return value < module.info.start; });
+			if (module_it == m_modules.begin() || !module_it[-1].info.contains(address))
+				return UINT32_MAX;
+
+			return uint32_t(module_it - m_modules.begin() - 1);
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Symbolizes return addresses, out_frames has one entry per address in the
+		// same order. Addresses should be unique, duplicates are resolved again.
+		////////////////////////////////////////////////////////////////////////////////
+		symbolizer_stats symbolize(const uint64_t* addresses, size_t num_addresses, const symbolizer_settings& settings, std::vector<symbolized_frame>& out_frames)
+		{
+			symbolizer_stats stats;
+			out_frames.clear();
+			out_frames.resize(num_addresses);
+
+			// Only the modules we need are loaded
+			std::vector<uint32_t> module_indices(num_addresses);
+			std::vector<uint8_t> is_module_needed(m_modules.size(), 0);
+			for (size_t address_index = 0; address_index < num_addresses; ++address_index)
+			{
+				const uint32_t module_index = find_module(addresses[address_index]);
+				module_indices[address_index] = module_index;
+				if (module_index != UINT32_MAX)
+					is_module_needed[module_index] = 1;
+			}
+
+			std::vector<uint32_t> needed_modules;
+			for (uint32_t module_index = 0; module_index < m_modules.size(); ++module_index)
+			{
+				if (is_module_needed[module_index] != 0 && !m_modules[module_index].is_loaded)
+					needed_modules.push_back(module_index);
+			}
+
+			if (settings.cache_directory != nullptr)
+				create_directories(settings.cache_directory);
+
+			const uint32_t num_threads = get_num_threads(settings);
+
+			std::atomic<uint32_t> next_module{ 0 };
+			std::atomic<uint32_t> num_cached_modules{ 0 };
+			run_parallel(num_threads, [&]()
+				{
+					for (uint32_t needed_index = next_module++; needed_index < needed_modules.size(); needed_index = next_module++)
+					{
+						if (load_module(m_modules[needed_modules[needed_index]], settings.cache_directory))
+							num_cached_modules++;
+					}
+				});
+
+			std::atomic<size_t> next_block{ 0 };
+			std::atomic<uint64_t> num_symbolized_frames{ 0 };
+			run_parallel(num_threads, [&]()
+				{
+					uint64_t num_block_symbolized = 0;
+					for (size_t block_index = next_block++; block_index * k_frame_block_size < num_addresses; block_index = next_block++)
+					{
+						const size_t block_end = std::min(num_addresses, (block_index + 1) * k_frame_block_size);
+						for (size_t address_index = block_index * k_frame_block_size; address_index < block_end; ++address_index)
+						{
+							if (resolve_frame(addresses[address_index], module_indices[address_index], out_frames[address_index]))
+								num_block_symbolized++;
+						}
+					}
+
+					num_symbolized_frames += num_block_symbolized;
+				});
+
+			for (uint32_t module_index : needed_modules)
+			{
+				if (m_modules[module_index].error.any())
+					stats.num_failed_modules++;
+			}
+
+			stats.num_cached_modules = num_cached_modules.load();
+			stats.num_parsed_modules = uint32_t(needed_modules.size()) - stats.num_cached_modules - stats.num_failed_modules;
+			stats.num_symbolized_frames = num_symbolized_frames.load();
+			return stats;
+		}
+
+		// Returns '$XDG_CACHE_HOME/vmemprof' or '$HOME/.cache/vmemprof', false if neither is set
+		static bool get_default_cache_directory(char* out_path, size_t out_path_size)
+		{
+			const char* cache_home = getenv("XDG_CACHE_HOME");
+			if (cache_home != nullptr && cache_home[0] != '\0')
+				return snprintf(out_path, out_path_size, "%s/vmemprof", cache_home) < int(out_path_size);
+
+			const char* home = getenv("HOME");
+			if (home != nullptr && home[0] != '\0')
+				return snprintf(out_path, out_path_size, "%s/.cache/vmemprof", home) < int(out_path_size);
+
+			return false;
+		}
+
+	private:
+		struct loaded_module
+		{
+			module_info		info;			// Its path is in 'path'
+			std::string		path;
+			module_symbols	symbols;
+			error_result	error;
+			bool			is_loaded = false;
+		};
+
+		// Returns true if the module was loaded from the cache
+		static bool load_module(loaded_module& module, const char* cache_directory)
+		{
+			module.is_loaded = true;
+
+			char cache_path[PATH_MAX];
+			const bool is_cacheable = cache_directory != nullptr && module.info.build_id_size != 0 && get_cache_path(cache_directory, module.info, cache_path, sizeof(cache_path));
+			if (is_cacheable && !module.symbols.load_cache(cache_path).any())
+				return true;
+
+			if (module.path.empty())
+			{
+				module.error = error_result("The module has no file");
+				return false;
+			}
+
+			module.error = module.symbols.build(module.path.c_str(), module.info.build_id_size != 0 ? module.info.build_id : nullptr, module.info.build_id_size);
+
+			// Failing to write the cache only costs time on the next run
+			if (!module.error.any() && is_cacheable)
+				module.symbols.save_cache(cache_path);
+
+			return false;
+		}
+
+		bool resolve_frame(uint64_t address, uint32_t module_index, symbolized_frame& out_frame) const
+		{
+			out_frame.address = address;
+			out_frame.line = 0;
+			out_frame.module_index = module_index;
+
+			if (module_index == UINT32_MAX || m_modules[module_index].error.any())
+				return false;
+
+			// Return addresses point after the call, the call instruction is one byte before at least
+			const loaded_module& module = m_modules[module_index];
+			source_location location;
+			if (!module.symbols.lookup(address - module.info.load_address - 1, location))
+				return false;
+
+			if (location.function != nullptr)
+			{
+				int status = 0;
+				char* demangled = abi::__cxa_demangle(location.function, nullptr, nullptr, &status);
+				out_frame.function = status == 0 && demangled != nullptr ? demangled : location.function;
+				free(demangled);
+			}
+
+			if (location.file != nullptr)
+				out_frame.file = location.file;
+			out_frame.line = location.line;
+			return location.function != nullptr;
+		}
+
+		static bool get_cache_path(const char* cache_directory, const module_info& info, char* out_path, size_t out_path_size)
+		{
+			size_t length = size_t(snprintf(out_path, out_path_size, "%s/", cache_directory));
+			for (uint32_t byte_index = 0; byte_index < info.build_id_size && length + 3 < out_path_size; ++byte_index)
+				length += size_t(snprintf(out_path + length, out_path_size - length, "%02x", info.build_id[byte_index]));
+
+			return snprintf(out_path + length, out_path_size - length, ".vsym") < int(out_path_size - length);
+		}
+
+		static void create_directories(const char* path)
+		{
+			char partial_path[PATH_MAX];
+			const size_t path_length = std::strlen(path);
+			if (path_length >= sizeof(partial_path))
+				return;
+
+			// Every parent is created in turn, existing ones are fine
+			for (size_t char_index = 1; char_index <= path_length; ++char_index)
+			{
+				if (path[char_index] != '/' && path[char_index] != '\0')
+					continue;
+
+				std::memcpy(partial_path, path, char_index);
+				partial_path[char_index] = '\0';
+				mkdir(partial_path, 0755);
+			}
+		}
+
+		static uint32_t get_num_threads(const symbolizer_settings& settings)
+		{
+			if (settings.num_threads != 0)
+				return settings.num_threads;
+
+			const uint32_t num_hardware_threads = std::thread::hardware_concurrency();
+			return num_hardware_threads != 0 ? num_hardware_threads : 1;
+		}
+
+		// The calling thread participates
+		template<typename function_type>
+		static void run_parallel(uint32_t num_threads, function_type function)
+		{
+			std::vector<std::thread> threads;
+			for (uint32_t thread_index = 1; thread_index < num_threads; ++thread_index)
+				threads.emplace_back(function);
+
+			function();
+
+			for (std::thread& thread : threads)
+				thread.join();
+		}
+
+		std::vector<loaded_module>	m_modules;
+	};
+}
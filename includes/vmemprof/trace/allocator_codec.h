@@ -0,0 +1,109 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/allocator_sample.h"
+#include "vmemprof/trace/varint.h"
+
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+// Allocator sample encoding
+//
+// Each sample is encoded as:
+//    zigzag varint: timestamp delta with the previous sample
+//    varint:        allocator
+//    varint:        arena
+//    varint:        mapped bytes
+//    varint:        allocated bytes
+//    varint:        free bytes
+//    varint:        released bytes
+//
+// A poll writes one sample per arena with the same timestamp. Allocators
+// account in bytes rather than pages, sizes are written as is. The delta
+// state is reset at the start of every chunk.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	// Largest size of an allocator sample once encoded
+	constexpr uint32_t k_max_encoded_allocator_sample_size = 10 + 5 + 5 + 10 + 10 + 10 + 10;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Encodes or decodes a sequence of allocator samples.
+	////////////////////////////////////////////////////////////////////////////////
+	class allocator_codec
+	{
+	public:
+		void reset(uint64_t first_timestamp)
+		{
+			m_previous_timestamp = first_timestamp;
+		}
+
+		// The output must have room for k_max_encoded_allocator_sample_size bytes. Returns the end of the written data.
+		uint8_t* encode(const allocator_sample& sample, uint8_t* output)
+		{
+			output = write_varint(output, zigzag_encode(int64_t(sample.timestamp - m_previous_timestamp)));
+			output = write_varint(output, uint64_t(sample.allocator));
+			output = write_varint(output, sample.arena);
+			output = write_varint(output, sample.mapped_bytes);
+			output = write_varint(output, sample.allocated_bytes);
+			output = write_varint(output, sample.free_bytes);
+			output = write_varint(output, sample.released_bytes);
+
+			m_previous_timestamp = sample.timestamp;
+			return output;
+		}
+
+		// Returns the end of the consumed data or nullptr if the input is malformed
+		const uint8_t* decode(const uint8_t* input, const uint8_t* input_end, allocator_sample& out_sample)
+		{
+			uint64_t values[7];
+			for (uint64_t& value : values)
+			{
+				input = read_varint(input, input_end, value);
+				if (input == nullptr)
+					return nullptr;
+			}
+
+			if (values[1] >= uint64_t(allocator_kind::count) || values[2] > UINT32_MAX)
+				return nullptr;
+
+			out_sample.timestamp = m_previous_timestamp + uint64_t(zigzag_decode(values[0]));
+			out_sample.allocator = allocator_kind(values[1]);
+			out_sample.arena = uint32_t(values[2]);
+			out_sample.mapped_bytes = values[3];
+			out_sample.allocated_bytes = values[4];
+			out_sample.free_bytes = values[5];
+			out_sample.released_bytes = values[6];
+
+			m_previous_timestamp = out_sample.timestamp;
+			return input;
+		}
+
+	private:
+		uint64_t	m_previous_timestamp = 0;
+	};
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/trace/lz_codec.h"
+#include "vmemprof/trace/trace_format.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(VMEMPROF_USE_ZSTD)
+#include <zstd.h>
+#endif
+
+namespace vmemprof
+{
+	// Smaller payloads are stored as is, the header would eat most of the gain
+	constexpr uint32_t k_min_compressed_payload_size = 256;
+
+	// Writers never produce larger chunks, larger decompressed sizes are treated as corruption
+	constexpr uint32_t k_max_decompressed_payload_size = 64 * 1024 * 1024;
+
+	// Fast levels keep up with the drain thread
+	constexpr int k_zstd_compression_level = 3;
+
+	// True when this build can compress and decompress with the codec
+	inline bool is_chunk_compression_supported(chunk_compression compression)
+	{
+		switch (compression)
+		{
+		case chunk_compression::none:
+		case chunk_compression::lz:
+			return true;
+#if defined(VMEMPROF_USE_ZSTD)
+		case chunk_compression::zstd:
+			return true;
+#endif
+		default:
+			return false;
+		}
+	}
+
+	// Largest stored payload of a compressed chunk, header included
+	inline uint32_t get_max_compressed_payload_size(chunk_compression compression, uint32_t size)
+	{
+		uint64_t max_size = size;
+		if (compression == chunk_compression::lz)
+			max_size = get_lz_max_compressed_size(size);
+#if defined(VMEMPROF_USE_ZSTD)
+		else if (compression == chunk_compression::zstd)
+			max_size = ZSTD_compressBound(size);
+#endif
+
+		return uint32_t(sizeof(compressed_payload_header) + max_size);
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Compresses a chunk payload into the stored format, a compressed_payload_header
+	// followed by the compressed data. The output must have room for
+	// get_max_compressed_payload_size(compression, size) bytes. Returns the stored
+	// size, or zero when the payload is better stored as is.
+	////////////////////////////////////////////////////////////////////////////////
+	inline uint32_t compress_chunk_payload(chunk_compression compression, const uint8_t* payload, uint32_t size, uint8_t* output)
+	{
+		if (size < k_min_compressed_payload_size || !is_chunk_compression_supported(compression))
+			return 0;
+
+		uint8_t* data = output + sizeof(compressed_payload_header);
+		uint64_t data_size = 0;
+		if (compression == chunk_compression::lz)
+			data_size = lz_compress(payload, size, data);
+#if defined(VMEMPROF_USE_ZSTD)
+		else if (compression == chunk_compression::zstd)
+		{
+			const size_t result = ZSTD_compress(data, ZSTD_compressBound(size), payload, size, k_zstd_compression_level);
+			if (ZSTD_isError(result))
+				return 0;
+
+			data_size = result;
+		}
+#endif
+		else
+			return 0;
+
+		const uint64_t stored_size = sizeof(compressed_payload_header) + data_size;
+		if (stored_size >= size)
+			return 0;
+
+		const compressed_payload_header header = { size, 0 };
+		std::memcpy(output, &header, sizeof(header));
+		return uint32_t(stored_size);
+	}
+
+	// Returns the size of a stored payload once decompressed, zero if the stored payload is too small to be valid
+	inline uint32_t get_decompressed_payload_size(const uint8_t* stored_payload, uint32_t stored_size)
+	{
+		if (stored_size < sizeof(compressed_payload_header))
+			return 0;
+
+		compressed_payload_header header;
+		std::memcpy(&header, stored_payload, sizeof(header));
+		return header.uncompressed_size;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Decompresses a stored payload into 'output', which must have room for
+	// get_decompressed_payload_size() bytes.
+	////////////////////////////////////////////////////////////////////////////////
+	inline error_result decompress_chunk_payload(chunk_compression compression, const uint8_t* stored_payload, uint32_t stored_size, uint8_t* output)
+	{
+		const uint32_t size = get_decompressed_payload_size(stored_payload, stored_size);
+		if (stored_size < sizeof(compressed_payload_header) || size > k_max_decompressed_payload_size)
+			return error_result("Corrupted compressed chunk");
+
+		const uint8_t* data = stored_payload + sizeof(compressed_payload_header);
+		const uint32_t data_size = stored_size - uint32_t(sizeof(compressed_payload_header));
+
+		if (compression == chunk_compression::lz)
+			return lz_decompress(data, data_size, output, size) ? error_result() : error_result("Corrupted compressed chunk");
+
+#if defined(VMEMPROF_USE_ZSTD)
+		if (compression == chunk_compression::zstd)
+		{
+			const size_t result = ZSTD_decompress(output, size, data, data_size);
+			return !ZSTD_isError(result) && result == size ? error_result() : error_result("Corrupted compressed chunk");
+		}
+#endif
+
+		if (compression == chunk_compression::zstd)
+			return error_result("The trace is compressed with zstd, rebuild with zstd to read it");
+
+		return error_result("Unknown chunk compression");
+	}
+}
@@ -0,0 +1,300 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/compiler_utils.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/trace/varint.h"
+
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+// Event encoding
+//
+// Every event starts with a tag byte:
+//    bits 0-4: event type
+//    bit 5:    same thread id as the previous event
+//    bit 6:    same stack id as the previous event
+//    bit 7:    same attributes (flags, protection, arg0, arg1) as the previous event of the same type
+//
+// Followed by:
+//    zigzag varint: timestamp delta with the previous event
+//    varint:        thread id, unless bit 5 is set
+//    varint:        stack id, unless bit 6 is set
+//    varint:        address delta with the previous event, see write_address_delta
+//    varint:        size, see write_size
+//    attributes unless bit 7 is set: varint flags, varint protection, zigzag varint arg0, zigzag varint arg1
+//
+// Virtual memory ranges are almost always page aligned, page aligned addresses
+// and sizes are encoded in pages which saves 12 bits each. In steady state an
+// mmap or munmap encodes in 5 to 7 bytes.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	// Largest size of an event once encoded
+	constexpr uint32_t k_max_encoded_event_size = 1 + 10 + 5 + 5 + 10 + 10 + 5 + 5 + 10 + 10;
+
+	namespace event_codec_impl
+	{
+		constexpr uint64_t k_page_shift = 12;
+		constexpr uint64_t k_page_mask = (uint64_t(1) << k_page_shift) - 1;
+
+		constexpr uint8_t k_type_mask = 0x1F;
+		constexpr uint8_t k_same_thread_bit = 0x20;
+		constexpr uint8_t k_same_stack_bit = 0x40;
+		constexpr uint8_t k_same_attributes_bit = 0x80;
+
+		static_assert(uint32_t(event_type::count) <= k_type_mask, "Too many event types for the tag byte");
+
+		struct event_attributes
+		{
+			uint64_t	arg0;
+			uint64_t	arg1;
+			uint32_t	flags;
+			uint32_t	protection;
+		};
+
+		// The delta state shared by the encoder and the decoder
+		struct codec_state
+		{
+			uint64_t			timestamp;
+			uint64_t			address;
+			uint32_t			thread_id;
+			uint32_t			stack_id;
+			event_attributes	attributes[uint32_t(event_type::count)];
+
+			void reset(uint64_t base_timestamp)
+			{
+				timestamp = base_timestamp;
+				address = 0;
+				thread_id = 0;
+				stack_id = k_invalid_stack_id;
+
+				for (event_attributes& type_attributes : attributes)
+					type_attributes = event_attributes{ 0, 0, 0, 0 };
+			}
+		};
+
+		VMEMPROF_FORCE_INLINE uint8_t* write_address_delta(uint8_t* output, int64_t delta)
+		{
+			// Low bit tags whether the delta is expressed in pages or in bytes
+			if ((uint64_t(delta) & k_page_mask) == 0)
+				return write_varint(output, zigzag_encode(delta >> k_page_shift) << 1);
+			else
+				return write_varint(output, (zigzag_encode(delta) << 1) | 1);
+		}
+
+		VMEMPROF_FORCE_INLINE const uint8_t* read_address_delta(const uint8_t* input, const uint8_t* input_end, int64_t& out_delta)
+		{
+			uint64_t value;
+			input = read_varint(input, input_end, value);
+			if (input == nullptr)
+				return nullptr;
+
+			const int64_t delta = zigzag_decode(value >> 1);
+			out_delta = (value & 1) != 0 ? delta : int64_t(uint64_t(delta) << k_page_shift);
+			return input;
+		}
+
+		VMEMPROF_FORCE_INLINE uint8_t* write_size(uint8_t* output, uint64_t size)
+		{
+			if ((size & k_page_mask) == 0)
+				return write_varint(output, (size >> k_page_shift) << 1);
+			else
+				return write_varint(output, (size << 1) | 1);
+		}
+
+		VMEMPROF_FORCE_INLINE const uint8_t* read_size(const uint8_t* input, const uint8_t* input_end, uint64_t& out_size)
+		{
+			uint64_t value;
+			input = read_varint(input, input_end, value);
+			if (input == nullptr)
+				return nullptr;
+
+			out_size = (value & 1) != 0 ? (value >> 1) : ((value >> 1) << k_page_shift);
+			return input;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Encodes events relative to the previously encoded event.
+	////////////////////////////////////////////////////////////////////////////////
+	class event_encoder
+	{
+	public:
+		void reset(uint64_t base_timestamp) { m_state.reset(base_timestamp); }
+
+		// Returns the end of the encoded event, the output must have room for k_max_encoded_event_size bytes
+		uint8_t* encode(const vm_event& event, uint8_t* output)
+		{
+			using namespace event_codec_impl;
+
+			event_attributes& previous_attributes = m_state.attributes[uint32_t(event.type)];
+			const bool is_same_thread = event.thread_id == m_state.thread_id;
+			const bool is_same_stack = event.stack_id == m_state.stack_id;
+			const bool is_same_attributes = event.flags == previous_attributes.flags
+				&& event.protection == previous_attributes.protection
+				&& event.arg0 == previous_attributes.arg0
+				&& event.arg1 == previous_attributes.arg1;
+
+			uint8_t tag = uint8_t(event.type);
+			if (is_same_thread)
+				tag |= k_same_thread_bit;
+			if (is_same_stack)
+				tag |= k_same_stack_bit;
+			if (is_same_attributes)
+				tag |= k_same_attributes_bit;
+
+			*output++ = tag;
+			output = write_varint(output, zigzag_encode(int64_t(event.timestamp - m_state.timestamp)));
+
+			if (!is_same_thread)
+				output = write_varint(output, event.thread_id);
+
+			if (!is_same_stack)
+				output = write_varint(output, event.stack_id);
+
+			output = write_address_delta(output, int64_t(event.address - m_state.address));
+			output = write_size(output, event.size);
+
+			if (!is_same_attributes)
+			{
+				output = write_varint(output, event.flags);
+				output = write_varint(output, event.protection);
+				output = write_varint(output, zigzag_encode(int64_t(event.arg0)));
+				output = write_varint(output, zigzag_encode(int64_t(event.arg1)));
+
+				previous_attributes = event_attributes{ event.arg0, event.arg1, event.flags, event.protection };
+			}
+
+			m_state.timestamp = event.timestamp;
+			m_state.address = event.address;
+			m_state.thread_id = event.thread_id;
+			m_state.stack_id = event.stack_id;
+
+			return output;
+		}
+
+	private:
+		event_codec_impl::codec_state m_state;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Decodes events encoded by the event_encoder.
+	////////////////////////////////////////////////////////////////////////////////
+	class event_decoder
+	{
+	public:
+		void reset(uint64_t base_timestamp) { m_state.reset(base_timestamp); }
+
+		// Returns the end of the decoded event or nullptr if the input is malformed
+		const uint8_t* decode(const uint8_t* input, const uint8_t* input_end, vm_event& out_event)
+		{
+			using namespace event_codec_impl;
+
+			if (input >= input_end)
+				return nullptr;
+
+			const uint8_t tag = *input++;
+			const uint32_t type = tag & k_type_mask;
+			if (type >= uint32_t(event_type::count))
+				return nullptr;
+
+			uint64_t timestamp_delta;
+			input = read_varint(input, input_end, timestamp_delta);
+			if (input == nullptr)
+				return nullptr;
+
+			m_state.timestamp += uint64_t(zigzag_decode(timestamp_delta));
+
+			if ((tag & k_same_thread_bit) == 0)
+			{
+				uint64_t thread_id;
+				input = read_varint(input, input_end, thread_id);
+				if (input == nullptr)
+					return nullptr;
+
+				m_state.thread_id = uint32_t(thread_id);
+			}
+
+			if ((tag & k_same_stack_bit) == 0)
+			{
+				uint64_t stack_id;
+				input = read_varint(input, input_end, stack_id);
+				if (input == nullptr)
+					return nullptr;
+
+				m_state.stack_id = uint32_t(stack_id);
+			}
+
+			int64_t address_delta;
+			input = read_address_delta(input, input_end, address_delta);
+			if (input == nullptr)
+				return nullptr;
+
+			m_state.address += uint64_t(address_delta);
+
+			uint64_t size;
+			input = read_size(input, input_end, size);
+			if (input == nullptr)
+				return nullptr;
+
+			event_attributes& attributes = m_state.attributes[type];
+			if ((tag & k_same_attributes_bit) == 0)
+			{
+				uint64_t flags;
+				uint64_t protection;
+				uint64_t arg0;
+				uint64_t arg1;
+
+				input = read_varint(input, input_end, flags);
+				input = input != nullptr ? read_varint(input, input_end, protection) : nullptr;
+				input = input != nullptr ? read_varint(input, input_end, arg0) : nullptr;
+				input = input != nullptr ? read_varint(input, input_end, arg1) : nullptr;
+				if (input == nullptr)
+					return nullptr;
+
+				attributes = event_attributes{ uint64_t(zigzag_decode(arg0)), uint64_t(zigzag_decode(arg1)), uint32_t(flags), uint32_t(protection) };
+			}
+
+			out_event.timestamp = m_state.timestamp;
+			out_event.address = m_state.address;
+			out_event.size = size;
+			out_event.arg0 = attributes.arg0;
+			out_event.arg1 = attributes.arg1;
+			out_event.thread_id = m_state.thread_id;
+			out_event.stack_id = m_state.stack_id;
+			out_event.flags = attributes.flags;
+			out_event.protection = attributes.protection;
+			out_event.type = event_type(type);
+
+			return input;
+		}
+
+	private:
+		event_codec_impl::codec_state m_state;
+	};
+}
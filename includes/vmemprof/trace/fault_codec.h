@@ -0,0 +1,159 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/fault_sample.h"
+#include "vmemprof/trace/varint.h"
+
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+// Fault sample encoding
+//
+// Every sample starts with a tag byte:
+//    bit 0: same thread id as the previous sample
+//    bit 1: same stack id as the previous sample
+//    bit 2: a CPU follows the stack id
+//    bit 3: same CPU as the previous sample
+//    bits 4-7: reserved
+//
+// Followed by:
+//    zigzag varint: timestamp delta with the previous sample
+//    varint:        flags
+//    varint:        thread id, unless bit 0 is set
+//    varint:        stack id, unless bit 1 is set
+//    varint:        CPU, if bit 2 is set
+//    zigzag varint: address delta with the previous sample
+//    zigzag varint: instruction pointer delta with the previous sample
+//
+// Faults come in bursts from the same loop touching neighbouring pages, most
+// samples only pay for the time, address and instruction deltas. Samples that
+// set neither CPU bit have an unknown CPU, older traces decode that way.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	// Largest size of a fault sample once encoded
+	constexpr uint32_t k_max_encoded_fault_sample_size = 1 + 10 + 5 + 5 + 5 + 5 + 10 + 10;
+
+	namespace fault_codec_impl
+	{
+		constexpr uint8_t k_same_thread_bit = 0x01;
+		constexpr uint8_t k_same_stack_bit = 0x02;
+		constexpr uint8_t k_has_cpu_bit = 0x04;
+		constexpr uint8_t k_same_cpu_bit = 0x08;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Encodes or decodes a sequence of fault samples.
+	////////////////////////////////////////////////////////////////////////////////
+	class fault_codec
+	{
+	public:
+		void reset(uint64_t first_timestamp)
+		{
+			m_previous = fault_sample{ first_timestamp, 0, 0, 0, k_invalid_stack_id, 0, k_unknown_cpu };
+		}
+
+		// The output must have room for k_max_encoded_fault_sample_size bytes. Returns the end of the written data.
+		uint8_t* encode(const fault_sample& sample, uint8_t* output)
+		{
+			using namespace fault_codec_impl;
+
+			const bool is_same_thread = sample.thread_id == m_previous.thread_id;
+			const bool is_same_stack = sample.stack_id == m_previous.stack_id;
+
+			const bool is_same_cpu = sample.cpu == m_previous.cpu;
+			const bool has_cpu = !is_same_cpu && sample.cpu != k_unknown_cpu;
+
+			*output++ = (is_same_thread ? k_same_thread_bit : 0) | (is_same_stack ? k_same_stack_bit : 0) | (has_cpu ? k_has_cpu_bit : 0) | (is_same_cpu ? k_same_cpu_bit : 0);
+			output = write_varint(output, zigzag_encode(int64_t(sample.timestamp - m_previous.timestamp)));
+			output = write_varint(output, sample.flags);
+
+			if (!is_same_thread)
+				output = write_varint(output, sample.thread_id);
+
+			if (!is_same_stack)
+				output = write_varint(output, sample.stack_id);
+
+			if (has_cpu)
+				output = write_varint(output, sample.cpu);
+
+			output = write_varint(output, zigzag_encode(int64_t(sample.address - m_previous.address)));
+			output = write_varint(output, zigzag_encode(int64_t(sample.instruction_pointer - m_previous.instruction_pointer)));
+
+			m_previous = sample;
+			return output;
+		}
+
+		// Returns the end of the consumed data or nullptr if the input is malformed
+		const uint8_t* decode(const uint8_t* input, const uint8_t* input_end, fault_sample& out_sample)
+		{
+			using namespace fault_codec_impl;
+
+			if (input >= input_end)
+				return nullptr;
+
+			const uint8_t tag = *input++;
+
+			uint64_t timestamp_delta;
+			uint64_t flags;
+			uint64_t thread_id = m_previous.thread_id;
+			uint64_t stack_id = m_previous.stack_id;
+			uint64_t cpu = (tag & k_same_cpu_bit) != 0 ? m_previous.cpu : k_unknown_cpu;
+			uint64_t address_delta;
+			uint64_t instruction_pointer_delta;
+
+			input = read_varint(input, input_end, timestamp_delta);
+			input = input != nullptr ? read_varint(input, input_end, flags) : nullptr;
+			if (input != nullptr && (tag & k_same_thread_bit) == 0)
+				input = read_varint(input, input_end, thread_id);
+			if (input != nullptr && (tag & k_same_stack_bit) == 0)
+				input = read_varint(input, input_end, stack_id);
+			if (input != nullptr && (tag & k_has_cpu_bit) != 0)
+				input = read_varint(input, input_end, cpu);
+			input = input != nullptr ? read_varint(input, input_end, address_delta) : nullptr;
+			input = input != nullptr ? read_varint(input, input_end, instruction_pointer_delta) : nullptr;
+
+			if (input == nullptr || flags > UINT32_MAX || thread_id > UINT32_MAX || stack_id > UINT32_MAX || cpu > UINT32_MAX)
+				return nullptr;
+
+			out_sample.timestamp = m_previous.timestamp + uint64_t(zigzag_decode(timestamp_delta));
+			out_sample.address = m_previous.address + uint64_t(zigzag_decode(address_delta));
+			out_sample.instruction_pointer = m_previous.instruction_pointer + uint64_t(zigzag_decode(instruction_pointer_delta));
+			out_sample.thread_id = uint32_t(thread_id);
+			out_sample.stack_id = uint32_t(stack_id);
+			out_sample.flags = uint32_t(flags);
+			out_sample.cpu = uint32_t(cpu);
+
+			m_previous = out_sample;
+			return input;
+		}
+
+	private:
+		fault_sample	m_previous = {};
+	};
+}
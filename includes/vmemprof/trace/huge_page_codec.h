@@ -0,0 +1,122 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/huge_page_sample.h"
+#include "vmemprof/trace/varint.h"
+
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+// Huge page sample encoding
+//
+// Each sample is encoded as:
+//    zigzag varint: timestamp delta with the previous sample
+//    zigzag varint: start delta in 4 KB units with the end of the previous sample
+//    varint:        size in 4 KB units
+//    varint:        resident size in 4 KB units
+//    varint:        AnonHugePages in 4 KB units
+//    varint:        hugetlb size in 4 KB units
+//    varint:        flags
+//
+// A poll reports VMAs in address order, consecutive samples are close to each
+// other. The delta state is reset at the start of every chunk.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	// Largest size of a huge page sample once encoded
+	constexpr uint32_t k_max_encoded_huge_page_sample_size = 10 + 10 + 10 + 10 + 10 + 10 + 5;
+
+	namespace huge_page_codec_impl
+	{
+		// smaps sizes are in KB and VMAs are page aligned
+		constexpr uint64_t k_unit_shift = 12;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Encodes or decodes a sequence of huge page samples.
+	////////////////////////////////////////////////////////////////////////////////
+	class huge_page_codec
+	{
+	public:
+		void reset(uint64_t first_timestamp)
+		{
+			m_previous_timestamp = first_timestamp;
+			m_previous_end = 0;
+		}
+
+		// The output must have room for k_max_encoded_huge_page_sample_size bytes. Returns the end of the written data.
+		uint8_t* encode(const huge_page_sample& sample, uint8_t* output)
+		{
+			using namespace huge_page_codec_impl;
+
+			output = write_varint(output, zigzag_encode(int64_t(sample.timestamp - m_previous_timestamp)));
+			output = write_varint(output, zigzag_encode(int64_t(sample.start - m_previous_end) >> k_unit_shift));
+			output = write_varint(output, (sample.end - sample.start) >> k_unit_shift);
+			output = write_varint(output, sample.resident_bytes >> k_unit_shift);
+			output = write_varint(output, sample.anon_huge_bytes >> k_unit_shift);
+			output = write_varint(output, sample.hugetlb_bytes >> k_unit_shift);
+			output = write_varint(output, sample.flags);
+
+			m_previous_timestamp = sample.timestamp;
+			m_previous_end = sample.end;
+			return output;
+		}
+
+		// Returns the end of the consumed data or nullptr if the input is malformed
+		const uint8_t* decode(const uint8_t* input, const uint8_t* input_end, huge_page_sample& out_sample)
+		{
+			using namespace huge_page_codec_impl;
+
+			uint64_t values[7];
+			for (uint64_t& value : values)
+			{
+				input = read_varint(input, input_end, value);
+				if (input == nullptr)
+					return nullptr;
+			}
+
+			if (values[6] > UINT32_MAX)
+				return nullptr;
+
+			out_sample.timestamp = m_previous_timestamp + uint64_t(zigzag_decode(values[0]));
+			out_sample.start = m_previous_end + (uint64_t(zigzag_decode(values[1])) << k_unit_shift);
+			out_sample.end = out_sample.start + (values[2] << k_unit_shift);
+			out_sample.resident_bytes = values[3] << k_unit_shift;
+			out_sample.anon_huge_bytes = values[4] << k_unit_shift;
+			out_sample.hugetlb_bytes = values[5] << k_unit_shift;
+			out_sample.flags = uint32_t(values[6]);
+
+			m_previous_timestamp = out_sample.timestamp;
+			m_previous_end = out_sample.end;
+			return input;
+		}
+
+	private:
+		uint64_t	m_previous_timestamp = 0;
+		uint64_t	m_previous_end = 0;
+	};
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/compiler_utils.h"
+
+#include <cstdint>
+#include <cstring>
+
+////////////////////////////////////////////////////////////////////////////////
+// A byte oriented LZ77 codec in the style of LZ4, fast enough to compress on
+// the capture side and to decode at several GB/s.
+//
+// The compressed data is a sequence of sequences. Each one starts with a token
+// byte holding the literal length in its high nibble and the match length minus
+// k_lz_min_match in its low nibble, a nibble of 15 is followed by bytes adding
+// to it until one is below 255. The literals follow, then the match offset as a
+// little endian 16 bit value. The last sequence only has literals.
+//
+// Matches end at least k_lz_last_literals bytes before the end and start at
+// least k_lz_match_limit bytes before it, the decoder relies on it to copy in
+// wide blocks.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	constexpr uint32_t k_lz_min_match = 4;
+	constexpr uint32_t k_lz_last_literals = 5;
+	constexpr uint32_t k_lz_match_limit = 12;
+	constexpr uint32_t k_lz_max_offset = 65535;
+
+	// Largest compressed size of an input
+	constexpr uint32_t get_lz_max_compressed_size(uint32_t size) { return size + size / 255 + 16; }
+
+	namespace lz_impl
+	{
+		constexpr uint32_t k_hash_bits = 12;
+
+		VMEMPROF_FORCE_INLINE uint32_t read_u32(const uint8_t* input)
+		{
+			uint32_t value;
+			std::memcpy(&value, input, sizeof(value));
+			return value;
+		}
+
+		VMEMPROF_FORCE_INLINE uint64_t read_u64(const uint8_t* input)
+		{
+			uint64_t value;
+			std::memcpy(&value, input, sizeof(value));
+			return value;
+		}
+
+		VMEMPROF_FORCE_INLINE uint32_t hash(uint32_t value)
+		{
+			return (value * 2654435761U) >> (32 - k_hash_bits);
+		}
+
+		// Number of bytes that match, stops at limit
+		VMEMPROF_FORCE_INLINE uint32_t count_matching(const uint8_t* input, const uint8_t* match, const uint8_t* limit)
+		{
+			const uint8_t* start = input;
+			while (input + sizeof(uint64_t) <= limit)
+			{
+				const uint64_t difference = read_u64(input) ^ read_u64(match);
+				if (difference != 0)
+					return uint32_t(input - start) + uint32_t(__builtin_ctzll(difference) >> 3);
+
+				input += sizeof(uint64_t);
+				match += sizeof(uint64_t);
+			}
+
+			while (input < limit && *input == *match)
+			{
+				input++;
+				match++;
+			}
+
+			return uint32_t(input - start);
+		}
+
+		VMEMPROF_FORCE_INLINE uint8_t* write_length(uint8_t* output, uint32_t length)
+		{
+			for (; length >= 255; length -= 255)
+				*output++ = 255;
+
+			*output++ = uint8_t(length);
+			return output;
+		}
+
+		VMEMPROF_FORCE_INLINE uint8_t* write_sequence(uint8_t* output, const uint8_t* literals, uint32_t literal_length, uint32_t offset, uint32_t match_length)
+		{
+			uint8_t* token = output++;
+			*token = uint8_t((literal_length >= 15 ? 15 : literal_length) << 4);
+			if (literal_length >= 15)
+				output = write_length(output, literal_length - 15);
+
+			std::memcpy(output, literals, literal_length);
+			output += literal_length;
+
+			if (match_length == 0)
+				return output;
+
+			output[0] = uint8_t(offset);
+			output[1] = uint8_t(offset >> 8);
+			output += 2;
+
+			const uint32_t extra_length = match_length - k_lz_min_match;
+			*token |= uint8_t(extra_length >= 15 ? 15 : extra_length);
+			if (extra_length >= 15)
+				output = write_length(output, extra_length - 15);
+
+			return output;
+		}
+
+		// Reads the extension bytes of a length nibble of 15, returns nullptr if the input ends first
+		VMEMPROF_FORCE_INLINE const uint8_t* read_length(const uint8_t* input, const uint8_t* input_end, uint32_t& length)
+		{
+			uint8_t value;
+			do
+			{
+				if (VMEMPROF_UNLIKELY(input >= input_end))
+					return nullptr;
+
+				value = *input++;
+				length += value;
+			} while (value == 255);
+
+			return input;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Compresses an input, the output must have room for
+	// get_lz_max_compressed_size(size) bytes. Returns the compressed size.
+	////////////////////////////////////////////////////////////////////////////////
+	inline uint32_t lz_compress(const uint8_t* input, uint32_t size, uint8_t* output)
+	{
+		using namespace lz_impl;
+
+		uint8_t* output_start = output;
+		const uint8_t* anchor = input;
+
+		if (size > k_lz_match_limit)
+		{
+			// Positions of the last 4 bytes seen with each hash
+			uint32_t table[1 << k_hash_bits] = { 0 };
+
+			const uint8_t* match_start_end = input + size - k_lz_match_limit;
+			const uint8_t* match_end_limit = input + size - k_lz_last_literals;
+
+			const uint8_t* cursor = input + 1;
+			while (cursor < match_start_end)
+			{
+				const uint32_t value = read_u32(cursor);
+				const uint32_t hash_index = hash(value);
+				const uint8_t* match = input + table[hash_index];
+				table[hash_index] = uint32_t(cursor - input);
+
+				if (match >= cursor || uint32_t(cursor - match) > k_lz_max_offset || read_u32(match) != value)
+				{
+					// Skip faster through data that does not compress
+					cursor += 1 + ((cursor - anchor) >> 6);
+					continue;
+				}
+
+				// Extend backwards over the literals
+				while (cursor > anchor && match > input && cursor[-1] == match[-1])
+				{
+					cursor--;
+					match--;
+				}
+
+				const uint32_t match_length = k_lz_min_match + count_matching(cursor + k_lz_min_match, match + k_lz_min_match, match_end_limit);
+				output = write_sequence(output, anchor, uint32_t(cursor - anchor), uint32_t(cursor - match), match_length);
+
+				cursor += match_length;
+				anchor = cursor;
+
+				// Index a position inside the match to find repetitions sooner
+				if (cursor < match_start_end)
+					table[hash(read_u32(cursor - 2))] = uint32_t(cursor - 2 - input);
+			}
+		}
+
+		output = lz_impl::write_sequence(output, anchor, uint32_t(input + size - anchor), 0, 0);
+		return uint32_t(output - output_start);
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Decompresses an input that must decode to exactly output_size bytes.
+	// Returns false if the input is corrupted, nothing is read or written out of
+	// bounds.
+	////////////////////////////////////////////////////////////////////////////////
+	inline bool lz_decompress(const uint8_t* input, uint32_t input_size, uint8_t* output, uint32_t output_size)
+	{
+		using namespace lz_impl;
+
+		const uint8_t* input_end = input + input_size;
+		uint8_t* output_start = output;
+		uint8_t* output_end = output + output_size;
+
+		while (true)
+		{
+			if (VMEMPROF_UNLIKELY(input >= input_end))
+				return false;
+
+			const uint32_t token = *input++;
+
+			uint32_t literal_length = token >> 4;
+			if (literal_length == 15)
+			{
+				input = read_length(input, input_end, literal_length);
+				if (input == nullptr)
+					return false;
+			}
+
+			if (VMEMPROF_UNLIKELY(literal_length > uint32_t(input_end - input) || literal_length > uint32_t(output_end - output)))
+				return false;
+
+			// Short literals are copied in a single block when both ends have room for it
+			if (literal_length <= 16 && input_end - input >= 16 && output_end - output >= 16)
+				std::memcpy(output, input, 16);
+			else
+				std::memcpy(output, input, literal_length);
+
+			input += literal_length;
+			output += literal_length;
+
+			// The last sequence has no match
+			if (input == input_end)
+				return output == output_end;
+
+			if (VMEMPROF_UNLIKELY(input_end - input < 2))
+				return false;
+
+			const uint32_t offset = uint32_t(input[0]) | (uint32_t(input[1]) << 8);
+			input += 2;
+
+			if (VMEMPROF_UNLIKELY(offset == 0 || offset > uint32_t(output - output_start)))
+				return false;
+
+			uint32_t match_length = token & 15;
+			if (match_length == 15)
+			{
+				input = read_length(input, input_end, match_length);
+				if (input == nullptr)
+					return false;
+			}
+
+			match_length += k_lz_min_match;
+			if (VMEMPROF_UNLIKELY(match_length > uint32_t(output_end - output)))
+				return false;
+
+			// Copies may write past the match, bytes that later sequences overwrite
+			const uint8_t* match = output - offset;
+			const uint32_t rounded_length = (match_length + 15) & ~15U;
+			if (offset >= 16 && rounded_length <= uint32_t(output_end - output))
+			{
+				for (uint32_t copied = 0; copied < match_length; copied += 16)
+					std::memcpy(output + copied, match + copied, 16);
+			}
+			else if (offset >= 8 && ((match_length + 7) & ~7U) <= uint32_t(output_end - output))
+			{
+				for (uint32_t copied = 0; copied < match_length; copied += 8)
+					std::memcpy(output + copied, match + copied, 8);
+			}
+			else
+			{
+				// Overlapping matches repeat the bytes they just wrote
+				for (uint32_t copied = 0; copied < match_length; ++copied)
+					output[copied] = match[copied];
+			}
+
+			output += match_length;
+		}
+	}
+}
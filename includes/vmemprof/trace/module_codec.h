@@ -0,0 +1,115 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/module_info.h"
+#include "vmemprof/trace/varint.h"
+
+#include <cstdint>
+#include <cstring>
+
+////////////////////////////////////////////////////////////////////////////////
+// Module map encoding
+//
+// Each module is encoded as:
+//    varint:        timestamp delta with the chunk first timestamp
+//    varint:        load address
+//    varint:        start address delta with the load address
+//    varint:        size of the loaded range
+//    varint:        build id size, followed by the build id bytes
+//    varint:        path length, followed by the path bytes
+//
+// Modules are written when the drain thread first sees them, a trace only holds
+// a handful of module chunks.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns the largest size of a module entry once encoded.
+	////////////////////////////////////////////////////////////////////////////////
+	inline uint32_t get_max_encoded_module_size(const module_info& module)
+	{
+		return 5 * k_max_varint_size + k_max_build_id_size + k_max_varint_size + module.path_length;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Encodes a module entry, the output must have room for get_max_encoded_module_size()
+	// bytes. Returns the end of the written data.
+	////////////////////////////////////////////////////////////////////////////////
+	inline uint8_t* encode_module(const module_info& module, uint64_t first_timestamp, uint8_t* output)
+	{
+		const uint32_t build_id_size = module.build_id_size <= k_max_build_id_size ? module.build_id_size : 0;
+
+		output = write_varint(output, module.timestamp - first_timestamp);
+		output = write_varint(output, module.load_address);
+		output = write_varint(output, module.start - module.load_address);
+		output = write_varint(output, module.end - module.start);
+
+		output = write_varint(output, build_id_size);
+		std::memcpy(output, module.build_id, build_id_size);
+		output += build_id_size;
+
+		output = write_varint(output, module.path_length);
+		std::memcpy(output, module.path, module.path_length);
+		return output + module.path_length;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Decodes a module entry, its path points into the input.
+	// Returns the end of the consumed data or nullptr if the input is malformed.
+	////////////////////////////////////////////////////////////////////////////////
+	inline const uint8_t* decode_module(const uint8_t* input, const uint8_t* input_end, uint64_t first_timestamp, module_info& out_module)
+	{
+		uint64_t values[5];
+		for (uint64_t& value : values)
+		{
+			input = read_varint(input, input_end, value);
+			if (input == nullptr)
+				return nullptr;
+		}
+
+		const uint64_t build_id_size = values[4];
+		if (build_id_size > k_max_build_id_size || build_id_size > uint64_t(input_end - input))
+			return nullptr;
+
+		out_module.timestamp = first_timestamp + values[0];
+		out_module.load_address = values[1];
+		out_module.start = values[1] + values[2];
+		out_module.end = out_module.start + values[3];
+		out_module.build_id_size = uint32_t(build_id_size);
+		std::memcpy(out_module.build_id, input, build_id_size);
+		input += build_id_size;
+
+		uint64_t path_length;
+		input = read_varint(input, input_end, path_length);
+		if (input == nullptr || path_length > uint64_t(input_end - input))
+			return nullptr;
+
+		out_module.path = reinterpret_cast<const char*>(input);
+		out_module.path_length = uint32_t(path_length);
+		return input + path_length;
+	}
+}
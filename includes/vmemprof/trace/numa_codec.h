@@ -0,0 +1,110 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/numa_sample.h"
+#include "vmemprof/trace/varint.h"
+
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+// NUMA page sample encoding
+//
+// Each sample is encoded as:
+//    zigzag varint: timestamp delta with the previous sample
+//    zigzag varint: address delta in 4 KB units with the previous sample
+//    varint:        node
+//
+// A sampling tick walks the tracked regions in order at a fixed stride, most
+// samples encode in 3 bytes. The delta state is reset at the start of every
+// chunk.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	// Largest size of a NUMA page sample once encoded
+	constexpr uint32_t k_max_encoded_numa_page_sample_size = 10 + 10 + 5;
+
+	namespace numa_codec_impl
+	{
+		constexpr uint64_t k_unit_shift = 12;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Encodes or decodes a sequence of NUMA page samples.
+	////////////////////////////////////////////////////////////////////////////////
+	class numa_page_codec
+	{
+	public:
+		void reset(uint64_t first_timestamp)
+		{
+			m_previous_timestamp = first_timestamp;
+			m_previous_address = 0;
+		}
+
+		// The output must have room for k_max_encoded_numa_page_sample_size bytes. Returns the end of the written data.
+		uint8_t* encode(const numa_page_sample& sample, uint8_t* output)
+		{
+			using namespace numa_codec_impl;
+
+			output = write_varint(output, zigzag_encode(int64_t(sample.timestamp - m_previous_timestamp)));
+			output = write_varint(output, zigzag_encode(int64_t(sample.address - m_previous_address) >> k_unit_shift));
+			output = write_varint(output, sample.node);
+
+			m_previous_timestamp = sample.timestamp;
+			m_previous_address = sample.address;
+			return output;
+		}
+
+		// Returns the end of the consumed data or nullptr if the input is malformed
+		const uint8_t* decode(const uint8_t* input, const uint8_t* input_end, numa_page_sample& out_sample)
+		{
+			using namespace numa_codec_impl;
+
+			uint64_t values[3];
+			for (uint64_t& value : values)
+			{
+				input = read_varint(input, input_end, value);
+				if (input == nullptr)
+					return nullptr;
+			}
+
+			if (values[2] > UINT32_MAX)
+				return nullptr;
+
+			out_sample.timestamp = m_previous_timestamp + uint64_t(zigzag_decode(values[0]));
+			out_sample.address = m_previous_address + (uint64_t(zigzag_decode(values[1])) << k_unit_shift);
+			out_sample.node = uint32_t(values[2]);
+
+			m_previous_timestamp = out_sample.timestamp;
+			m_previous_address = out_sample.address;
+			return input;
+		}
+
+	private:
+		uint64_t	m_previous_timestamp = 0;
+		uint64_t	m_previous_address = 0;
+	};
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/compiler_utils.h"
+#include "vmemprof/trace/varint.h"
+
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+// Stack dictionary encoding
+//
+// Each entry is encoded as:
+//    varint:        stack id
+//    varint:        number of frames, the leaf frame comes first
+//    varint:        the first frame address
+//    zigzag varint: every following frame as a delta with the previous frame
+//
+// Return addresses of neighbouring frames usually live in the same module, the
+// deltas are much smaller than the absolute addresses.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	// Deeper stacks are truncated by the capture
+	constexpr uint32_t k_max_stack_frames = 128;
+
+	// Largest size of a stack entry once encoded
+	constexpr uint32_t k_max_encoded_stack_size = 5 + 5 + k_max_stack_frames * k_max_varint_size;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Encodes a stack dictionary entry, the output must have room for
+	// k_max_encoded_stack_size bytes. Returns the end of the written data.
+	////////////////////////////////////////////////////////////////////////////////
+	inline uint8_t* encode_stack(uint32_t stack_id, const uint64_t* frames, uint32_t num_frames, uint8_t* output)
+	{
+		if (num_frames > k_max_stack_frames)
+			num_frames = k_max_stack_frames;
+
+		output = write_varint(output, stack_id);
+		output = write_varint(output, num_frames);
+
+		uint64_t previous_frame = 0;
+		for (uint32_t frame_index = 0; frame_index < num_frames; ++frame_index)
+		{
+			const uint64_t frame = frames[frame_index];
+			output = frame_index == 0 ? write_varint(output, frame) : write_varint(output, zigzag_encode(int64_t(frame - previous_frame)));
+			previous_frame = frame;
+		}
+
+		return output;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Decodes a stack dictionary entry, out_frames must have room for k_max_stack_frames.
+	// Returns the end of the consumed data or nullptr if the input is malformed.
+	////////////////////////////////////////////////////////////////////////////////
+	inline const uint8_t* decode_stack(const uint8_t* input, const uint8_t* input_end, uint32_t& out_stack_id, uint64_t* out_frames, uint32_t& out_num_frames)
+	{
+		uint64_t stack_id;
+		uint64_t num_frames;
+
+		input = read_varint(input, input_end, stack_id);
+		input = input != nullptr ? read_varint(input, input_end, num_frames) : nullptr;
+		if (input == nullptr || stack_id > UINT32_MAX || num_frames > k_max_stack_frames)
+			return nullptr;
+
+		uint64_t previous_frame = 0;
+		for (uint32_t frame_index = 0; frame_index < num_frames; ++frame_index)
+		{
+			uint64_t value;
+			input = read_varint(input, input_end, value);
+			if (input == nullptr)
+				return nullptr;
+
+			const uint64_t frame = frame_index == 0 ? value : previous_frame + uint64_t(zigzag_decode(value));
+			out_frames[frame_index] = frame;
+			previous_frame = frame;
+		}
+
+		out_stack_id = uint32_t(stack_id);
+		out_num_frames = uint32_t(num_frames);
+		return input;
+	}
+}
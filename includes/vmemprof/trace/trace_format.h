@@ -0,0 +1,233 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+// Trace file layout
+//
+// A trace starts with a trace_header followed by a sequence of chunks. Every
+// chunk starts with a chunk_header followed by its payload, padded to 8 bytes so
+// that every header is naturally aligned when the file is memory mapped.
+//
+// Chunks are self-contained: the delta encoding state of event chunks is reset
+// at the start of each chunk so any chunk can be decoded on its own. Stack
+// dictionary chunks always precede the first event or fault chunk that
+// references them.
+//
+// Chunk payloads can be compressed, each one on its own so that chunks can
+// still be decoded independently and in parallel. A compressed payload starts
+// with a compressed_payload_header, headers and the index are never compressed.
+//
+// When the trace is closed properly, an index chunk that lists every other chunk
+// is written followed by a trace_footer. Readers seek to the footer to find the
+// index, truncated traces (e.g. after a crash) can still be read by walking the
+// chunk headers from the start of the file.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	constexpr uint32_t k_trace_magic = 0x54504D56;			// 'VMPT'
+	constexpr uint32_t k_chunk_magic = 0x4B504D56;			// 'VMPK'
+	constexpr uint32_t k_trace_footer_magic = 0x49504D56;	// 'VMPI'
+
+	enum class trace_version : uint16_t
+	{
+		first_version = 1,
+
+		//////////////////////////////////////////////////////////////////////////
+		// First version, see above for the layout
+		v01 = 1,
+
+		// Adds residency chunks
+		v02 = 2,
+
+		// Adds fault chunks
+		v03 = 3,
+
+		// Adds module chunks
+		v04 = 4,
+
+		// Adds huge page chunks
+		v05 = 5,
+
+		// Adds NUMA chunks, mbind and set_mempolicy events and the CPU of fault samples
+		v06 = 6,
+
+		// Adds the sampling chunk
+		v07 = 7,
+
+		// Adds chunk compression, the flags of chunk headers became their compression
+		v08 = 8,
+
+		// Adds allocator chunks and allocator_extent events
+		v09 = 9,
+
+		// Adds userfaultfd events
+		v10 = 10,
+
+		//////////////////////////////////////////////////////////////////////////
+
+		latest = v10,
+	};
+
+	struct trace_header
+	{
+		uint32_t		magic;				// k_trace_magic
+		trace_version	version;
+		uint16_t		header_size;		// sizeof(trace_header) when written
+		uint32_t		process_id;
+		uint32_t		page_size;
+		uint64_t		start_timestamp;	// CLOCK_MONOTONIC nanoseconds when the capture started
+		uint64_t		start_realtime;		// CLOCK_REALTIME nanoseconds at the same instant
+	};
+
+	static_assert(sizeof(trace_header) == 32, "Unexpected trace header size");
+
+	enum class chunk_type : uint8_t
+	{
+		events,				// Delta encoded vm_event values
+		stacks,				// Stack dictionary entries
+		dropped_events,		// A dropped_events_payload
+		index,				// An array of chunk_index_entry values
+		residency,			// Delta encoded residency_sample values
+		faults,				// Delta encoded fault_sample values
+		lost_faults,		// A dropped_events_payload, fault samples the kernel could not record
+		modules,			// Module map entries, loaded executables and shared objects
+		huge_pages,			// Delta encoded huge_page_sample values
+		numa_pages,			// Delta encoded numa_page_sample values
+		numa_topology,		// A numa_topology_header followed by the node of every CPU
+		sampling,			// A sampling_payload, only present when mappings are sampled
+		allocators,			// Delta encoded allocator_sample values
+
+		count,
+	};
+
+	enum class chunk_compression : uint8_t
+	{
+		none,				// Stored as is
+		lz,					// The in-tree LZ codec, see lz_codec.h
+		zstd,				// Zstandard, only readable when built with zstd
+
+		count,
+	};
+
+	struct chunk_header
+	{
+		uint32_t			magic;				// k_chunk_magic
+		chunk_type			type;
+		chunk_compression	compression;		// Always none for index chunks
+		uint16_t			padding;
+		uint32_t			payload_size;		// Size of the payload following the header, excluding the alignment padding
+		uint32_t			num_entries;		// Number of events, stacks, samples, or index entries
+		uint64_t			first_timestamp;	// Timestamp of the first entry, event decoding starts from it
+		uint64_t			last_timestamp;		// Timestamp of the last entry
+	};
+
+	static_assert(sizeof(chunk_header) == 32, "Unexpected chunk header size");
+
+	struct compressed_payload_header
+	{
+		uint32_t		uncompressed_size;	// Payload size once decompressed
+		uint32_t		padding;
+	};
+
+	struct dropped_events_payload
+	{
+		uint64_t		timestamp;			// When the drops were reported
+		uint64_t		num_dropped;		// Events dropped since the previous report
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Mappings are sampled with a Poisson process over the bytes they map: a
+	// mapping of 'size' bytes is recorded with probability
+	// 1 - exp(-size / sampling_interval). Creations (mmap, brk and sbrk growth)
+	// are sampled, every other event is recorded.
+	////////////////////////////////////////////////////////////////////////////////
+	struct sampling_payload
+	{
+		uint64_t		sampling_interval;	// Mean bytes between two sampled mappings
+		uint64_t		padding;
+	};
+
+	struct chunk_index_entry
+	{
+		uint64_t		offset;				// Offset of the chunk header from the start of the file
+		uint64_t		first_timestamp;
+		uint64_t		last_timestamp;
+		uint32_t		num_entries;
+		chunk_type		type;
+		uint8_t			padding[3];
+	};
+
+	static_assert(sizeof(chunk_index_entry) == 32, "Unexpected chunk index entry size");
+
+	struct trace_footer
+	{
+		uint64_t		index_offset;		// Offset of the index chunk header
+		uint32_t		magic;				// k_trace_footer_magic
+		uint32_t		padding;
+	};
+
+	static_assert(sizeof(trace_footer) == 16, "Unexpected trace footer size");
+
+	// Chunk payloads are padded to this alignment
+	constexpr uint32_t k_chunk_alignment = 8;
+
+	constexpr uint32_t align_chunk_size(uint32_t size) { return (size + k_chunk_alignment - 1) & ~(k_chunk_alignment - 1); }
+
+	inline const char* get_chunk_type_name(chunk_type type)
+	{
+		switch (type)
+		{
+		case chunk_type::events:			return "events";
+		case chunk_type::stacks:			return "stacks";
+		case chunk_type::dropped_events:	return "dropped_events";
+		case chunk_type::index:				return "index";
+		case chunk_type::residency:			return "residency";
+		case chunk_type::faults:			return "faults";
+		case chunk_type::lost_faults:		return "lost_faults";
+		case chunk_type::modules:			return "modules";
+		case chunk_type::huge_pages:		return "huge_pages";
+		case chunk_type::numa_pages:		return "numa_pages";
+		case chunk_type::numa_topology:		return "numa_topology";
+		case chunk_type::sampling:			return "sampling";
+		case chunk_type::allocators:		return "allocators";
+		default:							return "<unknown>";
+		}
+	}
+
+	inline const char* get_chunk_compression_name(chunk_compression compression)
+	{
+		switch (compression)
+		{
+		case chunk_compression::none:		return "none";
+		case chunk_compression::lz:			return "lz";
+		case chunk_compression::zstd:		return "zstd";
+		default:							return "<unknown>";
+		}
+	}
+}
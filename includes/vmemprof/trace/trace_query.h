@@ -0,0 +1,170 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/trace/stack_codec.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Filters applied by query_events, every filter must match.
+	////////////////////////////////////////////////////////////////////////////////
+	struct trace_query
+	{
+		// Time window [start, end)
+		uint64_t			start_timestamp = 0;
+		uint64_t			end_timestamp = UINT64_MAX;
+
+		// Events whose range intersects [start, end), mremap also matches its old range
+		uint64_t			start_address = 0;
+		uint64_t			end_address = UINT64_MAX;
+
+		// Zero matches every thread
+		uint32_t			thread_id = 0;
+
+		// One bit per event_type
+		uint32_t			event_type_mask = ~0U;
+
+		// Events whose callstack starts with these frames, outermost caller first
+		const uint64_t*		stack_prefix = nullptr;
+		uint32_t			stack_prefix_size = 0;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns true if the event touches the address range [start, end).
+	////////////////////////////////////////////////////////////////////////////////
+	inline bool does_event_overlap_range(const vm_event& event, uint64_t start_address, uint64_t end_address)
+	{
+		uint64_t event_start = event.address;
+		uint64_t event_end = event.address + event.size;
+
+		if (event.type == event_type::brk || event.type == event_type::sbrk)
+		{
+			// The range moved by the program break
+			event_start = event.arg0 < event.address ? event.arg0 : event.address;
+			event_end = event.arg0 < event.address ? event.address : event.arg0;
+		}
+		else if (event.type == event_type::mremap && event.arg0 < end_address && event.arg0 + event.arg1 > start_address)
+			return true;
+
+		return event_start < end_address && event_end > start_address;
+	}
+
+	namespace trace_query_impl
+	{
+		// Decodes every stack once and flags the ones that start with the prefix
+		inline std::vector<bool> build_stack_prefix_matches(const trace_reader& reader, const trace_query& query)
+		{
+			const uint32_t num_stacks = reader.get_num_stacks();
+			std::vector<bool> matches(num_stacks, false);
+
+			uint64_t frames[k_max_stack_frames];
+			for (uint32_t stack_id = 1; stack_id < num_stacks; ++stack_id)
+			{
+				uint32_t num_frames;
+				if (!reader.get_stack(stack_id, frames, num_frames) || num_frames < query.stack_prefix_size)
+					continue;
+
+				// Frames are stored leaf first
+				bool is_match = true;
+				for (uint32_t prefix_index = 0; prefix_index < query.stack_prefix_size && is_match; ++prefix_index)
+					is_match = frames[num_frames - 1 - prefix_index] == query.stack_prefix[prefix_index];
+
+				matches[stack_id] = is_match;
+			}
+
+			return matches;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Streams the events that match a query, in timestamp order.
+	//
+	// Only the event chunks that overlap the time window are decoded, one event at
+	// a time, straight from the mapped trace. The callback has the signature
+	// 'bool(const vm_event&)' and returns false to stop the query early.
+	////////////////////////////////////////////////////////////////////////////////
+	template<typename callback_type>
+	error_result query_events(const trace_reader& reader, const trace_query& query, callback_type callback)
+	{
+		const bool has_stack_filter = query.stack_prefix_size != 0;
+		const std::vector<bool> stack_matches = has_stack_filter ? trace_query_impl::build_stack_prefix_matches(reader, query) : std::vector<bool>();
+
+		const bool has_address_filter = query.start_address != 0 || query.end_address != UINT64_MAX;
+
+		bool is_done = false;
+
+		const uint32_t num_event_chunks = reader.get_num_event_chunks();
+		for (uint32_t event_chunk_index = reader.find_first_event_chunk(query.start_timestamp); event_chunk_index < num_event_chunks && !is_done; ++event_chunk_index)
+		{
+			const chunk_view chunk = reader.get_chunk(reader.get_event_chunk_index(event_chunk_index));
+			if (chunk.header->first_timestamp >= query.end_timestamp)
+				break;
+
+			const error_result result = for_each_event_in_chunk(chunk, [&](const vm_event& event)
+				{
+					if (event.timestamp < query.start_timestamp)
+						return true;
+
+					if (event.timestamp >= query.end_timestamp)
+					{
+						is_done = true;
+						return false;
+					}
+
+					if ((query.event_type_mask & (1U << uint32_t(event.type))) == 0)
+						return true;
+
+					if (query.thread_id != 0 && event.thread_id != query.thread_id)
+						return true;
+
+					if (has_address_filter && !does_event_overlap_range(event, query.start_address, query.end_address))
+						return true;
+
+					if (has_stack_filter && (event.stack_id >= stack_matches.size() || !stack_matches[event.stack_id]))
+						return true;
+
+					if (!callback(event))
+					{
+						is_done = true;
+						return false;
+					}
+
+					return true;
+				});
+
+			if (result.any())
+				return result;
+		}
+
+		return error_result();
+	}
+}
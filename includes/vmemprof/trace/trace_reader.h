@@ -0,0 +1,773 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/allocator_sample.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/fault_sample.h"
+#include "vmemprof/core/huge_page_sample.h"
+#include "vmemprof/core/numa_sample.h"
+#include "vmemprof/core/module_info.h"
+#include "vmemprof/core/residency_sample.h"
+#include "vmemprof/trace/allocator_codec.h"
+#include "vmemprof/trace/chunk_compression.h"
+#include "vmemprof/trace/event_codec.h"
+#include "vmemprof/trace/fault_codec.h"
+#include "vmemprof/trace/huge_page_codec.h"
+#include "vmemprof/trace/numa_codec.h"
+#include "vmemprof/trace/module_codec.h"
+#include "vmemprof/trace/residency_codec.h"
+#include "vmemprof/trace/stack_codec.h"
+#include "vmemprof/trace/trace_format.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// A chunk as it lives in the mapped trace, or once decompressed.
+	////////////////////////////////////////////////////////////////////////////////
+	struct chunk_view
+	{
+		const chunk_header*						header;
+		const uint8_t*							payload;
+		const uint8_t*							payload_end;
+		std::shared_ptr<const std::vector<uint8_t>>	storage;	// Keeps a decompressed chunk alive, null when mapped
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Memory maps a trace and provides random access to its chunks.
+	//
+	// Uncompressed chunks are not copied out of the mapping: they are decoded in
+	// place and the page cache backs the data. Compressed chunks are decompressed
+	// when they are read, their views own the decompressed copy behind a header
+	// that says so. A few recently read chunks are cached, readers on several
+	// threads decompress in parallel. Stack and topology chunks are referenced for
+	// the lifetime of the reader, they are small and decompressed when opening.
+	// The chunk index is read from the footer, if the trace was not closed
+	// properly it is rebuilt by walking the chunk headers.
+	// Stack dictionary entries are located up front (a pointer per stack) and only
+	// decoded on demand.
+	////////////////////////////////////////////////////////////////////////////////
+	class trace_reader
+	{
+	public:
+		trace_reader() = default;
+		~trace_reader() { close(); }
+
+		trace_reader(const trace_reader&) = delete;
+		trace_reader& operator=(const trace_reader&) = delete;
+
+		error_result open(const char* path)
+		{
+			close();
+
+			const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				return error_result("Failed to open the trace");
+
+			struct stat file_stat;
+			if (fstat(fd, &file_stat) != 0 || file_stat.st_size < off_t(sizeof(trace_header)))
+			{
+				::close(fd);
+				return error_result("Trace is too small");
+			}
+
+			void* data = mmap(nullptr, size_t(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);
+
+			if (data == MAP_FAILED)
+				return error_result("Failed to map the trace");
+
+			m_data = static_cast<const uint8_t*>(data);
+			m_size = size_t(file_stat.st_size);
+
+			const error_result result = initialize();
+			if (result.any())
+				close();
+
+			return result;
+		}
+
+		void close()
+		{
+			if (m_data != nullptr)
+				munmap(const_cast<uint8_t*>(m_data), m_size);
+
+			m_data = nullptr;
+			m_size = 0;
+			m_index = nullptr;
+			m_num_chunks = 0;
+			m_is_index_recovered = false;
+			m_recovered_index.clear();
+			m_event_chunk_indices.clear();
+			m_residency_chunk_indices.clear();
+			m_fault_chunk_indices.clear();
+			m_module_chunk_indices.clear();
+			m_huge_page_chunk_indices.clear();
+			m_numa_page_chunk_indices.clear();
+			m_numa_topology_chunk_index = ~0U;
+			m_allocator_chunk_indices.clear();
+			m_sampling_interval = 0;
+			m_stack_entries.clear();
+			m_chunk_headers.clear();
+			m_pinned_chunks.clear();
+			m_cached_chunks.clear();
+			m_cache_clock = 0;
+		}
+
+		bool is_open() const { return m_data != nullptr; }
+
+		const trace_header& get_header() const { return *reinterpret_cast<const trace_header*>(m_data); }
+		uint64_t get_size() const { return m_size; }
+
+		// True when the footer was missing and the index was rebuilt from the chunk headers
+		bool is_index_recovered() const { return m_is_index_recovered; }
+
+		//////////////////////////////////////////////////////////////////////////
+		// Chunks
+
+		uint32_t get_num_chunks() const { return m_num_chunks; }
+		const chunk_index_entry& get_chunk_entry(uint32_t chunk_index) const { return m_index[chunk_index]; }
+
+		// Compressed chunks are decompressed, a corrupted one has an empty payload and fails to decode
+		chunk_view get_chunk(uint32_t chunk_index) const
+		{
+			const chunk_header* header = m_chunk_headers[chunk_index];
+			if (header->compression != chunk_compression::none)
+				return get_decompressed_chunk(chunk_index);
+
+			const uint8_t* payload = reinterpret_cast<const uint8_t*>(header + 1);
+			return chunk_view{ header, payload, payload + header->payload_size, nullptr };
+		}
+
+		// The payload size of a chunk once decompressed, without decompressing it
+		uint32_t get_chunk_payload_size(uint32_t chunk_index) const
+		{
+			const chunk_header* header = m_chunk_headers[chunk_index];
+			if (header->compression == chunk_compression::none)
+				return header->payload_size;
+
+			return get_decompressed_payload_size(reinterpret_cast<const uint8_t*>(header + 1), header->payload_size);
+		}
+
+		// The header as stored in the file, compressed chunks report their compression and stored size
+		const chunk_header& get_stored_chunk_header(uint32_t chunk_index) const { return *reinterpret_cast<const chunk_header*>(m_data + m_index[chunk_index].offset); }
+
+		// Event chunks are a subset of every chunk, in timestamp order
+		uint32_t get_num_event_chunks() const { return uint32_t(m_event_chunk_indices.size()); }
+		uint32_t get_event_chunk_index(uint32_t event_chunk_index) const { return m_event_chunk_indices[event_chunk_index]; }
+
+		// Returns the first event chunk that can contain events at or after the provided timestamp
+		uint32_t find_first_event_chunk(uint64_t timestamp) const
+		{
+			uint32_t low = 0;
+			uint32_t high = get_num_event_chunks();
+			while (low < high)
+			{
+				const uint32_t middle = low + (high - low) / 2;
+				if (m_index[m_event_chunk_indices[middle]].last_timestamp < timestamp)
+					low = middle + 1;
+				else
+					high = middle;
+			}
+
+			return low;
+		}
+
+		// Residency chunks are a subset of every chunk, in timestamp order
+		uint32_t get_num_residency_chunks() const { return uint32_t(m_residency_chunk_indices.size()); }
+		uint32_t get_residency_chunk_index(uint32_t residency_chunk_index) const { return m_residency_chunk_indices[residency_chunk_index]; }
+
+		// Fault chunks are a subset of every chunk, in timestamp order
+		uint32_t get_num_fault_chunks() const { return uint32_t(m_fault_chunk_indices.size()); }
+		uint32_t get_fault_chunk_index(uint32_t fault_chunk_index) const { return m_fault_chunk_indices[fault_chunk_index]; }
+
+		// Module chunks are a subset of every chunk, in the order they were written
+		uint32_t get_num_module_chunks() const { return uint32_t(m_module_chunk_indices.size()); }
+		uint32_t get_module_chunk_index(uint32_t module_chunk_index) const { return m_module_chunk_indices[module_chunk_index]; }
+
+		// Huge page chunks are a subset of every chunk, in timestamp order
+		uint32_t get_num_huge_page_chunks() const { return uint32_t(m_huge_page_chunk_indices.size()); }
+		uint32_t get_huge_page_chunk_index(uint32_t huge_page_chunk_index) const { return m_huge_page_chunk_indices[huge_page_chunk_index]; }
+
+		// NUMA page chunks are a subset of every chunk, in timestamp order
+		uint32_t get_num_numa_page_chunks() const { return uint32_t(m_numa_page_chunk_indices.size()); }
+		uint32_t get_numa_page_chunk_index(uint32_t numa_page_chunk_index) const { return m_numa_page_chunk_indices[numa_page_chunk_index]; }
+
+		// Allocator chunks are a subset of every chunk, in timestamp order
+		uint32_t get_num_allocator_chunks() const { return uint32_t(m_allocator_chunk_indices.size()); }
+		uint32_t get_allocator_chunk_index(uint32_t allocator_chunk_index) const { return m_allocator_chunk_indices[allocator_chunk_index]; }
+
+		// Returns the node of every CPU, false if the trace has no valid NUMA topology
+		bool get_numa_topology(numa_topology_header& out_header, const uint16_t*& out_cpu_nodes) const
+		{
+			if (m_numa_topology_chunk_index == ~0U)
+				return false;
+
+			const chunk_view chunk = get_chunk(m_numa_topology_chunk_index);
+			if (chunk.header->payload_size < sizeof(numa_topology_header))
+				return false;
+
+			memcpy(&out_header, chunk.payload, sizeof(numa_topology_header));
+			if (chunk.header->payload_size < sizeof(numa_topology_header) + uint64_t(out_header.num_cpus) * sizeof(uint16_t))
+				return false;
+
+			out_cpu_nodes = reinterpret_cast<const uint16_t*>(chunk.payload + sizeof(numa_topology_header));
+			return true;
+		}
+
+		// Mean bytes between two sampled mappings, zero when every mapping was recorded
+		uint64_t get_sampling_interval() const { return m_sampling_interval; }
+
+		//////////////////////////////////////////////////////////////////////////
+		// Stacks
+
+		// Stack ids are dense, valid ids are in [1, get_num_stacks())
+		uint32_t get_num_stacks() const { return uint32_t(m_stack_entries.size()); }
+
+		// Decodes a stack, out_frames must have room for k_max_stack_frames. Returns false if the stack is unknown.
+		bool get_stack(uint32_t stack_id, uint64_t* out_frames, uint32_t& out_num_frames) const
+		{
+			if (stack_id >= m_stack_entries.size() || m_stack_entries[stack_id].entry == nullptr)
+				return false;
+
+			const stack_location& location = m_stack_entries[stack_id];
+			uint32_t decoded_stack_id;
+			return decode_stack(location.entry, location.entry_end, decoded_stack_id, out_frames, out_num_frames) != nullptr;
+		}
+
+	private:
+		struct stack_location
+		{
+			const uint8_t*	entry;
+			const uint8_t*	entry_end;
+		};
+
+		error_result initialize()
+		{
+			const trace_header& header = get_header();
+			if (header.magic != k_trace_magic)
+				return error_result("Not a vmemprof trace");
+
+			if (header.version < trace_version::first_version || header.version > trace_version::latest)
+				return error_result("Unsupported trace version");
+
+			if (header.header_size < sizeof(trace_header) || header.header_size > m_size)
+				return error_result("Invalid trace header");
+
+			if (!read_index())
+				rebuild_index();
+
+			const error_result result = read_chunks();
+			if (result.any())
+				return result;
+
+			// Chunks are sorted by their index entry, only the ones read here are decompressed
+			for (uint32_t chunk_index = 0; chunk_index < m_num_chunks; ++chunk_index)
+			{
+				const chunk_index_entry& entry = m_index[chunk_index];
+				if (entry.type == chunk_type::events)
+					m_event_chunk_indices.push_back(chunk_index);
+				else if (entry.type == chunk_type::stacks)
+					index_stacks(get_chunk(chunk_index));
+				else if (entry.type == chunk_type::residency)
+					m_residency_chunk_indices.push_back(chunk_index);
+				else if (entry.type == chunk_type::faults)
+					m_fault_chunk_indices.push_back(chunk_index);
+				else if (entry.type == chunk_type::modules)
+					m_module_chunk_indices.push_back(chunk_index);
+				else if (entry.type == chunk_type::huge_pages)
+					m_huge_page_chunk_indices.push_back(chunk_index);
+				else if (entry.type == chunk_type::numa_pages)
+					m_numa_page_chunk_indices.push_back(chunk_index);
+				else if (entry.type == chunk_type::numa_topology)
+					m_numa_topology_chunk_index = chunk_index;
+				else if (entry.type == chunk_type::allocators)
+					m_allocator_chunk_indices.push_back(chunk_index);
+				else if (entry.type == chunk_type::sampling)
+				{
+					const chunk_view chunk = get_chunk(chunk_index);
+					if (chunk.header->payload_size >= sizeof(sampling_payload))
+						m_sampling_interval = reinterpret_cast<const sampling_payload*>(chunk.payload)->sampling_interval;
+				}
+			}
+
+			return error_result();
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Validates every chunk header. Compressed chunks are decompressed when read,
+		// except the ones we keep pointers into.
+		////////////////////////////////////////////////////////////////////////////////
+		error_result read_chunks()
+		{
+			m_chunk_headers.resize(m_num_chunks);
+
+			for (uint32_t chunk_index = 0; chunk_index < m_num_chunks; ++chunk_index)
+			{
+				const uint64_t offset = m_index[chunk_index].offset;
+				if (offset + sizeof(chunk_header) > m_size)
+					return error_result("Invalid chunk index");
+
+				const chunk_header* header = reinterpret_cast<const chunk_header*>(m_data + offset);
+				if (header->magic != k_chunk_magic || header->payload_size > m_size - offset - sizeof(chunk_header))
+					return error_result("Corrupted chunk");
+
+				m_chunk_headers[chunk_index] = header;
+				if (header->compression == chunk_compression::none)
+					continue;
+
+				if (!is_chunk_compression_supported(header->compression))
+					return error_result("Unsupported chunk compression");
+
+				const uint32_t payload_size = get_decompressed_payload_size(reinterpret_cast<const uint8_t*>(header + 1), header->payload_size);
+				if (payload_size > k_max_decompressed_payload_size)
+					return error_result("Corrupted compressed chunk");
+
+				if (header->type != chunk_type::stacks && header->type != chunk_type::numa_topology)
+					continue;
+
+				std::shared_ptr<std::vector<uint8_t>> storage = std::make_shared<std::vector<uint8_t>>();
+				const error_result result = decompress_chunk(*header, *storage);
+				if (result.any())
+					return result;
+
+				m_chunk_headers[chunk_index] = reinterpret_cast<const chunk_header*>(storage->data());
+				m_pinned_chunks.push_back(std::move(storage));
+			}
+
+			return error_result();
+		}
+
+		// Decompresses a chunk behind a copy of its header that describes the decompressed payload
+		static error_result decompress_chunk(const chunk_header& stored_header, std::vector<uint8_t>& out_storage)
+		{
+			const uint8_t* stored_payload = reinterpret_cast<const uint8_t*>(&stored_header + 1);
+			const uint32_t payload_size = get_decompressed_payload_size(stored_payload, stored_header.payload_size);
+
+			// Zeroed padding past the payload, like the mapping has
+			out_storage.assign(sizeof(chunk_header) + align_chunk_size(payload_size) + k_chunk_alignment, 0);
+
+			chunk_header* header = reinterpret_cast<chunk_header*>(out_storage.data());
+			*header = stored_header;
+			header->compression = chunk_compression::none;
+			header->payload_size = payload_size;
+
+			const error_result result = decompress_chunk_payload(stored_header.compression, stored_payload, stored_header.payload_size, reinterpret_cast<uint8_t*>(header + 1));
+			if (result.any())
+				header->payload_size = 0;
+
+			return result;
+		}
+
+		chunk_view get_decompressed_chunk(uint32_t chunk_index) const
+		{
+			std::shared_ptr<const std::vector<uint8_t>> storage;
+			{
+				std::lock_guard<std::mutex> lock(m_cache_lock);
+				for (cached_chunk& cached : m_cached_chunks)
+				{
+					if (cached.chunk_index == chunk_index)
+					{
+						cached.last_use = ++m_cache_clock;
+						storage = cached.storage;
+						break;
+					}
+				}
+			}
+
+			if (storage == nullptr)
+			{
+				// Decompress outside of the lock, concurrent readers of the same chunk both do it
+				std::shared_ptr<std::vector<uint8_t>> decompressed = std::make_shared<std::vector<uint8_t>>();
+				decompress_chunk(*m_chunk_headers[chunk_index], *decompressed);
+				storage = decompressed;
+
+				std::lock_guard<std::mutex> lock(m_cache_lock);
+				if (m_cached_chunks.size() < k_num_cached_chunks)
+					m_cached_chunks.push_back(cached_chunk{ chunk_index, ++m_cache_clock, storage });
+				else
+				{
+					auto oldest_it = std::min_element(m_cached_chunks.begin(), m_cached_chunks.end(), [](const cached_chunk& lhs, const cached_chunk& rhs) { return lhs.last_use < rhs.last_use; });
+					*oldest_it = cached_chunk{ chunk_index, ++m_cache_clock, storage };
+				}
+			}
+
+			const chunk_header* header = reinterpret_cast<const chunk_header*>(storage->data());
+			const uint8_t* payload = reinterpret_cast<const uint8_t*>(header + 1);
+			return chunk_view{ header, payload, payload + header->payload_size, std::move(storage) };
+		}
+
+		bool read_index()
+		{
+			if (m_size < sizeof(trace_header) + sizeof(chunk_header) + sizeof(trace_footer))
+				return false;
+
+			const trace_footer* footer = reinterpret_cast<const trace_footer*>(m_data + m_size - sizeof(trace_footer));
+			if (footer->magic != k_trace_footer_magic || footer->index_offset + sizeof(chunk_header) > m_size - sizeof(trace_footer))
+				return false;
+
+			const chunk_header* index_header = reinterpret_cast<const chunk_header*>(m_data + footer->index_offset);
+			if (index_header->magic != k_chunk_magic || index_header->type != chunk_type::index)
+				return false;
+
+			if (footer->index_offset + sizeof(chunk_header) + uint64_t(index_header->num_entries) * sizeof(chunk_index_entry) > m_size)
+				return false;
+
+			m_index = reinterpret_cast<const chunk_index_entry*>(index_header + 1);
+			m_num_chunks = index_header->num_entries;
+			return true;
+		}
+
+		void rebuild_index()
+		{
+			// Walk the chunks until we reach the end of the file or a truncated chunk
+			uint64_t offset = get_header().header_size;
+			while (offset + sizeof(chunk_header) <= m_size)
+			{
+				const chunk_header* header = reinterpret_cast<const chunk_header*>(m_data + offset);
+				const uint64_t chunk_size = sizeof(chunk_header) + align_chunk_size(header->payload_size);
+				if (header->magic != k_chunk_magic || offset + chunk_size > m_size)
+					break;
+
+				if (header->type != chunk_type::index)
+				{
+					chunk_index_entry entry;
+					entry.offset = offset;
+					entry.first_timestamp = header->first_timestamp;
+					entry.last_timestamp = header->last_timestamp;
+					entry.num_entries = header->num_entries;
+					entry.type = header->type;
+					std::memset(entry.padding, 0, sizeof(entry.padding));
+					m_recovered_index.push_back(entry);
+				}
+
+				offset += chunk_size;
+			}
+
+			m_index = m_recovered_index.data();
+			m_num_chunks = uint32_t(m_recovered_index.size());
+			m_is_index_recovered = true;
+		}
+
+		void index_stacks(const chunk_view& chunk)
+		{
+			uint64_t frames[k_max_stack_frames];
+
+			const uint8_t* entry = chunk.payload;
+			for (uint32_t stack_index = 0; stack_index < chunk.header->num_entries; ++stack_index)
+			{
+				uint32_t stack_id;
+				uint32_t num_frames;
+				const uint8_t* entry_end = decode_stack(entry, chunk.payload_end, stack_id, frames, num_frames);
+				if (entry_end == nullptr)
+					break;
+
+				if (stack_id >= m_stack_entries.size())
+					m_stack_entries.resize(stack_id + 1, stack_location{ nullptr, nullptr });
+
+				m_stack_entries[stack_id] = stack_location{ entry, entry_end };
+				entry = entry_end;
+			}
+		}
+
+		const uint8_t*					m_data = nullptr;
+		size_t							m_size = 0;
+
+		const chunk_index_entry*		m_index = nullptr;
+		uint32_t						m_num_chunks = 0;
+		bool							m_is_index_recovered = false;
+		std::vector<chunk_index_entry>	m_recovered_index;
+
+		std::vector<uint32_t>			m_event_chunk_indices;
+		std::vector<uint32_t>			m_residency_chunk_indices;
+		std::vector<uint32_t>			m_fault_chunk_indices;
+		std::vector<uint32_t>			m_module_chunk_indices;
+		std::vector<uint32_t>			m_huge_page_chunk_indices;
+		std::vector<uint32_t>			m_numa_page_chunk_indices;
+		uint32_t						m_numa_topology_chunk_index = ~0U;
+		std::vector<uint32_t>			m_allocator_chunk_indices;
+		uint64_t						m_sampling_interval = 0;
+		std::vector<stack_location>		m_stack_entries;
+
+		struct cached_chunk
+		{
+			uint32_t									chunk_index;
+			uint64_t									last_use;
+			std::shared_ptr<const std::vector<uint8_t>>	storage;
+		};
+
+		// Enough for a cursor per worker and a few seeks, chunks are at most a few MB once decompressed
+		static constexpr size_t k_num_cached_chunks = 16;
+
+		// Every chunk in the mapping, or in its pinned decompressed copy
+		std::vector<const chunk_header*>					m_chunk_headers;
+		std::vector<std::shared_ptr<std::vector<uint8_t>>>	m_pinned_chunks;
+
+		mutable std::mutex							m_cache_lock;
+		mutable std::vector<cached_chunk>			m_cached_chunks;
+		mutable uint64_t							m_cache_clock = 0;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Decodes the events of an event chunk in place.
+	// The callback has the signature 'bool(const vm_event&)' and returns false to stop early.
+	////////////////////////////////////////////////////////////////////////////////
+	template<typename callback_type>
+	error_result for_each_event_in_chunk(const chunk_view& chunk, callback_type callback)
+	{
+		event_decoder decoder;
+		decoder.reset(chunk.header->first_timestamp);
+
+		vm_event event;
+		const uint8_t* input = chunk.payload;
+		for (uint32_t event_index = 0; event_index < chunk.header->num_entries; ++event_index)
+		{
+			input = decoder.decode(input, chunk.payload_end, event);
+			if (input == nullptr)
+				return error_result("Corrupted event chunk");
+
+			if (!callback(event))
+				break;
+		}
+
+		return error_result();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Decodes the samples of a residency chunk in place.
+	// The callback has the signature 'bool(const residency_sample&)' and returns false to stop early.
+	////////////////////////////////////////////////////////////////////////////////
+	template<typename callback_type>
+	error_result for_each_residency_sample_in_chunk(const chunk_view& chunk, callback_type callback)
+	{
+		residency_codec decoder;
+		decoder.reset(chunk.header->first_timestamp);
+
+		residency_sample sample;
+		const uint8_t* input = chunk.payload;
+		for (uint32_t sample_index = 0; sample_index < chunk.header->num_entries; ++sample_index)
+		{
+			input = decoder.decode(input, chunk.payload_end, sample);
+			if (input == nullptr)
+				return error_result("Corrupted residency chunk");
+
+			if (!callback(sample))
+				break;
+		}
+
+		return error_result();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Decodes the samples of a fault chunk in place.
+	// The callback has the signature 'bool(const fault_sample&)' and returns false to stop early.
+	////////////////////////////////////////////////////////////////////////////////
+	template<typename callback_type>
+	error_result for_each_fault_sample_in_chunk(const chunk_view& chunk, callback_type callback)
+	{
+		fault_codec decoder;
+		decoder.reset(chunk.header->first_timestamp);
+
+		fault_sample sample;
+		const uint8_t* input = chunk.payload;
+		for (uint32_t sample_index = 0; sample_index < chunk.header->num_entries; ++sample_index)
+		{
+			input = decoder.decode(input, chunk.payload_end, sample);
+			if (input == nullptr)
+				return error_result("Corrupted fault chunk");
+
+			if (!callback(sample))
+				break;
+		}
+
+		return error_result();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Decodes the samples of a huge page chunk in place.
+	// The callback has the signature 'bool(const huge_page_sample&)' and returns false to stop early.
+	////////////////////////////////////////////////////////////////////////////////
+	template<typename callback_type>
+	error_result for_each_huge_page_sample_in_chunk(const chunk_view& chunk, callback_type callback)
+	{
+		huge_page_codec decoder;
+		decoder.reset(chunk.header->first_timestamp);
+
+		huge_page_sample sample;
+		const uint8_t* input = chunk.payload;
+		for (uint32_t sample_index = 0; sample_index < chunk.header->num_entries; ++sample_index)
+		{
+			input = decoder.decode(input, chunk.payload_end, sample);
+			if (input == nullptr)
+				return error_result("Corrupted huge page chunk");
+
+			if (!callback(sample))
+				break;
+		}
+
+		return error_result();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Decodes the samples of a NUMA page chunk in place.
+	// The callback has the signature 'bool(const numa_page_sample&)' and returns false to stop early.
+	////////////////////////////////////////////////////////////////////////////////
+	template<typename callback_type>
+	error_result for_each_numa_page_sample_in_chunk(const chunk_view& chunk, callback_type callback)
+	{
+		numa_page_codec decoder;
+		decoder.reset(chunk.header->first_timestamp);
+
+		numa_page_sample sample;
+		const uint8_t* input = chunk.payload;
+		for (uint32_t sample_index = 0; sample_index < chunk.header->num_entries; ++sample_index)
+		{
+			input = decoder.decode(input, chunk.payload_end, sample);
+			if (input == nullptr)
+				return error_result("Corrupted NUMA page chunk");
+
+			if (!callback(sample))
+				break;
+		}
+
+		return error_result();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Decodes the samples of an allocator chunk in place.
+	// The callback has the signature 'bool(const allocator_sample&)' and returns false to stop early.
+	////////////////////////////////////////////////////////////////////////////////
+	template<typename callback_type>
+	error_result for_each_allocator_sample_in_chunk(const chunk_view& chunk, callback_type callback)
+	{
+		allocator_codec decoder;
+		decoder.reset(chunk.header->first_timestamp);
+
+		allocator_sample sample;
+		const uint8_t* input = chunk.payload;
+		for (uint32_t sample_index = 0; sample_index < chunk.header->num_entries; ++sample_index)
+		{
+			input = decoder.decode(input, chunk.payload_end, sample);
+			if (input == nullptr)
+				return error_result("Corrupted allocator chunk");
+
+			if (!callback(sample))
+				break;
+		}
+
+		return error_result();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Decodes the modules of a module chunk in place, their paths point into the trace.
+	// The callback has the signature 'bool(const module_info&)' and returns false to stop early.
+	////////////////////////////////////////////////////////////////////////////////
+	template<typename callback_type>
+	error_result for_each_module_in_chunk(const chunk_view& chunk, callback_type callback)
+	{
+		module_info module;
+		const uint8_t* input = chunk.payload;
+		for (uint32_t module_index = 0; module_index < chunk.header->num_entries; ++module_index)
+		{
+			input = decode_module(input, chunk.payload_end, chunk.header->first_timestamp, module);
+			if (input == nullptr)
+				return error_result("Corrupted module chunk");
+
+			if (!callback(module))
+				break;
+		}
+
+		return error_result();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Pulls the events of a trace one at a time, in timestamp order.
+	//
+	// Callbacks are simpler when a single stream is consumed, the cursor is for
+	// merging events with another timestamp ordered stream.
+	////////////////////////////////////////////////////////////////////////////////
+	class event_cursor
+	{
+	public:
+		explicit event_cursor(const trace_reader& reader, uint32_t first_event_chunk_index = 0)
+			: m_reader(reader)
+			, m_next_event_chunk_index(first_event_chunk_index)
+		{
+		}
+
+		// Decodes the next event, returns false at the end of the trace or if a chunk is corrupted
+		bool next(vm_event& out_event)
+		{
+			while (m_num_remaining_events == 0)
+			{
+				if (m_next_event_chunk_index >= m_reader.get_num_event_chunks())
+					return false;
+
+				m_chunk = m_reader.get_chunk(m_reader.get_event_chunk_index(m_next_event_chunk_index++));
+				m_decoder.reset(m_chunk.header->first_timestamp);
+				m_input = m_chunk.payload;
+				m_input_end = m_chunk.payload_end;
+				m_num_remaining_events = m_chunk.header->num_entries;
+			}
+
+			m_input = m_decoder.decode(m_input, m_input_end, out_event);
+			if (m_input == nullptr)
+			{
+				m_is_corrupted = true;
+				m_num_remaining_events = 0;
+				m_next_event_chunk_index = m_reader.get_num_event_chunks();
+				return false;
+			}
+
+			m_num_remaining_events--;
+			return true;
+		}
+
+		bool is_corrupted() const { return m_is_corrupted; }
+
+	private:
+		const trace_reader&	m_reader;
+		uint32_t			m_next_event_chunk_index;
+		uint32_t			m_num_remaining_events = 0;
+		bool				m_is_corrupted = false;
+
+		event_decoder		m_decoder;
+		chunk_view			m_chunk = {};		// Keeps the chunk being decoded alive
+		const uint8_t*		m_input = nullptr;
+		const uint8_t*		m_input_end = nullptr;
+	};
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/trace/chunk_compression.h"
+#include "vmemprof/trace/trace_format.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Decodes a trace as it arrives over a stream, e.g. a socket.
+	//
+	// Received bytes are appended as they come and every chunk is handed out once
+	// it is complete, chunk views are only valid during the callback. The stream
+	// starts with the trace header and ends with the index chunk when the writer
+	// closes the trace properly, the footer that follows is ignored. Compressed
+	// chunks are decompressed before they are handed out.
+	////////////////////////////////////////////////////////////////////////////////
+	class trace_stream_decoder
+	{
+	public:
+		// Writers flush well before this, larger chunks are treated as corruption
+		static constexpr uint32_t k_max_chunk_payload_size = 64 * 1024 * 1024;
+
+		void reset()
+		{
+			m_buffer.clear();
+			m_has_header = false;
+			m_is_complete = false;
+			m_num_chunks = 0;
+			m_num_bytes = 0;
+		}
+
+		bool has_header() const { return m_has_header; }
+		const trace_header& get_header() const { return m_header; }
+
+		// True once the index chunk was received, the writer closed the trace
+		bool is_complete() const { return m_is_complete; }
+
+		uint64_t get_num_chunks() const { return m_num_chunks; }
+		uint64_t get_num_bytes() const { return m_num_bytes; }
+
+		// Bytes received that do not form a complete chunk yet
+		size_t get_num_pending_bytes() const { return m_buffer.size(); }
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Appends received bytes and decodes every chunk they complete.
+		// The callback has the signature 'error_result(const chunk_view&)', an error stops
+		// the decoding and is returned.
+		////////////////////////////////////////////////////////////////////////////////
+		template<typename callback_type>
+		error_result feed(const uint8_t* data, size_t size, callback_type callback)
+		{
+			m_num_bytes += size;
+			if (m_is_complete)
+				return error_result();
+
+			m_buffer.insert(m_buffer.end(), data, data + size);
+
+			size_t offset = 0;
+			if (!m_has_header)
+			{
+				if (m_buffer.size() < sizeof(trace_header))
+					return error_result();
+
+				std::memcpy(&m_header, m_buffer.data(), sizeof(trace_header));
+				if (m_header.magic != k_trace_magic)
+					return error_result("Not a vmemprof trace");
+
+				if (m_header.version < trace_version::first_version || m_header.version > trace_version::latest)
+					return error_result("Unsupported trace version");
+
+				if (m_header.header_size < sizeof(trace_header) || (m_header.header_size % k_chunk_alignment) != 0)
+					return error_result("Invalid trace header");
+
+				if (m_buffer.size() < m_header.header_size)
+					return error_result();
+
+				offset = m_header.header_size;
+				m_has_header = true;
+			}
+
+			error_result result;
+			while (m_buffer.size() - offset >= sizeof(chunk_header))
+			{
+				// Chunks are consumed from the start of the buffer, their headers stay aligned
+				const chunk_header* header = reinterpret_cast<const chunk_header*>(m_buffer.data() + offset);
+				if (header->magic != k_chunk_magic || header->payload_size > k_max_chunk_payload_size)
+				{
+					result = error_result("Corrupted chunk");
+					break;
+				}
+
+				const size_t chunk_size = sizeof(chunk_header) + align_chunk_size(header->payload_size);
+				if (m_buffer.size() - offset < chunk_size)
+					break;
+
+				offset += chunk_size;
+
+				if (header->type == chunk_type::index)
+				{
+					m_is_complete = true;
+					offset = m_buffer.size();
+					break;
+				}
+
+				const uint8_t* payload = reinterpret_cast<const uint8_t*>(header + 1);
+				m_num_chunks++;
+
+				if (header->compression != chunk_compression::none)
+				{
+					result = decompress_chunk(*header, payload);
+					if (result.any())
+						break;
+
+					header = reinterpret_cast<const chunk_header*>(m_decompressed_chunk.data());
+					payload = reinterpret_cast<const uint8_t*>(header + 1);
+				}
+
+				result = callback(chunk_view{ header, payload, payload + header->payload_size, nullptr });
+				if (result.any())
+					break;
+			}
+
+			m_buffer.erase(m_buffer.begin(), m_buffer.begin() + offset);
+			return result;
+		}
+
+	private:
+		// Decompresses a chunk behind a copy of its header that describes the decompressed payload
+		error_result decompress_chunk(const chunk_header& stored_header, const uint8_t* stored_payload)
+		{
+			const uint32_t payload_size = get_decompressed_payload_size(stored_payload, stored_header.payload_size);
+			if (payload_size > k_max_decompressed_payload_size)
+				return error_result("Corrupted compressed chunk");
+
+			// Padding past the payload, like chunks in the stream buffer have
+			m_decompressed_chunk.resize(sizeof(chunk_header) + align_chunk_size(payload_size) + k_chunk_alignment);
+
+			chunk_header* header = reinterpret_cast<chunk_header*>(m_decompressed_chunk.data());
+			*header = stored_header;
+			header->compression = chunk_compression::none;
+			header->payload_size = payload_size;
+
+			return decompress_chunk_payload(stored_header.compression, stored_payload, stored_header.payload_size, reinterpret_cast<uint8_t*>(header + 1));
+		}
+
+		std::vector<uint8_t>	m_buffer;
+		std::vector<uint8_t>	m_decompressed_chunk;
+		trace_header			m_header = {};
+		bool					m_has_header = false;
+		bool					m_is_complete = false;
+		uint64_t				m_num_chunks = 0;
+		uint64_t				m_num_bytes = 0;
+	};
+}
@@ -0,0 +1,676 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/worker_pool.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/fault_sample.h"
+#include "vmemprof/core/allocator_sample.h"
+#include "vmemprof/core/huge_page_sample.h"
+#include "vmemprof/core/numa_sample.h"
+#include "vmemprof/core/module_info.h"
+#include "vmemprof/core/residency_sample.h"
+#include "vmemprof/trace/chunk_compression.h"
+#include "vmemprof/trace/event_codec.h"
+#include "vmemprof/trace/fault_codec.h"
+#include "vmemprof/trace/allocator_codec.h"
+#include "vmemprof/trace/huge_page_codec.h"
+#include "vmemprof/trace/numa_codec.h"
+#include "vmemprof/trace/module_codec.h"
+#include "vmemprof/trace/residency_codec.h"
+#include "vmemprof/trace/stack_codec.h"
+#include "vmemprof/trace/trace_format.h"
+
+#include <cstdint>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Writes a trace to a file descriptor.
+	//
+	// Entries are accumulated into chunks that are written once they reach
+	// k_target_chunk_size or when flush() is called. The writer does not own the
+	// file descriptor. I/O errors are sticky and reported by close().
+	//
+	// The descriptor can be a stream socket, e.g. to a live daemon. Sockets are
+	// written without raising SIGPIPE, a peer that goes away is an I/O error.
+	//
+	// With compression, chunks are queued and compressed in batches, on a worker
+	// pool when one is provided, then written in their original order.
+	////////////////////////////////////////////////////////////////////////////////
+	class trace_writer
+	{
+	public:
+		// Chunks are written once their payload reaches this size
+		static constexpr uint32_t k_target_chunk_size = 64 * 1024;
+
+		// Queued chunks are compressed once their payloads reach this size
+		static constexpr uint32_t k_compression_batch_size = 1024 * 1024;
+
+		trace_writer() = default;
+		trace_writer(const trace_writer&) = delete;
+		trace_writer& operator=(const trace_writer&) = delete;
+
+		error_result open(int fd, uint32_t process_id, uint64_t start_timestamp, uint64_t start_realtime)
+		{
+			struct stat fd_stat;
+			m_fd = fd;
+			m_is_socket = fstat(fd, &fd_stat) == 0 && S_ISSOCK(fd_stat.st_mode);
+			m_offset = 0;
+			m_num_events = 0;
+			m_error.reset();
+			m_index.clear();
+
+			m_compression = chunk_compression::none;
+			m_compression_pool = nullptr;
+			m_queued_chunks.clear();
+			m_queued_payloads.clear();
+
+			m_event_payload.clear();
+			m_event_payload.reserve(k_target_chunk_size + k_max_encoded_event_size);
+			m_num_pending_events = 0;
+
+			m_stack_payload.clear();
+			m_num_pending_stacks = 0;
+
+			m_residency_payload.clear();
+			m_num_pending_residency_samples = 0;
+
+			m_fault_payload.clear();
+			m_num_pending_fault_samples = 0;
+
+			m_huge_page_payload.clear();
+			m_num_pending_huge_page_samples = 0;
+
+			m_numa_page_payload.clear();
+			m_num_pending_numa_page_samples = 0;
+
+			m_allocator_payload.clear();
+			m_num_pending_allocator_samples = 0;
+
+			trace_header header;
+			header.magic = k_trace_magic;
+			header.version = trace_version::latest;
+			header.header_size = sizeof(trace_header);
+			header.process_id = process_id;
+			header.page_size = uint32_t(sysconf(_SC_PAGESIZE));
+			header.start_timestamp = start_timestamp;
+			header.start_realtime = start_realtime;
+
+			write_bytes(&header, sizeof(header));
+			return m_error;
+		}
+
+		// Events must be written in timestamp order
+		void write_events(const vm_event* events, uint32_t num_events)
+		{
+			for (uint32_t event_index = 0; event_index < num_events; ++event_index)
+			{
+				const vm_event& event = events[event_index];
+
+				if (m_num_pending_events == 0)
+				{
+					m_event_encoder.reset(event.timestamp);
+					m_first_event_timestamp = event.timestamp;
+				}
+
+				const size_t payload_size = m_event_payload.size();
+				m_event_payload.resize(payload_size + k_max_encoded_event_size);
+
+				uint8_t* payload_end = m_event_encoder.encode(event, m_event_payload.data() + payload_size);
+				m_event_payload.resize(payload_end - m_event_payload.data());
+
+				m_last_event_timestamp = event.timestamp;
+				m_num_pending_events++;
+
+				if (m_event_payload.size() >= k_target_chunk_size)
+					flush_events();
+			}
+
+			m_num_events += num_events;
+		}
+
+		// Stacks must be written before the events that reference them
+		void write_stack(uint32_t stack_id, const uint64_t* frames, uint32_t num_frames)
+		{
+			const size_t payload_size = m_stack_payload.size();
+			m_stack_payload.resize(payload_size + k_max_encoded_stack_size);
+
+			uint8_t* payload_end = encode_stack(stack_id, frames, num_frames, m_stack_payload.data() + payload_size);
+			m_stack_payload.resize(payload_end - m_stack_payload.data());
+
+			m_num_pending_stacks++;
+
+			if (m_stack_payload.size() >= k_target_chunk_size)
+				flush_stacks();
+		}
+
+		// Samples must be written in timestamp order
+		void write_residency_samples(const residency_sample* samples, uint32_t num_samples)
+		{
+			for (uint32_t sample_index = 0; sample_index < num_samples; ++sample_index)
+			{
+				const residency_sample& sample = samples[sample_index];
+
+				if (m_num_pending_residency_samples == 0)
+				{
+					m_residency_codec.reset(sample.timestamp);
+					m_first_residency_timestamp = sample.timestamp;
+				}
+
+				const size_t payload_size = m_residency_payload.size();
+				m_residency_payload.resize(payload_size + k_max_encoded_residency_sample_size);
+
+				uint8_t* payload_end = m_residency_codec.encode(sample, m_residency_payload.data() + payload_size);
+				m_residency_payload.resize(payload_end - m_residency_payload.data());
+
+				m_last_residency_timestamp = sample.timestamp;
+				m_num_pending_residency_samples++;
+
+				if (m_residency_payload.size() >= k_target_chunk_size)
+					flush_residency_samples();
+			}
+		}
+
+		// Samples must be written in timestamp order, after the stacks they reference
+		void write_fault_samples(const fault_sample* samples, uint32_t num_samples)
+		{
+			for (uint32_t sample_index = 0; sample_index < num_samples; ++sample_index)
+			{
+				const fault_sample& sample = samples[sample_index];
+
+				if (m_num_pending_fault_samples == 0)
+				{
+					m_fault_codec.reset(sample.timestamp);
+					m_first_fault_timestamp = sample.timestamp;
+				}
+
+				const size_t payload_size = m_fault_payload.size();
+				m_fault_payload.resize(payload_size + k_max_encoded_fault_sample_size);
+
+				uint8_t* payload_end = m_fault_codec.encode(sample, m_fault_payload.data() + payload_size);
+				m_fault_payload.resize(payload_end - m_fault_payload.data());
+
+				m_last_fault_timestamp = sample.timestamp;
+				m_num_pending_fault_samples++;
+
+				if (m_fault_payload.size() >= k_target_chunk_size)
+					flush_fault_samples();
+			}
+		}
+
+		// Samples must be written in timestamp order
+		void write_huge_page_samples(const huge_page_sample* samples, uint32_t num_samples)
+		{
+			for (uint32_t sample_index = 0; sample_index < num_samples; ++sample_index)
+			{
+				const huge_page_sample& sample = samples[sample_index];
+
+				if (m_num_pending_huge_page_samples == 0)
+				{
+					m_huge_page_codec.reset(sample.timestamp);
+					m_first_huge_page_timestamp = sample.timestamp;
+				}
+
+				const size_t payload_size = m_huge_page_payload.size();
+				m_huge_page_payload.resize(payload_size + k_max_encoded_huge_page_sample_size);
+
+				uint8_t* payload_end = m_huge_page_codec.encode(sample, m_huge_page_payload.data() + payload_size);
+				m_huge_page_payload.resize(payload_end - m_huge_page_payload.data());
+
+				m_last_huge_page_timestamp = sample.timestamp;
+				m_num_pending_huge_page_samples++;
+
+				if (m_huge_page_payload.size() >= k_target_chunk_size)
+					flush_huge_page_samples();
+			}
+		}
+
+		// Samples must be written in timestamp order
+		void write_allocator_samples(const allocator_sample* samples, uint32_t num_samples)
+		{
+			for (uint32_t sample_index = 0; sample_index < num_samples; ++sample_index)
+			{
+				const allocator_sample& sample = samples[sample_index];
+
+				if (m_num_pending_allocator_samples == 0)
+				{
+					m_allocator_codec.reset(sample.timestamp);
+					m_first_allocator_timestamp = sample.timestamp;
+				}
+
+				const size_t payload_size = m_allocator_payload.size();
+				m_allocator_payload.resize(payload_size + k_max_encoded_allocator_sample_size);
+
+				uint8_t* payload_end = m_allocator_codec.encode(sample, m_allocator_payload.data() + payload_size);
+				m_allocator_payload.resize(payload_end - m_allocator_payload.data());
+
+				m_last_allocator_timestamp = sample.timestamp;
+				m_num_pending_allocator_samples++;
+
+				if (m_allocator_payload.size() >= k_target_chunk_size)
+					flush_allocator_samples();
+			}
+		}
+
+		// Samples must be written in timestamp order
+		void write_numa_page_samples(const numa_page_sample* samples, uint32_t num_samples)
+		{
+			for (uint32_t sample_index = 0; sample_index < num_samples; ++sample_index)
+			{
+				const numa_page_sample& sample = samples[sample_index];
+
+				if (m_num_pending_numa_page_samples == 0)
+				{
+					m_numa_page_codec.reset(sample.timestamp);
+					m_first_numa_page_timestamp = sample.timestamp;
+				}
+
+				const size_t payload_size = m_numa_page_payload.size();
+				m_numa_page_payload.resize(payload_size + k_max_encoded_numa_page_sample_size);
+
+				uint8_t* payload_end = m_numa_page_codec.encode(sample, m_numa_page_payload.data() + payload_size);
+				m_numa_page_payload.resize(payload_end - m_numa_page_payload.data());
+
+				m_last_numa_page_timestamp = sample.timestamp;
+				m_num_pending_numa_page_samples++;
+
+				if (m_numa_page_payload.size() >= k_target_chunk_size)
+					flush_numa_page_samples();
+			}
+		}
+
+		// Written once per trace, cpu_nodes holds the node of every CPU
+		void write_numa_topology(uint64_t timestamp, const uint16_t* cpu_nodes, uint32_t num_cpus, uint32_t num_nodes, uint32_t flags)
+		{
+			std::vector<uint8_t> payload(sizeof(numa_topology_header) + num_cpus * sizeof(uint16_t));
+
+			const numa_topology_header header = { num_nodes, num_cpus, flags, 0 };
+			memcpy(payload.data(), &header, sizeof(header));
+			memcpy(payload.data() + sizeof(header), cpu_nodes, num_cpus * sizeof(uint16_t));
+
+			write_chunk(chunk_type::numa_topology, payload.data(), uint32_t(payload.size()), 1, timestamp, timestamp);
+		}
+
+		// Written once per trace, right after the header, when mappings are sampled
+		void write_sampling(uint64_t timestamp, uint64_t sampling_interval)
+		{
+			const sampling_payload payload = { sampling_interval, 0 };
+			write_chunk(chunk_type::sampling, &payload, uint32_t(sizeof(payload)), 1, timestamp, timestamp);
+		}
+
+		// Modules are rare, they are written right away in their own chunk
+		void write_modules(const module_info* modules, uint32_t num_modules)
+		{
+			if (num_modules == 0)
+				return;
+
+			const uint64_t first_timestamp = modules[0].timestamp;
+			uint64_t last_timestamp = first_timestamp;
+
+			std::vector<uint8_t> payload;
+			for (uint32_t module_index = 0; module_index < num_modules; ++module_index)
+			{
+				const module_info& module = modules[module_index];
+				last_timestamp = module.timestamp > last_timestamp ? module.timestamp : last_timestamp;
+
+				const size_t payload_size = payload.size();
+				payload.resize(payload_size + get_max_encoded_module_size(module));
+
+				uint8_t* payload_end = encode_module(module, first_timestamp, payload.data() + payload_size);
+				payload.resize(payload_end - payload.data());
+			}
+
+			write_chunk(chunk_type::modules, payload.data(), uint32_t(payload.size()), num_modules, first_timestamp, last_timestamp);
+		}
+
+		void write_lost_faults(uint64_t timestamp, uint64_t num_lost)
+		{
+			const dropped_events_payload payload = { timestamp, num_lost };
+			write_chunk(chunk_type::lost_faults, &payload, sizeof(payload), 1, timestamp, timestamp);
+		}
+
+		void write_dropped_events(uint64_t timestamp, uint64_t num_dropped)
+		{
+			const dropped_events_payload payload = { timestamp, num_dropped };
+			write_chunk(chunk_type::dropped_events, &payload, sizeof(payload), 1, timestamp, timestamp);
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Compresses every chunk written from now on except the index, codecs this
+		// build does not support store chunks as is. The pool, if any, must outlive
+		// the writer or the next call.
+		////////////////////////////////////////////////////////////////////////////////
+		void set_compression(chunk_compression compression, worker_pool* pool)
+		{
+			compress_queued_chunks();
+
+			m_compression = is_chunk_compression_supported(compression) ? compression : chunk_compression::none;
+			m_compression_pool = pool;
+		}
+
+		// Writes every pending entry
+		void flush()
+		{
+			flush_stacks();
+			flush_events();
+			flush_residency_samples();
+			flush_fault_samples();
+			flush_huge_page_samples();
+			flush_numa_page_samples();
+			flush_allocator_samples();
+			compress_queued_chunks();
+		}
+
+		// Flushes, writes the chunk index and the footer
+		error_result close()
+		{
+			flush();
+
+			const uint64_t index_offset = m_offset;
+			const uint32_t num_index_entries = uint32_t(m_index.size());
+			write_chunk(chunk_type::index, m_index.data(), num_index_entries * sizeof(chunk_index_entry), num_index_entries, 0, 0);
+
+			trace_footer footer;
+			footer.index_offset = index_offset;
+			footer.magic = k_trace_footer_magic;
+			footer.padding = 0;
+			write_bytes(&footer, sizeof(footer));
+
+			m_fd = -1;
+			return m_error;
+		}
+
+		uint64_t get_num_bytes_written() const { return m_offset; }
+		uint64_t get_num_events_written() const { return m_num_events; }
+
+	private:
+		void flush_stacks()
+		{
+			if (m_num_pending_stacks == 0)
+				return;
+
+			write_chunk(chunk_type::stacks, m_stack_payload.data(), uint32_t(m_stack_payload.size()), m_num_pending_stacks, 0, 0);
+
+			m_stack_payload.clear();
+			m_num_pending_stacks = 0;
+		}
+
+		void flush_events()
+		{
+			if (m_num_pending_events == 0)
+				return;
+
+			// Stacks referenced by these events must be readable first
+			flush_stacks();
+
+			write_chunk(chunk_type::events, m_event_payload.data(), uint32_t(m_event_payload.size()), m_num_pending_events, m_first_event_timestamp, m_last_event_timestamp);
+
+			m_event_payload.clear();
+			m_num_pending_events = 0;
+		}
+
+		void flush_residency_samples()
+		{
+			if (m_num_pending_residency_samples == 0)
+				return;
+
+			write_chunk(chunk_type::residency, m_residency_payload.data(), uint32_t(m_residency_payload.size()), m_num_pending_residency_samples, m_first_residency_timestamp, m_last_residency_timestamp);
+
+			m_residency_payload.clear();
+			m_num_pending_residency_samples = 0;
+		}
+
+		void flush_fault_samples()
+		{
+			if (m_num_pending_fault_samples == 0)
+				return;
+
+			// Stacks referenced by these samples must be readable first
+			flush_stacks();
+
+			write_chunk(chunk_type::faults, m_fault_payload.data(), uint32_t(m_fault_payload.size()), m_num_pending_fault_samples, m_first_fault_timestamp, m_last_fault_timestamp);
+
+			m_fault_payload.clear();
+			m_num_pending_fault_samples = 0;
+		}
+
+		void flush_huge_page_samples()
+		{
+			if (m_num_pending_huge_page_samples == 0)
+				return;
+
+			write_chunk(chunk_type::huge_pages, m_huge_page_payload.data(), uint32_t(m_huge_page_payload.size()), m_num_pending_huge_page_samples, m_first_huge_page_timestamp, m_last_huge_page_timestamp);
+
+			m_huge_page_payload.clear();
+			m_num_pending_huge_page_samples = 0;
+		}
+
+		void flush_numa_page_samples()
+		{
+			if (m_num_pending_numa_page_samples == 0)
+				return;
+
+			write_chunk(chunk_type::numa_pages, m_numa_page_payload.data(), uint32_t(m_numa_page_payload.size()), m_num_pending_numa_page_samples, m_first_numa_page_timestamp, m_last_numa_page_timestamp);
+
+			m_numa_page_payload.clear();
+			m_num_pending_numa_page_samples = 0;
+		}
+
+		void flush_allocator_samples()
+		{
+			if (m_num_pending_allocator_samples == 0)
+				return;
+
+			write_chunk(chunk_type::allocators, m_allocator_payload.data(), uint32_t(m_allocator_payload.size()), m_num_pending_allocator_samples, m_first_allocator_timestamp, m_last_allocator_timestamp);
+
+			m_allocator_payload.clear();
+			m_num_pending_allocator_samples = 0;
+		}
+
+		void write_chunk(chunk_type type, const void* payload, uint32_t payload_size, uint32_t num_entries, uint64_t first_timestamp, uint64_t last_timestamp)
+		{
+			if (m_compression == chunk_compression::none || type == chunk_type::index)
+			{
+				write_stored_chunk(type, chunk_compression::none, payload, payload_size, num_entries, first_timestamp, last_timestamp);
+				return;
+			}
+
+			const uint8_t* bytes = static_cast<const uint8_t*>(payload);
+			m_queued_chunks.push_back(queued_chunk{ type, num_entries, first_timestamp, last_timestamp, m_queued_payloads.size(), payload_size, 0, 0 });
+			m_queued_payloads.insert(m_queued_payloads.end(), bytes, bytes + payload_size);
+
+			if (m_queued_payloads.size() >= k_compression_batch_size)
+				compress_queued_chunks();
+		}
+
+		void compress_queued_chunks()
+		{
+			if (m_queued_chunks.empty())
+				return;
+
+			// Every chunk gets room for its worst case so that they compress independently
+			uint64_t compressed_size = 0;
+			for (queued_chunk& chunk : m_queued_chunks)
+			{
+				chunk.compressed_offset = compressed_size;
+				compressed_size += get_max_compressed_payload_size(m_compression, chunk.payload_size);
+			}
+
+			m_compressed_payloads.resize(compressed_size);
+
+			const auto compress_chunk = [this](uint32_t chunk_index)
+			{
+				queued_chunk& chunk = m_queued_chunks[chunk_index];
+				chunk.stored_size = compress_chunk_payload(m_compression, m_queued_payloads.data() + chunk.payload_offset, chunk.payload_size, m_compressed_payloads.data() + chunk.compressed_offset);
+			};
+
+			const uint32_t num_chunks = uint32_t(m_queued_chunks.size());
+			if (m_compression_pool != nullptr)
+				m_compression_pool->run(num_chunks, compress_chunk);
+			else
+			{
+				for (uint32_t chunk_index = 0; chunk_index < num_chunks; ++chunk_index)
+					compress_chunk(chunk_index);
+			}
+
+			// Chunks that did not shrink are stored as is
+			for (const queued_chunk& chunk : m_queued_chunks)
+			{
+				if (chunk.stored_size != 0)
+					write_stored_chunk(chunk.type, m_compression, m_compressed_payloads.data() + chunk.compressed_offset, chunk.stored_size, chunk.num_entries, chunk.first_timestamp, chunk.last_timestamp);
+				else
+					write_stored_chunk(chunk.type, chunk_compression::none, m_queued_payloads.data() + chunk.payload_offset, chunk.payload_size, chunk.num_entries, chunk.first_timestamp, chunk.last_timestamp);
+			}
+
+			m_queued_chunks.clear();
+			m_queued_payloads.clear();
+		}
+
+		void write_stored_chunk(chunk_type type, chunk_compression compression, const void* payload, uint32_t payload_size, uint32_t num_entries, uint64_t first_timestamp, uint64_t last_timestamp)
+		{
+			chunk_header header;
+			header.magic = k_chunk_magic;
+			header.type = type;
+			header.compression = compression;
+			header.padding = 0;
+			header.payload_size = payload_size;
+			header.num_entries = num_entries;
+			header.first_timestamp = first_timestamp;
+			header.last_timestamp = last_timestamp;
+
+			if (type != chunk_type::index)
+			{
+				chunk_index_entry entry;
+				entry.offset = m_offset;
+				entry.first_timestamp = first_timestamp;
+				entry.last_timestamp = last_timestamp;
+				entry.num_entries = num_entries;
+				entry.type = type;
+				std::memset(entry.padding, 0, sizeof(entry.padding));
+				m_index.push_back(entry);
+			}
+
+			write_bytes(&header, sizeof(header));
+			write_bytes(payload, payload_size);
+
+			const uint8_t padding[k_chunk_alignment] = { 0 };
+			write_bytes(padding, align_chunk_size(payload_size) - payload_size);
+		}
+
+		void write_bytes(const void* data, size_t size)
+		{
+			m_offset += size;
+
+			if (m_error.any())
+				return;
+
+			const uint8_t* bytes = static_cast<const uint8_t*>(data);
+			while (size != 0)
+			{
+				const ssize_t num_written = m_is_socket ? ::send(m_fd, bytes, size, MSG_NOSIGNAL) : ::write(m_fd, bytes, size);
+				if (num_written <= 0)
+				{
+					m_error = error_result("Failed to write to the trace");
+					return;
+				}
+
+				bytes += num_written;
+				size -= size_t(num_written);
+			}
+		}
+
+		int								m_fd = -1;
+		bool							m_is_socket = false;
+		uint64_t						m_offset = 0;
+		uint64_t						m_num_events = 0;
+		error_result					m_error;
+
+		std::vector<chunk_index_entry>	m_index;
+
+		struct queued_chunk
+		{
+			chunk_type		type;
+			uint32_t		num_entries;
+			uint64_t		first_timestamp;
+			uint64_t		last_timestamp;
+			uint64_t		payload_offset;			// In m_queued_payloads
+			uint32_t		payload_size;
+			uint32_t		stored_size;			// Zero when stored as is
+			uint64_t		compressed_offset;		// In m_compressed_payloads
+		};
+
+		chunk_compression				m_compression = chunk_compression::none;
+		worker_pool*					m_compression_pool = nullptr;
+		std::vector<queued_chunk>		m_queued_chunks;
+		std::vector<uint8_t>			m_queued_payloads;
+		std::vector<uint8_t>			m_compressed_payloads;
+
+		event_encoder					m_event_encoder;
+		std::vector<uint8_t>			m_event_payload;
+		uint32_t						m_num_pending_events = 0;
+		uint64_t						m_first_event_timestamp = 0;
+		uint64_t						m_last_event_timestamp = 0;
+
+		std::vector<uint8_t>			m_stack_payload;
+		uint32_t						m_num_pending_stacks = 0;
+
+		residency_codec					m_residency_codec;
+		std::vector<uint8_t>			m_residency_payload;
+		uint32_t						m_num_pending_residency_samples = 0;
+		uint64_t						m_first_residency_timestamp = 0;
+		uint64_t						m_last_residency_timestamp = 0;
+
+		fault_codec						m_fault_codec;
+		std::vector<uint8_t>			m_fault_payload;
+		uint32_t						m_num_pending_fault_samples = 0;
+		uint64_t						m_first_fault_timestamp = 0;
+		uint64_t						m_last_fault_timestamp = 0;
+
+		huge_page_codec					m_huge_page_codec;
+		std::vector<uint8_t>			m_huge_page_payload;
+		uint32_t						m_num_pending_huge_page_samples = 0;
+		uint64_t						m_first_huge_page_timestamp = 0;
+		uint64_t						m_last_huge_page_timestamp = 0;
+
+		numa_page_codec					m_numa_page_codec;
+		std::vector<uint8_t>			m_numa_page_payload;
+		uint32_t						m_num_pending_numa_page_samples = 0;
+		uint64_t						m_first_numa_page_timestamp = 0;
+		uint64_t						m_last_numa_page_timestamp = 0;
+
+		allocator_codec					m_allocator_codec;
+		std::vector<uint8_t>			m_allocator_payload;
+		uint32_t						m_num_pending_allocator_samples = 0;
+		uint64_t						m_first_allocator_timestamp = 0;
+		uint64_t						m_last_allocator_timestamp = 0;
+	};
+}
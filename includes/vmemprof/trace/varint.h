@@ -0,0 +1,96 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/compiler_utils.h"
+
+#include <cstdint>
+
+namespace vmemprof
+{
+	// Largest size of a 64 bit value once encoded
+	constexpr uint32_t k_max_varint_size = 10;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Maps signed values to unsigned values so that small magnitudes encode compactly.
+	////////////////////////////////////////////////////////////////////////////////
+	VMEMPROF_FORCE_INLINE uint64_t zigzag_encode(int64_t value)
+	{
+		return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+	}
+
+	VMEMPROF_FORCE_INLINE int64_t zigzag_decode(uint64_t value)
+	{
+		return int64_t(value >> 1) ^ -int64_t(value & 1);
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Writes a LEB128 value and returns the end of the written data.
+	// The output must have room for k_max_varint_size bytes.
+	////////////////////////////////////////////////////////////////////////////////
+	VMEMPROF_FORCE_INLINE uint8_t* write_varint(uint8_t* output, uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			*output++ = uint8_t(value) | 0x80;
+			value >>= 7;
+		}
+
+		*output++ = uint8_t(value);
+		return output;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Reads a LEB128 value and returns the end of the consumed data.
+	// Returns nullptr if the input is truncated or the value overflows.
+	////////////////////////////////////////////////////////////////////////////////
+	VMEMPROF_FORCE_INLINE const uint8_t* read_varint(const uint8_t* input, const uint8_t* input_end, uint64_t& out_value)
+	{
+		// Fast path for the common single byte case
+		if (VMEMPROF_LIKELY(input < input_end && *input < 0x80))
+		{
+			out_value = *input;
+			return input + 1;
+		}
+
+		uint64_t value = 0;
+		for (uint32_t shift = 0; shift < 64; shift += 7)
+		{
+			if (input >= input_end)
+				return nullptr;
+
+			const uint8_t byte = *input++;
+			value |= uint64_t(byte & 0x7F) << shift;
+
+			if (byte < 0x80)
+			{
+				out_value = value;
+				return input;
+			}
+		}
+
+		return nullptr;
+	}
+}
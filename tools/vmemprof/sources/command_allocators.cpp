@@ -0,0 +1,186 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+#include "command_line.h"
+#include "stack_printer.h"
+
+#include "vmemprof/analysis/allocator_report.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace vmemprof
+{
+	namespace
+	{
+		void print_allocators_usage()
+		{
+			fprintf(stderr, "Usage: vmemprof allocators <trace> [options]\n\n");
+			fprintf(stderr, "Options:\n");
+			fprintf(stderr, "    --at=<time>          Report the allocators at this time since the capture start (default: end of trace)\n");
+			fprintf(stderr, "    --limit=<count>      Print this many size classes at most (default: 10)\n");
+		}
+
+		double get_percentage(uint64_t value, uint64_t total)
+		{
+			return total != 0 ? 100.0 * double(value) / double(total) : 0.0;
+		}
+
+		void print_arena(uint32_t arena)
+		{
+			if (arena == k_allocator_unknown_arena)
+				printf(" %-8s", "-");
+			else if (arena == k_allocator_direct_mmap_arena)
+				printf(" %-8s", "mmap");
+			else
+				printf(" %-8u", arena);
+		}
+	}
+
+	int run_allocators_command(int argc, char** argv)
+	{
+		if (argc < 1)
+		{
+			print_allocators_usage();
+			return 1;
+		}
+
+		const char* trace_path = argv[0];
+		uint64_t at_time = UINT64_MAX;
+		uint64_t limit = 10;
+
+		for (int argument_index = 1; argument_index < argc; ++argument_index)
+		{
+			const char* argument = argv[argument_index];
+			const char* value;
+			bool is_valid = true;
+
+			if ((value = get_option_value(argument, "--at")) != nullptr)
+				is_valid = parse_duration(value, at_time);
+			else if ((value = get_option_value(argument, "--limit")) != nullptr)
+				is_valid = parse_uint64(value, limit);
+			else
+				is_valid = false;
+
+			if (!is_valid)
+			{
+				fprintf(stderr, "Invalid argument '%s'\n\n", argument);
+				print_allocators_usage();
+				return 1;
+			}
+		}
+
+		trace_reader reader;
+		error_result result = reader.open(trace_path);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to open '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		const uint64_t start_timestamp = reader.get_header().start_timestamp;
+		const uint64_t at_timestamp = at_time == UINT64_MAX ? UINT64_MAX : start_timestamp + at_time;
+
+		address_space space;
+		allocator_extent_state extents;
+		allocator_sample_map samples;
+		result = read_allocator_state(reader, at_timestamp, space, extents, samples);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to replay '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		allocator_report report;
+		build_allocator_report(reader, space, extents, samples, report);
+
+		if (report.samples.empty() && report.arenas.empty())
+		{
+			fprintf(stderr, "'%s' has no allocator samples or extents and no mapping came from a known allocator, capture with VMEMPROF_ALLOCATORS=1\n", trace_path);
+			return 1;
+		}
+
+		if (!report.samples.empty())
+		{
+			// What the allocators say they hold, the only view of glibc whose calls we cannot see
+			uint64_t total_mapped_bytes = 0;
+			uint64_t total_unused_bytes = 0;
+
+			printf("Allocator  Arena     Mapped KB  Allocated KB   Free KB  Released KB  Unused\n");
+			for (const allocator_sample& sample : report.samples)
+			{
+				printf("%-10s", get_allocator_name(sample.allocator));
+				print_arena(sample.arena);
+				printf(" %10" PRIu64 " %13" PRIu64 " %9" PRIu64 " %12" PRIu64 " %6.1f%%\n", sample.mapped_bytes / 1024, sample.allocated_bytes / 1024,
+					sample.free_bytes / 1024, sample.released_bytes / 1024, get_percentage(sample.get_unused_bytes(), sample.mapped_bytes));
+
+				total_mapped_bytes += sample.mapped_bytes;
+				total_unused_bytes += sample.get_unused_bytes();
+			}
+
+			printf("Retained unused:   %" PRIu64 " KB of %" PRIu64 " KB mapped by allocators (%.1f%%)\n", total_unused_bytes / 1024, total_mapped_bytes / 1024,
+				get_percentage(total_unused_bytes, total_mapped_bytes));
+		}
+
+		if (!report.arenas.empty())
+		{
+			// What the trace attributes to each arena
+			printf("\nAllocator  Arena     Regions  Mapped KB  Extents KB  Retained KB  Uncarved KB\n");
+			for (const allocator_arena_mappings& arena : report.arenas)
+			{
+				printf("%-10s", get_allocator_name(arena.allocator));
+				print_arena(arena.arena);
+				printf(" %8" PRIu64 " %10" PRIu64 " %11" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n", arena.num_regions, arena.mapped_bytes / 1024,
+					arena.extent_bytes / 1024, arena.retained_bytes / 1024, arena.uncarved_bytes / 1024);
+			}
+		}
+
+		printf("Unattributed:      %" PRIu64 " KB in %" PRIu64 " anonymous regions\n", report.unattributed_bytes / 1024, report.num_unattributed_regions);
+
+		// The size classes that hold the most
+		std::vector<const allocator_size_class_mappings*> size_classes;
+		for (const allocator_size_class_mappings& size_class : report.size_classes)
+			size_classes.push_back(&size_class);
+
+		std::stable_sort(size_classes.begin(), size_classes.end(), [](const allocator_size_class_mappings* lhs, const allocator_size_class_mappings* rhs) { return lhs->extent_bytes > rhs->extent_bytes; });
+		if (size_classes.size() > limit)
+			size_classes.resize(limit);
+
+		const stack_printer stacks(reader, trace_path);
+		for (const allocator_size_class_mappings* size_class : size_classes)
+		{
+			printf("\n%s arena %u, %" PRIu64 " KB extents: %" PRIu64 " extents, %" PRIu64 " KB\n", get_allocator_name(size_class->allocator), size_class->arena,
+				size_class->size_class / 1024, size_class->num_extents, size_class->extent_bytes / 1024);
+			printf("    largest obtained by\n");
+			stacks.print(size_class->stack_id);
+		}
+
+		return 0;
+	}
+}
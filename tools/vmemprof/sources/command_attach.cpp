@@ -0,0 +1,858 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+#include "command_line.h"
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/time_utils.h"
+#include "vmemprof/proc/maps_tracker.h"
+#include "vmemprof/proc/residency_scanner.h"
+#include "vmemprof/proc/smaps_parser.h"
+#include "vmemprof/symbols/elf_image.h"
+#include "vmemprof/trace/trace_writer.h"
+
+#include <cerrno>
+#include <cinttypes>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dlfcn.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <initializer_list>
+#include <string>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+extern char** environ;
+
+// Attaching injects the capture library into a running process. We stop one of its threads with
+// ptrace, make it call dlopen on our library and then our entry point, and let it resume where
+// it was. Once loaded the library patches the GOT of every module to reach its hooks, the same
+// hooks LD_PRELOAD would have installed. Detaching makes the same thread call our exit point
+// and dlclose. The library is loaded with RTLD_NODELETE and stays mapped: threads can still be
+// inside a hook when we detach, attaching again reuses it.
+//
+// The stopped thread can be anywhere, including inside the allocator or the dynamic loader with
+// their locks held, in which case dlopen never returns. We prefer stopping it while it waits in
+// a system call, where it holds no lock unless the call is a lock wait.
+//
+// When the process cannot be traced we poll its maps and pagemap instead and write the trace
+// ourselves: mappings that live between two polls are missed and nothing has a callstack.
+
+namespace vmemprof
+{
+	namespace
+	{
+		constexpr const char* k_default_output_path = "vmemprof.%p.trace";
+		constexpr uint64_t k_default_poll_interval_ns = 100 * 1000000ULL;
+		constexpr uint64_t k_wait_interval_ns = 100 * 1000000ULL;
+		constexpr uint64_t k_flush_interval_ns = 1000 * 1000000ULL;
+
+		constexpr uint32_t k_residency_page_budget = 256 * 1024;
+		constexpr uint32_t k_residency_sample_capacity = 4096;
+
+		volatile sig_atomic_t g_is_stop_requested = 0;
+
+		void print_attach_usage()
+		{
+			fprintf(stderr, "Usage: vmemprof attach <pid> [options]\n\n");
+			fprintf(stderr, "Captures a running process until interrupted, the capture library is injected\n");
+			fprintf(stderr, "with ptrace and unloaded when we detach. The VMEMPROF_* variables of our\n");
+			fprintf(stderr, "environment configure it like they do when preloading.\n\n");
+			fprintf(stderr, "Options:\n");
+			fprintf(stderr, "    --output=<path>      Trace to write, '%%p' is replaced by the process id (default: %s)\n", k_default_output_path);
+			fprintf(stderr, "    --duration=<time>    Detach after this long (default: until interrupted)\n");
+			fprintf(stderr, "    --library=<path>     Capture library to inject (default: libvmemprof.so next to vmemprof)\n");
+			fprintf(stderr, "    --poll               Poll /proc instead of injecting, also used when ptrace is not permitted\n");
+			fprintf(stderr, "    --interval=<time>    How often /proc is polled (default: 100ms)\n");
+		}
+
+		void on_stop_signal(int)
+		{
+			g_is_stop_requested = 1;
+		}
+
+		void sleep_for(uint64_t duration_ns)
+		{
+			const timespec duration = { time_t(duration_ns / 1000000000ULL), long(duration_ns % 1000000000ULL) };
+			nanosleep(&duration, nullptr);
+		}
+
+		bool is_process_alive(uint32_t pid)
+		{
+			return kill(pid_t(pid), 0) == 0 || errno != ESRCH;
+		}
+
+		std::string replace_process_id(const char* path, uint32_t pid)
+		{
+			std::string result;
+			for (; *path != '\0'; ++path)
+			{
+				if (path[0] == '%' && path[1] == 'p')
+				{
+					result += std::to_string(pid);
+					path++;
+				}
+				else
+					result += *path;
+			}
+
+			return result;
+		}
+
+		std::string get_absolute_path(const char* path)
+		{
+			char current_directory[PATH_MAX];
+			if (path[0] == '/' || getcwd(current_directory, sizeof(current_directory)) == nullptr)
+				return path;
+
+			return std::string(current_directory) + "/" + path;
+		}
+
+		std::string get_default_library_path()
+		{
+			char executable_path[PATH_MAX];
+			const ssize_t path_length = readlink("/proc/self/exe", executable_path, sizeof(executable_path) - 1);
+			if (path_length <= 0)
+				return std::string();
+
+			executable_path[path_length] = '\0';
+			const std::string directory(executable_path, std::strrchr(executable_path, '/'));
+
+			// Installed side by side, or in the build tree
+			for (const char* relative_path : { "/libvmemprof.so", "/../vmemprof_preload/libvmemprof.so" })
+			{
+				const std::string library_path = directory + relative_path;
+				if (access(library_path.c_str(), R_OK) == 0)
+					return library_path;
+			}
+
+			return std::string();
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// A module mapped in another process, we assume its first segment is linked at
+		// address zero as it is for shared libraries.
+		////////////////////////////////////////////////////////////////////////////////
+		struct remote_module
+		{
+			uint64_t		base = 0;
+			std::string		path;
+		};
+
+		bool read_file(const char* path, std::vector<char>& out_data)
+		{
+			FILE* file = fopen(path, "rb");
+			if (file == nullptr)
+				return false;
+
+			out_data.clear();
+
+			char buffer[64 * 1024];
+			size_t num_read;
+			while ((num_read = fread(buffer, 1, sizeof(buffer), file)) != 0)
+				out_data.insert(out_data.end(), buffer, buffer + num_read);
+
+			fclose(file);
+			return true;
+		}
+
+		// Finds the first module mapped from the start of a file whose path passes the filter 'bool(const std::string&)'
+		template<typename filter_type>
+		bool find_remote_module(uint32_t pid, filter_type filter, remote_module& out_module)
+		{
+			char maps_path[64];
+			snprintf(maps_path, sizeof(maps_path), "/proc/%u/maps", pid);
+
+			std::vector<char> maps;
+			if (!read_file(maps_path, maps))
+				return false;
+
+			bool is_found = false;
+			parse_smaps(maps.data(), maps.size(), [&](const smaps_entry& entry)
+				{
+					if (entry.offset != 0 || entry.path_length == 0 || entry.path[0] != '/')
+						return true;
+
+					const std::string path(entry.path, entry.path_length);
+					if (!filter(path))
+						return true;
+
+					out_module.base = entry.start;
+					out_module.path = path;
+					is_found = true;
+					return false;
+				});
+
+			return is_found;
+		}
+
+		bool is_libc_module(const std::string& path)
+		{
+			const char* file_name = std::strrchr(path.c_str(), '/') + 1;
+			return std::strncmp(file_name, "libc.so", 7) == 0 || std::strncmp(file_name, "libc-", 5) == 0 || std::strncmp(file_name, "ld-musl-", 8) == 0;
+		}
+
+		// Returns the address of the first function found among the names
+		error_result find_remote_function(uint32_t pid, const remote_module& module, std::initializer_list<const char*> names, uint64_t& out_address, const char** out_name = nullptr)
+		{
+			// The process can live in another mount namespace, its root shows the files it sees
+			const std::string root_path = "/proc/" + std::to_string(pid) + "/root" + module.path;
+
+			elf_image image;
+			if (image.open(root_path.c_str()).any() && image.open(module.path.c_str()).any())
+				return error_result("Failed to read a module of the process");
+
+			for (const char* name : names)
+			{
+				uint64_t offset;
+				if (image.find_exported_function(name, offset))
+				{
+					out_address = module.base + offset;
+					if (out_name != nullptr)
+						*out_name = name;
+					return error_result();
+				}
+			}
+
+			return error_result("Function not found in the module");
+		}
+
+#if defined(__x86_64__)
+		////////////////////////////////////////////////////////////////////////////////
+		// A traced process whose stopped thread calls functions on our behalf. Its
+		// registers are restored when we detach, it resumes where it was stopped.
+		////////////////////////////////////////////////////////////////////////////////
+		class remote_process
+		{
+		public:
+			explicit remote_process(uint32_t pid) : m_pid(pid_t(pid)) {}
+			~remote_process() { detach(); }
+
+			remote_process(const remote_process&) = delete;
+			remote_process& operator=(const remote_process&) = delete;
+
+			error_result attach()
+			{
+				if (ptrace(PTRACE_SEIZE, m_pid, nullptr, nullptr) != 0)
+					return error_result(errno == EPERM ? "Not permitted to trace the process" : "Failed to trace the process");
+
+				m_is_attached = true;
+
+				char mem_path[64];
+				snprintf(mem_path, sizeof(mem_path), "/proc/%d/mem", int(m_pid));
+				m_mem_fd = open(mem_path, O_RDWR | O_CLOEXEC);
+				if (m_mem_fd < 0)
+					return error_result("Failed to open the memory of the process");
+
+				const error_result result = stop();
+				if (result.any())
+					return result;
+
+				iovec fp_state = { m_saved_fp_state, sizeof(m_saved_fp_state) };
+				if (ptrace(PTRACE_GETREGSET, m_pid, reinterpret_cast<void*>(uintptr_t(NT_X86_XSTATE)), &fp_state) == 0)
+					m_fp_state_type = NT_X86_XSTATE;
+				else if (ptrace(PTRACE_GETREGSET, m_pid, reinterpret_cast<void*>(uintptr_t(NT_PRFPREG)), &fp_state) == 0)
+					m_fp_state_type = NT_PRFPREG;
+				else
+					return error_result("Failed to read the floating point registers");
+
+				m_saved_fp_state_size = fp_state.iov_len;
+				m_is_stopped = true;
+				return error_result();
+			}
+
+			// Restores the registers and lets the process go
+			error_result detach()
+			{
+				if (!m_is_attached)
+					return error_result();
+
+				bool is_restored = true;
+				if (m_is_stopped)
+				{
+					iovec fp_state = { m_saved_fp_state, m_saved_fp_state_size };
+					is_restored = ptrace(PTRACE_SETREGS, m_pid, nullptr, &m_saved_registers) == 0
+						&& ptrace(PTRACE_SETREGSET, m_pid, reinterpret_cast<void*>(uintptr_t(m_fp_state_type)), &fp_state) == 0;
+				}
+
+				ptrace(PTRACE_DETACH, m_pid, nullptr, nullptr);
+
+				if (m_mem_fd >= 0)
+					close(m_mem_fd);
+
+				m_mem_fd = -1;
+				m_is_attached = false;
+				m_is_stopped = false;
+				return is_restored ? error_result() : error_result("Failed to restore the registers of the process");
+			}
+
+			// Where call() copies its data, below the red zone of the stopped thread
+			uint64_t get_data_address(size_t data_size) const
+			{
+				return (m_saved_registers.rsp - k_red_zone_size - data_size) & ~uint64_t(15);
+			}
+
+			////////////////////////////////////////////////////////////////////////////////
+			// Calls a function with up to six integer arguments and returns its result.
+			// The data is copied at get_data_address() first. Signals that arrive in
+			// the meantime are delivered. A call that does not return in time is
+			// interrupted, the registers are restored and we detach.
+			////////////////////////////////////////////////////////////////////////////////
+			error_result call(uint64_t function, std::initializer_list<uint64_t> arguments, const void* data, size_t data_size, uint64_t& out_result)
+			{
+				if (arguments.size() > 6)
+					return error_result("Too many arguments");
+
+				// The function returns to address zero, the fault hands control back to us
+				const uint64_t data_address = get_data_address(data_size);
+				const uint64_t return_address = 0;
+
+				user_regs_struct registers = m_saved_registers;
+				registers.rsp = data_address - sizeof(return_address);
+
+				if (!write_memory(data_address, data, data_size) || !write_memory(registers.rsp, &return_address, sizeof(return_address)))
+					return error_result("Failed to write to the memory of the process");
+
+				unsigned long long* const argument_registers[] = { &registers.rdi, &registers.rsi, &registers.rdx, &registers.rcx, &registers.r8, &registers.r9 };
+				uint32_t argument_index = 0;
+				for (uint64_t argument : arguments)
+					*argument_registers[argument_index++] = argument;
+
+				// No vector registers for variadic functions, no direction flag and no system call to restart
+				registers.rip = function;
+				registers.rax = 0;
+				registers.orig_rax = ~0ULL;
+				registers.eflags &= ~0x400ULL;
+
+				if (ptrace(PTRACE_SETREGS, m_pid, nullptr, &registers) != 0 || ptrace(PTRACE_CONT, m_pid, nullptr, nullptr) != 0)
+					return error_result("Failed to resume the process");
+
+				const uint64_t deadline = get_timestamp_ns() + k_call_timeout_ns;
+				while (true)
+				{
+					int status;
+					const wait_result wait = wait_for_stop(status, deadline);
+					if (wait == wait_result::timed_out)
+						return abort_call();
+
+					if (wait == wait_result::exited)
+					{
+						m_is_attached = false;
+						m_is_stopped = false;
+						return error_result("The process exited");
+					}
+
+					const int signal = WSTOPSIG(status);
+					const int event = status >> 16;
+					if (event == 0 && signal == SIGSEGV)
+					{
+						if (ptrace(PTRACE_GETREGS, m_pid, nullptr, &registers) != 0)
+							return error_result("Failed to read the registers of the process");
+
+						if (registers.rip != return_address)
+							return error_result("The process crashed in the injected call");
+
+						out_result = registers.rax;
+						return error_result();
+					}
+
+					// Group stops are resumed, other signals are delivered
+					const int delivered_signal = event == 0 ? signal : 0;
+					if (ptrace(PTRACE_CONT, m_pid, nullptr, reinterpret_cast<void*>(uintptr_t(delivered_signal))) != 0)
+						return error_result("Failed to resume the process");
+				}
+			}
+
+		private:
+			// Below the stack pointer, leaf functions use this much without moving it
+			static constexpr uint64_t k_red_zone_size = 128;
+
+			// Stopping outside of a system call is retried for a while, see the top of the file
+			static constexpr uint32_t k_max_stop_attempts = 50;
+			static constexpr uint64_t k_stop_retry_interval_ns = 1000000ULL;
+
+			static constexpr size_t k_max_fp_state_size = 32 * 1024;
+
+			// dlopen can deadlock on a lock the stopped thread or another one holds, detaching waits on the final flush
+			static constexpr uint64_t k_call_timeout_ns = 30 * 1000000000ULL;
+			static constexpr uint64_t k_stop_timeout_ns = 5 * 1000000000ULL;
+			static constexpr uint64_t k_wait_poll_interval_ns = 1000000ULL;
+
+			enum class wait_result
+			{
+				stopped,
+				exited,
+				timed_out,
+			};
+
+			// Polls for the next stop until the deadline, a thread that never stops must not hang us
+			wait_result wait_for_stop(int& out_status, uint64_t deadline)
+			{
+				while (true)
+				{
+					const pid_t result = waitpid(m_pid, &out_status, __WALL | WNOHANG);
+					if (result == m_pid)
+						return WIFSTOPPED(out_status) ? wait_result::stopped : wait_result::exited;
+
+					if (result < 0 && errno != EINTR)
+						return wait_result::exited;
+
+					if (get_timestamp_ns() >= deadline)
+						return wait_result::timed_out;
+
+					sleep_for(k_wait_poll_interval_ns);
+				}
+			}
+
+			// Stops the thread wherever the call is and puts it back where it was. Whatever locks
+			// the call holds stay held, the process can still hang later but we no longer wait on it.
+			error_result abort_call()
+			{
+				int status;
+				if (ptrace(PTRACE_INTERRUPT, m_pid, nullptr, nullptr) != 0 || wait_for_stop(status, get_timestamp_ns() + k_stop_timeout_ns) != wait_result::stopped)
+				{
+					// The thread is not stopped, its registers cannot be restored
+					m_is_stopped = false;
+					detach();
+					return error_result("The injected call timed out and the process could not be stopped");
+				}
+
+				detach();
+				return error_result("The injected call timed out, the process resumes where it was stopped");
+			}
+
+			error_result stop()
+			{
+				for (uint32_t attempt = 1; ; ++attempt)
+				{
+					if (ptrace(PTRACE_INTERRUPT, m_pid, nullptr, nullptr) != 0)
+						return error_result("Failed to interrupt the process");
+
+					// Signals that arrive before our stop are delivered
+					const uint64_t deadline = get_timestamp_ns() + k_stop_timeout_ns;
+					int status;
+					while (true)
+					{
+						const wait_result wait = wait_for_stop(status, deadline);
+						if (wait == wait_result::timed_out)
+							return error_result("The process did not stop");
+
+						if (wait == wait_result::exited)
+							return error_result("The process exited");
+
+						if ((status >> 16) == PTRACE_EVENT_STOP)
+							break;
+
+						ptrace(PTRACE_CONT, m_pid, nullptr, reinterpret_cast<void*>(uintptr_t(WSTOPSIG(status))));
+					}
+
+					if (ptrace(PTRACE_GETREGS, m_pid, nullptr, &m_saved_registers) != 0)
+						return error_result("Failed to read the registers of the process");
+
+					const bool is_waiting = int64_t(m_saved_registers.orig_rax) >= 0 && m_saved_registers.orig_rax != SYS_futex;
+					if (is_waiting || attempt == k_max_stop_attempts)
+						return error_result();
+
+					ptrace(PTRACE_CONT, m_pid, nullptr, nullptr);
+					sleep_for(k_stop_retry_interval_ns);
+				}
+			}
+
+			bool write_memory(uint64_t address, const void* data, size_t size)
+			{
+				return size == 0 || pwrite(m_mem_fd, data, size, off_t(address)) == ssize_t(size);
+			}
+
+			pid_t				m_pid;
+			int					m_mem_fd = -1;
+			bool				m_is_attached = false;
+			bool				m_is_stopped = false;
+
+			user_regs_struct	m_saved_registers = {};
+			int					m_fp_state_type = 0;
+			size_t				m_saved_fp_state_size = 0;
+			alignas(64) uint8_t	m_saved_fp_state[k_max_fp_state_size];
+		};
+
+		// Set in the mode of glibc's internal dlopen when it is called like the public one
+		constexpr uint64_t k_libc_dlopen_mode_flag = 0x80000000ULL;
+
+		error_result find_library_function(uint32_t pid, const std::string& library_path, const char* name, uint64_t& out_address)
+		{
+			remote_module library;
+			if (!find_remote_module(pid, [&library_path](const std::string& path) { return path == library_path; }, library))
+				return error_result("The capture library is not loaded in the process");
+
+			return find_remote_function(pid, library, { name }, out_address);
+		}
+
+		error_result call_dlclose(remote_process& process, const remote_module& libc, uint32_t pid, uint64_t handle)
+		{
+			uint64_t dlclose_address;
+			const error_result result = find_remote_function(pid, libc, { "dlclose", "__libc_dlclose" }, dlclose_address);
+			if (result.any())
+				return result;
+
+			uint64_t dlclose_result;
+			return process.call(dlclose_address, { handle }, nullptr, 0, dlclose_result);
+		}
+
+		// Loads the library in the process and starts capturing, returns its dlopen handle
+		error_result inject_library(uint32_t pid, const std::string& library_path, const std::vector<char>& settings, uint64_t& out_handle)
+		{
+			remote_process process(pid);
+			error_result result = process.attach();
+			if (result.any())
+				return result;
+
+			remote_module libc;
+			if (!find_remote_module(pid, is_libc_module, libc))
+				return error_result("The process does not use a C library we know");
+
+			// glibc only exports dlopen from libc itself since 2.34, older versions have an internal equivalent
+			uint64_t dlopen_address;
+			const char* dlopen_name = nullptr;
+			result = find_remote_function(pid, libc, { "dlopen", "__libc_dlopen_mode" }, dlopen_address, &dlopen_name);
+			if (result.any())
+				return result;
+
+			const uint64_t mode = std::strcmp(dlopen_name, "dlopen") == 0 ? uint64_t(RTLD_NOW | RTLD_NODELETE) : uint64_t(RTLD_NOW | RTLD_NODELETE) | k_libc_dlopen_mode_flag;
+
+			uint64_t handle = 0;
+			const size_t path_size = library_path.size() + 1;
+			result = process.call(dlopen_address, { process.get_data_address(path_size), mode }, library_path.c_str(), path_size, handle);
+			if (result.any())
+				return result;
+
+			if (handle == 0)
+				return error_result("The process failed to load the capture library");
+
+			uint64_t attach_address;
+			result = find_library_function(pid, library_path, "vmemprof_attach", attach_address);
+			if (result.any())
+				return result;
+
+			uint64_t attach_result = 0;
+			result = process.call(attach_address, { process.get_data_address(settings.size()) }, settings.data(), settings.size(), attach_result);
+			if (result.any())
+				return result;
+
+			if (int32_t(attach_result) != 0)
+			{
+				call_dlclose(process, libc, pid, handle);
+				process.detach();
+				return error_result("The capture library failed to start, its errors are printed by the process");
+			}
+
+			out_handle = handle;
+			return process.detach();
+		}
+
+		// Stops capturing and unloads the library
+		error_result eject_library(uint32_t pid, const std::string& library_path, uint64_t handle)
+		{
+			remote_process process(pid);
+			error_result result = process.attach();
+			if (result.any())
+				return result;
+
+			uint64_t detach_address;
+			result = find_library_function(pid, library_path, "vmemprof_detach", detach_address);
+			if (result.any())
+				return result;
+
+			uint64_t detach_result = 0;
+			result = process.call(detach_address, {}, nullptr, 0, detach_result);
+			if (result.any())
+				return result;
+
+			if (int32_t(detach_result) != 0)
+				return error_result("The capture library failed to detach");
+
+			remote_module libc;
+			if (!find_remote_module(pid, is_libc_module, libc))
+				return error_result("The process does not use a C library we know");
+
+			result = call_dlclose(process, libc, pid, handle);
+			if (result.any())
+				return result;
+
+			return process.detach();
+		}
+#else
+		error_result inject_library(uint32_t, const std::string&, const std::vector<char>&, uint64_t&)
+		{
+			return error_result("Injecting is only supported on x86_64");
+		}
+
+		error_result eject_library(uint32_t, const std::string&, uint64_t)
+		{
+			return error_result("Injecting is only supported on x86_64");
+		}
+#endif
+
+		// Our VMEMPROF_* variables followed by the output, 'NAME=value' strings each null terminated and an empty one last
+		std::vector<char> build_settings(const std::string& output_path)
+		{
+			std::vector<char> settings;
+			const auto add_setting = [&settings](const char* setting) { settings.insert(settings.end(), setting, setting + std::strlen(setting) + 1); };
+
+			for (char** variable = environ; *variable != nullptr; ++variable)
+			{
+				if (std::strncmp(*variable, "VMEMPROF_", 9) == 0 && std::strncmp(*variable, "VMEMPROF_OUTPUT=", 16) != 0)
+					add_setting(*variable);
+			}
+
+			add_setting(("VMEMPROF_OUTPUT=" + output_path).c_str());
+			settings.push_back('\0');
+			return settings;
+		}
+
+		int run_injected_capture(uint32_t pid, const std::string& library_path, uint64_t handle, uint64_t duration_ns)
+		{
+			const uint64_t end_timestamp = duration_ns != 0 ? get_timestamp_ns() + duration_ns : UINT64_MAX;
+			while (!g_is_stop_requested && get_timestamp_ns() < end_timestamp)
+			{
+				// The library completes the trace when the process exits
+				if (!is_process_alive(pid))
+				{
+					fprintf(stderr, "Process %u exited\n", pid);
+					return 0;
+				}
+
+				sleep_for(k_wait_interval_ns);
+			}
+
+			const error_result result = eject_library(pid, library_path, handle);
+			if (result.any())
+			{
+				fprintf(stderr, "Failed to detach from process %u: %s\n", pid, result.c_str());
+				return 1;
+			}
+
+			fprintf(stderr, "Detached from process %u\n", pid);
+
+			return 0;
+		}
+
+		int run_polled_capture(uint32_t pid, const std::string& output_path, uint64_t interval_ns, uint64_t duration_ns)
+		{
+			char path[64];
+			snprintf(path, sizeof(path), "/proc/%u/maps", pid);
+
+			maps_tracker tracker;
+			error_result result = tracker.open(path);
+			if (result.any())
+			{
+				fprintf(stderr, "Failed to poll process %u: %s\n", pid, result.c_str());
+				return 1;
+			}
+
+			residency_scanner scanner;
+			const bool is_sampling_residency = !scanner.open(pid, k_residency_page_budget).any();
+			if (!is_sampling_residency)
+				fprintf(stderr, "Failed to open the pagemap of process %u, residency is not sampled\n", pid);
+
+			const int fd = open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if (fd < 0)
+			{
+				fprintf(stderr, "Failed to create '%s'\n", output_path.c_str());
+				return 1;
+			}
+
+			timespec realtime;
+			clock_gettime(CLOCK_REALTIME, &realtime);
+
+			const uint64_t start_timestamp = get_timestamp_ns();
+			trace_writer writer;
+			result = writer.open(fd, pid, start_timestamp, uint64_t(realtime.tv_sec) * 1000000000ULL + uint64_t(realtime.tv_nsec));
+			if (result.any())
+			{
+				fprintf(stderr, "Failed to write '%s': %s\n", output_path.c_str(), result.c_str());
+				close(fd);
+				return 1;
+			}
+
+			fprintf(stderr, "Polling process %u into '%s'\n", pid, output_path.c_str());
+
+			address_space space;
+			std::vector<vm_event> events;
+			std::vector<residency_sample> residency_samples(k_residency_sample_capacity);
+			uint64_t num_events = 0;
+			uint64_t last_flush_timestamp = start_timestamp;
+
+			const uint64_t end_timestamp = duration_ns != 0 ? start_timestamp + duration_ns : UINT64_MAX;
+			while (!g_is_stop_requested)
+			{
+				const uint64_t now = get_timestamp_ns();
+				if (now >= end_timestamp)
+					break;
+
+				// The maps file cannot be read once the process exited
+				events.clear();
+				if (tracker.poll(now, [&events](const vm_event& event) { events.push_back(event); }).any())
+				{
+					fprintf(stderr, "Process %u exited\n", pid);
+					break;
+				}
+
+				writer.write_events(events.data(), uint32_t(events.size()));
+				for (const vm_event& event : events)
+					space.apply(event);
+
+				num_events += events.size();
+
+				if (is_sampling_residency)
+				{
+					const uint32_t num_samples = scanner.sample(space, get_timestamp_ns(), residency_samples.data(), k_residency_sample_capacity);
+					writer.write_residency_samples(residency_samples.data(), num_samples);
+				}
+
+				if (now - last_flush_timestamp >= k_flush_interval_ns)
+				{
+					writer.flush();
+					last_flush_timestamp = now;
+				}
+
+				sleep_for(interval_ns);
+			}
+
+			result = writer.close();
+			close(fd);
+
+			if (result.any())
+			{
+				fprintf(stderr, "Failed to write '%s': %s\n", output_path.c_str(), result.c_str());
+				return 1;
+			}
+
+			fprintf(stderr, "Wrote %" PRIu64 " events reconstructed from the maps of process %u\n", num_events, pid);
+			return 0;
+		}
+	}
+
+	int run_attach_command(int argc, char** argv)
+	{
+		uint64_t pid = 0;
+		const char* output_path = k_default_output_path;
+		const char* library_path = nullptr;
+		uint64_t duration_ns = 0;
+		uint64_t interval_ns = k_default_poll_interval_ns;
+		bool is_polling = false;
+
+		for (int argument_index = 0; argument_index < argc; ++argument_index)
+		{
+			const char* argument = argv[argument_index];
+			const char* value;
+			bool is_valid = true;
+
+			if ((value = get_option_value(argument, "--output")) != nullptr)
+				output_path = value;
+			else if ((value = get_option_value(argument, "--duration")) != nullptr)
+				is_valid = parse_duration(value, duration_ns) && duration_ns != 0;
+			else if ((value = get_option_value(argument, "--library")) != nullptr)
+				library_path = value;
+			else if ((value = get_option_value(argument, "--interval")) != nullptr)
+				is_valid = parse_duration(value, interval_ns) && interval_ns != 0;
+			else if (std::strcmp(argument, "--poll") == 0)
+				is_polling = true;
+			else if (argument[0] != '-' && pid == 0)
+				is_valid = parse_uint64(argument, pid) && pid != 0 && pid <= UINT32_MAX;
+			else
+				is_valid = false;
+
+			if (!is_valid)
+			{
+				fprintf(stderr, "Invalid argument '%s'\n\n", argument);
+				print_attach_usage();
+				return 1;
+			}
+		}
+
+		if (pid == 0)
+		{
+			fprintf(stderr, "No process id provided\n\n");
+			print_attach_usage();
+			return 1;
+		}
+
+		const uint32_t process_id = uint32_t(pid);
+		if (!is_process_alive(process_id))
+		{
+			fprintf(stderr, "Process %u does not exist\n", process_id);
+			return 1;
+		}
+
+		// Without SA_RESTART the signals interrupt our sleeps, the process is never left stopped
+		struct sigaction action = {};
+		action.sa_handler = on_stop_signal;
+		sigaction(SIGINT, &action, nullptr);
+		sigaction(SIGTERM, &action, nullptr);
+
+		// The injected library resolves relative paths from the working directory of the process
+		const std::string absolute_output_path = get_absolute_path(output_path);
+
+		if (!is_polling)
+		{
+			const std::string default_library_path = library_path == nullptr ? get_default_library_path() : std::string();
+			char resolved_library_path[PATH_MAX];
+			if (realpath(library_path != nullptr ? library_path : default_library_path.c_str(), resolved_library_path) == nullptr)
+			{
+				fprintf(stderr, "Capture library not found, use --library\n");
+				return 1;
+			}
+
+			uint64_t handle = 0;
+			const error_result result = inject_library(process_id, resolved_library_path, build_settings(absolute_output_path), handle);
+			if (!result.any())
+			{
+				const char* live_socket_path = getenv("VMEMPROF_LIVE");
+				if (live_socket_path != nullptr && live_socket_path[0] != '\0')
+					fprintf(stderr, "Attached to process %u, streaming to '%s'\n", process_id, live_socket_path);
+				else
+					fprintf(stderr, "Attached to process %u, capturing into '%s'\n", process_id, replace_process_id(absolute_output_path.c_str(), process_id).c_str());
+
+				return run_injected_capture(process_id, resolved_library_path, handle, duration_ns);
+			}
+
+			fprintf(stderr, "Failed to inject into process %u: %s\n", process_id, result.c_str());
+			fprintf(stderr, "Polling its maps instead, events have no callstack and short lived mappings are missed\n");
+		}
+
+		return run_polled_capture(process_id, replace_process_id(absolute_output_path.c_str(), process_id), interval_ns, duration_ns);
+	}
+}
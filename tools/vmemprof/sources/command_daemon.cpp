@@ -0,0 +1,759 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+#include "command_line.h"
+#include "leak_options.h"
+#include "live_protocol.h"
+
+#include "vmemprof/analysis/live_aggregator.h"
+#include "vmemprof/core/error_result.h"
+#include "vmemprof/core/time_utils.h"
+#include "vmemprof/trace/stack_codec.h"
+#include "vmemprof/trace/trace_stream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+namespace vmemprof
+{
+	namespace
+	{
+		// Bytes read from a connection at once, queries are answered between reads
+		constexpr size_t k_read_size = 256 * 1024;
+
+		// Sessions of processes that disconnected are kept for post mortem queries
+		constexpr size_t k_max_closed_sessions = 16;
+
+		constexpr uint64_t k_default_refresh_interval_ns = 200 * 1000000ULL;
+		constexpr uint32_t k_default_top_count = 10;
+
+		// The kernel default of vm.max_map_count
+		constexpr uint64_t k_default_max_map_count = 65530;
+
+		volatile sig_atomic_t g_is_stop_requested = 0;
+
+		void print_daemon_usage()
+		{
+			fprintf(stderr, "Usage: vmemprof daemon [options]\n\n");
+			fprintf(stderr, "Options:\n");
+			fprintf(stderr, "    --socket=<path>      Unix socket to listen on (default: $VMEMPROF_LIVE)\n");
+			fprintf(stderr, "    --refresh=<time>     How often committed bytes per callstack are recomputed (default: 200ms)\n");
+			print_leak_options_usage("leak-");
+		}
+
+		void on_stop_signal(int)
+		{
+			g_is_stop_requested = 1;
+		}
+
+		uint64_t read_max_map_count()
+		{
+			FILE* file = fopen("/proc/sys/vm/max_map_count", "r");
+			if (file == nullptr)
+				return k_default_max_map_count;
+
+			uint64_t max_map_count;
+			if (fscanf(file, "%" SCNu64, &max_map_count) != 1 || max_map_count == 0)
+				max_map_count = k_default_max_map_count;
+
+			fclose(file);
+			return max_map_count;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// The stream of one profiled process and its aggregates.
+		////////////////////////////////////////////////////////////////////////////////
+		struct live_session
+		{
+			explicit live_session(const leak_detector_settings& leak_settings) : aggregator(leak_settings) {}
+
+			trace_stream_decoder	decoder;
+			live_aggregator			aggregator;
+			error_result			error;						// Why the stream was dropped
+			uint64_t				connect_timestamp = 0;
+			uint64_t				disconnect_timestamp = 0;	// Zero while streaming
+			uint64_t				refresh_timestamp = 0;
+			bool					is_started = false;			// The aggregator was reset with the trace header
+
+			bool is_streaming() const { return disconnect_timestamp == 0; }
+			uint32_t get_process_id() const { return is_started ? aggregator.get_header().process_id : 0; }
+		};
+
+		enum class connection_kind
+		{
+			unknown,		// Not enough bytes to tell yet
+			capture,
+			query,
+		};
+
+		struct live_connection
+		{
+			int						fd;
+			connection_kind			kind;
+			std::vector<uint8_t>	pending;		// Bytes received before the kind is known, then the query line
+			live_session*			session;
+		};
+
+		struct live_query
+		{
+			char		name[32];
+			uint64_t	process_id = 0;		// Zero for the most recent process
+			uint64_t	count = k_default_top_count;
+		};
+
+		bool parse_live_query(const char* line, live_query& out_query)
+		{
+			const char* name_end = line + std::strcspn(line, " ");
+			const size_t name_length = size_t(name_end - line);
+			if (name_length == 0 || name_length >= sizeof(out_query.name))
+				return false;
+
+			std::memcpy(out_query.name, line, name_length);
+			out_query.name[name_length] = '\0';
+
+			char argument[k_max_live_query_size];
+			const char* input = name_end;
+			while (*input != '\0')
+			{
+				input += std::strspn(input, " ");
+				const size_t argument_length = std::strcspn(input, " ");
+				if (argument_length == 0)
+					break;
+
+				std::memcpy(argument, input, argument_length);
+				argument[argument_length] = '\0';
+				input += argument_length;
+
+				const char* value;
+				if ((value = get_option_value(argument, "pid")) != nullptr)
+				{
+					if (!parse_uint64(value, out_query.process_id))
+						return false;
+				}
+				else if ((value = get_option_value(argument, "count")) != nullptr)
+				{
+					if (!parse_uint64(value, out_query.count))
+						return false;
+				}
+				else
+					return false;
+			}
+
+			return true;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Accepts capture streams and queries on a single thread.
+		//
+		// Every connection is non-blocking and read at most k_read_size bytes at a
+		// time so a process flushing a large backlog does not delay queries. Queries
+		// read the aggregates as they are, the per-callstack join is refreshed
+		// between reads instead.
+		////////////////////////////////////////////////////////////////////////////////
+		class live_daemon
+		{
+		public:
+			live_daemon(uint64_t refresh_interval_ns, const leak_detector_settings& leak_settings)
+				: m_refresh_interval_ns(refresh_interval_ns)
+				, m_leak_settings(leak_settings)
+				, m_max_map_count(read_max_map_count())
+				, m_read_buffer(k_read_size)
+			{
+			}
+
+			~live_daemon()
+			{
+				for (const live_connection& connection : m_connections)
+					close(connection.fd);
+
+				if (m_listen_fd >= 0)
+				{
+					close(m_listen_fd);
+					unlink(m_socket_path.c_str());
+				}
+			}
+
+			error_result listen_on(const char* socket_path)
+			{
+				sockaddr_un address;
+				if (!make_live_socket_address(socket_path, address))
+					return error_result("Socket path is too long");
+
+				// A socket left behind by a daemon that died is replaced, a live one is not
+				struct stat socket_stat;
+				if (stat(socket_path, &socket_stat) == 0)
+				{
+					if (!S_ISSOCK(socket_stat.st_mode))
+						return error_result("Socket path exists and is not a socket");
+
+					const int probe_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+					const bool is_in_use = probe_fd >= 0 && connect(probe_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+					if (probe_fd >= 0)
+						close(probe_fd);
+
+					if (is_in_use)
+						return error_result("Another daemon is listening on the socket");
+
+					unlink(socket_path);
+				}
+
+				m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+				if (m_listen_fd < 0)
+					return error_result("Failed to create the socket");
+
+				if (bind(m_listen_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(m_listen_fd, 64) != 0)
+				{
+					close(m_listen_fd);
+					m_listen_fd = -1;
+					return error_result("Failed to listen on the socket");
+				}
+
+				m_socket_path = socket_path;
+				return error_result();
+			}
+
+			void run()
+			{
+				std::vector<pollfd> poll_fds;
+				const int poll_timeout_ms = int(std::max<uint64_t>(m_refresh_interval_ns / 1000000ULL, 1));
+
+				while (g_is_stop_requested == 0)
+				{
+					poll_fds.clear();
+					poll_fds.push_back(pollfd{ m_listen_fd, POLLIN, 0 });
+					for (const live_connection& connection : m_connections)
+						poll_fds.push_back(pollfd{ connection.fd, POLLIN, 0 });
+
+					const int num_ready = poll(poll_fds.data(), poll_fds.size(), poll_timeout_ms);
+					if (num_ready < 0 && errno != EINTR)
+					{
+						fprintf(stderr, "Failed to wait for connections: %s\n", strerror(errno));
+						return;
+					}
+
+					if (num_ready > 0)
+					{
+						// Connections are appended and removed while we iterate, handle them by descriptor
+						for (size_t poll_index = 1; poll_index < poll_fds.size(); ++poll_index)
+						{
+							if (poll_fds[poll_index].revents != 0)
+								read_connection(poll_fds[poll_index].fd);
+						}
+
+						if (poll_fds[0].revents != 0)
+							accept_connections();
+					}
+
+					refresh_sessions();
+				}
+			}
+
+		private:
+			void accept_connections()
+			{
+				while (true)
+				{
+					const int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+					if (fd < 0)
+						return;
+
+					m_connections.push_back(live_connection{ fd, connection_kind::unknown, std::vector<uint8_t>(), nullptr });
+				}
+			}
+
+			void read_connection(int fd)
+			{
+				const auto connection_it = std::find_if(m_connections.begin(), m_connections.end(), [fd](const live_connection& connection) { return connection.fd == fd; });
+				if (connection_it == m_connections.end())
+					return;
+
+				live_connection& connection = *connection_it;
+				const ssize_t num_read = recv(fd, m_read_buffer.data(), m_read_buffer.size(), 0);
+				if (num_read < 0 && (errno == EAGAIN || errno == EINTR))
+					return;
+
+				if (num_read <= 0)
+				{
+					close_connection(connection_it, error_result());
+					return;
+				}
+
+				const uint8_t* data = m_read_buffer.data();
+				size_t size = size_t(num_read);
+
+				if (connection.kind == connection_kind::unknown)
+				{
+					connection.pending.insert(connection.pending.end(), data, data + size);
+					if (connection.pending.size() < sizeof(k_trace_magic))
+						return;
+
+					uint32_t magic;
+					std::memcpy(&magic, connection.pending.data(), sizeof(magic));
+					connection.kind = magic == k_trace_magic ? connection_kind::capture : connection_kind::query;
+
+					if (connection.kind == connection_kind::capture)
+					{
+						connection.session = create_session();
+
+						// The bytes we held on to are decoded now, the pending buffer is not needed anymore
+						const std::vector<uint8_t> pending = std::move(connection.pending);
+						if (!feed_session(*connection.session, pending.data(), pending.size()))
+							close_connection(connection_it, connection.session->error);
+						return;
+					}
+
+					data = connection.pending.data();
+					size = 0;
+				}
+
+				if (connection.kind == connection_kind::capture)
+				{
+					if (!feed_session(*connection.session, data, size))
+						close_connection(connection_it, connection.session->error);
+					return;
+				}
+
+				if (size != 0)
+					connection.pending.insert(connection.pending.end(), data, data + size);
+
+				const auto line_end = std::find(connection.pending.begin(), connection.pending.end(), uint8_t('\n'));
+				if (line_end == connection.pending.end())
+				{
+					if (connection.pending.size() > k_max_live_query_size)
+					{
+						send_answer(fd, "Query is too long\n");
+						close_connection(connection_it, error_result());
+					}
+					return;
+				}
+
+				const std::string line(connection.pending.begin(), line_end);
+				send_answer(fd, answer_query(line.c_str()));
+				close_connection(connection_it, error_result());
+			}
+
+			void close_connection(std::vector<live_connection>::iterator connection_it, error_result error)
+			{
+				live_session* session = connection_it->session;
+				if (session != nullptr)
+				{
+					session->disconnect_timestamp = get_timestamp_ns();
+					session->error = error;
+					session->aggregator.refresh_stack_usage();
+
+					if (error.any())
+						fprintf(stderr, "Process %u dropped: %s\n", session->get_process_id(), error.c_str());
+					else
+						fprintf(stderr, "Process %u disconnected, %" PRIu64 " bytes received\n", session->get_process_id(), session->decoder.get_num_bytes());
+
+					prune_closed_sessions();
+				}
+
+				close(connection_it->fd);
+				m_connections.erase(connection_it);
+			}
+
+			live_session* create_session()
+			{
+				m_sessions.emplace_back(new live_session(m_leak_settings));
+
+				live_session* session = m_sessions.back().get();
+				session->connect_timestamp = get_timestamp_ns();
+				return session;
+			}
+
+			// Returns false if the stream is invalid
+			bool feed_session(live_session& session, const uint8_t* data, size_t size)
+			{
+				session.error = session.decoder.feed(data, size, [&session](const chunk_view& chunk)
+					{
+						if (!session.is_started)
+						{
+							// The header was received along with this chunk
+							session.aggregator.reset(session.decoder.get_header());
+							session.is_started = true;
+							fprintf(stderr, "Process %u connected\n", session.get_process_id());
+						}
+
+						return session.aggregator.apply_chunk(chunk);
+					});
+
+				return !session.error.any();
+			}
+
+			void prune_closed_sessions()
+			{
+				size_t num_closed_sessions = 0;
+				for (const std::unique_ptr<live_session>& session : m_sessions)
+					num_closed_sessions += session->is_streaming() ? 0 : 1;
+
+				// Sessions are in connection order, the oldest closed ones go first
+				for (auto session_it = m_sessions.begin(); session_it != m_sessions.end() && num_closed_sessions > k_max_closed_sessions;)
+				{
+					if ((*session_it)->is_streaming())
+						++session_it;
+					else
+					{
+						session_it = m_sessions.erase(session_it);
+						num_closed_sessions--;
+					}
+				}
+			}
+
+			void refresh_sessions()
+			{
+				const uint64_t now = get_timestamp_ns();
+				for (const std::unique_ptr<live_session>& session : m_sessions)
+				{
+					if (session->aggregator.is_stack_usage_stale() && now - session->refresh_timestamp >= m_refresh_interval_ns)
+					{
+						session->aggregator.refresh_stack_usage();
+						session->refresh_timestamp = now;
+					}
+
+					// Closed streams no longer change, observing them would only pad the window
+					if (session->is_started && session->is_streaming())
+						session->aggregator.observe_leaks(now);
+				}
+			}
+
+			// Returns the latest session of a process, or the latest session still streaming when the id is zero
+			const live_session* find_session(uint64_t process_id) const
+			{
+				const live_session* latest_session = nullptr;
+				for (auto session_it = m_sessions.rbegin(); session_it != m_sessions.rend(); ++session_it)
+				{
+					const live_session& session = **session_it;
+					if (!session.is_started)
+						continue;
+
+					if (process_id != 0 && session.get_process_id() == process_id)
+						return &session;
+
+					if (process_id == 0 && session.is_streaming())
+						return &session;
+
+					if (process_id == 0 && latest_session == nullptr)
+						latest_session = &session;
+				}
+
+				return latest_session;
+			}
+
+			std::string answer_query(const char* line) const
+			{
+				std::string answer;
+
+				live_query query;
+				if (!parse_live_query(line, query))
+				{
+					append_format(answer, "Invalid query '%s'\n", line);
+					return answer;
+				}
+
+				if (std::strcmp(query.name, "processes") == 0)
+				{
+					append_processes(answer);
+					return answer;
+				}
+
+				const bool is_summary = std::strcmp(query.name, "summary") == 0;
+				const bool is_leaks = std::strcmp(query.name, "leaks") == 0;
+				if (!is_summary && !is_leaks && std::strcmp(query.name, "top") != 0)
+				{
+					append_format(answer, "Unknown query '%s'\n", query.name);
+					return answer;
+				}
+
+				const live_session* session = find_session(query.process_id);
+				if (session == nullptr)
+				{
+					append_format(answer, query.process_id != 0 ? "Process %" PRIu64 " is not known\n" : "No process is streaming\n", query.process_id);
+					return answer;
+				}
+
+				if (is_summary)
+					append_summary(*session, answer);
+				else if (is_leaks)
+					append_leaks(*session, query.count, answer);
+				else
+					append_top(*session, query.count, answer);
+
+				return answer;
+			}
+
+			void append_processes(std::string& answer) const
+			{
+				append_format(answer, "%-8s %-10s %10s %12s %10s %10s %10s\n", "pid", "state", "duration", "received", "events", "vmas", "committed");
+
+				const uint64_t now = get_timestamp_ns();
+				for (const std::unique_ptr<live_session>& session : m_sessions)
+				{
+					if (!session->is_started)
+						continue;
+
+					const live_aggregator& aggregator = session->aggregator;
+					const uint64_t end_timestamp = session->is_streaming() ? now : session->disconnect_timestamp;
+
+					char committed[32];
+					append_format(answer, "%-8u %-10s %9.1fs %11" PRIu64 "K %10" PRIu64 " %10" PRIu64 " %10s\n",
+						session->get_process_id(), session->is_streaming() ? "streaming" : (session->error.any() ? "dropped" : "closed"),
+						double(end_timestamp - session->connect_timestamp) * 1.0e-9, session->decoder.get_num_bytes() / 1024,
+						aggregator.get_num_events(), aggregator.get_space().get_stats().num_vmas, format_size(aggregator.get_total_usage().committed_bytes, committed));
+				}
+			}
+
+			void append_summary(const live_session& session, std::string& answer) const
+			{
+				const live_aggregator& aggregator = session.aggregator;
+				const address_space_stats& stats = aggregator.get_space().get_stats();
+				const live_stack_usage& totals = aggregator.get_total_usage();
+
+				// The profiled process and the daemon share CLOCK_MONOTONIC, rates of a closed stream stop at its end
+				const uint64_t now = session.is_streaming() ? get_timestamp_ns() : std::max(aggregator.get_last_timestamp(), aggregator.get_header().start_timestamp);
+				const uint64_t elapsed_seconds = (now - std::min(now, aggregator.get_header().start_timestamp)) / 1000000000ULL;
+
+				append_format(answer, "Process:           %u (%s)\n", session.get_process_id(), session.is_streaming() ? "streaming" : "closed");
+				if (session.error.any())
+					append_format(answer, "Stream error:      %s\n", session.error.c_str());
+
+				append_format(answer, "VMAs:              %" PRIu64 " of %" PRIu64 " (%.1f%%)\n", stats.num_vmas, m_max_map_count, 100.0 * double(stats.num_vmas) / double(m_max_map_count));
+				append_format(answer, "Regions:           %" PRIu64 "\n", stats.num_regions);
+
+				// Sampled mappings are scaled in the refreshed totals, the VMA count only covers what was recorded
+				char size[32];
+				if (aggregator.get_scaler().is_sampled())
+				{
+					append_format(answer, "Sampling:          one mapping every %s, sizes are estimates\n", format_size(aggregator.get_scaler().get_sampling_interval(), size));
+					append_format(answer, "Mapped:            %s\n", format_size(totals.mapped_bytes, size));
+				}
+				else
+					append_format(answer, "Mapped:            %s\n", format_size(stats.mapped_bytes, size));
+				append_format(answer, "Committed:         %s\n", format_size(totals.committed_bytes, size));
+				append_format(answer, "Resident:          %s\n", format_size(totals.resident_bytes, size));
+				append_format(answer, "Unsampled:         %s\n", format_size(totals.mapped_bytes - std::min(totals.mapped_bytes, totals.sampled_bytes), size));
+
+				// The current second is still being filled, rates cover complete seconds
+				const uint32_t windows[] = { 1, 10, 60 };
+				const char* labels[] = { "Events/s:          ", "Sampled faults/s:  " };
+				for (uint32_t rate_index = 0; rate_index < 2; ++rate_index)
+				{
+					answer += labels[rate_index];
+					for (uint32_t window : windows)
+					{
+						const uint64_t count = rate_index == 0 ? aggregator.get_event_count(now - 1000000000ULL, window) : aggregator.get_fault_count(now - 1000000000ULL, window);
+						const uint64_t num_seconds = std::max<uint64_t>(std::min<uint64_t>(window, elapsed_seconds), 1);
+						append_format(answer, "%.1f (%us) ", double(count) / double(num_seconds), window);
+					}
+					answer.back() = '\n';
+				}
+
+				append_format(answer, "Events:            %" PRIu64 " (%" PRIu64 " dropped)\n", aggregator.get_num_events(), aggregator.get_num_dropped_events());
+				append_format(answer, "Fault samples:     %" PRIu64 " (%" PRIu64 " lost)\n", aggregator.get_num_fault_samples(), aggregator.get_num_lost_faults());
+			}
+
+			void append_top(const live_session& session, uint64_t count, std::string& answer) const
+			{
+				const live_aggregator& aggregator = session.aggregator;
+				const std::vector<live_stack_usage>& usages = aggregator.get_stack_usage();
+
+				append_format(answer, "%-10s %10s %10s %10s %8s\n", "stack", "committed", "resident", "mapped", "regions");
+
+				for (size_t usage_index = 0; usage_index < usages.size() && usage_index < count; ++usage_index)
+				{
+					const live_stack_usage& usage = usages[usage_index];
+
+					char committed[32];
+					char resident[32];
+					char mapped[32];
+					append_format(answer, "%-10u %10s %10s %10s %8u\n", usage.stack_id,
+						format_size(usage.committed_bytes, committed), format_size(usage.resident_bytes, resident), format_size(usage.mapped_bytes, mapped), usage.num_regions);
+
+					append_stack(aggregator, usage.stack_id, answer);
+				}
+
+				if (usages.empty())
+					answer += "No region is mapped\n";
+			}
+
+			void append_leaks(const live_session& session, uint64_t count, std::string& answer) const
+			{
+				const live_aggregator& aggregator = session.aggregator;
+				const leak_detector& detector = aggregator.get_leak_detector();
+				const leak_detector_settings& settings = detector.get_settings();
+
+				std::vector<leak_suspect> suspects;
+				detector.get_suspects(suspects);
+
+				append_format(answer, "Observations:      %" PRIu64 " every %.1fs, window of %u\n", detector.get_num_observations(), double(settings.interval_ns) * 1.0e-9, settings.num_windows);
+				append_format(answer, "Growing stacks:    %zu\n", suspects.size());
+				if (suspects.empty())
+					return;
+
+				append_format(answer, "\n%-10s %10s %12s %10s %12s %10s\n", "stack", "mappings", "mappings/h", "committed", "committed/h", "since");
+
+				const uint64_t start_timestamp = aggregator.get_header().start_timestamp;
+				for (size_t suspect_index = 0; suspect_index < suspects.size() && suspect_index < count; ++suspect_index)
+				{
+					const leak_suspect& suspect = suspects[suspect_index];
+
+					char committed[32];
+					char committed_rate[32];
+					append_format(answer, "%-10u %10u %12.1f %10s %12s %9.1fs\n", suspect.stack_id, suspect.live_count, suspect.count_rate * 3600.0,
+						format_size(suspect.committed_bytes, committed), format_size(uint64_t(std::max(suspect.committed_rate, 0.0) * 3600.0), committed_rate),
+						double(suspect.first_flagged_timestamp - std::min(suspect.first_flagged_timestamp, start_timestamp)) * 1.0e-9);
+
+					append_stack(aggregator, suspect.stack_id, answer);
+				}
+			}
+
+			static void append_stack(const live_aggregator& aggregator, uint32_t stack_id, std::string& answer)
+			{
+				uint64_t frames[k_max_stack_frames];
+				uint32_t num_frames;
+				if (stack_id == k_invalid_stack_id || !aggregator.get_stack(stack_id, frames, num_frames))
+				{
+					answer += "        <unknown stack>\n";
+					return;
+				}
+
+				// Stacks are not symbolized live, modules and offsets can be symbolized later
+				for (uint32_t frame_index = 0; frame_index < num_frames; ++frame_index)
+				{
+					const live_module* module = aggregator.find_module(frames[frame_index]);
+					append_format(answer, "        #%-2u 0x%" PRIx64, frame_index, frames[frame_index]);
+
+					if (module != nullptr && !module->path.empty())
+					{
+						const size_t name_offset = module->path.rfind('/');
+						const char* name = module->path.c_str() + (name_offset == std::string::npos ? 0 : name_offset + 1);
+						append_format(answer, " %s+0x%" PRIx64, name, frames[frame_index] - module->load_address);
+					}
+
+					answer += '\n';
+				}
+			}
+
+			static void send_answer(int fd, const std::string& answer)
+			{
+				// Answers are small, a client that does not read them only holds us for a moment
+				const int flags = fcntl(fd, F_GETFL);
+				fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+
+				const timeval timeout = { 1, 0 };
+				setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+				const char* data = answer.data();
+				size_t size = answer.size();
+				while (size != 0)
+				{
+					const ssize_t num_written = send(fd, data, size, MSG_NOSIGNAL);
+					if (num_written <= 0)
+						return;
+
+					data += num_written;
+					size -= size_t(num_written);
+				}
+			}
+
+			uint64_t								m_refresh_interval_ns;
+			leak_detector_settings					m_leak_settings;
+			uint64_t								m_max_map_count;
+			int										m_listen_fd = -1;
+			std::string								m_socket_path;
+			std::vector<uint8_t>					m_read_buffer;
+			std::vector<live_connection>			m_connections;
+			std::vector<std::unique_ptr<live_session>>	m_sessions;		// In connection order
+		};
+	}
+
+	int run_daemon_command(int argc, char** argv)
+	{
+		const char* socket_path = get_default_live_socket_path();
+		uint64_t refresh_interval_ns = k_default_refresh_interval_ns;
+		leak_detector_settings leak_settings;
+
+		for (int argument_index = 0; argument_index < argc; ++argument_index)
+		{
+			const char* argument = argv[argument_index];
+			const char* value;
+			bool is_valid = true;
+
+			if ((value = get_option_value(argument, "--socket")) != nullptr)
+				socket_path = value;
+			else if ((value = get_option_value(argument, "--refresh")) != nullptr)
+				is_valid = parse_duration(value, refresh_interval_ns) && refresh_interval_ns != 0;
+			else if (!parse_leak_option(argument, "leak-", leak_settings, is_valid))
+				is_valid = false;
+
+			if (!is_valid)
+			{
+				fprintf(stderr, "Invalid argument '%s'\n\n", argument);
+				print_daemon_usage();
+				return 1;
+			}
+		}
+
+		if (socket_path == nullptr)
+		{
+			fprintf(stderr, "No socket provided\n\n");
+			print_daemon_usage();
+			return 1;
+		}
+
+		// Without SA_RESTART the signals interrupt poll and we clean the socket up on the way out
+		struct sigaction action = {};
+		action.sa_handler = on_stop_signal;
+		sigaction(SIGINT, &action, nullptr);
+		sigaction(SIGTERM, &action, nullptr);
+
+		live_daemon daemon(refresh_interval_ns, leak_settings);
+		const error_result result = daemon.listen_on(socket_path);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to listen on '%s': %s\n", socket_path, result.c_str());
+			return 1;
+		}
+
+		fprintf(stderr, "Listening on '%s'\n", socket_path);
+		daemon.run();
+		return 0;
+	}
+}
@@ -0,0 +1,282 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+#include "command_line.h"
+#include "stack_printer.h"
+
+#include "vmemprof/analysis/address_space_replay.h"
+#include "vmemprof/analysis/residency_map.h"
+#include "vmemprof/analysis/snapshot_diff.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace vmemprof
+{
+	namespace
+	{
+		void print_diff_usage()
+		{
+			fprintf(stderr, "Usage: vmemprof diff <trace> [<other trace>] [options]\n\n");
+			fprintf(stderr, "Compares two points in time of a trace, or the ends of two traces.\n\n");
+			fprintf(stderr, "Options:\n");
+			fprintf(stderr, "    --from=<time>        Time since the capture start of the first snapshot (default: start of trace, end with two traces)\n");
+			fprintf(stderr, "    --to=<time>          Time since the capture start of the second snapshot (default: end of trace)\n");
+			fprintf(stderr, "    --by=<grouping>      Group regions by 'stack' (default), 'module' or 'mapping'\n");
+			fprintf(stderr, "    --limit=<count>      Print this many groups at most (default: 20)\n");
+		}
+
+		bool parse_grouping(const char* str, diff_grouping& out_grouping)
+		{
+			if (std::strcmp(str, "stack") == 0)
+				out_grouping = diff_grouping::stack;
+			else if (std::strcmp(str, "module") == 0)
+				out_grouping = diff_grouping::module;
+			else if (std::strcmp(str, "mapping") == 0)
+				out_grouping = diff_grouping::mapping;
+			else
+				return false;
+
+			return true;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// A trace and the replay of its events, shared by both snapshots of a single trace.
+		////////////////////////////////////////////////////////////////////////////////
+		struct diff_trace
+		{
+			const char*				path;
+			trace_reader			reader;
+			address_space_replay	replay;
+		};
+
+		error_result open_trace(const char* path, diff_trace& out_trace)
+		{
+			out_trace.path = path;
+
+			const error_result result = out_trace.reader.open(path);
+			if (result.any())
+				return result;
+
+			return out_trace.replay.initialize(out_trace.reader);
+		}
+
+		error_result load_snapshot(const diff_trace& trace, uint64_t time, address_space& out_space, residency_map& out_residency)
+		{
+			const uint64_t timestamp = time == UINT64_MAX ? UINT64_MAX : trace.reader.get_header().start_timestamp + time;
+
+			if (time == UINT64_MAX)
+				out_space = trace.replay.get_final_space();
+			else
+			{
+				const error_result result = trace.replay.seek(timestamp, out_space);
+				if (result.any())
+					return result;
+			}
+
+			return read_residency_samples(trace.reader, timestamp, out_residency);
+		}
+
+		void print_time(const char* label, const char* trace_path, uint64_t time)
+		{
+			if (time == UINT64_MAX)
+				printf("%-19s%s at the end\n", label, trace_path);
+			else
+				printf("%-19s%s at %.3fs\n", label, trace_path, double(time) * 1.0e-9);
+		}
+
+		void print_bytes_change(const char* label, uint64_t before_bytes, uint64_t after_bytes)
+		{
+			printf("%-19s%" PRIu64 " KB -> %" PRIu64 " KB (%+" PRId64 " KB)\n", label, before_bytes / 1024, after_bytes / 1024, (int64_t(after_bytes) - int64_t(before_bytes)) / 1024);
+		}
+
+		bool is_unchanged(const diff_entry& entry)
+		{
+			return entry.usages[0].num_regions == entry.usages[1].num_regions && entry.get_mapped_delta() == 0
+				&& entry.get_committed_delta() == 0 && entry.get_resident_delta() == 0;
+		}
+	}
+
+	int run_diff_command(int argc, char** argv)
+	{
+		if (argc < 1)
+		{
+			print_diff_usage();
+			return 1;
+		}
+
+		const char* trace_paths[2] = { argv[0], nullptr };
+		int first_option_index = 1;
+		if (argc >= 2 && std::strncmp(argv[1], "--", 2) != 0)
+		{
+			trace_paths[1] = argv[1];
+			first_option_index = 2;
+		}
+
+		const bool is_single_trace = trace_paths[1] == nullptr;
+		uint64_t from_time = is_single_trace ? 0 : UINT64_MAX;
+		uint64_t to_time = UINT64_MAX;
+		diff_grouping grouping = diff_grouping::stack;
+		uint64_t limit = 20;
+
+		for (int argument_index = first_option_index; argument_index < argc; ++argument_index)
+		{
+			const char* argument = argv[argument_index];
+			const char* value;
+			bool is_valid = true;
+
+			if ((value = get_option_value(argument, "--from")) != nullptr)
+				is_valid = parse_duration(value, from_time);
+			else if ((value = get_option_value(argument, "--to")) != nullptr)
+				is_valid = parse_duration(value, to_time);
+			else if ((value = get_option_value(argument, "--by")) != nullptr)
+				is_valid = parse_grouping(value, grouping);
+			else if ((value = get_option_value(argument, "--limit")) != nullptr)
+				is_valid = parse_uint64(value, limit);
+			else
+				is_valid = false;
+
+			if (!is_valid)
+			{
+				fprintf(stderr, "Invalid argument '%s'\n\n", argument);
+				print_diff_usage();
+				return 1;
+			}
+		}
+
+		if (is_single_trace && from_time > to_time)
+		{
+			fprintf(stderr, "The first snapshot must not be after the second one\n");
+			return 1;
+		}
+
+		diff_trace traces[2];
+		const uint32_t num_traces = is_single_trace ? 1 : 2;
+		for (uint32_t trace_index = 0; trace_index < num_traces; ++trace_index)
+		{
+			const error_result result = open_trace(trace_paths[trace_index], traces[trace_index]);
+			if (result.any())
+			{
+				fprintf(stderr, "Failed to read '%s': %s\n", trace_paths[trace_index], result.c_str());
+				return 1;
+			}
+		}
+
+		const diff_trace& before_trace = traces[0];
+		const diff_trace& after_trace = traces[num_traces - 1];
+
+		address_space spaces[2];
+		residency_map residencies[2] = { residency_map(before_trace.reader.get_header().page_size), residency_map(after_trace.reader.get_header().page_size) };
+		const diff_trace* snapshot_traces[2] = { &before_trace, &after_trace };
+		const uint64_t snapshot_times[2] = { from_time, to_time };
+		for (uint32_t side = 0; side < 2; ++side)
+		{
+			const error_result result = load_snapshot(*snapshot_traces[side], snapshot_times[side], spaces[side], residencies[side]);
+			if (result.any())
+			{
+				fprintf(stderr, "Failed to replay '%s': %s\n", snapshot_traces[side]->path, result.c_str());
+				return 1;
+			}
+		}
+
+		snapshot_diff diff;
+		const error_result result = diff.build(diff_snapshot{ &before_trace.reader, &spaces[0], &residencies[0] }, diff_snapshot{ &after_trace.reader, &spaces[1], &residencies[1] }, grouping);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to compare the snapshots: %s\n", result.c_str());
+			return 1;
+		}
+
+		std::vector<diff_entry>& entries = diff.get_entries();
+		sort_diff_entries(entries);
+
+		uint64_t num_changed = 0;
+		for (const diff_entry& entry : entries)
+			num_changed += is_unchanged(entry) ? 0 : 1;
+
+		const diff_usage& total_before = diff.get_total(0);
+		const diff_usage& total_after = diff.get_total(1);
+
+		print_time("Before:", before_trace.path, from_time);
+		print_time("After:", after_trace.path, to_time);
+		printf("Regions:           %u -> %u (%+" PRId64 ")\n", total_before.num_regions, total_after.num_regions, int64_t(total_after.num_regions) - int64_t(total_before.num_regions));
+		print_bytes_change("Mapped:", total_before.mapped_bytes, total_after.mapped_bytes);
+		print_bytes_change("Committed:", total_before.committed_bytes, total_after.committed_bytes);
+		print_bytes_change("Resident:", total_before.resident_bytes, total_after.resident_bytes);
+		printf("Groups:            %zu, %" PRIu64 " changed\n", entries.size(), num_changed);
+
+		if (num_changed == 0)
+			return 0;
+
+		printf("\n%12s %12s %12s %12s %12s %9s  %s\n", "committed", "delta", "mapped", "delta", "resident", "regions", grouping == diff_grouping::stack ? "stack" : "name");
+
+		const stack_printer before_stacks(before_trace.reader, before_trace.path);
+		const stack_printer after_stacks(after_trace.reader, after_trace.path);
+
+		uint64_t num_printed = 0;
+		for (const diff_entry& entry : entries)
+		{
+			if (num_printed >= limit)
+				break;
+
+			if (is_unchanged(entry))
+				continue;
+
+			num_printed++;
+
+			const diff_usage& after = entry.usages[1];
+			printf("%11" PRIu64 "K %+11" PRId64 "K %11" PRIu64 "K %+11" PRId64 "K %+11" PRId64 "K %+9" PRId64 "  ",
+				after.committed_bytes / 1024, entry.get_committed_delta() / 1024, after.mapped_bytes / 1024, entry.get_mapped_delta() / 1024,
+				entry.get_resident_delta() / 1024, int64_t(after.num_regions) - int64_t(entry.usages[0].num_regions));
+
+			if (grouping != diff_grouping::stack)
+			{
+				printf("%s\n", entry.name.c_str());
+				continue;
+			}
+
+			// The stack as the second snapshot knows it, or as the first one did when it is gone
+			if (entry.usages[1].num_regions != 0)
+			{
+				if (entry.usages[0].num_regions == 0 || entry.stack_ids[0] == entry.stack_ids[1])
+					printf("%u\n", entry.stack_ids[1]);
+				else
+					printf("%u (was %u)\n", entry.stack_ids[1], entry.stack_ids[0]);
+
+				after_stacks.print(entry.stack_ids[1]);
+			}
+			else
+			{
+				printf("%u (gone)\n", entry.stack_ids[0]);
+				before_stacks.print(entry.stack_ids[0]);
+			}
+		}
+
+		return 0;
+	}
+}
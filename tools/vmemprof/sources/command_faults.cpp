@@ -0,0 +1,212 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+#include "command_line.h"
+#include "stack_printer.h"
+
+#include "vmemprof/analysis/fault_attribution.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace vmemprof
+{
+	namespace
+	{
+		enum class fault_grouping
+		{
+			mapping,			// The mapping that contains the address
+			allocation_stack,	// The callstack that mapped the memory
+			fault_stack,		// The callstack that touched the memory
+		};
+
+		struct fault_group
+		{
+			uint64_t		key;
+			uint64_t		num_minor_faults;
+			uint64_t		num_major_faults;
+			vma_region		region;				// The first region seen, when attributed
+			bool			has_region;
+		};
+
+		void print_faults_usage()
+		{
+			fprintf(stderr, "Usage: vmemprof faults <trace> [options]\n\n");
+			fprintf(stderr, "Options:\n");
+			fprintf(stderr, "    --by=<grouping>      Group faults by 'mapping' (default), 'alloc-stack' or 'fault-stack'\n");
+			fprintf(stderr, "    --limit=<count>      Print this many groups at most (default: 20)\n");
+		}
+
+		bool parse_grouping(const char* str, fault_grouping& out_grouping)
+		{
+			if (std::strcmp(str, "mapping") == 0)
+				out_grouping = fault_grouping::mapping;
+			else if (std::strcmp(str, "alloc-stack") == 0)
+				out_grouping = fault_grouping::allocation_stack;
+			else if (std::strcmp(str, "fault-stack") == 0)
+				out_grouping = fault_grouping::fault_stack;
+			else
+				return false;
+
+			return true;
+		}
+	}
+
+	int run_faults_command(int argc, char** argv)
+	{
+		if (argc < 1)
+		{
+			print_faults_usage();
+			return 1;
+		}
+
+		const char* trace_path = argv[0];
+		fault_grouping grouping = fault_grouping::mapping;
+		uint64_t limit = 20;
+
+		for (int argument_index = 1; argument_index < argc; ++argument_index)
+		{
+			const char* argument = argv[argument_index];
+			const char* value;
+			bool is_valid;
+
+			if ((value = get_option_value(argument, "--by")) != nullptr)
+				is_valid = parse_grouping(value, grouping);
+			else if ((value = get_option_value(argument, "--limit")) != nullptr)
+				is_valid = parse_uint64(value, limit);
+			else
+				is_valid = false;
+
+			if (!is_valid)
+			{
+				fprintf(stderr, "Invalid argument '%s'\n\n", argument);
+				print_faults_usage();
+				return 1;
+			}
+		}
+
+		trace_reader reader;
+		error_result result = reader.open(trace_path);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to open '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		const stack_printer printer(reader, trace_path);
+
+		std::unordered_map<uint64_t, fault_group> groups;
+		uint64_t num_minor_faults = 0;
+		uint64_t num_major_faults = 0;
+		uint64_t num_unattributed_faults = 0;
+
+		result = attribute_faults(reader, [&](const fault_sample& sample, const vma_region* region)
+			{
+				uint64_t key;
+				switch (grouping)
+				{
+				default:
+				case fault_grouping::mapping:			key = region != nullptr ? region->mapping_id : UINT64_MAX; break;
+				case fault_grouping::allocation_stack:	key = region != nullptr ? region->stack_id : UINT64_MAX; break;
+				case fault_grouping::fault_stack:		key = sample.stack_id; break;
+				}
+
+				fault_group& group = groups.emplace(key, fault_group{ key, 0, 0, vma_region(), false }).first->second;
+				if (!group.has_region && region != nullptr)
+				{
+					group.region = *region;
+					group.has_region = true;
+				}
+
+				const bool is_major = is_major_fault(sample);
+				group.num_major_faults += is_major ? 1 : 0;
+				group.num_minor_faults += is_major ? 0 : 1;
+
+				num_major_faults += is_major ? 1 : 0;
+				num_minor_faults += is_major ? 0 : 1;
+				num_unattributed_faults += region == nullptr ? 1 : 0;
+				return true;
+			});
+
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to read '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		uint64_t num_lost_faults = 0;
+		for (uint32_t chunk_index = 0; chunk_index < reader.get_num_chunks(); ++chunk_index)
+		{
+			const chunk_view chunk = reader.get_chunk(chunk_index);
+			if (chunk.header->type == chunk_type::lost_faults)
+				num_lost_faults += reinterpret_cast<const dropped_events_payload*>(chunk.payload)->num_dropped;
+		}
+
+		std::vector<fault_group> sorted_groups;
+		sorted_groups.reserve(groups.size());
+		for (const auto& group : groups)
+			sorted_groups.push_back(group.second);
+
+		std::sort(sorted_groups.begin(), sorted_groups.end(), [](const fault_group& lhs, const fault_group& rhs)
+			{
+				const uint64_t lhs_total = lhs.num_minor_faults + lhs.num_major_faults;
+				const uint64_t rhs_total = rhs.num_minor_faults + rhs.num_major_faults;
+				return lhs_total != rhs_total ? lhs_total > rhs_total : lhs.key < rhs.key;
+			});
+
+		printf("Faults:            %" PRIu64 " (%" PRIu64 " minor, %" PRIu64 " major)\n", num_minor_faults + num_major_faults, num_minor_faults, num_major_faults);
+		printf("Unattributed:      %" PRIu64 "\n", num_unattributed_faults);
+		printf("Lost:              %" PRIu64 "\n\n", num_lost_faults);
+
+		for (uint64_t group_index = 0; group_index < sorted_groups.size() && group_index < limit; ++group_index)
+		{
+			const fault_group& group = sorted_groups[group_index];
+			printf("%10" PRIu64 " minor %8" PRIu64 " major  ", group.num_minor_faults, group.num_major_faults);
+
+			if (grouping == fault_grouping::fault_stack)
+			{
+				printf("fault stack %u\n", uint32_t(group.key));
+				printer.print(uint32_t(group.key));
+			}
+			else if (!group.has_region)
+				printf("<untracked memory>\n");
+			else if (grouping == fault_grouping::mapping)
+				printf("mapping at %012" PRIx64 " (%" PRIu64 "K) tid=%u stack=%u\n", group.region.start, group.region.get_size() / 1024, group.region.thread_id, group.region.stack_id);
+			else
+			{
+				printf("allocation stack %u\n", uint32_t(group.key));
+				printer.print(uint32_t(group.key));
+			}
+		}
+
+		return 0;
+	}
+}
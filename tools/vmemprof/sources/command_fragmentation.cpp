@@ -0,0 +1,240 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+#include "command_line.h"
+#include "stack_printer.h"
+
+#include "vmemprof/analysis/address_space_replay.h"
+#include "vmemprof/analysis/fragmentation.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace vmemprof
+{
+	namespace
+	{
+		// The kernel default of vm.max_map_count
+		constexpr uint64_t k_default_max_map_count = 65530;
+
+		void print_fragmentation_usage()
+		{
+			fprintf(stderr, "Usage: vmemprof fragmentation <trace> [options]\n\n");
+			fprintf(stderr, "Options:\n");
+			fprintf(stderr, "    --at=<time>              Report the holes and contributors at this time since the capture start (default: end of trace)\n");
+			fprintf(stderr, "    --samples=<count>        Number of evenly spaced points of the timeline (default: 20)\n");
+			fprintf(stderr, "    --top=<count>            Print this many contributors at most (default: 10)\n");
+			fprintf(stderr, "    --max-map-count=<count>  VMA limit to compare against (default: vm.max_map_count of this machine)\n");
+		}
+
+		uint64_t read_max_map_count()
+		{
+			FILE* file = fopen("/proc/sys/vm/max_map_count", "r");
+			if (file == nullptr)
+				return k_default_max_map_count;
+
+			uint64_t max_map_count;
+			if (fscanf(file, "%" SCNu64, &max_map_count) != 1 || max_map_count == 0)
+				max_map_count = k_default_max_map_count;
+
+			fclose(file);
+			return max_map_count;
+		}
+
+		uint64_t get_last_event_timestamp(const trace_reader& reader)
+		{
+			const uint32_t num_event_chunks = reader.get_num_event_chunks();
+			if (num_event_chunks == 0)
+				return reader.get_header().start_timestamp;
+
+			return reader.get_chunk_entry(reader.get_event_chunk_index(num_event_chunks - 1)).last_timestamp;
+		}
+
+		void print_size(uint64_t size)
+		{
+			if (size >= 1024ULL * 1024 * 1024)
+				printf("%8.1fG", double(size) / (1024.0 * 1024.0 * 1024.0));
+			else if (size >= 1024ULL * 1024)
+				printf("%8.1fM", double(size) / (1024.0 * 1024.0));
+			else
+				printf("%8.1fK", double(size) / 1024.0);
+		}
+	}
+
+	int run_fragmentation_command(int argc, char** argv)
+	{
+		if (argc < 1)
+		{
+			print_fragmentation_usage();
+			return 1;
+		}
+
+		const char* trace_path = argv[0];
+		uint64_t at_time = UINT64_MAX;
+		uint64_t num_samples = 20;
+		uint64_t top = 10;
+		uint64_t max_map_count = 0;
+
+		for (int argument_index = 1; argument_index < argc; ++argument_index)
+		{
+			const char* argument = argv[argument_index];
+			const char* value;
+			bool is_valid = true;
+
+			if ((value = get_option_value(argument, "--at")) != nullptr)
+				is_valid = parse_duration(value, at_time);
+			else if ((value = get_option_value(argument, "--samples")) != nullptr)
+				is_valid = parse_uint64(value, num_samples) && num_samples != 0 && num_samples <= 100000;
+			else if ((value = get_option_value(argument, "--top")) != nullptr)
+				is_valid = parse_uint64(value, top);
+			else if ((value = get_option_value(argument, "--max-map-count")) != nullptr)
+				is_valid = parse_uint64(value, max_map_count) && max_map_count != 0;
+			else
+				is_valid = false;
+
+			if (!is_valid)
+			{
+				fprintf(stderr, "Invalid argument '%s'\n\n", argument);
+				print_fragmentation_usage();
+				return 1;
+			}
+		}
+
+		if (max_map_count == 0)
+			max_map_count = read_max_map_count();
+
+		trace_reader reader;
+		error_result result = reader.open(trace_path);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to open '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		// Timeline, a single replay sampled at evenly spaced times
+		const uint64_t start_timestamp = reader.get_header().start_timestamp;
+		const uint64_t last_timestamp = get_last_event_timestamp(reader);
+		const uint64_t duration = last_timestamp - start_timestamp;
+
+		std::vector<uint64_t> timestamps;
+		timestamps.reserve(num_samples);
+		for (uint64_t sample_index = 1; sample_index <= num_samples; ++sample_index)
+			timestamps.push_back(start_timestamp + uint64_t(double(duration) * double(sample_index) / double(num_samples)));
+
+		fragmentation_settings timeline_settings;
+		timeline_settings.is_contributors_enabled = false;
+
+		uint64_t peak_num_vmas = 0;
+
+		printf("%10s %8s %7s %8s %9s %9s %9s %6s\n", "time", "VMAs", "limit", "holes", "mapped", "free", "largest", "frag");
+		result = analyze_fragmentation_over_time(reader, timestamps.data(), uint32_t(timestamps.size()), timeline_settings, [&](uint64_t timestamp, const fragmentation_report& report)
+			{
+				printf("%9.3fs %8" PRIu64 " %6.2f%% %8" PRIu64 " ", double(timestamp - start_timestamp) * 1.0e-9, report.num_vmas,
+					100.0 * double(report.num_vmas) / double(max_map_count), report.num_holes);
+				print_size(report.mapped_bytes);
+				printf(" ");
+				print_size(report.free_bytes);
+				printf(" ");
+				print_size(report.largest_hole_size);
+				printf(" %6.3f\n", report.get_fragmentation());
+
+				peak_num_vmas = report.num_vmas > peak_num_vmas ? report.num_vmas : peak_num_vmas;
+				return true;
+			});
+
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to replay '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		// Detailed report at a single point in time
+		address_space_replay replay;
+		result = replay.initialize(reader);
+
+		address_space space;
+		if (!result.any())
+		{
+			if (at_time == UINT64_MAX)
+				space = replay.get_final_space();
+			else
+				result = replay.seek(start_timestamp + at_time, space);
+		}
+
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to replay '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		fragmentation_settings settings;
+		fragmentation_report report;
+		analyze_fragmentation(space, settings, report);
+
+		printf("\nSpan:              %012" PRIx64 "-%012" PRIx64 "\n", report.span_start, report.span_end);
+		printf("VMAs:              %" PRIu64 " (peak %" PRIu64 ", %.2f%% of max_map_count %" PRIu64 ")\n",
+			report.num_vmas, peak_num_vmas, 100.0 * double(peak_num_vmas) / double(max_map_count), max_map_count);
+		printf("Holes:             %" PRIu64 " (%" PRIu64 " KB)\n", report.num_holes, report.free_bytes / 1024);
+		printf("Largest hole:      %012" PRIx64 " (%" PRIu64 " KB)\n", report.largest_hole_start, report.largest_hole_size / 1024);
+		printf("Stranded:          %" PRIu64 " KB in holes below %" PRIu64 " KB\n", report.stranded_bytes / 1024, settings.large_hole_size / 1024);
+		printf("Fragmentation:     %.3f\n", report.get_fragmentation());
+
+		if (report.num_holes != 0)
+		{
+			printf("\n%10s %10s %8s %12s\n", "from", "to", "holes", "bytes");
+			for (uint32_t bucket = 0; bucket < k_num_hole_size_buckets; ++bucket)
+			{
+				if (report.hole_counts[bucket] == 0)
+					continue;
+
+				const uint64_t bucket_start = 4096ULL << bucket;
+				printf("%9" PRIu64 "K ", bucket_start / 1024);
+				if (bucket + 1 < k_num_hole_size_buckets)
+					printf("%9" PRIu64 "K", (bucket_start * 2) / 1024);
+				else
+					printf("%10s", "-");
+				printf(" %8" PRIu64 " %11" PRIu64 "K\n", report.hole_counts[bucket], report.hole_bytes[bucket] / 1024);
+			}
+		}
+
+		const stack_printer stacks(reader, trace_path);
+		const uint64_t num_contributors = report.contributors.size() < top ? report.contributors.size() : top;
+		for (uint64_t contributor_index = 0; contributor_index < num_contributors; ++contributor_index)
+		{
+			const fragmentation_contributor& contributor = report.contributors[contributor_index];
+			if (contributor.stranded_bytes == 0 && contributor.num_islands == 0)
+				break;
+
+			printf("\n#%" PRIu64 " stranded %" PRIu64 " KB, %" PRIu64 " islands, %" PRIu64 " VMAs, %" PRIu64 " KB mapped\n", contributor_index + 1,
+				contributor.stranded_bytes / 1024, contributor.num_islands, contributor.num_vmas, contributor.mapped_bytes / 1024);
+			stacks.print(contributor.stack_id);
+		}
+
+		return 0;
+	}
+}
@@ -0,0 +1,193 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+#include "command_line.h"
+#include "stack_printer.h"
+
+#include "vmemprof/analysis/huge_page_report.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace vmemprof
+{
+	namespace
+	{
+		void print_hugepages_usage()
+		{
+			fprintf(stderr, "Usage: vmemprof hugepages <trace> [options]\n\n");
+			fprintf(stderr, "Options:\n");
+			fprintf(stderr, "    --at=<time>          Report the huge page backing at this time since the capture start (default: end of trace)\n");
+			fprintf(stderr, "    --limit=<count>      Print this many VMAs at most (default: 20)\n");
+			fprintf(stderr, "    --all                Print every sampled VMA, not only those with eligible blocks or huge pages\n");
+		}
+
+		double get_percentage(uint64_t value, uint64_t total)
+		{
+			return total != 0 ? 100.0 * double(value) / double(total) : 0.0;
+		}
+
+		void print_flags(uint32_t flags)
+		{
+			printf("%s%s%s%s", (flags & huge_page_sample_thp_eligible) != 0 ? " eligible" : "",
+				(flags & huge_page_sample_hugepage) != 0 ? " hugepage" : "",
+				(flags & huge_page_sample_no_hugepage) != 0 ? " nohugepage" : "",
+				(flags & huge_page_sample_hugetlb) != 0 ? " hugetlb" : "");
+		}
+	}
+
+	int run_hugepages_command(int argc, char** argv)
+	{
+		if (argc < 1)
+		{
+			print_hugepages_usage();
+			return 1;
+		}
+
+		const char* trace_path = argv[0];
+		uint64_t at_time = UINT64_MAX;
+		uint64_t limit = 20;
+		bool is_printing_all = false;
+
+		for (int argument_index = 1; argument_index < argc; ++argument_index)
+		{
+			const char* argument = argv[argument_index];
+			const char* value;
+			bool is_valid = true;
+
+			if ((value = get_option_value(argument, "--at")) != nullptr)
+				is_valid = parse_duration(value, at_time);
+			else if ((value = get_option_value(argument, "--limit")) != nullptr)
+				is_valid = parse_uint64(value, limit);
+			else if (std::strcmp(argument, "--all") == 0)
+				is_printing_all = true;
+			else
+				is_valid = false;
+
+			if (!is_valid)
+			{
+				fprintf(stderr, "Invalid argument '%s'\n\n", argument);
+				print_hugepages_usage();
+				return 1;
+			}
+		}
+
+		trace_reader reader;
+		error_result result = reader.open(trace_path);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to open '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		if (reader.get_num_huge_page_chunks() == 0)
+		{
+			fprintf(stderr, "'%s' has no huge page samples, capture with VMEMPROF_HUGE_PAGES=1\n", trace_path);
+			return 1;
+		}
+
+		const uint64_t start_timestamp = reader.get_header().start_timestamp;
+		const uint64_t at_timestamp = at_time == UINT64_MAX ? UINT64_MAX : start_timestamp + at_time;
+
+		address_space space;
+		range_call_map advice;
+		huge_page_map samples;
+		result = read_huge_page_state(reader, at_timestamp, space, advice, samples);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to replay '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		huge_page_report report;
+		build_huge_page_report(space, samples, report);
+
+		printf("VMAs:              %" PRIu64 " that can hold huge pages\n", report.num_vmas);
+		printf("Mapped:            %" PRIu64 " KB\n", report.mapped_bytes / 1024);
+		printf("Resident:          %" PRIu64 " KB\n", report.resident_bytes / 1024);
+		printf("Eligible:          %" PRIu64 " KB in 2 MB aligned blocks of THP eligible VMAs\n", report.eligible_bytes / 1024);
+		printf("AnonHugePages:     %" PRIu64 " KB (%.1f%% of eligible)\n", report.anon_huge_bytes / 1024, get_percentage(report.anon_huge_bytes, report.eligible_bytes));
+		printf("Unbacked:          %" PRIu64 " KB eligible but not backed by huge pages\n", report.unbacked_bytes / 1024);
+		printf("Misaligned:        %" PRIu64 " VMAs would fit one more block if 2 MB aligned\n", report.num_misaligned_vmas);
+		printf("MADV_HUGEPAGE:     %" PRIu64 " VMAs, %" PRIu64 " with eligible blocks and no huge page\n", report.num_advised_vmas, report.num_advised_unbacked_vmas);
+		printf("hugetlb:           %" PRIu64 " KB mapped, %" PRIu64 " KB faulted in\n", report.hugetlb_mapped_bytes / 1024, report.hugetlb_bytes / 1024);
+
+		// The VMAs that lose the most, those without blocks or huge pages are noise unless asked for
+		std::vector<const huge_page_vma_report*> vmas;
+		for (const huge_page_vma_report& vma : report.vmas)
+		{
+			if (is_printing_all || vma.eligible_bytes != 0 || vma.sample.anon_huge_bytes != 0 || vma.sample.hugetlb_bytes != 0)
+				vmas.push_back(&vma);
+		}
+
+		std::stable_sort(vmas.begin(), vmas.end(), [](const huge_page_vma_report* lhs, const huge_page_vma_report* rhs)
+			{
+				if (lhs->unbacked_bytes != rhs->unbacked_bytes)
+					return lhs->unbacked_bytes > rhs->unbacked_bytes;
+				return lhs->sample.get_size() > rhs->sample.get_size();
+			});
+
+		if (vmas.size() > limit)
+			vmas.resize(limit);
+
+		const stack_printer stacks(reader, trace_path);
+		for (const huge_page_vma_report* vma : vmas)
+		{
+			const huge_page_sample& sample = vma->sample;
+			printf("\n%012" PRIx64 "-%012" PRIx64 " %" PRIu64 " KB, resident %" PRIu64 " KB, huge %" PRIu64 " KB, eligible %" PRIu64 " KB, unbacked %" PRIu64 " KB",
+				sample.start, sample.end, sample.get_size() / 1024, sample.resident_bytes / 1024, (sample.anon_huge_bytes + sample.hugetlb_bytes) / 1024,
+				vma->eligible_bytes / 1024, vma->unbacked_bytes / 1024);
+			print_flags(sample.flags);
+			printf("\n");
+
+			if (vma->block_end != vma->block_start)
+				printf("    blocks %012" PRIx64 "-%012" PRIx64 "%s\n", vma->block_start, vma->block_end, vma->is_misaligned ? ", misaligned" : "");
+			else if (vma->is_misaligned)
+				printf("    no 2 MB aligned block fits, misaligned\n");
+
+			if (vma->is_tracked)
+			{
+				printf("    mapped by\n");
+				stacks.print(vma->stack_id);
+			}
+			else
+				printf("    not mapped during the capture\n");
+
+			advice.for_each_call(sample.start, sample.end, [&](const range_call& call)
+				{
+					printf("    %s at %.3fs tid=%u over %012" PRIx64 "-%012" PRIx64 "\n", call.arg0 == MADV_HUGEPAGE ? "MADV_HUGEPAGE" : "MADV_NOHUGEPAGE",
+						double(call.timestamp - start_timestamp) * 1.0e-9, call.thread_id, call.start, call.end);
+					stacks.print(call.stack_id);
+				});
+		}
+
+		return 0;
+	}
+}
@@ -0,0 +1,132 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+
+#include "vmemprof/trace/trace_reader.h"
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+
+namespace vmemprof
+{
+	int run_info_command(int argc, char** argv)
+	{
+		if (argc != 1)
+		{
+			fprintf(stderr, "Usage: vmemprof info <trace>\n");
+			return 1;
+		}
+
+		trace_reader reader;
+		const error_result result = reader.open(argv[0]);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to open '%s': %s\n", argv[0], result.c_str());
+			return 1;
+		}
+
+		const trace_header& header = reader.get_header();
+
+		uint32_t num_chunks_per_type[uint32_t(chunk_type::count)] = { 0 };
+		uint64_t num_entries_per_type[uint32_t(chunk_type::count)] = { 0 };
+		uint64_t num_event_bytes = 0;
+		uint64_t num_dropped = 0;
+
+		// Payloads of the compressed chunks, as stored and once decompressed
+		chunk_compression compression = chunk_compression::none;
+		uint64_t num_compressed_chunks = 0;
+		uint64_t num_stored_bytes = 0;
+		uint64_t num_decompressed_bytes = 0;
+		uint64_t last_timestamp = header.start_timestamp;
+
+		for (uint32_t chunk_index = 0; chunk_index < reader.get_num_chunks(); ++chunk_index)
+		{
+			// Only the headers are needed, chunks are not decompressed
+			const chunk_header& stored_header = reader.get_stored_chunk_header(chunk_index);
+			const uint32_t type = uint32_t(stored_header.type);
+			if (type >= uint32_t(chunk_type::count))
+				continue;
+
+			if (stored_header.compression != chunk_compression::none)
+			{
+				compression = stored_header.compression;
+				num_compressed_chunks++;
+				num_stored_bytes += stored_header.payload_size;
+				num_decompressed_bytes += reader.get_chunk_payload_size(chunk_index);
+			}
+
+			num_chunks_per_type[type]++;
+			num_entries_per_type[type] += stored_header.num_entries;
+
+			if (stored_header.type == chunk_type::events)
+			{
+				num_event_bytes += sizeof(chunk_header) + align_chunk_size(stored_header.payload_size);
+				if (stored_header.last_timestamp > last_timestamp)
+					last_timestamp = stored_header.last_timestamp;
+			}
+			else if (stored_header.type == chunk_type::dropped_events)
+			{
+				const chunk_view chunk = reader.get_chunk(chunk_index);
+				if (chunk.header->payload_size >= sizeof(dropped_events_payload))
+					num_dropped += reinterpret_cast<const dropped_events_payload*>(chunk.payload)->num_dropped;
+			}
+		}
+
+		const uint64_t num_events = num_entries_per_type[uint32_t(chunk_type::events)];
+		const uint64_t duration = last_timestamp - header.start_timestamp;
+
+		printf("Trace:             %s\n", argv[0]);
+		printf("Version:           %u\n", uint32_t(header.version));
+		printf("Process id:        %u\n", header.process_id);
+		printf("Page size:         %u\n", header.page_size);
+		printf("Size:              %" PRIu64 " bytes\n", reader.get_size());
+		printf("Index:             %s\n", reader.is_index_recovered() ? "recovered (trace was not closed)" : "ok");
+		printf("Duration:          %.3f s\n", double(duration) * 1.0e-9);
+		printf("Events:            %" PRIu64 "\n", num_events);
+		printf("Dropped events:    %" PRIu64 "\n", num_dropped);
+		if (reader.get_sampling_interval() != 0)
+			printf("Sampling:          one mapping every %" PRIu64 " bytes on average\n", reader.get_sampling_interval());
+		else
+			printf("Sampling:          every mapping\n");
+		if (num_compressed_chunks != 0)
+			printf("Compression:       %s, %" PRIu64 " chunks, %" PRIu64 " bytes stored for %" PRIu64 " (%.2fx)\n", get_chunk_compression_name(compression), num_compressed_chunks,
+				num_stored_bytes, num_decompressed_bytes, double(num_decompressed_bytes) / double(num_stored_bytes));
+		else
+			printf("Compression:       none\n");
+		printf("Stacks:            %" PRIu64 "\n", num_entries_per_type[uint32_t(chunk_type::stacks)]);
+		printf("Modules:           %" PRIu64 "\n", num_entries_per_type[uint32_t(chunk_type::modules)]);
+		printf("Bytes per event:   %.2f\n", num_events != 0 ? double(num_event_bytes) / double(num_events) : 0.0);
+
+		printf("Chunks:\n");
+		for (uint32_t type = 0; type < uint32_t(chunk_type::count); ++type)
+		{
+			if (num_chunks_per_type[type] != 0)
+				printf("    %-16s %u\n", get_chunk_type_name(chunk_type(type)), num_chunks_per_type[type]);
+		}
+
+		return 0;
+	}
+}
@@ -0,0 +1,145 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+#include "command_line.h"
+#include "leak_options.h"
+#include "stack_printer.h"
+
+#include "vmemprof/analysis/leak_detector.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace vmemprof
+{
+	namespace
+	{
+		void print_leaks_usage()
+		{
+			fprintf(stderr, "Usage: vmemprof leaks <trace> [options]\n\n");
+			fprintf(stderr, "Replays the trace through the leak detector and lists the callstacks still growing at its end.\n\n");
+			fprintf(stderr, "Options:\n");
+			print_leak_options_usage("");
+			fprintf(stderr, "                              The interval defaults to the trace duration divided by the windows\n");
+			fprintf(stderr, "    --limit=<count>           Print this many callstacks at most (default: 20)\n");
+		}
+
+		// Events and residency samples both move the detector forward
+		uint64_t get_last_timestamp(const trace_reader& reader)
+		{
+			uint64_t last_timestamp = reader.get_header().start_timestamp;
+			for (uint32_t chunk_index = 0; chunk_index < reader.get_num_chunks(); ++chunk_index)
+			{
+				const chunk_view chunk = reader.get_chunk(chunk_index);
+				if (chunk.header->type == chunk_type::events || chunk.header->type == chunk_type::residency)
+					last_timestamp = std::max(last_timestamp, chunk.header->last_timestamp);
+			}
+
+			return last_timestamp;
+		}
+	}
+
+	int run_leaks_command(int argc, char** argv)
+	{
+		if (argc < 1)
+		{
+			print_leaks_usage();
+			return 1;
+		}
+
+		const char* trace_path = argv[0];
+		leak_detector_settings settings;
+		settings.interval_ns = 0;
+		uint64_t limit = 20;
+
+		for (int argument_index = 1; argument_index < argc; ++argument_index)
+		{
+			const char* argument = argv[argument_index];
+			const char* value;
+			bool is_valid = true;
+
+			if ((value = get_option_value(argument, "--limit")) != nullptr)
+				is_valid = parse_uint64(value, limit);
+			else if (!parse_leak_option(argument, "", settings, is_valid))
+				is_valid = false;
+
+			if (!is_valid)
+			{
+				fprintf(stderr, "Invalid argument '%s'\n\n", argument);
+				print_leaks_usage();
+				return 1;
+			}
+		}
+
+		trace_reader reader;
+		error_result result = reader.open(trace_path);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to open '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		const uint64_t start_timestamp = reader.get_header().start_timestamp;
+		const uint64_t duration = get_last_timestamp(reader) - start_timestamp;
+		if (settings.interval_ns == 0)
+			settings.interval_ns = std::max<uint64_t>(duration / std::max(settings.num_windows, 1U), 1000000);
+
+		leak_detector detector(settings);
+		result = detect_leaks(reader, detector);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to replay '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		std::vector<leak_suspect> suspects;
+		detector.get_suspects(suspects);
+
+		const leak_detector_settings& used_settings = detector.get_settings();
+		printf("Duration:          %.3fs\n", double(duration) * 1.0e-9);
+		printf("Observations:      %" PRIu64 " every %.3fs, window of %u\n", detector.get_num_observations(), double(used_settings.interval_ns) * 1.0e-9, used_settings.num_windows);
+		printf("Growing stacks:    %zu\n", suspects.size());
+
+		const stack_printer stacks(reader, trace_path);
+		for (size_t suspect_index = 0; suspect_index < suspects.size() && suspect_index < limit; ++suspect_index)
+		{
+			const leak_suspect& suspect = suspects[suspect_index];
+
+			printf("\nstack %u, growing %s%s%s since %.3fs\n", suspect.stack_id,
+				suspect.is_count_growing ? "live mappings" : "", suspect.is_count_growing && suspect.is_committed_growing ? " and " : "",
+				suspect.is_committed_growing ? "committed bytes" : "", double(suspect.first_flagged_timestamp - start_timestamp) * 1.0e-9);
+			printf("    live mappings:  %u (%+" PRId64 " over %u observations, %.2f/s)\n", suspect.live_count, suspect.count_growth, suspect.num_windows, suspect.count_rate);
+			printf("    committed:      %" PRIu64 " KB (%+" PRId64 " KB, %.1f KB/s), %" PRIu64 " KB mapped\n", suspect.committed_bytes / 1024, suspect.committed_growth / 1024,
+				suspect.committed_rate / 1024.0, suspect.mapped_bytes / 1024);
+			stacks.print(suspect.stack_id);
+		}
+
+		return 0;
+	}
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/event.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns the value of an '--name=value' argument or nullptr if the argument
+	// is for another option.
+	////////////////////////////////////////////////////////////////////////////////
+	inline const char* get_option_value(const char* argument, const char* option_name)
+	{
+		const size_t option_name_length = std::strlen(option_name);
+		if (std::strncmp(argument, option_name, option_name_length) != 0 || argument[option_name_length] != '=')
+			return nullptr;
+
+		return argument + option_name_length + 1;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Parses a decimal or '0x' prefixed hexadecimal integer.
+	////////////////////////////////////////////////////////////////////////////////
+	inline bool parse_uint64(const char* str, uint64_t& out_value, const char** out_end = nullptr)
+	{
+		char* end = nullptr;
+		out_value = std::strtoull(str, &end, 0);
+		if (end == str)
+			return false;
+
+		if (out_end != nullptr)
+			*out_end = end;
+		else if (*end != '\0')
+			return false;
+
+		return true;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Parses a duration with an optional 'min', 's', 'ms', 'us' or 'ns' suffix into nanoseconds.
+	// Values without a suffix are in nanoseconds.
+	////////////////////////////////////////////////////////////////////////////////
+	inline bool parse_duration(const char* str, uint64_t& out_duration_ns)
+	{
+		char* end = nullptr;
+		const double value = std::strtod(str, &end);
+		if (end == str || value < 0.0)
+			return false;
+
+		double scale;
+		if (*end == '\0' || std::strcmp(end, "ns") == 0)
+			scale = 1.0;
+		else if (std::strcmp(end, "us") == 0)
+			scale = 1.0e3;
+		else if (std::strcmp(end, "ms") == 0)
+			scale = 1.0e6;
+		else if (std::strcmp(end, "s") == 0)
+			scale = 1.0e9;
+		else if (std::strcmp(end, "min") == 0)
+			scale = 60.0e9;
+		else
+			return false;
+
+		out_duration_ns = uint64_t(value * scale);
+		return true;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Parses a size in bytes with an optional 'K', 'M' or 'G' suffix.
+	////////////////////////////////////////////////////////////////////////////////
+	inline bool parse_size(const char* str, uint64_t& out_size)
+	{
+		const char* end = nullptr;
+		if (!parse_uint64(str, out_size, &end))
+			return false;
+
+		uint64_t scale;
+		if (*end == '\0')
+			scale = 1;
+		else if (std::strcmp(end, "K") == 0)
+			scale = 1ULL << 10;
+		else if (std::strcmp(end, "M") == 0)
+			scale = 1ULL << 20;
+		else if (std::strcmp(end, "G") == 0)
+			scale = 1ULL << 30;
+		else
+			return false;
+
+		if (out_size > UINT64_MAX / scale)
+			return false;
+
+		out_size *= scale;
+		return true;
+	}
+
+	inline uint32_t get_num_hardware_threads()
+	{
+		const uint32_t num_threads = std::thread::hardware_concurrency();
+		return num_threads != 0 ? num_threads : 1;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Parses a thread count, zero stands for every hardware thread.
+	////////////////////////////////////////////////////////////////////////////////
+	inline bool parse_thread_count(const char* str, uint32_t& out_num_threads)
+	{
+		uint64_t num_threads;
+		if (!parse_uint64(str, num_threads) || num_threads > 1024)
+			return false;
+
+		out_num_threads = num_threads != 0 ? uint32_t(num_threads) : get_num_hardware_threads();
+		return true;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Parses an address range formatted as 'start-end'.
+	////////////////////////////////////////////////////////////////////////////////
+	inline bool parse_address_range(const char* str, uint64_t& out_start, uint64_t& out_end)
+	{
+		const char* separator = nullptr;
+		if (!parse_uint64(str, out_start, &separator) || *separator != '-')
+			return false;
+
+		return parse_uint64(separator + 1, out_end) && out_start < out_end;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Parses a comma separated list of event type names into a mask with one bit per type.
+	////////////////////////////////////////////////////////////////////////////////
+	inline bool parse_event_type_mask(const char* str, uint32_t& out_mask)
+	{
+		out_mask = 0;
+
+		while (*str != '\0')
+		{
+			const char* name_end = std::strchr(str, ',');
+			const size_t name_length = name_end != nullptr ? size_t(name_end - str) : std::strlen(str);
+
+			bool is_found = false;
+			for (uint32_t type = 0; type < uint32_t(event_type::count); ++type)
+			{
+				const char* type_name = get_event_type_name(event_type(type));
+				if (std::strlen(type_name) == name_length && std::strncmp(type_name, str, name_length) == 0)
+				{
+					out_mask |= 1U << type;
+					is_found = true;
+				}
+			}
+
+			if (!is_found)
+				return false;
+
+			str += name_length;
+			if (*str == ',')
+				str++;
+		}
+
+		return out_mask != 0;
+	}
+}
@@ -0,0 +1,144 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+#include "command_line.h"
+#include "live_protocol.h"
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace vmemprof
+{
+	namespace
+	{
+		void print_live_usage()
+		{
+			fprintf(stderr, "Usage: vmemprof live [processes|summary|top|leaks] [options]\n\n");
+			fprintf(stderr, "Queries a running 'vmemprof daemon', the default query is 'summary'.\n\n");
+			fprintf(stderr, "Options:\n");
+			fprintf(stderr, "    --socket=<path>      Unix socket of the daemon (default: $VMEMPROF_LIVE)\n");
+			fprintf(stderr, "    --pid=<pid>          Process to report (default: the latest process streaming)\n");
+			fprintf(stderr, "    --count=<count>      Callstacks listed by 'top' and 'leaks' (default: 10)\n");
+			fprintf(stderr, "    --watch=<time>       Repeat the query at this interval until interrupted\n");
+		}
+
+		// Sends a query line and prints the answer, returns false if the daemon cannot be reached
+		bool run_live_query(const sockaddr_un& address, const std::string& query)
+		{
+			const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (fd < 0)
+				return false;
+
+			if (connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || send(fd, query.data(), query.size(), MSG_NOSIGNAL) != ssize_t(query.size()))
+			{
+				close(fd);
+				return false;
+			}
+
+			char buffer[16 * 1024];
+			ssize_t num_read;
+			while ((num_read = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+				fwrite(buffer, 1, size_t(num_read), stdout);
+
+			close(fd);
+			fflush(stdout);
+			return num_read == 0;
+		}
+	}
+
+	int run_live_command(int argc, char** argv)
+	{
+		const char* socket_path = get_default_live_socket_path();
+		const char* query_name = "summary";
+		uint64_t process_id = 0;
+		uint64_t count = 0;
+		uint64_t watch_interval_ns = 0;
+
+		for (int argument_index = 0; argument_index < argc; ++argument_index)
+		{
+			const char* argument = argv[argument_index];
+			const char* value;
+			bool is_valid = true;
+
+			if ((value = get_option_value(argument, "--socket")) != nullptr)
+				socket_path = value;
+			else if ((value = get_option_value(argument, "--pid")) != nullptr)
+				is_valid = parse_uint64(value, process_id) && process_id != 0;
+			else if ((value = get_option_value(argument, "--count")) != nullptr)
+				is_valid = parse_uint64(value, count) && count != 0;
+			else if ((value = get_option_value(argument, "--watch")) != nullptr)
+				is_valid = parse_duration(value, watch_interval_ns) && watch_interval_ns != 0;
+			else if (argument_index == 0 && argument[0] != '-')
+				query_name = argument;
+			else
+				is_valid = false;
+
+			if (!is_valid)
+			{
+				fprintf(stderr, "Invalid argument '%s'\n\n", argument);
+				print_live_usage();
+				return 1;
+			}
+		}
+
+		sockaddr_un address;
+		if (socket_path == nullptr || !make_live_socket_address(socket_path, address))
+		{
+			fprintf(stderr, socket_path == nullptr ? "No socket provided\n\n" : "Socket path is too long\n\n");
+			print_live_usage();
+			return 1;
+		}
+
+		std::string query = query_name;
+		if (process_id != 0)
+			append_format(query, " pid=%" PRIu64, process_id);
+		if (count != 0)
+			append_format(query, " count=%" PRIu64, count);
+		query += '\n';
+
+		while (true)
+		{
+			if (!run_live_query(address, query))
+			{
+				fprintf(stderr, "Failed to query the daemon on '%s'\n", socket_path);
+				return 1;
+			}
+
+			if (watch_interval_ns == 0)
+				return 0;
+
+			const timespec interval = { time_t(watch_interval_ns / 1000000000ULL), long(watch_interval_ns % 1000000000ULL) };
+			nanosleep(&interval, nullptr);
+			printf("\n");
+		}
+	}
+}
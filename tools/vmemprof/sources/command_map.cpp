@@ -0,0 +1,153 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+#include "command_line.h"
+
+#include "vmemprof/analysis/address_space_replay.h"
+#include "vmemprof/core/worker_pool.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+
+namespace vmemprof
+{
+	namespace
+	{
+		void print_map_usage()
+		{
+			fprintf(stderr, "Usage: vmemprof map <trace> [options]\n\n");
+			fprintf(stderr, "Options:\n");
+			fprintf(stderr, "    --at=<time>      Reconstruct the address space at this time since the capture start (default: end of trace)\n");
+			fprintf(stderr, "    --regions        Print every region instead of coalescing them into kernel VMAs\n");
+			fprintf(stderr, "    --threads=<n>    Replay the trace on this many threads, 0 for every hardware thread (default: 0)\n");
+		}
+
+		void print_region(const vma_region& region, uint64_t end)
+		{
+			const char permissions[5] =
+			{
+				(region.protection & PROT_READ) != 0 ? 'r' : '-',
+				(region.protection & PROT_WRITE) != 0 ? 'w' : '-',
+				(region.protection & PROT_EXEC) != 0 ? 'x' : '-',
+				region.is_shared() ? 's' : 'p',
+				'\0',
+			};
+
+			printf("%012" PRIx64 "-%012" PRIx64 " %s %08" PRIx64 " %10" PRIu64 "K", region.start, end, permissions, region.offset, (end - region.start) / 1024);
+
+			if (!region.is_anonymous())
+				printf(" fd=%d", region.fd);
+			if (region.stack_id != k_invalid_stack_id)
+				printf(" stack=%u", region.stack_id);
+			if (region.advice_flags != 0)
+				printf(" advice=0x%x", region.advice_flags);
+
+			printf(" tid=%u\n", region.thread_id);
+		}
+	}
+
+	int run_map_command(int argc, char** argv)
+	{
+		if (argc < 1)
+		{
+			print_map_usage();
+			return 1;
+		}
+
+		const char* trace_path = argv[0];
+		uint64_t at_time = UINT64_MAX;
+		bool print_regions = false;
+		uint32_t num_threads = get_num_hardware_threads();
+
+		for (int argument_index = 1; argument_index < argc; ++argument_index)
+		{
+			const char* argument = argv[argument_index];
+			const char* value;
+			bool is_valid = true;
+
+			if ((value = get_option_value(argument, "--at")) != nullptr)
+				is_valid = parse_duration(value, at_time);
+			else if (std::strcmp(argument, "--regions") == 0)
+				print_regions = true;
+			else if ((value = get_option_value(argument, "--threads")) != nullptr)
+				is_valid = parse_thread_count(value, num_threads);
+			else
+				is_valid = false;
+
+			if (!is_valid)
+			{
+				fprintf(stderr, "Invalid argument '%s'\n\n", argument);
+				print_map_usage();
+				return 1;
+			}
+		}
+
+		trace_reader reader;
+		error_result result = reader.open(trace_path);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to open '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		// The calling thread replays as well
+		worker_pool pool;
+		pool.start(num_threads - 1);
+
+		address_space_replay replay;
+		result = replay.initialize(reader, address_space_replay::k_default_snapshot_interval, &pool);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to replay '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		address_space space;
+		if (at_time == UINT64_MAX)
+			space = replay.get_final_space();
+		else
+			result = replay.seek(reader.get_header().start_timestamp + at_time, space);
+
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to replay '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		if (print_regions)
+			space.for_each_region([](const vma_region& region) { print_region(region, region.end); return true; });
+		else
+			space.for_each_vma([](const vma_region& first, uint64_t end) { print_region(first, end); return true; });
+
+		const address_space_stats& stats = space.get_stats();
+		printf("\nVMAs:              %" PRIu64 "\n", stats.num_vmas);
+		printf("Regions:           %" PRIu64 "\n", stats.num_regions);
+		printf("Mapped:            %" PRIu64 " KB\n", stats.mapped_bytes / 1024);
+		printf("Inaccessible:      %" PRIu64 " KB\n", stats.inaccessible_bytes / 1024);
+		return 0;
+	}
+}
@@ -0,0 +1,180 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+#include "command_line.h"
+#include "stack_printer.h"
+
+#include "vmemprof/analysis/numa_report.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace vmemprof
+{
+	namespace
+	{
+		void print_numa_usage()
+		{
+			fprintf(stderr, "Usage: vmemprof numa <trace> [options]\n\n");
+			fprintf(stderr, "Options:\n");
+			fprintf(stderr, "    --at=<time>          Report the page placement at this time since the capture start (default: end of trace)\n");
+			fprintf(stderr, "    --by=<grouping>      Group pages by 'mapping' (default) or 'alloc-stack'\n");
+			fprintf(stderr, "    --limit=<count>      Print this many groups at most (default: 20)\n");
+			fprintf(stderr, "    --remote=<percent>   Flag groups with more remote faults than this (default: 50)\n");
+		}
+
+		bool parse_grouping(const char* str, numa_grouping& out_grouping)
+		{
+			if (std::strcmp(str, "mapping") == 0)
+				out_grouping = numa_grouping::mapping;
+			else if (std::strcmp(str, "alloc-stack") == 0)
+				out_grouping = numa_grouping::allocation_stack;
+			else
+				return false;
+
+			return true;
+		}
+
+		void print_node_counts(const std::vector<uint64_t>& counts)
+		{
+			for (size_t node = 0; node < counts.size(); ++node)
+				printf(" %" PRIu64, counts[node]);
+		}
+	}
+
+	int run_numa_command(int argc, char** argv)
+	{
+		if (argc < 1)
+		{
+			print_numa_usage();
+			return 1;
+		}
+
+		const char* trace_path = argv[0];
+		uint64_t at_time = UINT64_MAX;
+		numa_grouping grouping = numa_grouping::mapping;
+		uint64_t limit = 20;
+		uint64_t remote_percent = 50;
+
+		for (int argument_index = 1; argument_index < argc; ++argument_index)
+		{
+			const char* argument = argv[argument_index];
+			const char* value;
+			bool is_valid = true;
+
+			if ((value = get_option_value(argument, "--at")) != nullptr)
+				is_valid = parse_duration(value, at_time);
+			else if ((value = get_option_value(argument, "--by")) != nullptr)
+				is_valid = parse_grouping(value, grouping);
+			else if ((value = get_option_value(argument, "--limit")) != nullptr)
+				is_valid = parse_uint64(value, limit);
+			else if ((value = get_option_value(argument, "--remote")) != nullptr)
+				is_valid = parse_uint64(value, remote_percent) && remote_percent <= 100;
+			else
+				is_valid = false;
+
+			if (!is_valid)
+			{
+				fprintf(stderr, "Invalid argument '%s'\n\n", argument);
+				print_numa_usage();
+				return 1;
+			}
+		}
+
+		trace_reader reader;
+		error_result result = reader.open(trace_path);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to open '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		const uint64_t start_timestamp = reader.get_header().start_timestamp;
+		const uint64_t at_timestamp = at_time == UINT64_MAX ? UINT64_MAX : start_timestamp + at_time;
+
+		numa_report report;
+		result = build_numa_report(reader, at_timestamp, grouping, report);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to read '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		uint64_t num_flagged = 0;
+		for (const numa_group& group : report.groups)
+			num_flagged += group.num_faults != 0 && group.get_remote_fraction() * 100.0 > double(remote_percent) ? 1 : 0;
+
+		printf("Nodes:             %u%s\n", report.num_nodes, report.is_fake_topology ? " (fake topology)" : "");
+		printf("Sampled pages:    ");
+		print_node_counts(report.page_counts);
+		printf("\nFaults:           ");
+		print_node_counts(report.fault_counts);
+		printf("\nUnknown CPU:       %" PRIu64 " faults\n", report.num_unknown_cpu_faults);
+		printf("Remote:            %" PRIu64 " groups with more than %" PRIu64 "%% remote faults\n", num_flagged, remote_percent);
+
+		for (const range_call& policy : report.thread_policies)
+		{
+			printf("Thread %u:         set_mempolicy(%s, nodes=0x%" PRIx64 ") at %.3fs\n", policy.thread_id, get_memory_policy_name(policy.arg0), policy.arg1,
+				double(policy.timestamp - start_timestamp) * 1.0e-9);
+		}
+
+		const stack_printer stacks(reader, trace_path);
+		for (uint64_t group_index = 0; group_index < report.groups.size() && group_index < limit; ++group_index)
+		{
+			const numa_group& group = report.groups[group_index];
+			const bool is_flagged = group.num_faults != 0 && group.get_remote_fraction() * 100.0 > double(remote_percent);
+
+			printf("\n%s", is_flagged ? "REMOTE " : "");
+			if (grouping == numa_grouping::allocation_stack)
+				printf("stack %u", uint32_t(group.key));
+			else
+				printf("%012" PRIx64 "-%012" PRIx64, group.region.start, group.region.end);
+
+			printf(", home node %u, %" PRIu64 " of %" PRIu64 " faults remote (%.1f%%)\n", group.home_node, group.num_remote_faults, group.num_faults, group.get_remote_fraction() * 100.0);
+			printf("    pages per node: ");
+			print_node_counts(group.page_counts);
+			printf("\n    faults per node:");
+			print_node_counts(group.fault_counts);
+			printf("\n");
+
+			if (grouping == numa_grouping::mapping)
+			{
+				report.bindings.for_each_call(group.region.start, group.region.end, [start_timestamp](const range_call& call)
+					{
+						printf("    mbind(%s, nodes=0x%" PRIx64 ") at %.3fs tid=%u over %012" PRIx64 "-%012" PRIx64 "\n", get_memory_policy_name(call.arg0), call.arg1,
+							double(call.timestamp - start_timestamp) * 1.0e-9, call.thread_id, call.start, call.end);
+					});
+			}
+
+			if (group.has_region)
+				stacks.print(group.region.stack_id);
+		}
+
+		return 0;
+	}
+}
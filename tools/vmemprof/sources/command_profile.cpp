@@ -0,0 +1,236 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+#include "command_line.h"
+
+#include "vmemprof/analysis/address_space_replay.h"
+#include "vmemprof/analysis/callstack_tree.h"
+#include "vmemprof/analysis/profile_export.h"
+#include "vmemprof/analysis/residency_map.h"
+#include "vmemprof/analysis/sample_scaler.h"
+#include "vmemprof/core/worker_pool.h"
+#include "vmemprof/symbols/symbol_file.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace vmemprof
+{
+	namespace
+	{
+		enum class profile_format
+		{
+			folded,
+			pprof,
+		};
+
+		void print_profile_usage()
+		{
+			fprintf(stderr, "Usage: vmemprof profile <trace> [options]\n\n");
+			fprintf(stderr, "Exports a callstack profile for flame graphs, symbolized when <trace>%s exists.\n\n", k_symbol_file_suffix);
+			fprintf(stderr, "Options:\n");
+			fprintf(stderr, "    --weight=<weight>    'reserved', 'committed' (default) or 'resident' bytes by the stack that mapped them,\n");
+			fprintf(stderr, "                         'faults' by the stack that faulted or 'alloc-faults' by the stack that mapped the memory\n");
+			fprintf(stderr, "    --format=<format>    'folded' stacks (default) or 'pprof' protobuf\n");
+			fprintf(stderr, "    --from=<time>        Time since the capture start where the window starts, bytes only count regions mapped since (default: start of trace)\n");
+			fprintf(stderr, "    --to=<time>          Time since the capture start where the window ends, bytes are measured then (default: end of trace)\n");
+			fprintf(stderr, "    --output=<path>      File to write (default: standard output)\n");
+			fprintf(stderr, "    --threads=<n>        Replay the trace on this many threads, 0 for every hardware thread (default: 0)\n");
+		}
+
+		bool parse_format(const char* str, profile_format& out_format)
+		{
+			if (std::strcmp(str, "folded") == 0)
+				out_format = profile_format::folded;
+			else if (std::strcmp(str, "pprof") == 0)
+				out_format = profile_format::pprof;
+			else
+				return false;
+
+			return true;
+		}
+
+		// The last timestamp of any chunk of the trace
+		uint64_t get_end_timestamp(const trace_reader& reader)
+		{
+			uint64_t end_timestamp = reader.get_header().start_timestamp;
+			if (reader.get_num_event_chunks() != 0)
+				end_timestamp = std::max(end_timestamp, reader.get_chunk_entry(reader.get_event_chunk_index(reader.get_num_event_chunks() - 1)).last_timestamp);
+			if (reader.get_num_residency_chunks() != 0)
+				end_timestamp = std::max(end_timestamp, reader.get_chunk_entry(reader.get_residency_chunk_index(reader.get_num_residency_chunks() - 1)).last_timestamp);
+			if (reader.get_num_fault_chunks() != 0)
+				end_timestamp = std::max(end_timestamp, reader.get_chunk_entry(reader.get_fault_chunk_index(reader.get_num_fault_chunks() - 1)).last_timestamp);
+			return end_timestamp;
+		}
+	}
+
+	int run_profile_command(int argc, char** argv)
+	{
+		if (argc < 1)
+		{
+			print_profile_usage();
+			return 1;
+		}
+
+		const char* trace_path = argv[0];
+		profile_weight weight = profile_weight::committed;
+		profile_format format = profile_format::folded;
+		uint64_t from_time = 0;
+		uint64_t to_time = UINT64_MAX;
+		const char* output_path = nullptr;
+		uint32_t num_threads = get_num_hardware_threads();
+
+		for (int argument_index = 1; argument_index < argc; ++argument_index)
+		{
+			const char* argument = argv[argument_index];
+			const char* value;
+			bool is_valid = true;
+
+			if ((value = get_option_value(argument, "--weight")) != nullptr)
+				is_valid = parse_profile_weight(value, weight);
+			else if ((value = get_option_value(argument, "--format")) != nullptr)
+				is_valid = parse_format(value, format);
+			else if ((value = get_option_value(argument, "--from")) != nullptr)
+				is_valid = parse_duration(value, from_time);
+			else if ((value = get_option_value(argument, "--to")) != nullptr)
+				is_valid = parse_duration(value, to_time);
+			else if ((value = get_option_value(argument, "--output")) != nullptr)
+				output_path = value;
+			else if ((value = get_option_value(argument, "--threads")) != nullptr)
+				is_valid = parse_thread_count(value, num_threads);
+			else
+				is_valid = false;
+
+			if (!is_valid || from_time >= to_time)
+			{
+				fprintf(stderr, "Invalid argument '%s'\n\n", argument);
+				print_profile_usage();
+				return 1;
+			}
+		}
+
+		trace_reader reader;
+		error_result result = reader.open(trace_path);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to open '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		const uint64_t start_timestamp = reader.get_header().start_timestamp;
+		const uint64_t from_timestamp = from_time != 0 ? start_timestamp + from_time : 0;
+		const uint64_t to_timestamp = to_time == UINT64_MAX ? get_end_timestamp(reader) : start_timestamp + to_time;
+
+		// A weight per interned stack, the tree is then built from the stack table alone
+		std::vector<uint64_t> stack_weights(reader.get_num_stacks(), 0);
+		if (is_byte_weight(weight))
+		{
+			// The calling thread replays as well
+			worker_pool pool;
+			pool.start(num_threads - 1);
+
+			address_space_replay replay;
+			result = replay.initialize(reader, address_space_replay::k_default_snapshot_interval, &pool);
+
+			address_space space;
+			if (!result.any())
+			{
+				if (to_time == UINT64_MAX)
+					space = replay.get_final_space();
+				else
+					result = replay.seek(to_timestamp, space);
+			}
+
+			residency_map residency(reader.get_header().page_size);
+			if (!result.any() && weight != profile_weight::reserved)
+				result = read_residency_samples(reader, to_timestamp, residency);
+
+			if (!result.any())
+				add_region_weights(space, residency, sample_scaler(reader.get_sampling_interval()), weight, from_timestamp, stack_weights);
+		}
+		else
+			result = add_fault_weights(reader, from_timestamp, to_timestamp, weight == profile_weight::allocation_faults, stack_weights);
+
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to replay '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		callstack_tree tree;
+		tree.build(reader, stack_weights);
+
+		char symbol_file_path[PATH_MAX];
+		symbol_file symbols;
+		if (snprintf(symbol_file_path, sizeof(symbol_file_path), "%s%s", trace_path, k_symbol_file_suffix) < int(sizeof(symbol_file_path)))
+			symbols.open(symbol_file_path);
+
+		profile_exporter exporter;
+		result = exporter.initialize(reader, symbols);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to read the modules of '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		FILE* file = output_path != nullptr ? fopen(output_path, "wb") : stdout;
+		if (file == nullptr)
+		{
+			fprintf(stderr, "Failed to create '%s'\n", output_path);
+			return 1;
+		}
+
+		if (format == profile_format::folded)
+			result = exporter.write_folded(tree, file);
+		else
+		{
+			pprof_profile_info info;
+			info.weight = weight;
+			info.time_ns = reader.get_header().start_realtime + (to_timestamp - start_timestamp);
+			info.duration_ns = to_timestamp - std::max(from_timestamp, start_timestamp);
+			result = exporter.write_pprof(tree, info, file);
+		}
+
+		if (file != stdout && fclose(file) != 0 && !result.any())
+			result = error_result("Failed to write the profile");
+
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to write '%s': %s\n", output_path != nullptr ? output_path : "<stdout>", result.c_str());
+			return 1;
+		}
+
+		if (output_path != nullptr)
+			fprintf(stderr, "Wrote %u callstack nodes weighing %" PRIu64 " %s to '%s'\n", tree.get_num_nodes() - 1, tree.get_total_weight(), is_byte_weight(weight) ? "bytes" : "faults", output_path);
+
+		return 0;
+	}
+}
@@ -0,0 +1,151 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+#include "command_line.h"
+#include "event_printer.h"
+
+#include "vmemprof/trace/trace_query.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace vmemprof
+{
+	namespace
+	{
+		void print_query_usage()
+		{
+			fprintf(stderr, "Usage: vmemprof query <trace> [options]\n\n");
+			fprintf(stderr, "Options:\n");
+			fprintf(stderr, "    --from=<time>               Skip events before this time since the capture start (e.g. 1.5s, 200ms)\n");
+			fprintf(stderr, "    --to=<time>                 Skip events at or after this time since the capture start\n");
+			fprintf(stderr, "    --address=<start>-<end>     Only events that touch this address range\n");
+			fprintf(stderr, "    --thread=<tid>              Only events from this thread\n");
+			fprintf(stderr, "    --type=<type>[,<type>...]   Only events of these types (mmap, munmap, ...)\n");
+			fprintf(stderr, "    --stack-prefix=<pc>[,<pc>]  Only events whose callstack starts with these frames, outermost first\n");
+			fprintf(stderr, "    --limit=<count>             Stop after this many events\n");
+		}
+
+		bool parse_stack_prefix(const char* str, std::vector<uint64_t>& out_frames)
+		{
+			while (*str != '\0')
+			{
+				uint64_t frame;
+				const char* frame_end = nullptr;
+				if (!parse_uint64(str, frame, &frame_end) || (*frame_end != ',' && *frame_end != '\0'))
+					return false;
+
+				out_frames.push_back(frame);
+				str = *frame_end == ',' ? frame_end + 1 : frame_end;
+			}
+
+			return !out_frames.empty();
+		}
+	}
+
+	int run_query_command(int argc, char** argv)
+	{
+		if (argc < 1)
+		{
+			print_query_usage();
+			return 1;
+		}
+
+		const char* trace_path = argv[0];
+
+		trace_query query;
+		std::vector<uint64_t> stack_prefix;
+		uint64_t from_time = 0;
+		uint64_t to_time = UINT64_MAX;
+		uint64_t limit = UINT64_MAX;
+
+		for (int argument_index = 1; argument_index < argc; ++argument_index)
+		{
+			const char* argument = argv[argument_index];
+			const char* value;
+			bool is_valid;
+
+			if ((value = get_option_value(argument, "--from")) != nullptr)
+				is_valid = parse_duration(value, from_time);
+			else if ((value = get_option_value(argument, "--to")) != nullptr)
+				is_valid = parse_duration(value, to_time);
+			else if ((value = get_option_value(argument, "--address")) != nullptr)
+				is_valid = parse_address_range(value, query.start_address, query.end_address);
+			else if ((value = get_option_value(argument, "--thread")) != nullptr)
+			{
+				uint64_t thread_id;
+				is_valid = parse_uint64(value, thread_id) && thread_id != 0 && thread_id <= UINT32_MAX;
+				query.thread_id = uint32_t(thread_id);
+			}
+			else if ((value = get_option_value(argument, "--type")) != nullptr)
+				is_valid = parse_event_type_mask(value, query.event_type_mask);
+			else if ((value = get_option_value(argument, "--stack-prefix")) != nullptr)
+				is_valid = parse_stack_prefix(value, stack_prefix);
+			else if ((value = get_option_value(argument, "--limit")) != nullptr)
+				is_valid = parse_uint64(value, limit);
+			else
+				is_valid = false;
+
+			if (!is_valid)
+			{
+				fprintf(stderr, "Invalid argument '%s'\n\n", argument);
+				print_query_usage();
+				return 1;
+			}
+		}
+
+		trace_reader reader;
+		error_result result = reader.open(trace_path);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to open '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		const uint64_t start_timestamp = reader.get_header().start_timestamp;
+		query.start_timestamp = start_timestamp + from_time;
+		query.end_timestamp = to_time != UINT64_MAX ? start_timestamp + to_time : UINT64_MAX;
+		query.stack_prefix = stack_prefix.data();
+		query.stack_prefix_size = uint32_t(stack_prefix.size());
+
+		uint64_t num_matches = 0;
+		result = query_events(reader, query, [&](const vm_event& event)
+			{
+				print_event(stdout, event, start_timestamp);
+				return ++num_matches < limit;
+			});
+
+		if (result.any())
+		{
+			fprintf(stderr, "Query failed: %s\n", result.c_str());
+			return 1;
+		}
+
+		return 0;
+	}
+}
@@ -0,0 +1,160 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+#include "command_line.h"
+
+#include "vmemprof/analysis/address_space_replay.h"
+#include "vmemprof/analysis/residency_map.h"
+#include "vmemprof/analysis/sample_scaler.h"
+#include "vmemprof/core/worker_pool.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+
+namespace vmemprof
+{
+	namespace
+	{
+		void print_residency_usage()
+		{
+			fprintf(stderr, "Usage: vmemprof residency <trace> [options]\n\n");
+			fprintf(stderr, "Options:\n");
+			fprintf(stderr, "    --at=<time>      Report the residency at this time since the capture start (default: end of trace)\n");
+			fprintf(stderr, "    --threads=<n>    Replay the trace on this many threads, 0 for every hardware thread (default: 0)\n");
+		}
+	}
+
+	int run_residency_command(int argc, char** argv)
+	{
+		if (argc < 1)
+		{
+			print_residency_usage();
+			return 1;
+		}
+
+		const char* trace_path = argv[0];
+		uint64_t at_time = UINT64_MAX;
+		uint32_t num_threads = get_num_hardware_threads();
+
+		for (int argument_index = 1; argument_index < argc; ++argument_index)
+		{
+			const char* argument = argv[argument_index];
+			const char* value;
+			bool is_valid = true;
+
+			if ((value = get_option_value(argument, "--at")) != nullptr)
+				is_valid = parse_duration(value, at_time);
+			else if ((value = get_option_value(argument, "--threads")) != nullptr)
+				is_valid = parse_thread_count(value, num_threads);
+			else
+				is_valid = false;
+
+			if (!is_valid)
+			{
+				fprintf(stderr, "Invalid argument '%s'\n\n", argument);
+				print_residency_usage();
+				return 1;
+			}
+		}
+
+		trace_reader reader;
+		error_result result = reader.open(trace_path);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to open '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		// The calling thread replays as well
+		worker_pool pool;
+		pool.start(num_threads - 1);
+
+		address_space_replay replay;
+		result = replay.initialize(reader, address_space_replay::k_default_snapshot_interval, &pool);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to replay '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		const uint64_t at_timestamp = at_time == UINT64_MAX ? UINT64_MAX : reader.get_header().start_timestamp + at_time;
+
+		address_space space;
+		if (at_time == UINT64_MAX)
+			space = replay.get_final_space();
+		else
+			result = replay.seek(at_timestamp, space);
+
+		residency_map residency(reader.get_header().page_size);
+		if (!result.any())
+			result = read_residency_samples(reader, at_timestamp, residency);
+
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to replay '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		printf("%-12s %-12s %12s %12s %12s %12s\n", "start", "end", "reserved", "committed", "resident", "unsampled");
+
+		// Regions are listed as recorded, totals are scaled back to the whole process when mappings were sampled
+		const sample_scaler scaler(reader.get_sampling_interval());
+		residency_estimate total = { 0, 0, 0 };
+		uint64_t reserved_bytes = 0;
+		uint64_t unsampled_bytes = 0;
+
+		space.for_each_region([&](const vma_region& region)
+			{
+				const residency_estimate estimate = residency.estimate(region);
+				const uint64_t size = region.get_size();
+
+				printf("%012" PRIx64 "-%012" PRIx64 " %10" PRIu64 "K %10" PRIu64 "K %10" PRIu64 "K %10" PRIu64 "K",
+					region.start, region.end, size / 1024, estimate.committed_bytes / 1024, estimate.resident_bytes / 1024, (size - estimate.sampled_bytes) / 1024);
+
+				if (region.stack_id != k_invalid_stack_id)
+					printf(" stack=%u", region.stack_id);
+				printf(" tid=%u\n", region.thread_id);
+
+				const residency_estimate scaled_estimate = scaler.scale(region, estimate);
+				reserved_bytes += scaler.scale(region, size);
+				unsampled_bytes += scaler.scale(region, size - estimate.sampled_bytes);
+				total.committed_bytes += scaled_estimate.committed_bytes;
+				total.resident_bytes += scaled_estimate.resident_bytes;
+				return true;
+			});
+
+		printf("\n");
+		if (scaler.is_sampled())
+			printf("Sampling:          one mapping every %" PRIu64 " bytes, totals are estimates\n", scaler.get_sampling_interval());
+
+		printf("Reserved:          %" PRIu64 " KB\n", reserved_bytes / 1024);
+		printf("Committed:         %" PRIu64 " KB\n", total.committed_bytes / 1024);
+		printf("Resident:          %" PRIu64 " KB\n", total.resident_bytes / 1024);
+		printf("Unsampled:         %" PRIu64 " KB\n", unsampled_bytes / 1024);
+		return 0;
+	}
+}
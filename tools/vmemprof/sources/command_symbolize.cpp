@@ -0,0 +1,170 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+#include "command_line.h"
+
+#include "vmemprof/core/time_utils.h"
+#include "vmemprof/symbols/symbol_file.h"
+#include "vmemprof/symbols/symbolizer.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace vmemprof
+{
+	namespace
+	{
+		void print_symbolize_usage()
+		{
+			fprintf(stderr, "Usage: vmemprof symbolize <trace> [options]\n\n");
+			fprintf(stderr, "Options:\n");
+			fprintf(stderr, "    --output=<path>      Symbol file to write (default: <trace>%s)\n", k_symbol_file_suffix);
+			fprintf(stderr, "    --cache=<dir>        Symbol cache directory (default: $XDG_CACHE_HOME/vmemprof or ~/.cache/vmemprof)\n");
+			fprintf(stderr, "    --no-cache           Parse every module, do not read or write the cache\n");
+			fprintf(stderr, "    --threads=<count>    Number of threads (default: every hardware thread)\n");
+		}
+	}
+
+	int run_symbolize_command(int argc, char** argv)
+	{
+		if (argc < 1)
+		{
+			print_symbolize_usage();
+			return 1;
+		}
+
+		const char* trace_path = argv[0];
+		const char* output_path = nullptr;
+		const char* cache_directory = nullptr;
+		bool is_cache_enabled = true;
+		uint64_t num_threads = 0;
+
+		for (int argument_index = 1; argument_index < argc; ++argument_index)
+		{
+			const char* argument = argv[argument_index];
+			const char* value;
+			bool is_valid = true;
+
+			if ((value = get_option_value(argument, "--output")) != nullptr)
+				output_path = value;
+			else if ((value = get_option_value(argument, "--cache")) != nullptr)
+				cache_directory = value;
+			else if (std::strcmp(argument, "--no-cache") == 0)
+				is_cache_enabled = false;
+			else if ((value = get_option_value(argument, "--threads")) != nullptr)
+				is_valid = parse_uint64(value, num_threads) && num_threads <= 1024;
+			else
+				is_valid = false;
+
+			if (!is_valid)
+			{
+				fprintf(stderr, "Invalid argument '%s'\n\n", argument);
+				print_symbolize_usage();
+				return 1;
+			}
+		}
+
+		char default_output_path[PATH_MAX];
+		if (output_path == nullptr)
+		{
+			snprintf(default_output_path, sizeof(default_output_path), "%s%s", trace_path, k_symbol_file_suffix);
+			output_path = default_output_path;
+		}
+
+		char default_cache_directory[PATH_MAX];
+		if (is_cache_enabled && cache_directory == nullptr && symbolizer::get_default_cache_directory(default_cache_directory, sizeof(default_cache_directory)))
+			cache_directory = default_cache_directory;
+
+		trace_reader reader;
+		error_result result = reader.open(trace_path);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to open '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		symbolizer symbols;
+		result = symbols.initialize(reader);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to read the modules of '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		if (symbols.get_num_modules() == 0)
+			fprintf(stderr, "Warning: '%s' has no module map, frames cannot be symbolized\n", trace_path);
+
+		// Stacks share most of their frames, each address is symbolized once
+		std::vector<uint64_t> addresses;
+		uint64_t frames[k_max_stack_frames];
+		for (uint32_t stack_id = 1; stack_id < reader.get_num_stacks(); ++stack_id)
+		{
+			uint32_t num_frames;
+			if (reader.get_stack(stack_id, frames, num_frames))
+				addresses.insert(addresses.end(), frames, frames + num_frames);
+		}
+
+		std::sort(addresses.begin(), addresses.end());
+		addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+
+		symbolizer_settings settings;
+		settings.cache_directory = is_cache_enabled ? cache_directory : nullptr;
+		settings.num_threads = uint32_t(num_threads);
+
+		const uint64_t start_timestamp = get_timestamp_ns();
+
+		std::vector<symbolized_frame> symbolized_frames;
+		const symbolizer_stats stats = symbols.symbolize(addresses.data(), addresses.size(), settings, symbolized_frames);
+
+		const uint64_t end_timestamp = get_timestamp_ns();
+
+		result = write_symbol_file(output_path, symbolized_frames, symbols);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to write '%s': %s\n", output_path, result.c_str());
+			return 1;
+		}
+
+		for (uint32_t module_index = 0; module_index < symbols.get_num_modules(); ++module_index)
+		{
+			// Modules without a file (e.g. the vDSO) are expected to fail
+			const char* module_error = symbols.get_module_error(module_index);
+			if (module_error != nullptr && !symbols.get_module_path(module_index).empty())
+				fprintf(stderr, "Warning: '%s': %s\n", symbols.get_module_path(module_index).c_str(), module_error);
+		}
+
+		printf("Frames:            %zu (%" PRIu64 " symbolized)\n", addresses.size(), stats.num_symbolized_frames);
+		printf("Modules:           %u cached, %u parsed, %u failed\n", stats.num_cached_modules, stats.num_parsed_modules, stats.num_failed_modules);
+		printf("Time:              %.3f s\n", double(end_timestamp - start_timestamp) * 1.0e-9);
+		printf("Output:            %s\n", output_path);
+		return 0;
+	}
+}
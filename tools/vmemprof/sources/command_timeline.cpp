@@ -0,0 +1,359 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+#include "command_line.h"
+#include "stack_printer.h"
+
+#include "vmemprof/analysis/timeline.h"
+#include "vmemprof/analysis/timeline_file.h"
+#include "vmemprof/core/time_utils.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace vmemprof
+{
+	namespace
+	{
+		void print_timeline_usage()
+		{
+			fprintf(stderr, "Usage: vmemprof timeline <trace> [options]\n\n");
+			fprintf(stderr, "Prints reserved, committed and resident memory and the VMA count over time from rollups kept in <trace>%s.\n\n", k_timeline_file_suffix);
+			fprintf(stderr, "Options:\n");
+			fprintf(stderr, "    --from=<time>          Time since the capture start where the view starts (default: start of trace)\n");
+			fprintf(stderr, "    --to=<time>            Time since the capture start where the view ends (default: end of trace)\n");
+			fprintf(stderr, "    --points=<count>       Print at most this many buckets, picks the finest resolution that fits (default: 40)\n");
+			fprintf(stderr, "    --by=<grouping>        Also roll up per 'stack' or per 'module', or 'none' (default)\n");
+			fprintf(stderr, "    --limit=<count>        Print this many groups at most, largest peak committed first (default: 5)\n");
+			fprintf(stderr, "    --resolutions=<list>   Comma separated bucket durations, finest first (default: 1ms,1s,1min)\n");
+			fprintf(stderr, "    --rebuild              Rebuild the rollups even if they are up to date\n");
+			fprintf(stderr, "    --csv                  Print comma separated values in bytes\n");
+		}
+
+		bool parse_grouping(const char* str, timeline_grouping& out_grouping)
+		{
+			if (std::strcmp(str, "none") == 0)
+				out_grouping = timeline_grouping::none;
+			else if (std::strcmp(str, "stack") == 0)
+				out_grouping = timeline_grouping::stack;
+			else if (std::strcmp(str, "module") == 0)
+				out_grouping = timeline_grouping::module;
+			else
+				return false;
+
+			return true;
+		}
+
+		bool parse_resolutions(const char* str, std::vector<uint64_t>& out_resolutions)
+		{
+			out_resolutions.clear();
+
+			char resolution[64];
+			while (*str != '\0')
+			{
+				const char* resolution_end = std::strchr(str, ',');
+				const size_t resolution_length = resolution_end != nullptr ? size_t(resolution_end - str) : std::strlen(str);
+				if (resolution_length == 0 || resolution_length >= sizeof(resolution))
+					return false;
+
+				std::memcpy(resolution, str, resolution_length);
+				resolution[resolution_length] = '\0';
+
+				uint64_t duration;
+				if (!parse_duration(resolution, duration) || duration == 0 || (!out_resolutions.empty() && duration <= out_resolutions.back()))
+					return false;
+
+				out_resolutions.push_back(duration);
+
+				str += resolution_length;
+				if (*str == ',')
+					str++;
+			}
+
+			return !out_resolutions.empty() && out_resolutions.size() <= k_max_timeline_levels;
+		}
+
+		void print_duration(uint64_t duration)
+		{
+			if (duration % 60000000000ULL == 0)
+				printf("%" PRIu64 "min", uint64_t(duration / 60000000000ULL));
+			else if (duration % 1000000000ULL == 0)
+				printf("%" PRIu64 "s", uint64_t(duration / 1000000000ULL));
+			else if (duration % 1000000ULL == 0)
+				printf("%" PRIu64 "ms", uint64_t(duration / 1000000ULL));
+			else if (duration % 1000ULL == 0)
+				printf("%" PRIu64 "us", uint64_t(duration / 1000ULL));
+			else
+				printf("%" PRIu64 "ns", duration);
+		}
+
+		// True when the file has the requested grouping and resolutions, or any resolutions when none were requested
+		bool is_timeline_reusable(const timeline_file& timeline, timeline_grouping grouping, const std::vector<uint64_t>& resolutions)
+		{
+			if (timeline.get_grouping() != grouping)
+				return false;
+
+			if (resolutions.empty())
+				return true;
+
+			if (timeline.get_num_levels() != resolutions.size())
+				return false;
+
+			for (uint32_t level_index = 0; level_index < timeline.get_num_levels(); ++level_index)
+			{
+				if (timeline.get_resolution(level_index) != resolutions[level_index])
+					return false;
+			}
+
+			return true;
+		}
+
+		void print_points(const char* series_name, const std::vector<timeline_point>& points, uint64_t start_timestamp, bool is_csv)
+		{
+			if (!is_csv)
+				printf("%10s %12s %12s %12s %12s %8s\n", "time", "reserved", "committed", "peak", "resident", "vmas");
+
+			for (const timeline_point& point : points)
+			{
+				const double time = double(point.timestamp - start_timestamp) * 1.0e-9;
+				if (is_csv)
+					printf("%s,%.6f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n", series_name, time, point.last.reserved_bytes,
+						point.last.committed_bytes, point.maximum.committed_bytes, point.last.resident_bytes, point.last.num_vmas);
+				else
+					printf("%9.3fs %11" PRIu64 "K %11" PRIu64 "K %11" PRIu64 "K %11" PRIu64 "K %8" PRIu64 "\n", time, point.last.reserved_bytes / 1024,
+						point.last.committed_bytes / 1024, point.maximum.committed_bytes / 1024, point.last.resident_bytes / 1024, point.last.num_vmas);
+			}
+		}
+	}
+
+	int run_timeline_command(int argc, char** argv)
+	{
+		if (argc < 1)
+		{
+			print_timeline_usage();
+			return 1;
+		}
+
+		const char* trace_path = argv[0];
+		uint64_t from_time = 0;
+		uint64_t to_time = UINT64_MAX;
+		uint64_t max_points = 40;
+		uint64_t limit = 5;
+		timeline_grouping grouping = timeline_grouping::none;
+		std::vector<uint64_t> resolutions;
+		bool is_rebuild_forced = false;
+		bool is_csv = false;
+
+		for (int argument_index = 1; argument_index < argc; ++argument_index)
+		{
+			const char* argument = argv[argument_index];
+			const char* value;
+			bool is_valid = true;
+
+			if ((value = get_option_value(argument, "--from")) != nullptr)
+				is_valid = parse_duration(value, from_time);
+			else if ((value = get_option_value(argument, "--to")) != nullptr)
+				is_valid = parse_duration(value, to_time);
+			else if ((value = get_option_value(argument, "--points")) != nullptr)
+				is_valid = parse_uint64(value, max_points) && max_points != 0 && max_points <= 1000000;
+			else if ((value = get_option_value(argument, "--by")) != nullptr)
+				is_valid = parse_grouping(value, grouping);
+			else if ((value = get_option_value(argument, "--limit")) != nullptr)
+				is_valid = parse_uint64(value, limit);
+			else if ((value = get_option_value(argument, "--resolutions")) != nullptr)
+				is_valid = parse_resolutions(value, resolutions);
+			else if (std::strcmp(argument, "--rebuild") == 0)
+				is_rebuild_forced = true;
+			else if (std::strcmp(argument, "--csv") == 0)
+				is_csv = true;
+			else
+				is_valid = false;
+
+			if (!is_valid || from_time >= to_time)
+			{
+				fprintf(stderr, "Invalid argument '%s'\n\n", argument);
+				print_timeline_usage();
+				return 1;
+			}
+		}
+
+		trace_reader reader;
+		error_result result = reader.open(trace_path);
+		if (result.any())
+		{
+			fprintf(stderr, "Failed to open '%s': %s\n", trace_path, result.c_str());
+			return 1;
+		}
+
+		char timeline_path[PATH_MAX];
+		if (snprintf(timeline_path, sizeof(timeline_path), "%s%s", trace_path, k_timeline_file_suffix) >= int(sizeof(timeline_path)))
+		{
+			fprintf(stderr, "Trace path is too long\n");
+			return 1;
+		}
+
+		// Rollups are rebuilt when they are missing, stale or built with other settings
+		timeline_file timeline;
+		const bool is_reused = !is_rebuild_forced && !timeline.open(timeline_path).any()
+			&& timeline.is_built_from(reader.get_header(), reader.get_size()) && is_timeline_reusable(timeline, grouping, resolutions);
+
+		double build_time = 0.0;
+		bool is_kept = true;
+		if (!is_reused)
+		{
+			timeline.close();
+
+			timeline_settings settings;
+			settings.grouping = grouping;
+			if (!resolutions.empty())
+			{
+				std::copy(resolutions.begin(), resolutions.end(), settings.resolutions);
+				settings.num_levels = uint32_t(resolutions.size());
+			}
+
+			const uint64_t build_start_timestamp = get_timestamp_ns();
+
+			timeline_builder builder;
+			result = builder.build(reader, settings);
+			if (result.any())
+			{
+				fprintf(stderr, "Failed to replay '%s': %s\n", trace_path, result.c_str());
+				return 1;
+			}
+
+			build_time = double(get_timestamp_ns() - build_start_timestamp) * 1.0e-9;
+
+			// A trace in a read-only directory is still plotted, its rollups are just not kept
+			result = write_timeline_file(timeline_path, builder, reader.get_header(), reader.get_size());
+			if (result.any())
+			{
+				fprintf(stderr, "Failed to write '%s': %s, the rollups are not kept\n", timeline_path, result.c_str());
+				is_kept = false;
+				result = timeline.open(builder, reader.get_header(), reader.get_size());
+			}
+			else
+				result = timeline.open(timeline_path);
+
+			if (result.any())
+			{
+				fprintf(stderr, "Failed to open '%s': %s\n", timeline_path, result.c_str());
+				return 1;
+			}
+		}
+
+		const uint64_t start_timestamp = timeline.get_start_timestamp();
+		const uint64_t end_timestamp = timeline.get_end_timestamp() + 1;
+		const uint64_t view_start_timestamp = std::min(start_timestamp + from_time, end_timestamp);
+		const uint64_t view_end_timestamp = to_time == UINT64_MAX || to_time > end_timestamp - start_timestamp ? end_timestamp : start_timestamp + to_time;
+		const uint32_t level_index = timeline.find_level(view_start_timestamp, view_end_timestamp, max_points);
+
+		// Largest peak committed memory first, series 0 is the whole process
+		std::vector<uint32_t> group_indices;
+		for (uint32_t series_index = 1; series_index < timeline.get_num_series(); ++series_index)
+			group_indices.push_back(series_index);
+
+		std::sort(group_indices.begin(), group_indices.end(), [&timeline](uint32_t lhs, uint32_t rhs)
+			{
+				const timeline_value& lhs_peak = timeline.get_series_peak(lhs);
+				const timeline_value& rhs_peak = timeline.get_series_peak(rhs);
+				if (lhs_peak.committed_bytes != rhs_peak.committed_bytes)
+					return lhs_peak.committed_bytes > rhs_peak.committed_bytes;
+				if (lhs_peak.reserved_bytes != rhs_peak.reserved_bytes)
+					return lhs_peak.reserved_bytes > rhs_peak.reserved_bytes;
+				return lhs < rhs;
+			});
+
+		if (group_indices.size() > limit)
+			group_indices.resize(size_t(limit));
+
+		std::vector<timeline_point> points;
+		if (is_csv)
+		{
+			printf("series,time,reserved,committed,committed_peak,resident,vmas\n");
+			timeline.query(0, level_index, view_start_timestamp, view_end_timestamp, points);
+			print_points("total", points, start_timestamp, true);
+
+			char series_name[32];
+			for (const uint32_t series_index : group_indices)
+			{
+				// Module names can hold commas, series are numbered instead
+				snprintf(series_name, sizeof(series_name), "%s%u", grouping == timeline_grouping::stack ? "stack" : "group", grouping == timeline_grouping::stack ? timeline.get_series_stack_id(series_index) : series_index);
+				timeline.query(series_index, level_index, view_start_timestamp, view_end_timestamp, points);
+				print_points(series_name, points, start_timestamp, true);
+			}
+
+			return 0;
+		}
+
+		printf("Timeline:          %s (%s", timeline_path, is_reused ? "up to date" : "built in ");
+		if (!is_reused)
+			printf("%.3fs%s", build_time, is_kept ? "" : ", not kept");
+		printf(")\nResolutions:       ");
+		for (uint32_t index = 0; index < timeline.get_num_levels(); ++index)
+		{
+			if (index != 0)
+				printf(", ");
+			print_duration(timeline.get_resolution(index));
+		}
+
+		printf("\nView:              %.3fs to %.3fs, ", double(view_start_timestamp - start_timestamp) * 1.0e-9, double(view_end_timestamp - start_timestamp) * 1.0e-9);
+		print_duration(timeline.get_resolution(level_index));
+		printf(" buckets\n");
+
+		const timeline_value& peak = timeline.get_series_peak(0);
+		printf("Peak:              %" PRIu64 " KB reserved, %" PRIu64 " KB committed, %" PRIu64 " KB resident, %" PRIu64 " VMAs\n",
+			peak.reserved_bytes / 1024, peak.committed_bytes / 1024, peak.resident_bytes / 1024, peak.num_vmas);
+		if (grouping != timeline_grouping::none)
+			printf("Groups:            %u\n", timeline.get_num_series() - 1);
+
+		printf("\n");
+		timeline.query(0, level_index, view_start_timestamp, view_end_timestamp, points);
+		print_points("total", points, start_timestamp, false);
+
+		const stack_printer stacks(reader, trace_path);
+		for (const uint32_t series_index : group_indices)
+		{
+			const timeline_value& series_peak = timeline.get_series_peak(series_index);
+			if (grouping == timeline_grouping::stack)
+			{
+				printf("\nstack %u, peak %" PRIu64 " KB committed\n", timeline.get_series_stack_id(series_index), series_peak.committed_bytes / 1024);
+				stacks.print(timeline.get_series_stack_id(series_index));
+			}
+			else
+				printf("\n%s, peak %" PRIu64 " KB committed\n", timeline.get_series_name(series_index), series_peak.committed_bytes / 1024);
+
+			timeline.query(series_index, level_index, view_start_timestamp, view_end_timestamp, points);
+			print_points(nullptr, points, start_timestamp, false);
+		}
+
+		return 0;
+	}
+}
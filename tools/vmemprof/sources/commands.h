@@ -0,0 +1,48 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	// Every command receives the arguments that follow the command name and returns the process exit code
+
+	int run_info_command(int argc, char** argv);
+	int run_query_command(int argc, char** argv);
+	int run_map_command(int argc, char** argv);
+	int run_residency_command(int argc, char** argv);
+	int run_faults_command(int argc, char** argv);
+	int run_symbolize_command(int argc, char** argv);
+	int run_fragmentation_command(int argc, char** argv);
+	int run_hugepages_command(int argc, char** argv);
+	int run_numa_command(int argc, char** argv);
+	int run_daemon_command(int argc, char** argv);
+	int run_live_command(int argc, char** argv);
+	int run_attach_command(int argc, char** argv);
+	int run_diff_command(int argc, char** argv);
+	int run_leaks_command(int argc, char** argv);
+	int run_allocators_command(int argc, char** argv);
+	int run_timeline_command(int argc, char** argv);
+	int run_profile_command(int argc, char** argv);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/allocator_sample.h"
+#include "vmemprof/core/event.h"
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Prints an event on a single line, timestamps are relative to the capture start.
+	////////////////////////////////////////////////////////////////////////////////
+	inline void print_event(FILE* file, const vm_event& event, uint64_t start_timestamp)
+	{
+		const uint64_t relative_timestamp = event.timestamp - start_timestamp;
+
+		fprintf(file, "%" PRIu64 ".%09" PRIu64 " %u %-8s 0x%012" PRIx64 " %10" PRIu64,
+			relative_timestamp / uint64_t(1000000000), relative_timestamp % uint64_t(1000000000),
+			event.thread_id, get_event_type_name(event.type), event.address, event.size);
+
+		switch (event.type)
+		{
+		case event_type::mmap:
+			fprintf(file, " prot=0x%x flags=0x%x fd=%d offset=0x%" PRIx64, event.protection, event.flags, int(int64_t(event.arg0)), event.arg1);
+			break;
+		case event_type::mremap:
+			fprintf(file, " flags=0x%x old=0x%" PRIx64 " old_size=%" PRIu64, event.flags, event.arg0, event.arg1);
+			break;
+		case event_type::mprotect:
+			fprintf(file, " prot=0x%x", event.protection);
+			break;
+		case event_type::madvise:
+			fprintf(file, " advice=%u", uint32_t(event.arg0));
+			break;
+		case event_type::brk:
+		case event_type::sbrk:
+			fprintf(file, " old=0x%" PRIx64, event.arg0);
+			break;
+		case event_type::mbind:
+			fprintf(file, " mode=0x%x nodes=0x%" PRIx64 " flags=0x%x", uint32_t(event.arg0), event.arg1, event.flags);
+			break;
+		case event_type::set_mempolicy:
+			fprintf(file, " mode=0x%x nodes=0x%" PRIx64, uint32_t(event.arg0), event.arg1);
+			break;
+		case event_type::allocator_extent:
+			fprintf(file, " %s %s arena=%u", get_allocator_name(allocator_kind(event.flags)), get_allocator_extent_op_name(allocator_extent_op(event.arg1)), uint32_t(event.arg0));
+			break;
+		case event_type::uffd_register:
+			fprintf(file, " mode=0x%x uffd=%d", uint32_t(event.arg0), int(int64_t(event.arg1)));
+			break;
+		case event_type::uffd_unregister:
+			fprintf(file, " uffd=%d", int(int64_t(event.arg1)));
+			break;
+		case event_type::uffd_populate:
+			fprintf(file, " %s uffd=%d", get_uffd_populate_op_name(uffd_populate_op(event.arg0)), int(int64_t(event.arg1)));
+			break;
+		default:
+			break;
+		}
+
+		if (event.stack_id != k_invalid_stack_id)
+			fprintf(file, " stack=%u", event.stack_id);
+
+		fputc('\n', file);
+	}
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "command_line.h"
+
+#include "vmemprof/analysis/leak_detector.h"
+
+#include <cstdint>
+#include <cstdio>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Leak detection options, shared by the daemon and the leaks command.
+	////////////////////////////////////////////////////////////////////////////////
+	inline void print_leak_options_usage(const char* prefix)
+	{
+		const leak_detector_settings defaults;
+		fprintf(stderr, "    --%sinterval=<time>       Time between two observations (default: %.0fs)\n", prefix, double(defaults.interval_ns) * 1.0e-9);
+		fprintf(stderr, "    --%swindows=<count>       Observations in the sliding window (default: %u)\n", prefix, defaults.num_windows);
+		fprintf(stderr, "    --%smin-windows=<count>   Observations needed before a callstack is flagged (default: %u)\n", prefix, defaults.min_windows);
+		fprintf(stderr, "    --%stolerance=<count>     Decreases tolerated within the window (default: %u)\n", prefix, defaults.max_decreases);
+		fprintf(stderr, "    --%smin-count=<count>     Growth in live mappings that flags a callstack (default: %u)\n", prefix, defaults.min_count_growth);
+		fprintf(stderr, "    --%smin-committed=<size>  Growth in committed bytes that flags a callstack (default: %uM)\n", prefix, uint32_t(defaults.min_committed_growth >> 20));
+	}
+
+	namespace leak_options_impl
+	{
+		// Every callstack keeps this many observations at most
+		constexpr uint32_t k_max_leak_windows = 10000;
+
+		inline bool parse_count(const char* str, uint32_t min_value, uint32_t max_value, uint32_t& out_count)
+		{
+			uint64_t value;
+			if (!parse_uint64(str, value) || value < min_value || value > max_value)
+				return false;
+
+			out_count = uint32_t(value);
+			return true;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Parses an option of print_leak_options_usage(). Returns false if the
+	// argument is another option, out_is_valid tells if the value is valid.
+	////////////////////////////////////////////////////////////////////////////////
+	inline bool parse_leak_option(const char* argument, const char* prefix, leak_detector_settings& settings, bool& out_is_valid)
+	{
+		using namespace leak_options_impl;
+
+		char option_name[64];
+		const auto get_value = [&](const char* name)
+			{
+				snprintf(option_name, sizeof(option_name), "--%s%s", prefix, name);
+				return get_option_value(argument, option_name);
+			};
+
+		const char* value;
+		if ((value = get_value("interval")) != nullptr)
+			out_is_valid = parse_duration(value, settings.interval_ns) && settings.interval_ns != 0;
+		else if ((value = get_value("windows")) != nullptr)
+			out_is_valid = parse_count(value, 2, k_max_leak_windows, settings.num_windows);
+		else if ((value = get_value("min-windows")) != nullptr)
+			out_is_valid = parse_count(value, 2, k_max_leak_windows, settings.min_windows);
+		else if ((value = get_value("tolerance")) != nullptr)
+			out_is_valid = parse_count(value, 0, k_max_leak_windows, settings.max_decreases);
+		else if ((value = get_value("min-count")) != nullptr)
+			out_is_valid = parse_count(value, 1, UINT32_MAX, settings.min_count_growth);
+		else if ((value = get_value("min-committed")) != nullptr)
+			out_is_valid = parse_size(value, settings.min_committed_growth) && settings.min_committed_growth != 0;
+		else
+			return false;
+
+		return true;
+	}
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Live protocol
+//
+// The daemon listens on a Unix stream socket. A profiled process connects and
+// streams its trace exactly as it would write it to a file: the connection
+// starts with the trace header and chunks follow as they are flushed.
+//
+// Any connection that does not start with the trace magic is a query: a single
+// line made of the query name followed by 'key=value' arguments separated by
+// spaces. The daemon writes the answer as text and closes the connection.
+//
+//    processes                      Every process streaming or recently streamed
+//    summary [pid=<pid>]            VMA count, committed bytes, event and fault rates
+//    top [pid=<pid>] [count=<n>]    Callstacks with the most committed bytes
+//    leaks [pid=<pid>] [count=<n>]  Callstacks whose mappings or committed bytes keep growing
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	// Longest query line accepted by the daemon
+	constexpr uint32_t k_max_live_query_size = 1024;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns the socket path used when none is provided, the one the capture
+	// library streams to. Returns nullptr if VMEMPROF_LIVE is not set.
+	////////////////////////////////////////////////////////////////////////////////
+	inline const char* get_default_live_socket_path()
+	{
+		const char* socket_path = getenv("VMEMPROF_LIVE");
+		return socket_path != nullptr && socket_path[0] != '\0' ? socket_path : nullptr;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Fills the address of a Unix socket, returns false if the path is too long.
+	////////////////////////////////////////////////////////////////////////////////
+	inline bool make_live_socket_address(const char* socket_path, sockaddr_un& out_address)
+	{
+		std::memset(&out_address, 0, sizeof(out_address));
+		out_address.sun_family = AF_UNIX;
+
+		if (std::strlen(socket_path) >= sizeof(out_address.sun_path))
+			return false;
+
+		std::strcpy(out_address.sun_path, socket_path);
+		return true;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Appends formatted text to a query answer.
+	////////////////////////////////////////////////////////////////////////////////
+	__attribute__((format(printf, 2, 3)))
+	inline void append_format(std::string& output, const char* format, ...)
+	{
+		char buffer[1024];
+
+		va_list arguments;
+		va_start(arguments, format);
+		const int length = vsnprintf(buffer, sizeof(buffer), format, arguments);
+		va_end(arguments);
+
+		if (length > 0)
+			output.append(buffer, size_t(length) < sizeof(buffer) ? size_t(length) : sizeof(buffer) - 1);
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Formats a size with a K, M or G suffix.
+	////////////////////////////////////////////////////////////////////////////////
+	inline const char* format_size(uint64_t size, char (&out_buffer)[32])
+	{
+		if (size >= 1024ULL * 1024 * 1024)
+			snprintf(out_buffer, sizeof(out_buffer), "%.1fG", double(size) / (1024.0 * 1024.0 * 1024.0));
+		else if (size >= 1024ULL * 1024)
+			snprintf(out_buffer, sizeof(out_buffer), "%.1fM", double(size) / (1024.0 * 1024.0));
+		else
+			snprintf(out_buffer, sizeof(out_buffer), "%.1fK", double(size) / 1024.0);
+
+		return out_buffer;
+	}
+}
@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "commands.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace vmemprof
+{
+	namespace
+	{
+		struct command_entry
+		{
+			const char* name;
+			const char* description;
+			int (*run)(int argc, char** argv);
+		};
+
+		const command_entry k_commands[] =
+		{
+			{ "info", "Summarizes the content of a trace", run_info_command },
+			{ "query", "Prints the events that match a set of filters", run_query_command },
+			{ "map", "Reconstructs the address space at a point in time", run_map_command },
+			{ "residency", "Reports reserved, committed and resident memory per region", run_residency_command },
+			{ "faults", "Attributes sampled page faults to mappings and callstacks", run_faults_command },
+			{ "symbolize", "Symbolizes the stacks of a trace with the module map it recorded", run_symbolize_command },
+			{ "fragmentation", "Measures holes, VMA counts and the mappings that fragment the address space", run_fragmentation_command },
+			{ "hugepages", "Reports how well huge pages back each VMA and which madvise calls covered it", run_hugepages_command },
+			{ "numa", "Reports the NUMA placement of pages and the mappings faulted in from remote nodes", run_numa_command },
+			{ "daemon", "Aggregates the traces that processes stream in live mode", run_daemon_command },
+			{ "live", "Queries the aggregates of a running daemon", run_live_command },
+			{ "attach", "Captures a running process by injecting the capture library", run_attach_command },
+			{ "diff", "Compares the memory of two points in time or two traces by callstack, module or mapping", run_diff_command },
+			{ "leaks", "Finds the callstacks whose live mappings or committed bytes keep growing", run_leaks_command },
+			{ "allocators", "Attributes mappings to allocator arenas and reports the memory allocators retain unused", run_allocators_command },
+			{ "timeline", "Plots memory and the VMA count over time from multi-resolution rollups", run_timeline_command },
+			{ "profile", "Exports folded stacks or a pprof profile of memory or faults for flame graphs", run_profile_command },
+		};
+
+		void print_usage()
+		{
+			printf("Usage: vmemprof <command> [arguments]\n\n");
+			printf("Commands:\n");
+			for (const command_entry& command : k_commands)
+				printf("    %-16s %s\n", command.name, command.description);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	using namespace vmemprof;
+
+	if (argc < 2 || std::strcmp(argv[1], "--help") == 0)
+	{
+		print_usage();
+		return argc < 2 ? 1 : 0;
+	}
+
+	for (const command_entry& command : k_commands)
+	{
+		if (std::strcmp(argv[1], command.name) == 0)
+			return command.run(argc - 2, argv + 2);
+	}
+
+	fprintf(stderr, "Unknown command '%s'\n\n", argv[1]);
+	print_usage();
+	return 1;
+}
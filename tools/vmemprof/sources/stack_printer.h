@@ -0,0 +1,84 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/event.h"
+#include "vmemprof/symbols/symbol_file.h"
+#include "vmemprof/trace/stack_codec.h"
+#include "vmemprof/trace/trace_reader.h"
+
+#include <cinttypes>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Prints the stacks of a trace, symbolized when 'vmemprof symbolize' wrote
+	// the symbol file of the trace.
+	////////////////////////////////////////////////////////////////////////////////
+	class stack_printer
+	{
+	public:
+		stack_printer(const trace_reader& reader, const char* trace_path)
+			: m_reader(reader)
+		{
+			char symbol_file_path[PATH_MAX];
+			if (snprintf(symbol_file_path, sizeof(symbol_file_path), "%s%s", trace_path, k_symbol_file_suffix) < int(sizeof(symbol_file_path)))
+				m_symbols.open(symbol_file_path);
+		}
+
+		void print(uint32_t stack_id) const
+		{
+			uint64_t frames[k_max_stack_frames];
+			uint32_t num_frames;
+			if (stack_id == k_invalid_stack_id || !m_reader.get_stack(stack_id, frames, num_frames))
+			{
+				printf("        <unknown stack>\n");
+				return;
+			}
+
+			for (uint32_t frame_index = 0; frame_index < num_frames; ++frame_index)
+			{
+				symbol_file_frame frame;
+				if (!m_symbols.is_open() || !m_symbols.find(frames[frame_index], frame) || frame.function[0] == '\0')
+				{
+					printf("        #%-2u 0x%" PRIx64 "\n", frame_index, frames[frame_index]);
+					continue;
+				}
+
+				if (frame.line != 0)
+					printf("        #%-2u 0x%" PRIx64 " %s (%s:%u)\n", frame_index, frames[frame_index], frame.function, frame.file, frame.line);
+				else
+					printf("        #%-2u 0x%" PRIx64 " %s (%s)\n", frame_index, frames[frame_index], frame.function, frame.module);
+			}
+		}
+
+	private:
+		const trace_reader&	m_reader;
+		symbol_file			m_symbols;
+	};
+}
@@ -0,0 +1,508 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "benchmarks.h"
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/proc/maps_tracker.h"
+#include "vmemprof/proc/residency_scanner.h"
+#include "vmemprof/trace/trace_reader.h"
+#include "vmemprof/trace/trace_writer.h"
+
+#include <atomic>
+#include <cinttypes>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+extern char** environ;
+
+// Each workload runs in a child process so that the capture library can be preloaded in it, the
+// baseline runs the same child without it. Threads of the child repeatedly map, touch, protect
+// and unmap a region and time themselves, the overhead of a mode is the extra time per call over
+// the baseline. Polling mode has no library, we poll the maps of the child from here like
+// 'vmemprof attach --poll' does and the overhead is what the polls cost the child.
+
+namespace vmemprof
+{
+	namespace
+	{
+		enum class capture_mode
+		{
+			baseline,
+			full,
+			sampled,
+			polling,
+		};
+
+		const char* get_capture_mode_name(capture_mode mode)
+		{
+			switch (mode)
+			{
+			case capture_mode::baseline:	return "baseline";
+			case capture_mode::full:		return "full";
+			case capture_mode::sampled:		return "sampled";
+			case capture_mode::polling:		return "polling";
+			default:						return "unknown";
+			}
+		}
+
+		constexpr capture_mode k_capture_modes[] = { capture_mode::baseline, capture_mode::full, capture_mode::sampled, capture_mode::polling };
+		constexpr uint32_t k_thread_counts[] = { 1, 4 };
+		constexpr uint64_t k_mapping_sizes[] = { 4 * 1024, 64 * 1024, 2 * 1024 * 1024 };
+
+		// Every iteration maps, protects and unmaps
+		constexpr uint32_t k_num_iterations_per_thread = 20000;
+		constexpr uint32_t k_num_calls_per_iteration = 3;
+
+		constexpr const char* k_sample_bytes = "1M";
+		constexpr uint64_t k_poll_interval_ns = 10 * 1000000ULL;
+		constexpr uint32_t k_residency_page_budget = 256 * 1024;
+		constexpr uint32_t k_residency_sample_capacity = 4096;
+
+		// Replaying a trace runs for at least this long
+		constexpr uint64_t k_min_replay_duration_ns = 200000000ULL;
+
+		struct workload_result
+		{
+			uint64_t	num_calls = 0;
+			uint64_t	elapsed_ns = 0;				// Summed over the threads
+		};
+
+		struct trace_stats
+		{
+			uint64_t	num_bytes = 0;
+			uint64_t	num_events = 0;
+			uint64_t	num_dropped = 0;
+			double		replay_ns = 0.0;			// Replaying every event into an address space
+		};
+
+		void sleep_for(uint64_t duration_ns)
+		{
+			const timespec duration = { time_t(duration_ns / 1000000000ULL), long(duration_ns % 1000000000ULL) };
+			nanosleep(&duration, nullptr);
+		}
+
+		std::string get_default_library_path()
+		{
+			char executable_path[PATH_MAX];
+			const ssize_t path_length = readlink("/proc/self/exe", executable_path, sizeof(executable_path) - 1);
+			if (path_length <= 0)
+				return std::string();
+
+			executable_path[path_length] = '\0';
+			const std::string directory(executable_path, std::strrchr(executable_path, '/'));
+
+			// Installed side by side, or in the build tree
+			for (const char* relative_path : { "/libvmemprof.so", "/../vmemprof_preload/libvmemprof.so" })
+			{
+				const std::string library_path = directory + relative_path;
+				if (access(library_path.c_str(), R_OK) == 0)
+					return library_path;
+			}
+
+			return std::string();
+		}
+
+		// Our environment without any capture setting, plus those of the mode
+		std::vector<std::string> build_environment(capture_mode mode, const std::string& library_path, const std::string& trace_path)
+		{
+			std::vector<std::string> environment;
+			for (char** variable = environ; *variable != nullptr; ++variable)
+			{
+				if (std::strncmp(*variable, "LD_PRELOAD=", 11) != 0 && std::strncmp(*variable, "VMEMPROF_", 9) != 0)
+					environment.push_back(*variable);
+			}
+
+			if (mode == capture_mode::full || mode == capture_mode::sampled)
+			{
+				environment.push_back("LD_PRELOAD=" + library_path);
+				environment.push_back("VMEMPROF_OUTPUT=" + trace_path);
+			}
+
+			if (mode == capture_mode::sampled)
+				environment.push_back(std::string("VMEMPROF_SAMPLE_BYTES=") + k_sample_bytes);
+
+			return environment;
+		}
+
+		bool read_line(int fd, char* out_line, size_t line_size)
+		{
+			size_t length = 0;
+			while (length + 1 < line_size)
+			{
+				char character;
+				const ssize_t num_read = read(fd, &character, 1);
+				if (num_read <= 0)
+					return false;
+
+				if (character == '\n')
+					break;
+
+				out_line[length++] = character;
+			}
+
+			out_line[length] = '\0';
+			return true;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Polls the maps of a process into a trace until stopped, the same work
+		// 'vmemprof attach --poll' does.
+		////////////////////////////////////////////////////////////////////////////////
+		void poll_process(uint32_t pid, int fd, const std::atomic<bool>& is_stop_requested)
+		{
+			char path[64];
+			snprintf(path, sizeof(path), "/proc/%u/maps", pid);
+
+			maps_tracker tracker;
+			if (tracker.open(path).any())
+				return;
+
+			residency_scanner scanner;
+			const bool is_sampling_residency = !scanner.open(pid, k_residency_page_budget).any();
+
+			trace_writer writer;
+			if (writer.open(fd, pid, get_timestamp_ns(), 0).any())
+				return;
+
+			address_space space;
+			std::vector<vm_event> events;
+			std::vector<residency_sample> residency_samples(k_residency_sample_capacity);
+
+			while (!is_stop_requested.load(std::memory_order_relaxed))
+			{
+				events.clear();
+				if (tracker.poll(get_timestamp_ns(), [&events](const vm_event& event) { events.push_back(event); }).any())
+					break;
+
+				writer.write_events(events.data(), uint32_t(events.size()));
+				for (const vm_event& event : events)
+					space.apply(event);
+
+				if (is_sampling_residency)
+				{
+					const uint32_t num_samples = scanner.sample(space, get_timestamp_ns(), residency_samples.data(), k_residency_sample_capacity);
+					writer.write_residency_samples(residency_samples.data(), num_samples);
+				}
+
+				sleep_for(k_poll_interval_ns);
+			}
+
+			writer.close();
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Runs the workload in a child process with the mode's capture and returns
+		// what the child measured. The child reports when it is ready and waits for
+		// us to start, so that polling starts once it runs our executable.
+		////////////////////////////////////////////////////////////////////////////////
+		bool run_workload(capture_mode mode, const std::string& library_path, const std::string& trace_path, uint32_t num_threads, uint64_t mapping_size, workload_result& out_result)
+		{
+			char executable_path[PATH_MAX];
+			const ssize_t path_length = readlink("/proc/self/exe", executable_path, sizeof(executable_path) - 1);
+			if (path_length <= 0)
+				return false;
+
+			executable_path[path_length] = '\0';
+
+			char num_threads_argument[32];
+			char mapping_size_argument[32];
+			char num_iterations_argument[32];
+			snprintf(num_threads_argument, sizeof(num_threads_argument), "%u", num_threads);
+			snprintf(mapping_size_argument, sizeof(mapping_size_argument), "%" PRIu64, mapping_size);
+			snprintf(num_iterations_argument, sizeof(num_iterations_argument), "%u", k_num_iterations_per_thread);
+			char* arguments[] = { executable_path, const_cast<char*>("--workload"), num_threads_argument, mapping_size_argument, num_iterations_argument, nullptr };
+
+			const std::vector<std::string> environment = build_environment(mode, library_path, trace_path);
+			std::vector<char*> environment_pointers;
+			for (const std::string& variable : environment)
+				environment_pointers.push_back(const_cast<char*>(variable.c_str()));
+			environment_pointers.push_back(nullptr);
+
+			int start_pipe[2];
+			int result_pipe[2];
+			if (pipe2(start_pipe, O_CLOEXEC) != 0)
+				return false;
+
+			if (pipe2(result_pipe, O_CLOEXEC) != 0)
+			{
+				close(start_pipe[0]);
+				close(start_pipe[1]);
+				return false;
+			}
+
+			const pid_t pid = fork();
+			if (pid == 0)
+			{
+				// The child reads its start signal from stdin and reports on stdout
+				dup2(start_pipe[0], STDIN_FILENO);
+				dup2(result_pipe[1], STDOUT_FILENO);
+				execve(executable_path, arguments, environment_pointers.data());
+				_exit(127);
+			}
+
+			close(start_pipe[0]);
+			close(result_pipe[1]);
+
+			bool is_successful = false;
+			std::atomic<bool> is_stop_requested(false);
+			std::thread poll_thread;
+			int trace_fd = -1;
+
+			char line[128];
+			if (pid > 0 && read_line(result_pipe[0], line, sizeof(line)) && std::strcmp(line, "ready") == 0)
+			{
+				if (mode == capture_mode::polling)
+				{
+					trace_fd = open(trace_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+					if (trace_fd >= 0)
+						poll_thread = std::thread(poll_process, uint32_t(pid), trace_fd, std::cref(is_stop_requested));
+				}
+
+				const char start = 's';
+				if (write(start_pipe[1], &start, 1) == 1 && read_line(result_pipe[0], line, sizeof(line)))
+					is_successful = sscanf(line, "%" SCNu64 " %" SCNu64, &out_result.num_calls, &out_result.elapsed_ns) == 2 && out_result.num_calls != 0;
+			}
+
+			close(start_pipe[1]);
+			close(result_pipe[0]);
+
+			if (pid > 0)
+			{
+				int status = 0;
+				waitpid(pid, &status, 0);
+				is_successful &= WIFEXITED(status) && WEXITSTATUS(status) == 0;
+			}
+
+			is_stop_requested.store(true, std::memory_order_relaxed);
+			if (poll_thread.joinable())
+				poll_thread.join();
+
+			if (trace_fd >= 0)
+				close(trace_fd);
+
+			return is_successful;
+		}
+
+		bool measure_trace(const char* trace_path, trace_stats& out_stats)
+		{
+			trace_reader reader;
+			if (reader.open(trace_path).any())
+				return false;
+
+			out_stats.num_bytes = reader.get_size();
+
+			for (uint32_t chunk_index = 0; chunk_index < reader.get_num_chunks(); ++chunk_index)
+			{
+				const chunk_view chunk = reader.get_chunk(chunk_index);
+				if (chunk.header->type == chunk_type::events)
+					out_stats.num_events += chunk.header->num_entries;
+				else if (chunk.header->type == chunk_type::dropped_events)
+					out_stats.num_dropped += reinterpret_cast<const dropped_events_payload*>(chunk.payload)->num_dropped;
+			}
+
+			// Decoding and applying every event, what each analysis starts with
+			bool is_valid = true;
+			out_stats.replay_ns = measure_ns_per_call(k_min_replay_duration_ns, [&]()
+				{
+					address_space space;
+					for (uint32_t event_chunk_index = 0; event_chunk_index < reader.get_num_event_chunks(); ++event_chunk_index)
+					{
+						const chunk_view chunk = reader.get_chunk(reader.get_event_chunk_index(event_chunk_index));
+						is_valid &= !for_each_event_in_chunk(chunk, [&space](const vm_event& event) { space.apply(event); return true; }).any();
+					}
+				});
+
+			return is_valid;
+		}
+
+		void print_result(const benchmark_options& options, capture_mode mode, uint32_t num_threads, uint64_t mapping_size, double ns_per_call, double baseline_ns_per_call, const trace_stats& stats)
+		{
+			const double overhead_ns = ns_per_call - baseline_ns_per_call;
+			const double overhead_percent = baseline_ns_per_call > 0.0 ? overhead_ns * 100.0 / baseline_ns_per_call : 0.0;
+			const double bytes_per_event = stats.num_events != 0 ? double(stats.num_bytes) / double(stats.num_events) : 0.0;
+			const double events_per_s = stats.replay_ns > 0.0 ? double(stats.num_events) / (stats.replay_ns * 1.0e-9) : 0.0;
+
+			char name[64];
+			snprintf(name, sizeof(name), "%s/%ut/%" PRIu64 "K", get_capture_mode_name(mode), num_threads, mapping_size / 1024);
+
+			if (options.is_json)
+			{
+				print_json_result("capture", name, { { "threads", double(num_threads) }, { "mapping_size", double(mapping_size) },
+					{ "ns_per_call", ns_per_call }, { "overhead_ns_per_call", overhead_ns }, { "overhead_percent", overhead_percent },
+					{ "trace_bytes", double(stats.num_bytes) }, { "events", double(stats.num_events) }, { "dropped_events", double(stats.num_dropped) },
+					{ "bytes_per_event", bytes_per_event }, { "replay_events_per_s", events_per_s } });
+				return;
+			}
+
+			if (mode == capture_mode::baseline)
+			{
+				printf("capture/%-20s %10.0f ns/call\n", name, ns_per_call);
+				return;
+			}
+
+			printf("capture/%-20s %10.0f ns/call %+8.0f ns %+7.1f%% %10" PRIu64 " events %6.1f B/event %12.0f replayed events/s",
+				name, ns_per_call, overhead_ns, overhead_percent, stats.num_events, bytes_per_event, events_per_s);
+
+			if (stats.num_dropped != 0)
+				printf(" (%" PRIu64 " dropped)", stats.num_dropped);
+
+			printf("\n");
+		}
+	}
+
+	int run_capture_benchmark(const benchmark_options& options)
+	{
+		const std::string library_path = options.library_path != nullptr ? std::string(options.library_path) : get_default_library_path();
+		if (library_path.empty() || access(library_path.c_str(), R_OK) != 0)
+		{
+			fprintf(stderr, "capture: capture library not found, use --library=<path>\n");
+			return 1;
+		}
+
+		// The preloaded library resolves the trace path from the working directory of the child
+		char directory_template[] = "/tmp/vmemprof_bench.XXXXXX";
+		const char* directory = mkdtemp(directory_template);
+		if (directory == nullptr)
+		{
+			fprintf(stderr, "capture: failed to create a temporary directory\n");
+			return 1;
+		}
+
+		const std::string trace_path = std::string(directory) + "/capture.trace";
+
+		int exit_code = 0;
+		for (uint32_t num_threads : k_thread_counts)
+		{
+			for (uint64_t mapping_size : k_mapping_sizes)
+			{
+				double baseline_ns_per_call = 0.0;
+				for (capture_mode mode : k_capture_modes)
+				{
+					unlink(trace_path.c_str());
+
+					workload_result result;
+					if (!run_workload(mode, library_path, trace_path, num_threads, mapping_size, result))
+					{
+						fprintf(stderr, "capture: the %s workload failed\n", get_capture_mode_name(mode));
+						exit_code = 1;
+						continue;
+					}
+
+					trace_stats stats;
+					if (mode != capture_mode::baseline && !measure_trace(trace_path.c_str(), stats))
+					{
+						fprintf(stderr, "capture: failed to read the %s trace\n", get_capture_mode_name(mode));
+						exit_code = 1;
+						continue;
+					}
+
+					const double ns_per_call = double(result.elapsed_ns) / double(result.num_calls);
+					if (mode == capture_mode::baseline)
+						baseline_ns_per_call = ns_per_call;
+
+					print_result(options, mode, num_threads, mapping_size, ns_per_call, baseline_ns_per_call, stats);
+					fflush(stdout);
+				}
+			}
+		}
+
+		unlink(trace_path.c_str());
+		rmdir(directory);
+		return exit_code;
+	}
+
+	int run_capture_workload(int argc, char** argv)
+	{
+		if (argc != 3)
+			return 1;
+
+		const uint32_t num_threads = uint32_t(std::strtoul(argv[0], nullptr, 10));
+		const size_t mapping_size = size_t(std::strtoull(argv[1], nullptr, 10));
+		const uint32_t num_iterations = uint32_t(std::strtoul(argv[2], nullptr, 10));
+		if (num_threads == 0 || mapping_size == 0)
+			return 1;
+
+		printf("ready\n");
+		fflush(stdout);
+
+		char start;
+		if (read(STDIN_FILENO, &start, 1) != 1)
+			return 1;
+
+		std::atomic<uint64_t> elapsed_ns(0);
+		std::atomic<uint32_t> num_failures(0);
+		std::atomic<uint32_t> num_started(0);
+
+		std::vector<std::thread> threads;
+		for (uint32_t thread_index = 0; thread_index < num_threads; ++thread_index)
+		{
+			threads.emplace_back([&]()
+				{
+					// Start together so that threads contend
+					num_started.fetch_add(1);
+					while (num_started.load() != num_threads)
+						std::this_thread::yield();
+
+					const uint64_t start_timestamp = get_timestamp_ns();
+					for (uint32_t iteration = 0; iteration < num_iterations; ++iteration)
+					{
+						void* pointer = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+						if (pointer == MAP_FAILED)
+						{
+							num_failures.fetch_add(1);
+							return;
+						}
+
+						static_cast<volatile uint8_t*>(pointer)[0] = uint8_t(iteration);
+						mprotect(pointer, mapping_size, PROT_READ);
+						munmap(pointer, mapping_size);
+					}
+
+					elapsed_ns.fetch_add(get_timestamp_ns() - start_timestamp);
+				});
+		}
+
+		for (std::thread& thread : threads)
+			thread.join();
+
+		if (num_failures.load() != 0)
+			return 1;
+
+		printf("%" PRIu64 " %" PRIu64 "\n", uint64_t(num_threads) * num_iterations * k_num_calls_per_iteration, elapsed_ns.load());
+		fflush(stdout);
+		return 0;
+	}
+}
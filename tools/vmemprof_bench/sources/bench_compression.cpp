@@ -0,0 +1,207 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "benchmarks.h"
+
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/worker_pool.h"
+#include "vmemprof/trace/chunk_compression.h"
+#include "vmemprof/trace/event_codec.h"
+#include "vmemprof/trace/trace_writer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace vmemprof
+{
+	namespace
+	{
+		// Each measurement runs for at least this long
+		constexpr uint64_t k_min_duration_ns = 500000000ULL;
+
+		// Raw event payloads compressed and decompressed per call
+		constexpr uint64_t k_num_raw_bytes = 32 * 1024 * 1024;
+
+		constexpr uint32_t k_num_threads = 4;
+
+		struct payload_range
+		{
+			uint64_t	raw_offset;
+			uint32_t	raw_size;
+			uint64_t	stored_offset;
+			uint32_t	stored_size;
+		};
+
+		uint64_t next_random(uint64_t& state)
+		{
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			return state;
+		}
+
+		// Event chunks like a program mapping, protecting and unmapping regions from a few threads produces
+		void build_event_payloads(std::vector<uint8_t>& out_payloads, std::vector<payload_range>& out_ranges)
+		{
+			uint64_t random_state = 0x9E3779B97F4A7C15ULL;
+			uint64_t timestamp = 1000000000ULL;
+			uint64_t addresses[k_num_threads] = { 0 };
+
+			event_encoder encoder;
+			uint8_t* payload_end = nullptr;
+
+			out_payloads.resize(k_num_raw_bytes + trace_writer::k_target_chunk_size + k_max_encoded_event_size);
+			uint64_t offset = 0;
+			uint64_t chunk_offset = 0;
+			uint32_t event_index = 0;
+			while (offset < k_num_raw_bytes)
+			{
+				if (offset == chunk_offset)
+					encoder.reset(timestamp);
+
+				// Threads run in bursts and every step of the loop has its own callstack
+				const uint64_t random = next_random(random_state);
+				const uint32_t thread_index = (event_index / 48) % k_num_threads;
+				const uint32_t step = event_index++ % 3;
+
+				vm_event event = {};
+				event.timestamp = timestamp;
+				event.thread_id = 1000 + thread_index;
+				event.stack_id = thread_index * 3 + step;
+				event.protection = step == 1 ? 1 : 3;
+				event.flags = 0x22;
+				event.size = 64 * 1024 << (thread_index % 4);
+				event.type = step == 0 ? event_type::mmap : (step == 1 ? event_type::mprotect : event_type::munmap);
+
+				if (step == 0)
+					addresses[thread_index] = 0x7f0000000000ULL + ((random >> 24) % 64) * 0x100000ULL;
+				event.address = addresses[thread_index];
+
+				payload_end = encoder.encode(event, out_payloads.data() + offset);
+				offset = uint64_t(payload_end - out_payloads.data());
+				timestamp += 1000 + (random >> 40) % 256;
+
+				if (offset - chunk_offset >= trace_writer::k_target_chunk_size)
+				{
+					out_ranges.push_back(payload_range{ chunk_offset, uint32_t(offset - chunk_offset), 0, 0 });
+					chunk_offset = offset;
+				}
+			}
+
+			if (offset != chunk_offset)
+				out_ranges.push_back(payload_range{ chunk_offset, uint32_t(offset - chunk_offset), 0, 0 });
+
+			out_payloads.resize(offset);
+		}
+
+		void print_result(const benchmark_options& options, const char* name, uint64_t num_raw_bytes, double ns_per_call)
+		{
+			const double raw_mb_per_s = double(num_raw_bytes) / (ns_per_call * 1.0e-9) / (1024.0 * 1024.0);
+			if (options.is_json)
+				print_json_result("compression", name, { { "raw_mb_per_s", raw_mb_per_s }, { "ms_per_call", ns_per_call * 1.0e-6 } });
+			else
+				printf("compression/%-24s %10.1f MB/s of raw events\n", name, raw_mb_per_s);
+		}
+	}
+
+	int run_compression_benchmark(const benchmark_options& options)
+	{
+		std::vector<uint8_t> raw_payloads;
+		std::vector<payload_range> ranges;
+		build_event_payloads(raw_payloads, ranges);
+
+		const uint32_t num_chunks = uint32_t(ranges.size());
+
+		uint64_t stored_size = 0;
+		for (payload_range& range : ranges)
+		{
+			range.stored_offset = stored_size;
+			stored_size += get_max_compressed_payload_size(chunk_compression::lz, range.raw_size);
+		}
+
+		std::vector<uint8_t> stored_payloads(stored_size);
+		std::vector<uint8_t> decompressed_payloads(raw_payloads.size());
+
+		const auto compress_chunk = [&](uint32_t chunk_index)
+		{
+			payload_range& range = ranges[chunk_index];
+			range.stored_size = compress_chunk_payload(chunk_compression::lz, raw_payloads.data() + range.raw_offset, range.raw_size, stored_payloads.data() + range.stored_offset);
+		};
+
+		bool is_valid = true;
+		const auto decompress_chunk = [&](uint32_t chunk_index)
+		{
+			const payload_range& range = ranges[chunk_index];
+			if (range.stored_size != 0)
+				is_valid &= !decompress_chunk_payload(chunk_compression::lz, stored_payloads.data() + range.stored_offset, range.stored_size, decompressed_payloads.data() + range.raw_offset).any();
+			else
+				std::memcpy(decompressed_payloads.data() + range.raw_offset, raw_payloads.data() + range.raw_offset, range.raw_size);
+		};
+
+		// Like the drain thread with its default single worker, and like a reader using every core
+		worker_pool writer_pool;
+		writer_pool.start(1);
+
+		worker_pool reader_pool;
+		const uint32_t num_cores = std::max(1U, std::thread::hardware_concurrency());
+		reader_pool.start(num_cores - 1);
+
+		const double compress_ns = measure_ns_per_call(k_min_duration_ns, [&]() { for (uint32_t chunk_index = 0; chunk_index < num_chunks; ++chunk_index) compress_chunk(chunk_index); });
+		print_result(options, "lz_compress", raw_payloads.size(), compress_ns);
+
+		const double pool_compress_ns = measure_ns_per_call(k_min_duration_ns, [&]() { writer_pool.run(num_chunks, compress_chunk); });
+		print_result(options, "lz_compress_2_threads", raw_payloads.size(), pool_compress_ns);
+
+		const double decompress_ns = measure_ns_per_call(k_min_duration_ns, [&]() { for (uint32_t chunk_index = 0; chunk_index < num_chunks; ++chunk_index) decompress_chunk(chunk_index); });
+		print_result(options, "lz_decompress", raw_payloads.size(), decompress_ns);
+
+		char name[64];
+		snprintf(name, sizeof(name), "lz_decompress_%u_threads", num_cores);
+		const double pool_decompress_ns = measure_ns_per_call(k_min_duration_ns, [&]() { reader_pool.run(num_chunks, decompress_chunk); });
+		print_result(options, name, raw_payloads.size(), pool_decompress_ns);
+
+		uint64_t num_stored_bytes = 0;
+		for (const payload_range& range : ranges)
+			num_stored_bytes += range.stored_size != 0 ? range.stored_size : range.raw_size;
+
+		const double ratio = double(raw_payloads.size()) / double(num_stored_bytes);
+		if (options.is_json)
+			print_json_result("compression", "lz_ratio", { { "raw_bytes", double(raw_payloads.size()) }, { "stored_bytes", double(num_stored_bytes) }, { "ratio", ratio } });
+		else
+			printf("compression/%-24s %10.2fx (%u chunks)\n", "lz_ratio", ratio, num_chunks);
+
+		// Every round trip must restore the events exactly
+		if (!is_valid || decompressed_payloads != raw_payloads)
+		{
+			fprintf(stderr, "compression: decompressed payloads differ from the originals\n");
+			return 1;
+		}
+
+		return 0;
+	}
+}
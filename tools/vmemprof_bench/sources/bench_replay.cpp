@@ -0,0 +1,303 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "benchmarks.h"
+
+#include "benchmarks.h"
+
+#include "vmemprof/analysis/address_space_replay.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/worker_pool.h"
+#include "vmemprof/trace/trace_reader.h"
+#include "vmemprof/trace/trace_writer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iterator>
+#include <string>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace vmemprof
+{
+	namespace
+	{
+		// Each measurement runs for at least this long
+		constexpr uint64_t k_min_duration_ns = 500000000ULL;
+
+		constexpr uint32_t k_num_events = 1000000;
+
+		// Every simulated thread maps into its own arena of fixed size slots
+		constexpr uint32_t k_num_arenas = 8;
+		constexpr uint32_t k_num_slots_per_arena = 4096;
+		constexpr uint64_t k_slot_size = 1024 * 1024;
+		constexpr uint64_t k_arena_base = 0x7f0000000000ULL;
+		constexpr uint64_t k_arena_size = 16ULL << 30;
+		constexpr uint64_t k_heap_base = 0x555500000000ULL;
+
+		constexpr uint32_t k_thread_counts[] = { 2, 4 };
+
+		uint64_t next_random(uint64_t& state)
+		{
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			return state;
+		}
+
+		uint64_t get_slot_address(uint32_t arena_index, uint64_t random)
+		{
+			return k_arena_base + arena_index * k_arena_size + (random % k_num_slots_per_arena) * k_slot_size;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Events like threads mapping, protecting, advising, resizing and unmapping
+		// memory in their arenas produce, with a few moves between arenas and partial
+		// mprotects that span slots, and a growing and shrinking heap.
+		////////////////////////////////////////////////////////////////////////////////
+		void build_events(std::vector<vm_event>& out_events)
+		{
+			uint64_t random_state = 0x9E3779B97F4A7C15ULL;
+			uint64_t timestamp = 1000000000ULL;
+			uint64_t heap_break = k_heap_base;
+
+			out_events.resize(k_num_events);
+			for (uint32_t event_index = 0; event_index < k_num_events; ++event_index)
+			{
+				const uint64_t random = next_random(random_state);
+				const uint32_t arena_index = (event_index / 32) % k_num_arenas;
+				const uint64_t address = get_slot_address(arena_index, random >> 20);
+				const uint64_t size = (1 + (random >> 8) % 256) * address_space::k_page_size;
+				const uint32_t operation = random % 100;
+
+				vm_event event = {};
+				event.timestamp = timestamp;
+				event.thread_id = 1000 + arena_index;
+				event.stack_id = operation % 16;
+				event.address = address;
+				event.size = size;
+
+				if (operation < 40)
+				{
+					event.type = event_type::mmap;
+					event.protection = PROT_READ | PROT_WRITE;
+					event.flags = MAP_PRIVATE | MAP_ANONYMOUS;
+					if (operation < 4)
+					{
+						event.flags = MAP_PRIVATE;
+						event.arg0 = 3;
+						event.arg1 = (random >> 40) % 64 * address_space::k_page_size;
+					}
+				}
+				else if (operation < 55)
+				{
+					event.type = event_type::munmap;
+					event.size = k_slot_size;
+				}
+				else if (operation < 70)
+				{
+					event.type = event_type::mprotect;
+					event.address = address + (random >> 48) % 64 * address_space::k_page_size;
+					event.protection = (random & 1) != 0 ? PROT_READ : PROT_READ | PROT_WRITE;
+					if (operation < 57)
+					{
+						// Stops at the first hole, possibly in the next slot
+						event.size = k_slot_size + size;
+						event.flags = k_event_flag_partial;
+					}
+				}
+				else if (operation < 80)
+				{
+					event.type = event_type::madvise;
+					event.address = address + (random >> 48) % 64 * address_space::k_page_size;
+					event.arg0 = (random & 2) != 0 ? MADV_DONTFORK : MADV_DOFORK;
+				}
+				else if (operation < 90)
+				{
+					// Resized in place
+					event.type = event_type::mremap;
+					event.arg0 = address;
+					event.arg1 = (1 + (random >> 48) % 256) * address_space::k_page_size;
+					event.flags = MREMAP_MAYMOVE;
+				}
+				else if (operation < 92)
+				{
+					// Moved to another arena
+					event.type = event_type::mremap;
+					event.address = get_slot_address((arena_index + 1 + (random >> 56) % (k_num_arenas - 1)) % k_num_arenas, random >> 36);
+					event.arg0 = address;
+					event.arg1 = size;
+					event.flags = MREMAP_MAYMOVE | MREMAP_FIXED;
+				}
+				else
+				{
+					event.type = event_type::brk;
+					event.arg0 = heap_break;
+					if (operation < 97 || heap_break == k_heap_base)
+						heap_break += size;
+					else
+						heap_break -= std::min(heap_break - k_heap_base, size);
+					event.address = heap_break;
+				}
+
+				out_events[event_index] = event;
+				timestamp += 1000 + (random >> 40) % 256;
+			}
+		}
+
+		bool write_trace(const std::string& path, const std::vector<vm_event>& events)
+		{
+			const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if (fd < 0)
+				return false;
+
+			trace_writer writer;
+			bool is_valid = !writer.open(fd, 1, events.front().timestamp, 0).any();
+			if (is_valid)
+			{
+				writer.write_events(events.data(), uint32_t(events.size()));
+				is_valid = !writer.close().any();
+			}
+
+			close(fd);
+			return is_valid;
+		}
+
+		bool are_spaces_identical(const address_space& lhs, const address_space& rhs)
+		{
+			const address_space_stats& lhs_stats = lhs.get_stats();
+			const address_space_stats& rhs_stats = rhs.get_stats();
+			if (lhs_stats.num_vmas != rhs_stats.num_vmas || lhs_stats.num_regions != rhs_stats.num_regions
+				|| lhs_stats.mapped_bytes != rhs_stats.mapped_bytes || lhs_stats.inaccessible_bytes != rhs_stats.inaccessible_bytes
+				|| lhs.get_next_mapping_id() != rhs.get_next_mapping_id())
+				return false;
+
+			std::vector<vma_region> lhs_regions;
+			std::vector<vma_region> rhs_regions;
+			lhs.for_each_region([&lhs_regions](const vma_region& region) { lhs_regions.push_back(region); return true; });
+			rhs.for_each_region([&rhs_regions](const vma_region& region) { rhs_regions.push_back(region); return true; });
+
+			return std::equal(lhs_regions.begin(), lhs_regions.end(), rhs_regions.begin(), rhs_regions.end(), [](const vma_region& lhs_region, const vma_region& rhs_region)
+				{
+					return lhs_region.start == rhs_region.start && lhs_region.end == rhs_region.end && lhs_region.offset == rhs_region.offset
+						&& lhs_region.mapping_id == rhs_region.mapping_id && lhs_region.mapping_size == rhs_region.mapping_size
+						&& lhs_region.timestamp == rhs_region.timestamp && lhs_region.fd == rhs_region.fd
+						&& lhs_region.stack_id == rhs_region.stack_id && lhs_region.thread_id == rhs_region.thread_id
+						&& lhs_region.protection == rhs_region.protection && lhs_region.map_flags == rhs_region.map_flags
+						&& lhs_region.advice_flags == rhs_region.advice_flags;
+				});
+		}
+
+		// The final space and every snapshot must match the serial replay
+		bool are_replays_identical(const address_space_replay& lhs, const address_space_replay& rhs, const std::vector<vm_event>& events)
+		{
+			if (lhs.get_num_snapshots() != rhs.get_num_snapshots() || !are_spaces_identical(lhs.get_final_space(), rhs.get_final_space()))
+				return false;
+
+			address_space lhs_space;
+			address_space rhs_space;
+			for (uint32_t seek_index = 1; seek_index < 16; ++seek_index)
+			{
+				const uint64_t timestamp = events[uint64_t(seek_index) * events.size() / 16].timestamp;
+				if (lhs.seek(timestamp, lhs_space).any() || rhs.seek(timestamp, rhs_space).any() || !are_spaces_identical(lhs_space, rhs_space))
+					return false;
+			}
+
+			return true;
+		}
+
+		void print_result(const benchmark_options& options, const char* name, uint32_t num_events, double ns_per_call, double serial_ns_per_call)
+		{
+			const double mevents_per_s = double(num_events) / (ns_per_call * 1.0e-9) * 1.0e-6;
+			const double speedup = serial_ns_per_call / ns_per_call;
+			if (options.is_json)
+				print_json_result("replay", name, { { "mevents_per_s", mevents_per_s }, { "ms_per_call", ns_per_call * 1.0e-6 }, { "speedup", speedup } });
+			else
+				printf("replay/%-24s %10.2f M events/s %6.2fx\n", name, mevents_per_s, speedup);
+		}
+	}
+
+	int run_replay_benchmark(const benchmark_options& options)
+	{
+		std::vector<vm_event> events;
+		build_events(events);
+
+		char directory_template[] = "/tmp/vmemprof_bench.XXXXXX";
+		const char* directory = mkdtemp(directory_template);
+		if (directory == nullptr)
+		{
+			fprintf(stderr, "replay: failed to create a temporary directory\n");
+			return 1;
+		}
+
+		const std::string trace_path = std::string(directory) + "/replay.trace";
+		trace_reader reader;
+		const bool is_trace_valid = write_trace(trace_path, events) && !reader.open(trace_path.c_str()).any();
+		unlink(trace_path.c_str());
+		rmdir(directory);
+
+		if (!is_trace_valid)
+		{
+			fprintf(stderr, "replay: failed to write the trace\n");
+			return 1;
+		}
+
+		address_space_replay serial_replay;
+		const double serial_ns = measure_ns_per_call(k_min_duration_ns, [&]() { serial_replay.initialize(reader); });
+		print_result(options, "serial", k_num_events, serial_ns, serial_ns);
+
+		// Sharding pays off with cores, it must produce the same address spaces with any number of threads
+		std::vector<uint32_t> thread_counts(std::begin(k_thread_counts), std::end(k_thread_counts));
+		const uint32_t num_cores = std::max(1U, std::thread::hardware_concurrency());
+		if (std::find(thread_counts.begin(), thread_counts.end(), num_cores) == thread_counts.end() && num_cores > 1)
+			thread_counts.push_back(num_cores);
+
+		int exit_code = 0;
+		for (uint32_t num_threads : thread_counts)
+		{
+			worker_pool pool;
+			pool.start(num_threads - 1);
+
+			address_space_replay sharded_replay;
+			const double sharded_ns = measure_ns_per_call(k_min_duration_ns, [&]() { sharded_replay.initialize(reader, address_space_replay::k_default_snapshot_interval, &pool); });
+
+			char name[64];
+			snprintf(name, sizeof(name), "sharded_%u_threads", num_threads);
+			print_result(options, name, k_num_events, sharded_ns, serial_ns);
+
+			if (!are_replays_identical(serial_replay, sharded_replay, events))
+			{
+				fprintf(stderr, "replay: the %u threads replay differs from the serial replay\n", num_threads);
+				exit_code = 1;
+			}
+		}
+
+		return exit_code;
+	}
+}
@@ -0,0 +1,186 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "benchmarks.h"
+
+#include "vmemprof/proc/smaps_parser.h"
+#include "vmemprof/proc/smaps_poller.h"
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+namespace vmemprof
+{
+	namespace
+	{
+		// Each measurement runs for at least this long
+		constexpr uint64_t k_min_duration_ns = 500000000ULL;
+
+		constexpr uint32_t k_num_synthetic_vmas = 100000;
+
+		// Percentage of synthetic VMAs whose Rss changes between polls
+		constexpr uint32_t k_changed_percentage = 1;
+
+		// Builds smaps content formatted like the kernel does
+		void build_synthetic_smaps(uint32_t num_vmas, bool is_variant, std::vector<char>& out_content)
+		{
+			enum class field_value { zero, size, page_size, rss };
+
+			struct field_description
+			{
+				const char*	name;
+				field_value	value;
+			};
+
+			static const field_description k_fields[] =
+			{
+				{ "Size", field_value::size }, { "KernelPageSize", field_value::page_size }, { "MMUPageSize", field_value::page_size },
+				{ "Rss", field_value::rss }, { "Pss", field_value::rss }, { "Pss_Dirty", field_value::rss },
+				{ "Shared_Clean", field_value::zero }, { "Shared_Dirty", field_value::zero }, { "Private_Clean", field_value::zero },
+				{ "Private_Dirty", field_value::rss }, { "Referenced", field_value::rss }, { "Anonymous", field_value::rss },
+				{ "KSM", field_value::zero }, { "LazyFree", field_value::zero }, { "AnonHugePages", field_value::zero },
+				{ "ShmemPmdMapped", field_value::zero }, { "FilePmdMapped", field_value::zero }, { "Shared_Hugetlb", field_value::zero },
+				{ "Private_Hugetlb", field_value::zero }, { "Swap", field_value::zero }, { "SwapPss", field_value::zero },
+				{ "Locked", field_value::zero },
+			};
+
+			out_content.clear();
+
+			char line[256];
+			uint64_t address = 0x7f0000000000ULL;
+			for (uint32_t vma_index = 0; vma_index < num_vmas; ++vma_index)
+			{
+				const uint64_t size_kb = 4 * (1 + vma_index % 64);
+				const bool is_file = vma_index % 4 == 0;
+
+				int length = snprintf(line, sizeof(line), "%012" PRIx64 "-%012" PRIx64 " %s %08x %s %-26u%s\n",
+					address, address + size_kb * 1024, is_file ? "r--p" : "rw-p", is_file ? vma_index * 4096 : 0,
+					is_file ? "fe:00" : "00:00", is_file ? 463548 : 0, is_file ? "/usr/lib/x86_64-linux-gnu/libc.so.6" : "");
+				out_content.insert(out_content.end(), line, line + length);
+
+				// Changed VMAs are spread evenly, the variant has them fully resident
+				const bool is_changed = is_variant && vma_index % (100 / k_changed_percentage) == 0;
+				const uint64_t rss_kb = is_changed ? size_kb : size_kb / 2;
+
+				for (const field_description& field : k_fields)
+				{
+					const uint64_t value = field.value == field_value::size ? size_kb : (field.value == field_value::page_size ? 4 : (field.value == field_value::rss ? rss_kb : 0));
+					length = snprintf(line, sizeof(line), "%s:%*" PRIu64 " kB\n", field.name, int(24 - std::strlen(field.name)), value);
+					out_content.insert(out_content.end(), line, line + length);
+				}
+
+				length = snprintf(line, sizeof(line), "THPeligible:           0\nProtectionKey:         0\nVmFlags: rd wr mr mw me ac sd \n");
+				out_content.insert(out_content.end(), line, line + length);
+
+				// Leave a gap so VMAs do not look mergeable
+				address += size_kb * 1024 + 4096;
+			}
+		}
+
+		void print_result(const benchmark_options& options, const char* name, uint32_t num_vmas, size_t num_bytes, double ns_per_call)
+		{
+			const double seconds_per_call = ns_per_call * 1.0e-9;
+			if (options.is_json)
+			{
+				print_json_result("smaps", name, { { "vmas", double(num_vmas) }, { "vmas_per_s", double(num_vmas) / seconds_per_call },
+					{ "mb_per_s", double(num_bytes) / seconds_per_call / (1024.0 * 1024.0) }, { "ms_per_poll", ns_per_call * 1.0e-6 } });
+				return;
+			}
+
+			printf("smaps/%-20s %10.0f VMAs/s %10.1f MB/s %10.3f ms/poll (%u VMAs)\n",
+				name, double(num_vmas) / seconds_per_call, double(num_bytes) / seconds_per_call / (1024.0 * 1024.0), ns_per_call * 1.0e-6, num_vmas);
+		}
+	}
+
+	int run_smaps_benchmark(const benchmark_options& options)
+	{
+		// Parsing alone, in memory
+		std::vector<char> content;
+		build_synthetic_smaps(k_num_synthetic_vmas, false, content);
+
+		uint64_t checksum = 0;
+		const double parse_ns = measure_ns_per_call(k_min_duration_ns, [&]()
+			{
+				parse_smaps(content.data(), content.size(), [&checksum](const smaps_entry& entry) { checksum += entry.rss; return true; });
+			});
+		print_result(options, "parse", k_num_synthetic_vmas, content.size(), parse_ns);
+
+		// Parsing and diffing, polls alternate between two contents that differ by a few Rss values
+		std::vector<char> changed_content;
+		build_synthetic_smaps(k_num_synthetic_vmas, true, changed_content);
+
+		smaps_poller poller;
+		uint32_t poll_index = 0;
+		uint64_t num_changes = 0;
+		const double diff_ns = measure_ns_per_call(k_min_duration_ns, [&]()
+			{
+				const std::vector<char>& poll_content = (poll_index++ & 1) == 0 ? content : changed_content;
+				poller.update(poll_content.data(), poll_content.size(), [&num_changes](const smaps_entry&, smaps_change) { num_changes++; });
+			});
+		print_result(options, "parse_and_diff", k_num_synthetic_vmas, content.size(), diff_ns);
+		const double changes_per_poll = double(num_changes - k_num_synthetic_vmas) / double(poll_index - 1);
+		if (options.is_json)
+			print_json_result("smaps", "parse_and_diff_changes", { { "changes_per_poll", changes_per_poll } });
+		else
+			printf("smaps/%-20s %10.0f changes/poll\n", "parse_and_diff", changes_per_poll);
+
+		// Reading the process own smaps, the kernel generating the content dominates
+		const long page_size = sysconf(_SC_PAGESIZE);
+		const uint32_t num_pages = 2 * 16 * 1024;
+		uint8_t* pages = static_cast<uint8_t*>(mmap(nullptr, num_pages * size_t(page_size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		if (pages == MAP_FAILED)
+		{
+			fprintf(stderr, "smaps: failed to map the benchmark pages\n");
+			return 1;
+		}
+
+		// Every other page is made read only, each one becomes its own VMA
+		for (uint32_t page_index = 0; page_index < num_pages; page_index += 2)
+			mprotect(pages + page_index * size_t(page_size), size_t(page_size), PROT_READ);
+
+		const error_result result = poller.open("/proc/self/smaps");
+		if (result.any())
+		{
+			fprintf(stderr, "smaps: %s\n", result.c_str());
+			munmap(pages, num_pages * size_t(page_size));
+			return 1;
+		}
+
+		uint32_t num_vmas = 0;
+		const double proc_ns = measure_ns_per_call(k_min_duration_ns, [&]()
+			{
+				poller.poll([](const smaps_entry&, smaps_change) {});
+				num_vmas = uint32_t(poller.get_entries().size());
+			});
+		print_result(options, "proc_self", num_vmas, 0, proc_ns);
+
+		munmap(pages, num_pages * size_t(page_size));
+		return checksum != 0 ? 0 : 1;
+	}
+}
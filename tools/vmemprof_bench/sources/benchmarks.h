@@ -0,0 +1,87 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include <initializer_list>
+
+namespace vmemprof
+{
+	struct benchmark_options
+	{
+		bool			is_json = false;			// One JSON object per result and line instead of text
+		const char*		library_path = nullptr;		// Capture library, found next to the benchmark when null
+	};
+
+	// Every benchmark prints its results to stdout and returns the process exit code
+
+	int run_smaps_benchmark(const benchmark_options& options);
+	int run_capture_benchmark(const benchmark_options& options);
+	int run_compression_benchmark(const benchmark_options& options);
+	int run_replay_benchmark(const benchmark_options& options);
+
+	// The capture benchmark runs its workloads in a child process started with '--workload'
+	int run_capture_workload(int argc, char** argv);
+
+	struct benchmark_value
+	{
+		const char*	name;
+		double		value;
+	};
+
+	// Prints '{"benchmark":"<benchmark>","name":"<name>","<value name>":<value>,...}'
+	void print_json_result(const char* benchmark, const char* name, std::initializer_list<benchmark_value> values);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Calls a function repeatedly for at least min_duration_ns and returns the
+	// average nanoseconds per call.
+	////////////////////////////////////////////////////////////////////////////////
+	template<typename function_type>
+	double measure_ns_per_call(uint64_t min_duration_ns, function_type function);
+}
+
+#include "vmemprof/core/time_utils.h"
+
+namespace vmemprof
+{
+	template<typename function_type>
+	double measure_ns_per_call(uint64_t min_duration_ns, function_type function)
+	{
+		// Warm up caches and buffers first
+		function();
+
+		uint64_t num_calls = 0;
+		const uint64_t start_timestamp = get_timestamp_ns();
+		uint64_t elapsed_ns = 0;
+		do
+		{
+			function();
+			num_calls++;
+			elapsed_ns = get_timestamp_ns() - start_timestamp;
+		} while (elapsed_ns < min_duration_ns);
+
+		return double(elapsed_ns) / double(num_calls);
+	}
+}
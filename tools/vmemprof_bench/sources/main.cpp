@@ -0,0 +1,116 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "benchmarks.h"
+
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+
+namespace vmemprof
+{
+	namespace
+	{
+		struct benchmark_entry
+		{
+			const char* name;
+			const char* description;
+			int (*run)(const benchmark_options& options);
+		};
+
+		const benchmark_entry k_benchmarks[] =
+		{
+			{ "smaps", "Parses and diffs smaps, reports VMAs per second", run_smaps_benchmark },
+			{ "compression", "Compresses and decompresses event chunks, reports MB of raw events per second", run_compression_benchmark },
+			{ "capture", "Runs mapping workloads with every capture mode, reports overhead, trace size and replay rate", run_capture_benchmark },
+			{ "replay", "Replays a synthetic trace serially and sharded over threads, reports events per second", run_replay_benchmark },
+		};
+
+		void print_usage()
+		{
+			printf("Usage: vmemprof_bench [options] [benchmark...]\n\n");
+			printf("Runs every benchmark when none is named.\n\n");
+			printf("Options:\n");
+			printf("    --json               Print one JSON object per result and line\n");
+			printf("    --library=<path>     Capture library (default: libvmemprof.so next to vmemprof_bench)\n\n");
+			printf("Benchmarks:\n");
+			for (const benchmark_entry& benchmark : k_benchmarks)
+				printf("    %-16s %s\n", benchmark.name, benchmark.description);
+		}
+	}
+
+	void print_json_result(const char* benchmark, const char* name, std::initializer_list<benchmark_value> values)
+	{
+		printf("{\"benchmark\":\"%s\",\"name\":\"%s\"", benchmark, name);
+		for (const benchmark_value& value : values)
+			printf(",\"%s\":%.15g", value.name, value.value);
+		printf("}\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	using namespace vmemprof;
+
+	if (argc >= 2 && std::strcmp(argv[1], "--help") == 0)
+	{
+		print_usage();
+		return 0;
+	}
+
+	if (argc >= 2 && std::strcmp(argv[1], "--workload") == 0)
+		return run_capture_workload(argc - 2, argv + 2);
+
+	benchmark_options options;
+	uint32_t num_selected = 0;
+	for (int argument_index = 1; argument_index < argc; ++argument_index)
+	{
+		const char* argument = argv[argument_index];
+		if (std::strcmp(argument, "--json") == 0)
+			options.is_json = true;
+		else if (std::strncmp(argument, "--library=", 10) == 0)
+			options.library_path = argument + 10;
+		else if (argument[0] == '-')
+		{
+			fprintf(stderr, "Unknown option '%s'\n\n", argument);
+			print_usage();
+			return 1;
+		}
+		else
+			num_selected++;
+	}
+
+	int exit_code = 0;
+	for (const benchmark_entry& benchmark : k_benchmarks)
+	{
+		bool is_selected = num_selected == 0;
+		for (int argument_index = 1; argument_index < argc; ++argument_index)
+			is_selected |= std::strcmp(argv[argument_index], benchmark.name) == 0;
+
+		if (is_selected && benchmark.run(options) != 0)
+			exit_code = 1;
+	}
+
+	return exit_code;
+}
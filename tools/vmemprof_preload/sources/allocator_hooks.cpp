@@ -0,0 +1,286 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "allocator_hooks.h"
+#include "capture_runtime.h"
+#include "stack_unwinder.h"
+
+#include "vmemprof/core/allocator_sample.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/time_utils.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <dlfcn.h>
+
+// jemalloc lets every arena obtain its extents through a table of hooks, see
+// 'arena.<i>.extent_hooks' in its manual. We declare the table ourselves, its
+// layout is part of the stable API since jemalloc 5, and resolve mallctl at
+// runtime so that the capture does not depend on jemalloc.
+//
+// A missing hook means the arena opts out of the operation, our hook keeps
+// that behavior by returning the opt out value when the original is missing.
+
+namespace vmemprof
+{
+	namespace
+	{
+		struct extent_hooks;
+
+		using extent_alloc_func = void* (*)(extent_hooks*, void* new_address, size_t size, size_t alignment, bool* zero, bool* commit, unsigned arena);
+		using extent_dalloc_func = bool (*)(extent_hooks*, void* address, size_t size, bool committed, unsigned arena);
+		using extent_destroy_func = void (*)(extent_hooks*, void* address, size_t size, bool committed, unsigned arena);
+		using extent_commit_func = bool (*)(extent_hooks*, void* address, size_t size, size_t offset, size_t length, unsigned arena);
+		using extent_purge_func = bool (*)(extent_hooks*, void* address, size_t size, size_t offset, size_t length, unsigned arena);
+		using extent_split_func = bool (*)(extent_hooks*, void* address, size_t size, size_t size_a, size_t size_b, bool committed, unsigned arena);
+		using extent_merge_func = bool (*)(extent_hooks*, void* address_a, size_t size_a, void* address_b, size_t size_b, bool committed, unsigned arena);
+
+		// extent_hooks_t
+		struct extent_hooks
+		{
+			extent_alloc_func		alloc;
+			extent_dalloc_func		dalloc;
+			extent_destroy_func		destroy;
+			extent_commit_func		commit;
+			extent_commit_func		decommit;
+			extent_purge_func		purge_lazy;
+			extent_purge_func		purge_forced;
+			extent_split_func		split;
+			extent_merge_func		merge;
+		};
+
+		using mallctl_func = int (*)(const char* name, void* old_value, size_t* old_size, void* new_value, size_t new_size);
+
+		// Arenas past this index keep their hooks, jemalloc creates 4 automatic arenas per CPU
+		constexpr uint32_t k_max_hooked_arenas = 1024;
+
+		mallctl_func g_mallctl = nullptr;
+
+		// The hooks every arena had before ours, indexed by arena
+		std::atomic<extent_hooks*> g_original_hooks[k_max_hooked_arenas];
+		uint32_t g_num_arenas = 0;
+
+		void record_extent(allocator_extent_op op, void* address, size_t size, unsigned arena)
+		{
+			vm_event event;
+			event.timestamp = get_timestamp_ns();
+			event.address = uint64_t(address);
+			event.size = size;
+			event.arg0 = arena;
+			event.arg1 = uint64_t(op);
+			event.thread_id = get_thread_id();
+			event.stack_id = capture_stack_id();
+			event.flags = uint32_t(allocator_kind::jemalloc);
+			event.protection = 0;
+			event.type = event_type::allocator_extent;
+
+			capture_event(event);
+		}
+
+		extent_hooks* get_original_hooks(unsigned arena)
+		{
+			return arena < k_max_hooked_arenas ? g_original_hooks[arena].load(std::memory_order_acquire) : nullptr;
+		}
+
+		void* hook_extent_alloc(extent_hooks*, void* new_address, size_t size, size_t alignment, bool* zero, bool* commit, unsigned arena)
+		{
+			hook_scope scope;
+			extent_hooks* original = get_original_hooks(arena);
+			if (original == nullptr)
+				return nullptr;
+
+			void* result = original->alloc(original, new_address, size, alignment, zero, commit, arena);
+			if (result != nullptr)
+				record_extent(allocator_extent_op::alloc, result, size, arena);
+
+			return result;
+		}
+
+		bool hook_extent_dalloc(extent_hooks*, void* address, size_t size, bool committed, unsigned arena)
+		{
+			hook_scope scope;
+			extent_hooks* original = get_original_hooks(arena);
+			const bool is_retained = original == nullptr || original->dalloc == nullptr || original->dalloc(original, address, size, committed, arena);
+
+			record_extent(is_retained ? allocator_extent_op::retain : allocator_extent_op::dalloc, address, size, arena);
+			return is_retained;
+		}
+
+		void hook_extent_destroy(extent_hooks*, void* address, size_t size, bool committed, unsigned arena)
+		{
+			hook_scope scope;
+			extent_hooks* original = get_original_hooks(arena);
+			if (original != nullptr && original->destroy != nullptr)
+				original->destroy(original, address, size, committed, arena);
+
+			record_extent(allocator_extent_op::destroy, address, size, arena);
+		}
+
+		bool hook_extent_commit(extent_hooks*, void* address, size_t size, size_t offset, size_t length, unsigned arena)
+		{
+			hook_scope scope;
+			extent_hooks* original = get_original_hooks(arena);
+			const bool is_failed = original == nullptr || original->commit == nullptr || original->commit(original, address, size, offset, length, arena);
+			if (!is_failed)
+				record_extent(allocator_extent_op::commit, static_cast<uint8_t*>(address) + offset, length, arena);
+
+			return is_failed;
+		}
+
+		bool hook_extent_decommit(extent_hooks*, void* address, size_t size, size_t offset, size_t length, unsigned arena)
+		{
+			hook_scope scope;
+			extent_hooks* original = get_original_hooks(arena);
+			const bool is_failed = original == nullptr || original->decommit == nullptr || original->decommit(original, address, size, offset, length, arena);
+			if (!is_failed)
+				record_extent(allocator_extent_op::decommit, static_cast<uint8_t*>(address) + offset, length, arena);
+
+			return is_failed;
+		}
+
+		bool hook_extent_purge_lazy(extent_hooks*, void* address, size_t size, size_t offset, size_t length, unsigned arena)
+		{
+			hook_scope scope;
+			extent_hooks* original = get_original_hooks(arena);
+			const bool is_failed = original == nullptr || original->purge_lazy == nullptr || original->purge_lazy(original, address, size, offset, length, arena);
+			if (!is_failed)
+				record_extent(allocator_extent_op::purge, static_cast<uint8_t*>(address) + offset, length, arena);
+
+			return is_failed;
+		}
+
+		bool hook_extent_purge_forced(extent_hooks*, void* address, size_t size, size_t offset, size_t length, unsigned arena)
+		{
+			hook_scope scope;
+			extent_hooks* original = get_original_hooks(arena);
+			const bool is_failed = original == nullptr || original->purge_forced == nullptr || original->purge_forced(original, address, size, offset, length, arena);
+			if (!is_failed)
+				record_extent(allocator_extent_op::purge, static_cast<uint8_t*>(address) + offset, length, arena);
+
+			return is_failed;
+		}
+
+		// Splitting and merging do not change what the arena holds, they are not recorded
+		bool hook_extent_split(extent_hooks*, void* address, size_t size, size_t size_a, size_t size_b, bool committed, unsigned arena)
+		{
+			extent_hooks* original = get_original_hooks(arena);
+			return original == nullptr || original->split == nullptr || original->split(original, address, size, size_a, size_b, committed, arena);
+		}
+
+		bool hook_extent_merge(extent_hooks*, void* address_a, size_t size_a, void* address_b, size_t size_b, bool committed, unsigned arena)
+		{
+			extent_hooks* original = get_original_hooks(arena);
+			return original == nullptr || original->merge == nullptr || original->merge(original, address_a, size_a, address_b, size_b, committed, arena);
+		}
+
+		extent_hooks g_extent_hooks =
+		{
+			hook_extent_alloc,
+			hook_extent_dalloc,
+			hook_extent_destroy,
+			hook_extent_commit,
+			hook_extent_decommit,
+			hook_extent_purge_lazy,
+			hook_extent_purge_forced,
+			hook_extent_split,
+			hook_extent_merge,
+		};
+
+		bool get_extent_hooks_name(uint32_t arena, char* out_name, size_t name_size)
+		{
+			return snprintf(out_name, name_size, "arena.%u.extent_hooks", arena) < int(name_size);
+		}
+	}
+
+	bool install_allocator_hooks()
+	{
+		g_mallctl = reinterpret_cast<mallctl_func>(dlsym(RTLD_DEFAULT, "mallctl"));
+		if (g_mallctl == nullptr)
+			return false;
+
+		unsigned num_arenas = 0;
+		size_t value_size = sizeof(num_arenas);
+		if (g_mallctl("arenas.narenas", &num_arenas, &value_size, nullptr, 0) != 0)
+			return false;
+
+		g_num_arenas = num_arenas < k_max_hooked_arenas ? num_arenas : k_max_hooked_arenas;
+
+		// Creating arenas and setting hooks allocates, the arenas we already hooked would see us
+		const bool was_capture_disabled = t_is_capture_disabled;
+		t_is_capture_disabled = true;
+
+		uint32_t num_hooked_arenas = 0;
+		for (uint32_t arena = 0; arena < g_num_arenas; ++arena)
+		{
+			char name[64];
+			if (!get_extent_hooks_name(arena, name, sizeof(name)))
+				continue;
+
+			// Our hooks need the original as soon as they are set, it is read first. Reading does not create the arena.
+			extent_hooks* original = nullptr;
+			value_size = sizeof(original);
+			if (g_mallctl(name, &original, &value_size, nullptr, 0) != 0 || original == nullptr || original == &g_extent_hooks)
+				continue;
+
+			g_original_hooks[arena].store(original, std::memory_order_release);
+
+			extent_hooks* hooks = &g_extent_hooks;
+			if (g_mallctl(name, nullptr, nullptr, &hooks, sizeof(hooks)) != 0)
+			{
+				g_original_hooks[arena].store(nullptr, std::memory_order_relaxed);
+				continue;
+			}
+
+			num_hooked_arenas++;
+		}
+
+		t_is_capture_disabled = was_capture_disabled;
+
+		if (num_arenas > k_max_hooked_arenas)
+			fprintf(stderr, "vmemprof: jemalloc has %u arenas, the extents of the arenas past %u are not recorded\n", num_arenas, k_max_hooked_arenas);
+
+		return num_hooked_arenas != 0;
+	}
+
+	void remove_allocator_hooks()
+	{
+		if (g_mallctl == nullptr)
+			return;
+
+		for (uint32_t arena = 0; arena < g_num_arenas; ++arena)
+		{
+			// Our hooks keep forwarding to the original, it stays set for the callbacks in flight
+			extent_hooks* original = g_original_hooks[arena].load(std::memory_order_acquire);
+			char name[64];
+			if (original == nullptr || !get_extent_hooks_name(arena, name, sizeof(name)))
+				continue;
+
+			g_mallctl(name, nullptr, nullptr, &original, sizeof(original));
+		}
+
+		g_mallctl = nullptr;
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Registers our extent hooks with every jemalloc arena, they forward to the
+	// hooks the arena had and record an allocator_extent event for every extent
+	// the arena obtains, returns, commits or purges. Arenas that were not
+	// created yet are created by the registration. Returns false if jemalloc is
+	// not loaded or none of its arenas could be hooked.
+	//
+	// tcmalloc has no C interface to replace its system allocator, its mappings
+	// are attributed from their callstack instead.
+	////////////////////////////////////////////////////////////////////////////////
+	bool install_allocator_hooks();
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Gives the arenas their previous hooks back, before we are unloaded.
+	// Callbacks that already loaded our hooks can still be running.
+	////////////////////////////////////////////////////////////////////////////////
+	void remove_allocator_hooks();
+}
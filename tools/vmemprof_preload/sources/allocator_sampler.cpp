@@ -0,0 +1,255 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "allocator_sampler.h"
+
+#include "vmemprof/core/allocator_sample.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <vector>
+
+namespace vmemprof
+{
+	namespace
+	{
+		using malloc_info_func = int (*)(int options, FILE* file);
+		using mallctl_func = int (*)(const char* name, void* old_value, size_t* old_size, void* new_value, size_t new_size);
+		using get_numeric_property_func = int (*)(const char* name, size_t* value);
+
+		// glibc reserves this much address space for every heap of its secondary arenas and commits it as the heap grows
+		constexpr uint64_t k_glibc_heap_reservation_size = 64 * 1024 * 1024;
+
+		malloc_info_func g_malloc_info = nullptr;
+		mallctl_func g_mallctl = nullptr;
+		get_numeric_property_func g_get_numeric_property = nullptr;
+
+		// Returns the value of a numeric attribute of a malloc_info XML element, zero if it is missing
+		uint64_t get_xml_attribute(const char* line, const char* name)
+		{
+			char pattern[32];
+			snprintf(pattern, sizeof(pattern), " %s=\"", name);
+
+			const char* value = std::strstr(line, pattern);
+			return value != nullptr ? strtoull(value + std::strlen(pattern), nullptr, 10) : 0;
+		}
+
+		bool is_xml_element(const char* line, const char* element)
+		{
+			while (*line == ' ')
+				line++;
+
+			return std::strncmp(line, element, std::strlen(element)) == 0;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// malloc_info reports every arena as a heap element, followed by totals:
+		//    <heap nr="1">
+		//    <sizes> ... </sizes>
+		//    <total type="fast" count="0" size="0"/>
+		//    <total type="rest" count="2" size="2689"/>
+		//    <system type="current" size="4956160"/>
+		//    <aspace type="mprotect" size="4956160"/>
+		//    <aspace type="subheaps" size="1"/>
+		//    </heap>
+		//    <total type="mmap" count="1" size="1052672"/>
+		// Free chunks are 'fast' and 'rest', the top chunk is not free in this
+		// sense and counts as allocated. Secondary arenas reserve their heaps
+		// whole, what they did not commit yet is released.
+		////////////////////////////////////////////////////////////////////////////////
+		void sample_glibc(uint64_t timestamp, std::vector<allocator_sample>& out_samples)
+		{
+			char* report = nullptr;
+			size_t report_size = 0;
+			FILE* file = open_memstream(&report, &report_size);
+			if (file == nullptr)
+				return;
+
+			const int result = g_malloc_info(0, file);
+			fclose(file);
+
+			if (result != 0 || report == nullptr)
+			{
+				free(report);
+				return;
+			}
+
+			allocator_sample sample = {};
+			uint64_t committed_bytes = 0;
+			uint64_t num_subheaps = 0;
+			bool is_in_heap = false;
+
+			for (char* line = report; line != nullptr && *line != '\0';)
+			{
+				char* line_end = std::strchr(line, '\n');
+				if (line_end != nullptr)
+					*line_end = '\0';
+
+				if (is_xml_element(line, "<heap "))
+				{
+					sample = allocator_sample{ timestamp, 0, 0, 0, 0, uint32_t(get_xml_attribute(line, "nr")), allocator_kind::glibc };
+					committed_bytes = 0;
+					num_subheaps = 0;
+					is_in_heap = true;
+				}
+				else if (is_xml_element(line, "</heap>"))
+				{
+					const uint64_t reserved_bytes = num_subheaps * k_glibc_heap_reservation_size;
+					sample.released_bytes = reserved_bytes > committed_bytes ? reserved_bytes - committed_bytes : 0;
+					sample.allocated_bytes = sample.mapped_bytes > sample.free_bytes ? sample.mapped_bytes - sample.free_bytes : 0;
+					sample.mapped_bytes += sample.released_bytes;
+
+					// Arenas of threads that never allocated are empty
+					if (sample.mapped_bytes != 0)
+						out_samples.push_back(sample);
+
+					is_in_heap = false;
+				}
+				else if (is_in_heap && (is_xml_element(line, "<total type=\"fast\"") || is_xml_element(line, "<total type=\"rest\"")))
+					sample.free_bytes += get_xml_attribute(line, "size");
+				else if (is_in_heap && is_xml_element(line, "<system type=\"current\""))
+					sample.mapped_bytes = get_xml_attribute(line, "size");
+				else if (is_in_heap && is_xml_element(line, "<aspace type=\"mprotect\""))
+					committed_bytes = get_xml_attribute(line, "size");
+				else if (is_in_heap && is_xml_element(line, "<aspace type=\"subheaps\""))
+					num_subheaps = get_xml_attribute(line, "size");
+				else if (!is_in_heap && is_xml_element(line, "<total type=\"mmap\""))
+				{
+					// Chunks mapped on their own belong to no arena and are entirely allocated
+					const uint64_t mapped_bytes = get_xml_attribute(line, "size");
+					if (mapped_bytes != 0)
+						out_samples.push_back(allocator_sample{ timestamp, mapped_bytes, mapped_bytes, 0, 0, k_allocator_direct_mmap_arena, allocator_kind::glibc });
+				}
+
+				line = line_end != nullptr ? line_end + 1 : nullptr;
+			}
+
+			free(report);
+		}
+
+		bool read_jemalloc_size(const char* name_format, uint32_t arena, size_t& out_value)
+		{
+			char name[96];
+			snprintf(name, sizeof(name), name_format, arena);
+
+			size_t value_size = sizeof(out_value);
+			return g_mallctl(name, &out_value, &value_size, nullptr, 0) == 0;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// jemalloc keeps per arena statistics when built with them, the default.
+		// Dirty and muzzy pages are free but still committed, retained extents
+		// are address space whose pages were given back.
+		////////////////////////////////////////////////////////////////////////////////
+		void sample_jemalloc(uint64_t timestamp, std::vector<allocator_sample>& out_samples)
+		{
+			// Statistics are a snapshot taken when the epoch advances
+			uint64_t epoch = 1;
+			size_t value_size = sizeof(epoch);
+			if (g_mallctl("epoch", &epoch, &value_size, &epoch, sizeof(epoch)) != 0)
+				return;
+
+			unsigned num_arenas = 0;
+			value_size = sizeof(num_arenas);
+			size_t page_size = 0;
+			size_t page_size_size = sizeof(page_size);
+			if (g_mallctl("arenas.narenas", &num_arenas, &value_size, nullptr, 0) != 0 || g_mallctl("arenas.page", &page_size, &page_size_size, nullptr, 0) != 0)
+				return;
+
+			for (uint32_t arena = 0; arena < num_arenas; ++arena)
+			{
+				// Arenas that were never used have no statistics
+				size_t mapped_bytes;
+				size_t retained_bytes;
+				size_t num_dirty_pages;
+				size_t num_muzzy_pages;
+				size_t small_bytes;
+				size_t large_bytes;
+				if (!read_jemalloc_size("stats.arenas.%u.mapped", arena, mapped_bytes)
+					|| !read_jemalloc_size("stats.arenas.%u.retained", arena, retained_bytes)
+					|| !read_jemalloc_size("stats.arenas.%u.pdirty", arena, num_dirty_pages)
+					|| !read_jemalloc_size("stats.arenas.%u.pmuzzy", arena, num_muzzy_pages)
+					|| !read_jemalloc_size("stats.arenas.%u.small.allocated", arena, small_bytes)
+					|| !read_jemalloc_size("stats.arenas.%u.large.allocated", arena, large_bytes))
+					continue;
+
+				if (mapped_bytes == 0 && retained_bytes == 0)
+					continue;
+
+				out_samples.push_back(allocator_sample{ timestamp, uint64_t(mapped_bytes) + retained_bytes, uint64_t(small_bytes) + large_bytes,
+					uint64_t(num_dirty_pages + num_muzzy_pages) * page_size, retained_bytes, arena, allocator_kind::jemalloc });
+			}
+		}
+
+		uint64_t read_tcmalloc_property(const char* name)
+		{
+			size_t value = 0;
+			return g_get_numeric_property(name, &value) != 0 ? uint64_t(value) : 0;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// tcmalloc has a single page heap. Free bytes are spread over the page heap
+		// and the central, transfer and thread caches, unmapped bytes are page
+		// heap spans whose pages were given back.
+		////////////////////////////////////////////////////////////////////////////////
+		void sample_tcmalloc(uint64_t timestamp, std::vector<allocator_sample>& out_samples)
+		{
+			const uint64_t mapped_bytes = read_tcmalloc_property("generic.heap_size");
+			if (mapped_bytes == 0)
+				return;
+
+			const uint64_t free_bytes = read_tcmalloc_property("tcmalloc.pageheap_free_bytes") + read_tcmalloc_property("tcmalloc.central_cache_free_bytes")
+				+ read_tcmalloc_property("tcmalloc.transfer_cache_free_bytes") + read_tcmalloc_property("tcmalloc.thread_cache_free_bytes");
+
+			out_samples.push_back(allocator_sample{ timestamp, mapped_bytes, read_tcmalloc_property("generic.current_allocated_bytes"), free_bytes,
+				read_tcmalloc_property("tcmalloc.pageheap_unmapped_bytes"), 0, allocator_kind::tcmalloc });
+		}
+	}
+
+	bool start_allocator_sampling()
+	{
+		// When another allocator replaces malloc, glibc's arenas stay empty and are skipped
+		g_malloc_info = reinterpret_cast<malloc_info_func>(dlsym(RTLD_DEFAULT, "malloc_info"));
+		g_mallctl = reinterpret_cast<mallctl_func>(dlsym(RTLD_DEFAULT, "mallctl"));
+		g_get_numeric_property = reinterpret_cast<get_numeric_property_func>(dlsym(RTLD_DEFAULT, "MallocExtension_GetNumericProperty"));
+
+		return g_malloc_info != nullptr || g_mallctl != nullptr || g_get_numeric_property != nullptr;
+	}
+
+	void sample_allocators(trace_writer& writer, uint64_t timestamp)
+	{
+		std::vector<allocator_sample> samples;
+
+		if (g_malloc_info != nullptr)
+			sample_glibc(timestamp, samples);
+		if (g_mallctl != nullptr)
+			sample_jemalloc(timestamp, samples);
+		if (g_get_numeric_property != nullptr)
+			sample_tcmalloc(timestamp, samples);
+
+		writer.write_allocator_samples(samples.data(), uint32_t(samples.size()));
+	}
+}
@@ -0,0 +1,406 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "capture_runtime.h"
+#include "allocator_hooks.h"
+#include "drain_thread.h"
+#include "got_patcher.h"
+#include "mapping_sampler.h"
+#include "module_tracker.h"
+#include "stack_table.h"
+#include "stack_unwinder.h"
+#include "thread_buffer.h"
+
+#include "vmemprof/trace/chunk_compression.h"
+
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <pthread.h>
+
+namespace vmemprof
+{
+	thread_local uint32_t t_thread_id = 0;
+	thread_local thread_buffer* t_thread_buffer = nullptr;
+	thread_local bool t_is_capture_disabled = false;
+
+	namespace
+	{
+		constexpr uint32_t k_default_buffer_capacity = 16 * 1024;
+		constexpr uint32_t k_default_drain_interval_ms = 10;
+		constexpr uint32_t k_default_flush_interval_ms = 1000;
+		constexpr uint32_t k_default_live_flush_interval_ms = 100;
+		constexpr uint32_t k_default_residency_interval_ms = 100;
+		constexpr uint32_t k_default_residency_page_budget = 256 * 1024;
+		constexpr uint32_t k_default_fault_period = 1;
+		constexpr uint32_t k_default_fault_ring_pages = 64;
+		constexpr uint32_t k_default_huge_page_interval_ms = 1000;
+		constexpr uint32_t k_default_numa_interval_ms = 1000;
+		constexpr uint32_t k_default_numa_stride_pages = 16;
+		constexpr uint32_t k_default_numa_page_budget = 16 * 1024;
+		constexpr uint32_t k_default_allocator_interval_ms = 1000;
+		constexpr uint32_t k_default_compression_threads = 1;
+		constexpr uint32_t k_max_compression_threads = 16;
+		constexpr const char* k_default_output_path = "vmemprof.%p.trace";
+
+		std::atomic<bool> g_is_capturing{ false };
+
+		// Injected by 'vmemprof attach', we can detach. 'vmemprof attach' loads us with RTLD_NODELETE, threads
+		// can still be running our hooks after we detach and we are never unloaded.
+		bool g_is_attached = false;
+		bool g_is_detached = false;
+
+		// The thread buffer key and the fork handler outlive a detach, they are registered once
+		bool g_is_thread_handling_registered = false;
+
+		// The settings block we were attached with, null when settings come from the environment
+		const char* g_attach_settings = nullptr;
+		uint32_t g_buffer_capacity = k_default_buffer_capacity;
+
+		// Releases the thread buffer when its thread exits
+		pthread_key_t g_thread_buffer_key;
+
+		// Output path template, every '%p' is replaced by the process id
+		char g_output_path_template[PATH_MAX];
+
+		void build_output_path(char* out_path, size_t out_path_size)
+		{
+			const char* input = g_output_path_template;
+			size_t output_size = 0;
+
+			while (*input != '\0' && output_size + 1 < out_path_size)
+			{
+				if (input[0] == '%' && input[1] == 'p')
+				{
+					const int num_written = snprintf(out_path + output_size, out_path_size - output_size, "%d", int(getpid()));
+					if (num_written > 0)
+						output_size += size_t(num_written);
+					input += 2;
+				}
+				else
+					out_path[output_size++] = *input++;
+			}
+
+			out_path[output_size < out_path_size ? output_size : out_path_size - 1] = '\0';
+		}
+
+		// The settings block holds 'NAME=value' strings, each null terminated, and ends with an empty string
+		const char* read_setting(const char* name)
+		{
+			if (g_attach_settings == nullptr)
+				return getenv(name);
+
+			const size_t name_length = std::strlen(name);
+			for (const char* setting = g_attach_settings; *setting != '\0'; setting += std::strlen(setting) + 1)
+			{
+				if (std::strncmp(setting, name, name_length) == 0 && setting[name_length] == '=')
+					return setting + name_length + 1;
+			}
+
+			return nullptr;
+		}
+
+		uint32_t read_setting_uint32(const char* name, uint32_t default_value)
+		{
+			const char* value_str = read_setting(name);
+			if (value_str == nullptr)
+				return default_value;
+
+			const unsigned long value = strtoul(value_str, nullptr, 10);
+			return value != 0 && value <= UINT32_MAX ? uint32_t(value) : default_value;
+		}
+
+		// Sizes take an optional 'K', 'M' or 'G' suffix
+		uint64_t read_setting_size(const char* name, uint64_t default_value)
+		{
+			const char* value_str = read_setting(name);
+			if (value_str == nullptr)
+				return default_value;
+
+			char* suffix = nullptr;
+			const unsigned long long value = strtoull(value_str, &suffix, 10);
+			if (suffix == value_str)
+				return default_value;
+
+			switch (*suffix)
+			{
+			case 'K':	return uint64_t(value) << 10;
+			case 'M':	return uint64_t(value) << 20;
+			case 'G':	return uint64_t(value) << 30;
+			default:	return uint64_t(value);
+			}
+		}
+
+		void on_thread_exit(void* value)
+		{
+			thread_buffer* buffer = static_cast<thread_buffer*>(value);
+			if (buffer == t_thread_buffer)
+				t_thread_buffer = nullptr;
+
+			// If the thread captures again during its teardown it acquires a new buffer and
+			// registers it again, pthread keeps calling us until the value stays null
+			release_thread_buffer(buffer);
+		}
+
+		void on_fork_child()
+		{
+			// Only the forking thread survives and it now has a new id
+			t_thread_id = 0;
+			t_thread_buffer = nullptr;
+			pthread_setspecific(g_thread_buffer_key, nullptr);
+
+			if (!g_is_capturing.load(std::memory_order_relaxed))
+				return;
+
+			char output_path[PATH_MAX];
+			build_output_path(output_path, sizeof(output_path));
+
+			if (!restart_drain_thread_after_fork(output_path))
+			{
+				g_is_capturing.store(false, std::memory_order_relaxed);
+				fprintf(stderr, "vmemprof: failed to restart capture in child process %d\n", int(getpid()));
+			}
+		}
+
+		bool start_capture(bool is_attached)
+		{
+			// Live mode streams the trace to a daemon instead of writing it to a file
+			const char* live_socket_path = read_setting("VMEMPROF_LIVE");
+			const bool is_live = live_socket_path != nullptr && live_socket_path[0] != '\0';
+
+			const char* output_path = is_live ? live_socket_path : read_setting("VMEMPROF_OUTPUT");
+			if (output_path == nullptr || output_path[0] == '\0')
+				output_path = k_default_output_path;
+
+			strncpy(g_output_path_template, output_path, sizeof(g_output_path_template) - 1);
+
+			// Ring capacities must be a power of two
+			uint32_t buffer_capacity = read_setting_uint32("VMEMPROF_BUFFER_EVENTS", k_default_buffer_capacity);
+			g_buffer_capacity = buffer_capacity <= (1U << 31) ? (1U << (31 - __builtin_clz(buffer_capacity))) : (1U << 31);
+
+			drain_settings settings;
+			settings.interval_ms = read_setting_uint32("VMEMPROF_DRAIN_INTERVAL_MS", k_default_drain_interval_ms);
+			settings.flush_interval_ms = read_setting_uint32("VMEMPROF_FLUSH_INTERVAL_MS", is_live ? k_default_live_flush_interval_ms : k_default_flush_interval_ms);
+			settings.is_live = is_live;
+			settings.is_attached = is_attached;
+			settings.sampling_interval = read_setting_size("VMEMPROF_SAMPLE_BYTES", 0);
+
+			// Files are compressed by default, the daemon reads a local socket and has better use for its time
+			settings.compression = is_live ? chunk_compression::none : chunk_compression::lz;
+			const char* compression_str = read_setting("VMEMPROF_COMPRESSION");
+			if (compression_str != nullptr)
+			{
+				if (std::strcmp(compression_str, "none") == 0 || std::strcmp(compression_str, "0") == 0)
+					settings.compression = chunk_compression::none;
+				else if (std::strcmp(compression_str, "lz") == 0)
+					settings.compression = chunk_compression::lz;
+				else if (std::strcmp(compression_str, "zstd") == 0 && is_chunk_compression_supported(chunk_compression::zstd))
+					settings.compression = chunk_compression::zstd;
+				else
+					fprintf(stderr, "vmemprof: unsupported compression '%s', using %s\n", compression_str, get_chunk_compression_name(settings.compression));
+			}
+
+			settings.compression_threads = read_setting_uint32("VMEMPROF_COMPRESSION_THREADS", k_default_compression_threads);
+			if (settings.compression_threads > k_max_compression_threads)
+				settings.compression_threads = k_max_compression_threads;
+
+			settings.residency_interval_ms = read_setting_uint32("VMEMPROF_RESIDENCY_INTERVAL_MS", k_default_residency_interval_ms);
+			settings.residency_page_budget = read_setting_uint32("VMEMPROF_RESIDENCY_PAGES", k_default_residency_page_budget);
+
+			const char* residency_str = read_setting("VMEMPROF_RESIDENCY");
+			if (residency_str != nullptr && std::strcmp(residency_str, "0") == 0)
+				settings.residency_interval_ms = 0;
+
+			// Page fault sampling is opt-in, every sampled fault costs a perf record
+			const char* faults_str = read_setting("VMEMPROF_FAULTS");
+			const bool is_sampling_faults = faults_str != nullptr && std::strcmp(faults_str, "1") == 0;
+			settings.fault_period = is_sampling_faults ? read_setting_uint32("VMEMPROF_FAULT_PERIOD", k_default_fault_period) : 0;
+			settings.fault_ring_pages = read_setting_uint32("VMEMPROF_FAULT_RING_PAGES", k_default_fault_ring_pages);
+
+			// Huge page sampling is opt-in, generating smaps walks the page tables of the whole process
+			const char* huge_pages_str = read_setting("VMEMPROF_HUGE_PAGES");
+			const bool is_sampling_huge_pages = huge_pages_str != nullptr && std::strcmp(huge_pages_str, "1") == 0;
+			settings.huge_page_interval_ms = is_sampling_huge_pages ? read_setting_uint32("VMEMPROF_HUGE_PAGES_INTERVAL_MS", k_default_huge_page_interval_ms) : 0;
+
+			// NUMA sampling is opt-in, a fake topology lets it run on a single node box
+			const char* numa_str = read_setting("VMEMPROF_NUMA");
+			const bool is_sampling_numa = numa_str != nullptr && std::strcmp(numa_str, "1") == 0;
+			settings.numa_interval_ms = is_sampling_numa ? read_setting_uint32("VMEMPROF_NUMA_INTERVAL_MS", k_default_numa_interval_ms) : 0;
+			settings.numa_stride_pages = read_setting_uint32("VMEMPROF_NUMA_STRIDE", k_default_numa_stride_pages);
+			settings.numa_page_budget = read_setting_uint32("VMEMPROF_NUMA_PAGES", k_default_numa_page_budget);
+			settings.numa_fake_nodes = read_setting_uint32("VMEMPROF_NUMA_FAKE_NODES", 0);
+
+			// Allocator integration is opt-in, jemalloc calls our extent hooks while holding its locks
+			const char* allocators_str = read_setting("VMEMPROF_ALLOCATORS");
+			const bool is_tracking_allocators = allocators_str != nullptr && std::strcmp(allocators_str, "1") == 0;
+			settings.allocator_interval_ms = is_tracking_allocators ? read_setting_uint32("VMEMPROF_ALLOCATORS_INTERVAL_MS", k_default_allocator_interval_ms) : 0;
+
+			// Frame pointer stacks are cheap enough to be on by default
+			stack_capture_mode stack_mode = stack_capture_mode::frame_pointers;
+			const char* stacks_str = read_setting("VMEMPROF_STACKS");
+			if (stacks_str != nullptr && std::strcmp(stacks_str, "0") == 0)
+				stack_mode = stack_capture_mode::none;
+			else if (stacks_str != nullptr && std::strcmp(stacks_str, "unwind") == 0)
+				stack_mode = stack_capture_mode::unwinder;
+
+			if (!initialize_stack_capture(stack_mode))
+				fprintf(stderr, "vmemprof: failed to reserve the stack table, stacks are not captured\n");
+
+			if (!g_is_thread_handling_registered)
+			{
+				if (pthread_key_create(&g_thread_buffer_key, on_thread_exit) != 0)
+				{
+					fprintf(stderr, "vmemprof: failed to create the thread buffer key, capture disabled\n");
+					return false;
+				}
+
+				pthread_atfork(nullptr, nullptr, on_fork_child);
+				g_is_thread_handling_registered = true;
+			}
+
+			// Mappings are byte weighted sampled when requested, hooks read the interval from now on
+			set_sampling_interval(settings.sampling_interval);
+
+			char resolved_output_path[PATH_MAX];
+			build_output_path(resolved_output_path, sizeof(resolved_output_path));
+
+			if (!start_drain_thread(resolved_output_path, settings))
+			{
+				fprintf(stderr, "vmemprof: failed to start capturing to '%s', capture disabled\n", resolved_output_path);
+				return false;
+			}
+
+			g_is_capturing.store(true, std::memory_order_release);
+
+			// Extents are recorded once capturing, jemalloc may not be loaded at all
+			if (is_tracking_allocators)
+				install_allocator_hooks();
+
+			return true;
+		}
+
+		bool is_preloaded()
+		{
+			// Preloaded, our mmap comes first in the global scope. Injected with dlopen, libc's does.
+			Dl_info own_info;
+			Dl_info mmap_info;
+			void* mmap_function = dlsym(RTLD_DEFAULT, "mmap");
+			return mmap_function != nullptr && dladdr(mmap_function, &mmap_info) != 0
+				&& dladdr(reinterpret_cast<void*>(&acquire_current_thread_buffer), &own_info) != 0
+				&& mmap_info.dli_fbase == own_info.dli_fbase;
+		}
+
+		__attribute__((constructor(101))) void initialize_capture()
+		{
+			// When injected, 'vmemprof attach' starts the capture with its own settings
+			if (is_preloaded())
+				start_capture(false);
+		}
+
+		__attribute__((destructor(101))) void terminate_capture()
+		{
+			if (!g_is_capturing.exchange(false, std::memory_order_acquire))
+				return;
+
+			// Thread buffers are intentionally kept alive, other threads might still be recording
+			stop_drain_thread();
+		}
+	}
+
+	thread_buffer* acquire_current_thread_buffer()
+	{
+		if (t_is_capture_disabled || !g_is_capturing.load(std::memory_order_acquire))
+			return nullptr;
+
+		// Registering the buffer with pthread can allocate, which can map memory and re-enter us
+		t_is_capture_disabled = true;
+
+		thread_buffer* buffer = acquire_thread_buffer(g_buffer_capacity);
+		if (buffer != nullptr)
+		{
+			pthread_setspecific(g_thread_buffer_key, buffer);
+			t_thread_buffer = buffer;
+		}
+
+		t_is_capture_disabled = false;
+		return buffer;
+	}
+}
+
+using namespace vmemprof;
+
+////////////////////////////////////////////////////////////////////////////////
+// Called by 'vmemprof attach' once it loaded us into a running process. The
+// settings block replaces the environment. Returns zero once capturing.
+////////////////////////////////////////////////////////////////////////////////
+extern "C" VMEMPROF_EXPORT int vmemprof_attach(const char* settings)
+{
+	if (g_is_capturing.load(std::memory_order_acquire))
+	{
+		fprintf(stderr, "vmemprof: the process is already captured, cannot attach\n");
+		return -1;
+	}
+
+	if (g_is_detached)
+	{
+		// We stayed loaded since the previous capture, what it left behind must be written again or not at all
+		discard_thread_buffer_events();
+		reset_written_stacks();
+		reset_written_modules();
+	}
+
+	g_attach_settings = settings;
+	const bool is_started = start_capture(true);
+	g_attach_settings = nullptr;
+
+	// The drain thread patches the GOT on its first drain
+	g_is_attached = is_started;
+	return is_started ? 0 : -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Called by 'vmemprof attach' when it detaches. The trace is completed and the
+// GOT restored. Returns zero once detached.
+////////////////////////////////////////////////////////////////////////////////
+extern "C" VMEMPROF_EXPORT int vmemprof_detach()
+{
+	if (!g_is_attached || !g_is_capturing.exchange(false, std::memory_order_acquire))
+		return -1;
+
+	remove_allocator_hooks();
+
+	// The drain thread is the only one patching, it must be gone before we restore
+	stop_drain_thread();
+	restore_got();
+
+	// Threads that loaded a hook before the restore, that are blocked in its system call or in a
+	// jemalloc callback can still record. Their buffers and the stack table stay alive and we are
+	// never unloaded, the events they record are discarded if we attach again.
+	g_is_attached = false;
+	g_is_detached = true;
+	return 0;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "raw_syscalls.h"
+#include "thread_buffer.h"
+
+#include "vmemprof/core/compiler_utils.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/time_utils.h"
+
+#include <atomic>
+#include <cstdint>
+
+namespace vmemprof
+{
+	// Cached kernel thread id of the calling thread, zero until first queried
+	extern thread_local uint32_t t_thread_id;
+
+	// The capture buffer of the calling thread, null until its first event
+	extern thread_local thread_buffer* t_thread_buffer;
+
+	// Set on our internal threads and while acquiring a buffer, events are ignored
+	extern thread_local bool t_is_capture_disabled;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns the kernel thread id of the calling thread.
+	// Only the first call per thread performs a syscall.
+	////////////////////////////////////////////////////////////////////////////////
+	VMEMPROF_FORCE_INLINE uint32_t get_thread_id()
+	{
+		uint32_t thread_id = t_thread_id;
+		if (VMEMPROF_UNLIKELY(thread_id == 0))
+		{
+			thread_id = raw_gettid();
+			t_thread_id = thread_id;
+		}
+
+		return thread_id;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Acquires the buffer of the calling thread on its first event.
+	// Returns nullptr if capture is disabled for this thread.
+	////////////////////////////////////////////////////////////////////////////////
+	thread_buffer* acquire_current_thread_buffer();
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Publishes that the calling thread is inside a hook, from before its syscall
+	// until its event is recorded.
+	//
+	// The event of a hook is pushed after the syscall returns, other threads can
+	// publish newer events in the meantime. The drain thread holds back the events
+	// newer than the entry of every hook in flight so that the trace stays in
+	// timestamp order. Nested hooks keep the entry of the outermost one.
+	////////////////////////////////////////////////////////////////////////////////
+	class hook_scope
+	{
+	public:
+		VMEMPROF_FORCE_INLINE hook_scope()
+		{
+			thread_buffer* buffer = t_thread_buffer;
+			if (VMEMPROF_UNLIKELY(buffer == nullptr))
+				buffer = acquire_current_thread_buffer();
+
+			if (buffer == nullptr || buffer->hook_timestamp.load(std::memory_order_relaxed) != 0)
+			{
+				m_timestamp = get_timestamp_ns();
+				return;
+			}
+
+			// A drain that does not see the pending marker read its time before ours
+			buffer->hook_timestamp.store(k_hook_timestamp_pending, std::memory_order_seq_cst);
+			m_timestamp = get_timestamp_ns();
+			buffer->hook_timestamp.store(m_timestamp, std::memory_order_release);
+			m_buffer = buffer;
+		}
+
+		VMEMPROF_FORCE_INLINE ~hook_scope()
+		{
+			if (m_buffer != nullptr)
+				m_buffer->hook_timestamp.store(0, std::memory_order_release);
+		}
+
+		hook_scope(const hook_scope&) = delete;
+		hook_scope& operator=(const hook_scope&) = delete;
+
+		// When the hook was entered
+		uint64_t get_timestamp() const { return m_timestamp; }
+
+	private:
+		thread_buffer*	m_buffer = nullptr;
+		uint64_t		m_timestamp;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Records an event in the calling thread's buffer.
+	////////////////////////////////////////////////////////////////////////////////
+	VMEMPROF_FORCE_INLINE void capture_event(const vm_event& event)
+	{
+		thread_buffer* buffer = t_thread_buffer;
+		if (VMEMPROF_UNLIKELY(buffer == nullptr))
+		{
+			buffer = acquire_current_thread_buffer();
+			if (buffer == nullptr)
+				return;
+		}
+
+		buffer->record(event);
+	}
+}
@@ -0,0 +1,575 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "drain_thread.h"
+#include "allocator_sampler.h"
+#include "capture_runtime.h"
+#include "fault_sampler.h"
+#include "got_patcher.h"
+#include "huge_page_sampler.h"
+#include "mapping_sampler.h"
+#include "module_tracker.h"
+#include "numa_sampler.h"
+#include "raw_syscalls.h"
+#include "residency_sampler.h"
+#include "stack_table.h"
+#include "thread_buffer.h"
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/core/time_utils.h"
+#include "vmemprof/core/worker_pool.h"
+#include "vmemprof/proc/maps_tracker.h"
+#include "vmemprof/trace/trace_writer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <new>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <vector>
+#include <sys/un.h>
+
+namespace vmemprof
+{
+	namespace
+	{
+		// Number of events staged before the staging grows
+		constexpr uint32_t k_initial_staging_capacity = 64 * 1024;
+
+		// Residency samples written per tick at most
+		constexpr uint32_t k_residency_sample_capacity = 4096;
+
+		// NUMA page samples written per tick at most
+		constexpr uint32_t k_numa_sample_capacity = 16 * 1024;
+
+		// Fault samples read per drain at most, the rest waits in the perf rings
+		constexpr uint32_t k_fault_sample_capacity = 16 * 1024;
+
+		// How often we look for a userfaultfd when we are injected, ioctl is patched once there is one
+		constexpr uint64_t k_userfaultfd_check_interval_ns = 1000000000ULL;
+
+		// The writer is constructed in place when capture starts, the library constructor runs
+		// before the dynamic initializers of our globals
+		alignas(trace_writer) uint8_t g_writer_storage[sizeof(trace_writer)];
+		trace_writer* g_writer = nullptr;
+		int g_output_fd = -1;
+		uint64_t g_last_flush_timestamp = 0;
+
+		vm_event* g_staging_events = nullptr;
+		uint32_t g_staging_capacity = 0;
+
+		// Holds the sample arrays below
+		void* g_sample_storage = nullptr;
+		size_t g_sample_storage_size = 0;
+		drain_settings g_settings = {};
+
+		// Compresses the chunks of the writer, constructed in place like the writer
+		alignas(worker_pool) uint8_t g_compression_pool_storage[sizeof(worker_pool)];
+		worker_pool* g_compression_pool = nullptr;
+
+		// The address space as of the last event written, constructed in place like the writer
+		alignas(address_space) uint8_t g_address_space_storage[sizeof(address_space)];
+		address_space* g_address_space = nullptr;
+
+		residency_sample* g_residency_samples = nullptr;
+		uint64_t g_last_residency_timestamp = 0;
+
+		bool g_is_sampling_huge_pages = false;
+		uint64_t g_last_huge_page_timestamp = 0;
+
+		numa_page_sample* g_numa_samples = nullptr;
+		uint64_t g_last_numa_timestamp = 0;
+
+		bool g_is_sampling_allocators = false;
+		uint64_t g_last_allocator_timestamp = 0;
+
+		uint64_t g_last_userfaultfd_check_timestamp = 0;
+
+		fault_sample* g_fault_samples = nullptr;
+		bool g_is_sampling_faults = false;
+		uint64_t g_last_written_fault_timestamp = 0;
+
+		// Faults of the drain thread itself are not part of the profile
+		uint32_t g_drain_thread_id = 0;
+
+		pthread_t g_drain_thread;
+		std::atomic<bool> g_is_running{ false };
+		std::atomic<bool> g_is_stop_requested{ false };
+
+		// Events popped but not written yet, they are kept until every thread had a chance to publish older events
+		uint32_t g_num_staged = 0;
+
+		// Timestamp of the last event written, the trace must be in timestamp order
+		uint64_t g_last_written_timestamp = 0;
+
+		bool grow_staging()
+		{
+			// Events newer than a hook in flight cannot be written, the staging holds them no matter how many there are
+			if (g_staging_capacity > UINT32_MAX / 2)
+				return false;
+
+			const uint32_t capacity = g_staging_capacity * 2;
+			void* staging = raw_mremap(g_staging_events, size_t(g_staging_capacity) * sizeof(vm_event), size_t(capacity) * sizeof(vm_event), MREMAP_MAYMOVE, nullptr);
+			if (staging == MAP_FAILED)
+				return false;
+
+			g_staging_events = static_cast<vm_event*>(staging);
+			g_staging_capacity = capacity;
+			return true;
+		}
+
+		// Newest timestamp we can write, every thread published its events up to it
+		uint64_t get_watermark(uint64_t now)
+		{
+			// Pairs with hook_scope, a hook that does not see this order entered after now
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			uint64_t watermark = now;
+			for (const thread_buffer* buffer = get_thread_buffer_list(); buffer != nullptr; buffer = buffer->next)
+			{
+				const uint64_t hook_timestamp = buffer->hook_timestamp.load(std::memory_order_acquire);
+				if (hook_timestamp == k_hook_timestamp_pending)
+					watermark = std::min(watermark, g_last_written_timestamp);
+				else if (hook_timestamp != 0)
+					watermark = std::min(watermark, hook_timestamp - 1);
+			}
+
+			// Never move back, what we wrote already is final
+			return std::max(watermark, g_last_written_timestamp);
+		}
+
+		void write_staged_events(uint64_t watermark)
+		{
+			// Buffers are drained one after the other, restore a global order for the replay
+			std::sort(g_staging_events, g_staging_events + g_num_staged, [](const vm_event& lhs, const vm_event& rhs) { return lhs.timestamp < rhs.timestamp; });
+
+			vm_event* staging_end = g_staging_events + g_num_staged;
+			vm_event* written_end = std::upper_bound(g_staging_events, staging_end, watermark, [](uint64_t timestamp, const vm_event& event) { return timestamp < event.timestamp; });
+			const uint32_t num_written = uint32_t(written_end - g_staging_events);
+
+			if (num_written != 0)
+				g_last_written_timestamp = written_end[-1].timestamp;
+
+			// Every stack referenced by these events was interned before they were published
+			write_new_stacks(*g_writer);
+			g_writer->write_events(g_staging_events, num_written);
+
+			for (const vm_event* event = g_staging_events; event < written_end; ++event)
+				g_address_space->apply(*event);
+
+			g_num_staged -= num_written;
+			std::copy(written_end, staging_end, g_staging_events);
+		}
+
+		void write_fault_samples(uint64_t now)
+		{
+			uint64_t num_lost = 0;
+			const uint32_t num_samples = read_fault_samples(g_drain_thread_id, g_fault_samples, k_fault_sample_capacity, num_lost);
+
+			// Rings are per CPU, merge them. Like events, late samples are moved up to keep the trace sorted.
+			std::sort(g_fault_samples, g_fault_samples + num_samples, [](const fault_sample& lhs, const fault_sample& rhs) { return lhs.timestamp < rhs.timestamp; });
+
+			for (uint32_t sample_index = 0; sample_index < num_samples && g_fault_samples[sample_index].timestamp < g_last_written_fault_timestamp; ++sample_index)
+				g_fault_samples[sample_index].timestamp = g_last_written_fault_timestamp;
+
+			if (num_samples != 0)
+				g_last_written_fault_timestamp = g_fault_samples[num_samples - 1].timestamp;
+
+			write_new_stacks(*g_writer);
+			g_writer->write_fault_samples(g_fault_samples, num_samples);
+
+			if (num_lost != 0)
+				g_writer->write_lost_faults(now, num_lost);
+		}
+
+		void drain_once(bool is_final)
+		{
+			// Every event sampled before the watermark has been published by the time we pop its buffer,
+			// the events of hooks still in flight are not and hold it back. Newer events wait for the next
+			// drain where they are sorted along with the events of buffers we pop before theirs.
+			const uint64_t now = get_timestamp_ns();
+			uint64_t watermark = is_final ? UINT64_MAX : get_watermark(now);
+			uint64_t num_dropped = 0;
+
+			// Modules loaded since the previous drain, stacks can refer to them
+			bool is_patch_needed = write_new_modules(*g_writer, now) && g_settings.is_attached;
+
+			if (g_settings.is_attached && !is_final && now - g_last_userfaultfd_check_timestamp >= k_userfaultfd_check_interval_ns)
+			{
+				is_patch_needed |= enable_ioctl_patching();
+				g_last_userfaultfd_check_timestamp = now;
+			}
+
+			if (is_patch_needed && !patch_got())
+				fprintf(stderr, "vmemprof: too many GOT slots to patch, some calls are not captured\n");
+
+			for (thread_buffer* buffer = get_thread_buffer_list(); buffer != nullptr; buffer = buffer->next)
+			{
+				while (true)
+				{
+					g_num_staged += buffer->ring.pop(g_staging_events + g_num_staged, g_staging_capacity - g_num_staged);
+					if (g_num_staged != g_staging_capacity || !grow_staging())
+						break;
+				}
+
+				if (g_num_staged == g_staging_capacity)
+				{
+					// Out of memory, the buffers we did not pop can hold older events. They wait in their
+					// rings and drop new events until the staging drains.
+					watermark = std::min(watermark, g_last_written_timestamp);
+				}
+
+				const uint64_t buffer_num_dropped = buffer->num_dropped.load(std::memory_order_relaxed);
+				num_dropped += buffer_num_dropped - buffer->num_dropped_reported;
+				buffer->num_dropped_reported = buffer_num_dropped;
+			}
+
+			write_staged_events(watermark);
+
+			if (num_dropped != 0)
+				g_writer->write_dropped_events(now, num_dropped);
+
+			if (g_is_sampling_faults)
+				write_fault_samples(now);
+
+			if (g_settings.residency_interval_ms != 0 && !is_final && now - g_last_residency_timestamp >= g_settings.residency_interval_ms * 1000000ULL)
+			{
+				// Sampled after the drain, every region we scan was mapped before this time
+				const uint64_t sample_timestamp = get_timestamp_ns();
+				const uint32_t num_samples = sample_residency(*g_address_space, sample_timestamp, g_residency_samples, k_residency_sample_capacity);
+				g_writer->write_residency_samples(g_residency_samples, num_samples);
+				g_last_residency_timestamp = now;
+			}
+
+			if (g_is_sampling_huge_pages && !is_final && now - g_last_huge_page_timestamp >= g_settings.huge_page_interval_ms * 1000000ULL)
+			{
+				sample_huge_pages(*g_writer, get_timestamp_ns());
+				g_last_huge_page_timestamp = now;
+			}
+
+			if (g_settings.numa_interval_ms != 0 && !is_final && now - g_last_numa_timestamp >= g_settings.numa_interval_ms * 1000000ULL)
+			{
+				const uint32_t num_samples = sample_numa_nodes(*g_address_space, get_timestamp_ns(), g_numa_samples, k_numa_sample_capacity);
+				g_writer->write_numa_page_samples(g_numa_samples, num_samples);
+				g_last_numa_timestamp = now;
+			}
+
+			if (g_is_sampling_allocators && !is_final && now - g_last_allocator_timestamp >= g_settings.allocator_interval_ms * 1000000ULL)
+			{
+				sample_allocators(*g_writer, get_timestamp_ns());
+				g_last_allocator_timestamp = now;
+			}
+
+			if (is_final || now - g_last_flush_timestamp >= g_settings.flush_interval_ms * 1000000ULL)
+			{
+				g_writer->flush();
+				g_last_flush_timestamp = now;
+			}
+		}
+
+		void* drain_thread_main(void*)
+		{
+			// Our own allocations and I/O are not part of the profile
+			t_is_capture_disabled = true;
+			g_drain_thread_id = raw_gettid();
+
+			const timespec interval = { time_t(g_settings.interval_ms / 1000), long(g_settings.interval_ms % 1000) * 1000000L };
+
+			while (!g_is_stop_requested.load(std::memory_order_acquire))
+			{
+				drain_once(false);
+				nanosleep(&interval, nullptr);
+			}
+
+			drain_once(true);
+			return nullptr;
+		}
+
+		void close_output()
+		{
+			const error_result result = g_writer->close();
+			if (result.any())
+				fprintf(stderr, "vmemprof: %s\n", result.c_str());
+
+			g_writer->~trace_writer();
+			g_writer = nullptr;
+
+			if (g_compression_pool != nullptr)
+			{
+				g_compression_pool->~worker_pool();
+				g_compression_pool = nullptr;
+			}
+
+			close(g_output_fd);
+			g_output_fd = -1;
+		}
+
+		void initialize_compression_worker()
+		{
+			// Our own allocations are not part of the profile
+			t_is_capture_disabled = true;
+		}
+
+		int connect_to_daemon(const char* socket_path)
+		{
+			sockaddr_un address = {};
+			address.sun_family = AF_UNIX;
+			if (strlen(socket_path) >= sizeof(address.sun_path))
+				return -1;
+
+			strcpy(address.sun_path, socket_path);
+
+			const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (fd < 0)
+				return -1;
+
+			if (connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+			{
+				close(fd);
+				return -1;
+			}
+
+			return fd;
+		}
+
+		bool open_output(const char* output_path)
+		{
+			if (g_settings.is_live)
+				g_output_fd = connect_to_daemon(output_path);
+			else
+				g_output_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+			if (g_output_fd < 0)
+				return false;
+
+			timespec realtime;
+			clock_gettime(CLOCK_REALTIME, &realtime);
+
+			const uint64_t start_timestamp = get_timestamp_ns();
+			const uint64_t start_realtime = uint64_t(realtime.tv_sec) * 1000000000ULL + uint64_t(realtime.tv_nsec);
+
+			g_writer = new(g_writer_storage) trace_writer();
+			g_last_flush_timestamp = start_timestamp;
+
+			if (g_writer->open(g_output_fd, uint32_t(getpid()), start_timestamp, start_realtime).any())
+			{
+				close_output();
+				return false;
+			}
+
+			if (g_settings.compression != chunk_compression::none)
+			{
+				// The stacks of the workers are ours, not the program's
+				const bool was_capture_disabled = t_is_capture_disabled;
+				t_is_capture_disabled = true;
+
+				g_compression_pool = new(g_compression_pool_storage) worker_pool();
+				g_compression_pool->start(g_settings.compression_threads, initialize_compression_worker);
+				g_writer->set_compression(g_settings.compression, g_compression_pool);
+
+				t_is_capture_disabled = was_capture_disabled;
+			}
+
+			return true;
+		}
+
+		void write_existing_mappings()
+		{
+			// Our hooks are not installed yet, every later event is newer than the snapshot
+			const uint64_t timestamp = get_timestamp_ns();
+
+			std::vector<vm_event> events;
+			maps_tracker tracker;
+			if (tracker.open("/proc/self/maps").any() || tracker.poll(timestamp, [&events](const vm_event& event) { events.push_back(event); }).any())
+			{
+				fprintf(stderr, "vmemprof: failed to read the existing mappings\n");
+				return;
+			}
+
+			// The existing mappings are sampled like new ones
+			if (g_settings.sampling_interval != 0)
+				events.erase(std::remove_if(events.begin(), events.end(), [](const vm_event& event) { return !should_sample_mapping(event.size); }), events.end());
+
+			g_writer->write_events(events.data(), uint32_t(events.size()));
+			for (const vm_event& event : events)
+				g_address_space->apply(event);
+
+			g_last_written_timestamp = timestamp;
+		}
+
+		bool create_drain_thread(const char* output_path)
+		{
+			if (!open_output(output_path))
+				return false;
+
+			// A previous address space is leaked after a fork, the drain thread could have been updating it
+			g_address_space = new(g_address_space_storage) address_space();
+
+			if (g_settings.sampling_interval != 0)
+				g_writer->write_sampling(get_timestamp_ns(), g_settings.sampling_interval);
+
+			// Mappings created before we were injected are not in the trace otherwise
+			if (g_settings.is_attached)
+				write_existing_mappings();
+
+			if (g_settings.residency_interval_ms != 0)
+				start_residency_sampling(g_settings.residency_page_budget);
+
+			g_is_sampling_huge_pages = g_settings.huge_page_interval_ms != 0 && start_huge_page_sampling();
+			g_last_huge_page_timestamp = 0;
+
+			// Fault samples carry their CPU, the topology maps them to nodes
+			if (g_settings.numa_interval_ms != 0 || g_settings.fault_period != 0)
+			{
+				start_numa_sampling(g_settings.numa_stride_pages, g_settings.numa_page_budget, g_settings.numa_fake_nodes);
+				write_numa_topology(*g_writer, get_timestamp_ns());
+			}
+			g_last_numa_timestamp = 0;
+
+			g_is_sampling_allocators = g_settings.allocator_interval_ms != 0 && start_allocator_sampling();
+			g_last_allocator_timestamp = 0;
+
+			g_last_written_fault_timestamp = 0;
+			g_last_userfaultfd_check_timestamp = 0;
+
+			g_is_stop_requested.store(false, std::memory_order_relaxed);
+			if (pthread_create(&g_drain_thread, nullptr, drain_thread_main, nullptr) != 0)
+			{
+				stop_residency_sampling();
+				stop_huge_page_sampling();
+				close_output();
+				return false;
+			}
+
+			g_is_running.store(true, std::memory_order_release);
+			return true;
+		}
+	}
+
+	bool start_drain_thread(const char* output_path, const drain_settings& settings)
+	{
+		const size_t staging_size = k_initial_staging_capacity * sizeof(vm_event);
+		void* staging = raw_mmap(nullptr, staging_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (staging == MAP_FAILED)
+			return false;
+
+		const size_t sample_storage_size = k_residency_sample_capacity * sizeof(residency_sample) + k_fault_sample_capacity * sizeof(fault_sample)
+			+ k_numa_sample_capacity * sizeof(numa_page_sample);
+		void* sample_storage = raw_mmap(nullptr, sample_storage_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (sample_storage == MAP_FAILED)
+		{
+			raw_munmap(staging, staging_size);
+			return false;
+		}
+
+		g_staging_events = static_cast<vm_event*>(staging);
+		g_staging_capacity = k_initial_staging_capacity;
+		g_sample_storage = sample_storage;
+		g_sample_storage_size = sample_storage_size;
+		g_residency_samples = static_cast<residency_sample*>(sample_storage);
+		g_fault_samples = reinterpret_cast<fault_sample*>(g_residency_samples + k_residency_sample_capacity);
+		g_numa_samples = reinterpret_cast<numa_page_sample*>(g_fault_samples + k_fault_sample_capacity);
+
+		g_settings = settings;
+		g_settings.interval_ms = settings.interval_ms != 0 ? settings.interval_ms : 1;
+
+		if (g_settings.fault_period != 0)
+		{
+			g_is_sampling_faults = start_fault_sampling(g_settings.fault_period, g_settings.fault_ring_pages);
+			if (!g_is_sampling_faults)
+				fprintf(stderr, "vmemprof: failed to open the page fault perf events, faults are not sampled\n");
+		}
+
+		return create_drain_thread(output_path);
+	}
+
+	void stop_drain_thread()
+	{
+		if (!g_is_running.exchange(false, std::memory_order_acquire))
+			return;
+
+		g_is_stop_requested.store(true, std::memory_order_release);
+		pthread_join(g_drain_thread, nullptr);
+		stop_residency_sampling();
+		stop_huge_page_sampling();
+		close_output();
+
+		if (g_is_sampling_faults)
+			stop_fault_sampling();
+		g_is_sampling_faults = false;
+
+		g_address_space->~address_space();
+		g_address_space = nullptr;
+
+		raw_munmap(g_staging_events, size_t(g_staging_capacity) * sizeof(vm_event));
+		g_staging_events = nullptr;
+		g_staging_capacity = 0;
+		g_num_staged = 0;
+
+		raw_munmap(g_sample_storage, g_sample_storage_size);
+		g_sample_storage = nullptr;
+		g_sample_storage_size = 0;
+		g_residency_samples = nullptr;
+		g_fault_samples = nullptr;
+		g_numa_samples = nullptr;
+	}
+
+	bool restart_drain_thread_after_fork(const char* output_path)
+	{
+		if (!g_is_running.exchange(false, std::memory_order_acquire))
+			return false;
+
+		// The parent still owns its output and the events it buffered
+		g_writer->~trace_writer();
+		g_writer = nullptr;
+
+		// The compression workers did not survive the fork, the pool is leaked
+		g_compression_pool = nullptr;
+
+		close(g_output_fd);
+		g_output_fd = -1;
+
+		// Our pagemap and smaps descriptors and perf events refer to the parent
+		stop_residency_sampling();
+		stop_huge_page_sampling();
+		if (g_is_sampling_faults)
+			g_is_sampling_faults = restart_fault_sampling_after_fork();
+
+		// Stacks the parent already wrote must be in our trace as well
+		abandon_unpublished_stacks();
+		reset_written_stacks();
+		reset_written_modules();
+
+		g_num_staged = 0;
+		g_last_written_timestamp = 0;
+		reset_thread_buffers();
+
+		return create_drain_thread(output_path);
+	}
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/trace/trace_format.h"
+
+#include <cstdint>
+
+namespace vmemprof
+{
+	struct drain_settings
+	{
+		uint32_t	interval_ms;
+
+		// Pending chunks are written at least this often even when they are not full
+		uint32_t	flush_interval_ms;
+
+		// The output path is the Unix socket of a vmemprof daemon rather than a file
+		bool		is_live;
+
+		// We were injected into a running process: the mappings that already exist are
+		// written first and the GOT of every module is patched as modules are loaded
+		bool		is_attached;
+
+		// Mean bytes between two sampled mappings, every mapping is recorded when it is zero
+		uint64_t	sampling_interval;
+
+		// Chunks are compressed on worker threads besides the drain thread
+		chunk_compression	compression;
+		uint32_t			compression_threads;
+
+		// Residency sampling is disabled when the interval is zero
+		uint32_t	residency_interval_ms;
+		uint32_t	residency_page_budget;
+
+		// Page fault sampling is disabled when the period is zero
+		uint32_t	fault_period;
+		uint32_t	fault_ring_pages;
+
+		// Huge page sampling is disabled when the interval is zero
+		uint32_t	huge_page_interval_ms;
+
+		// NUMA sampling is disabled when the interval is zero
+		uint32_t	numa_interval_ms;
+		uint32_t	numa_stride_pages;
+		uint32_t	numa_page_budget;
+		uint32_t	numa_fake_nodes;		// Zero for the real topology
+
+		// Allocator sampling is disabled when the interval is zero
+		uint32_t	allocator_interval_ms;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Starts the thread that periodically moves events from every thread buffer
+	// into the output sink. Returns false if the output could not be opened or the
+	// thread could not be created. In live mode the trace is streamed to the daemon
+	// socket as it is written, a daemon that stops reading blocks the drain thread
+	// and events are dropped when the thread buffers fill up.
+	//
+	// Chunks are compressed in batches by a pool of compression_threads workers
+	// while the drain thread waits, it takes part in the compression.
+	//
+	// The drain thread also replays the events it writes to track the address space,
+	// residency samples are taken over the tracked regions. Page fault samples are
+	// read from their perf rings on every drain. Huge page samples come from smaps
+	// and cover every VMA, tracked or not. NUMA samples look up the node of pages
+	// of the tracked regions. Allocator samples are what the allocators report
+	// about their arenas.
+	////////////////////////////////////////////////////////////////////////////////
+	bool start_drain_thread(const char* output_path, const drain_settings& settings);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Stops the drain thread after a final drain, closes the output and releases
+	// the staging memory.
+	////////////////////////////////////////////////////////////////////////////////
+	void stop_drain_thread();
+
+	////////////////////////////////////////////////////////////////////////////////
+	// The drain thread does not survive a fork, the child starts its own with a new
+	// output. Events buffered by the parent are discarded in the child.
+	////////////////////////////////////////////////////////////////////////////////
+	bool restart_drain_thread_after_fork(const char* output_path);
+}
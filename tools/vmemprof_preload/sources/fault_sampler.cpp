@@ -0,0 +1,281 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "fault_sampler.h"
+#include "raw_syscalls.h"
+#include "stack_table.h"
+
+#include "vmemprof/trace/stack_codec.h"
+
+#include <cstring>
+#include <ctime>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace vmemprof
+{
+	namespace
+	{
+		constexpr uint32_t k_max_cpus = 1024;
+
+		constexpr uint64_t k_sample_type = PERF_SAMPLE_IDENTIFIER | PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_ADDR | PERF_SAMPLE_CALLCHAIN;
+
+		// Records are at most 64 KB, their size is 16 bits
+		constexpr uint32_t k_max_record_size = 64 * 1024;
+
+		struct fault_ring
+		{
+			int						minor_fd;
+			int						major_fd;
+			uint64_t				major_id;		// Identifier of the major fault event in the samples
+			perf_event_mmap_page*	page;			// Control page followed by the data pages
+			uint8_t*				data;
+			uint64_t				data_size;
+			uint32_t				cpu;			// Every sample of the ring ran on this CPU
+		};
+
+		fault_ring g_rings[k_max_cpus];
+		uint32_t g_num_rings = 0;
+
+		uint32_t g_period = 0;
+		uint32_t g_ring_pages = 0;
+
+		// Wrapped records are copied here to be contiguous
+		alignas(8) uint8_t g_record_buffer[k_max_record_size];
+
+		int open_fault_event(uint64_t config, int cpu)
+		{
+			perf_event_attr attributes;
+			std::memset(&attributes, 0, sizeof(attributes));
+			attributes.size = sizeof(attributes);
+			attributes.type = PERF_TYPE_SOFTWARE;
+			attributes.config = config;
+			attributes.sample_period = g_period;
+			attributes.sample_type = k_sample_type;
+			attributes.exclude_kernel = 1;
+			attributes.exclude_hv = 1;
+			attributes.exclude_callchain_kernel = 1;
+
+			// Threads created later are followed, child processes are not
+			attributes.inherit = 1;
+			attributes.inherit_thread = 1;
+			attributes.remove_on_exec = 1;
+
+			// Sample times match the timestamps of the events
+			attributes.use_clockid = 1;
+			attributes.clockid = CLOCK_MONOTONIC;
+
+			return int(syscall(SYS_perf_event_open, &attributes, getpid(), cpu, -1, PERF_FLAG_FD_CLOEXEC));
+		}
+
+		void close_ring(fault_ring& ring)
+		{
+			if (ring.page != nullptr)
+				raw_munmap(ring.page, (g_ring_pages + 1) * size_t(sysconf(_SC_PAGESIZE)));
+			if (ring.major_fd >= 0)
+				close(ring.major_fd);
+			if (ring.minor_fd >= 0)
+				close(ring.minor_fd);
+
+			ring = fault_ring{ -1, -1, 0, nullptr, nullptr, 0, k_unknown_cpu };
+		}
+
+		bool open_ring(int cpu, fault_ring& out_ring)
+		{
+			out_ring = fault_ring{ -1, -1, 0, nullptr, nullptr, 0, uint32_t(cpu) };
+
+			out_ring.minor_fd = open_fault_event(PERF_COUNT_SW_PAGE_FAULTS_MIN, cpu);
+			out_ring.major_fd = open_fault_event(PERF_COUNT_SW_PAGE_FAULTS_MAJ, cpu);
+			if (out_ring.minor_fd < 0 || out_ring.major_fd < 0)
+			{
+				close_ring(out_ring);
+				return false;
+			}
+
+			const size_t page_size = size_t(sysconf(_SC_PAGESIZE));
+			void* ring_memory = raw_mmap(nullptr, (g_ring_pages + 1) * page_size, PROT_READ | PROT_WRITE, MAP_SHARED, out_ring.minor_fd, 0);
+			if (ring_memory == MAP_FAILED)
+			{
+				close_ring(out_ring);
+				return false;
+			}
+
+			out_ring.page = static_cast<perf_event_mmap_page*>(ring_memory);
+			out_ring.data = static_cast<uint8_t*>(ring_memory) + page_size;
+			out_ring.data_size = g_ring_pages * page_size;
+
+			// Major faults are written in the ring of the minor faults, samples tell them apart with their identifier
+			if (ioctl(out_ring.major_fd, PERF_EVENT_IOC_SET_OUTPUT, out_ring.minor_fd) != 0 || ioctl(out_ring.major_fd, PERF_EVENT_IOC_ID, &out_ring.major_id) != 0)
+			{
+				close_ring(out_ring);
+				return false;
+			}
+
+			return true;
+		}
+
+		bool open_rings()
+		{
+			const long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+			for (int cpu = 0; cpu < num_cpus && g_num_rings < k_max_cpus; ++cpu)
+			{
+				// Offline CPUs fail to open, nothing can run there
+				if (open_ring(cpu, g_rings[g_num_rings]))
+					g_num_rings++;
+			}
+
+			return g_num_rings != 0;
+		}
+
+		void close_rings()
+		{
+			for (uint32_t ring_index = 0; ring_index < g_num_rings; ++ring_index)
+				close_ring(g_rings[ring_index]);
+
+			g_num_rings = 0;
+		}
+
+		// Parses a PERF_RECORD_SAMPLE laid out as requested by k_sample_type
+		bool parse_sample(const fault_ring& ring, const uint8_t* record, uint32_t record_size, uint32_t ignored_thread_id, fault_sample& out_sample)
+		{
+			const uint64_t* values = reinterpret_cast<const uint64_t*>(record + sizeof(perf_event_header));
+			const uint64_t* values_end = reinterpret_cast<const uint64_t*>(record + record_size);
+			if (values + 6 > values_end)
+				return false;
+
+			const uint64_t identifier = values[0];
+			const uint64_t instruction_pointer = values[1];
+			const uint32_t thread_id = uint32_t(values[2] >> 32);
+			const uint64_t timestamp = values[3];
+			const uint64_t address = values[4];
+			const uint64_t num_callchain_entries = values[5];
+			const uint64_t* callchain = values + 6;
+
+			if (thread_id == ignored_thread_id || callchain + num_callchain_entries > values_end)
+				return false;
+
+			// Drop the context markers, only user frames are requested
+			uint64_t frames[k_max_stack_frames];
+			uint32_t num_frames = 0;
+			for (uint64_t entry_index = 0; entry_index < num_callchain_entries && num_frames < k_max_stack_frames; ++entry_index)
+			{
+				if (callchain[entry_index] < uint64_t(PERF_CONTEXT_MAX))
+					frames[num_frames++] = callchain[entry_index];
+			}
+
+			out_sample.timestamp = timestamp;
+			out_sample.address = address;
+			out_sample.instruction_pointer = instruction_pointer;
+			out_sample.thread_id = thread_id;
+			out_sample.stack_id = intern_stack(frames, num_frames);
+			out_sample.flags = identifier == ring.major_id ? uint32_t(fault_sample_flags::major) : uint32_t(fault_sample_flags::none);
+			out_sample.cpu = ring.cpu;
+			return true;
+		}
+	}
+
+	bool start_fault_sampling(uint32_t period, uint32_t ring_pages)
+	{
+		g_period = period != 0 ? period : 1;
+		g_ring_pages = ring_pages != 0 && (ring_pages & (ring_pages - 1)) == 0 ? ring_pages : 64;
+
+		if (!initialize_stack_table())
+			return false;
+
+		return open_rings();
+	}
+
+	void stop_fault_sampling()
+	{
+		close_rings();
+	}
+
+	bool restart_fault_sampling_after_fork()
+	{
+		if (g_num_rings == 0)
+			return false;
+
+		// Samples left in the shared rings are the parent's
+		close_rings();
+		return open_rings();
+	}
+
+	uint32_t read_fault_samples(uint32_t ignored_thread_id, fault_sample* out_samples, uint32_t max_samples, uint64_t& out_num_lost)
+	{
+		uint32_t num_samples = 0;
+
+		for (uint32_t ring_index = 0; ring_index < g_num_rings && num_samples < max_samples; ++ring_index)
+		{
+			fault_ring& ring = g_rings[ring_index];
+
+			// The kernel publishes data_head with release semantics, we hand the space back through data_tail
+			const uint64_t head = __atomic_load_n(&ring.page->data_head, __ATOMIC_ACQUIRE);
+			uint64_t tail = ring.page->data_tail;
+
+			while (tail < head && num_samples < max_samples)
+			{
+				const uint64_t record_offset = tail & (ring.data_size - 1);
+				const perf_event_header* header = reinterpret_cast<const perf_event_header*>(ring.data + record_offset);
+				const uint32_t record_size = header->size;
+				if (record_size < sizeof(perf_event_header))
+				{
+					// Corrupted, skip everything that was published
+					tail = head;
+					break;
+				}
+
+				const uint8_t* record = ring.data + record_offset;
+				if (record_offset + record_size > ring.data_size)
+				{
+					// The record wraps around the end of the ring
+					const uint64_t first_part_size = ring.data_size - record_offset;
+					std::memcpy(g_record_buffer, record, first_part_size);
+					std::memcpy(g_record_buffer + first_part_size, ring.data, record_size - first_part_size);
+					record = g_record_buffer;
+				}
+
+				const uint32_t record_type = reinterpret_cast<const perf_event_header*>(record)->type;
+				if (record_type == PERF_RECORD_SAMPLE)
+				{
+					if (parse_sample(ring, record, record_size, ignored_thread_id, out_samples[num_samples]))
+						num_samples++;
+				}
+				else if (record_type == PERF_RECORD_LOST && record_size >= sizeof(perf_event_header) + 2 * sizeof(uint64_t))
+				{
+					// Followed by the event identifier and the number of lost samples
+					out_num_lost += reinterpret_cast<const uint64_t*>(record + sizeof(perf_event_header))[1];
+				}
+
+				tail += record_size;
+			}
+
+			__atomic_store_n(&ring.page->data_tail, tail, __ATOMIC_RELEASE);
+		}
+
+		return num_samples;
+	}
+}
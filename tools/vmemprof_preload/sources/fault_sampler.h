@@ -0,0 +1,61 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/fault_sample.h"
+
+#include <cstdint>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Opens a minor and a major page fault perf event per CPU that sample every
+	// 'period' faults of this process and of the threads it creates later. Both
+	// events of a CPU share one ring of ring_pages pages (a power of two).
+	// Returns false if no event could be opened, e.g. perf_event_paranoid is too
+	// restrictive or the syscall is filtered.
+	////////////////////////////////////////////////////////////////////////////////
+	bool start_fault_sampling(uint32_t period, uint32_t ring_pages);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Closes the events and unmaps their rings.
+	////////////////////////////////////////////////////////////////////////////////
+	void stop_fault_sampling();
+
+	////////////////////////////////////////////////////////////////////////////////
+	// The events and rings inherited through a fork belong to the parent, the
+	// child must not consume them. Opens new events for the child.
+	////////////////////////////////////////////////////////////////////////////////
+	bool restart_fault_sampling_after_fork();
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Reads the samples published in every ring. No syscall is made, the rings are
+	// read through their mapping. Faulting callstacks are interned in the stack
+	// table. Samples of ignored_thread_id are skipped and samples that do not fit
+	// the output are left in their ring for the next call. Samples are in
+	// timestamp order per CPU only. Returns the number of samples written.
+	////////////////////////////////////////////////////////////////////////////////
+	uint32_t read_fault_samples(uint32_t ignored_thread_id, fault_sample* out_samples, uint32_t max_samples, uint64_t& out_num_lost);
+}
@@ -0,0 +1,381 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "got_patcher.h"
+#include "interposer.h"
+#include "raw_syscalls.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// A library loaded with dlopen comes after libc in the global scope, calls from modules already
+// loaded keep binding to libc. Their calls go through the GOT: every PLT stub jumps through a
+// JUMP_SLOT entry and function pointers are loaded from GLOB_DAT entries. We find the entries of the
+// hooked functions in the relocation tables of each module and overwrite them.
+//
+// Modules linked with full RELRO have their GOT read-only after startup, we make its page writable
+// for the duration of the write. Lazy slots that were never resolved point to the PLT resolver,
+// restoring them restores lazy binding.
+//
+// ioctl is only hooked for userfaultfd and every other request would go through us, including those
+// that block for good. It is left alone until the process has a userfaultfd.
+
+namespace vmemprof
+{
+	namespace
+	{
+#if defined(__x86_64__)
+		constexpr uint32_t k_jump_slot_relocation = R_X86_64_JUMP_SLOT;
+		constexpr uint32_t k_global_data_relocation = R_X86_64_GLOB_DAT;
+#elif defined(__aarch64__)
+		constexpr uint32_t k_jump_slot_relocation = R_AARCH64_JUMP_SLOT;
+		constexpr uint32_t k_global_data_relocation = R_AARCH64_GLOB_DAT;
+#else
+		// Nothing is patched, only calls from modules loaded after us are captured
+		constexpr uint32_t k_jump_slot_relocation = ~0U;
+		constexpr uint32_t k_global_data_relocation = ~0U;
+#endif
+
+		// Hooked functions are imported at most twice per module, once per relocation type
+		constexpr uint32_t k_max_patched_slots = 8192;
+
+		struct patched_slot
+		{
+			uintptr_t*	slot;
+			uintptr_t	original;
+			uintptr_t	hook;
+		};
+
+		patched_slot g_patched_slots[k_max_patched_slots];
+		uint32_t g_num_patched_slots = 0;
+
+		bool g_is_patching_ioctl = false;
+
+		struct module_layout
+		{
+			uintptr_t	start;
+			uintptr_t	end;
+			uintptr_t	relro_start;
+			uintptr_t	relro_end;
+			const ElfW(Dyn)* dynamic;
+		};
+
+		struct patch_context
+		{
+			hooked_function		hooks[k_num_hooked_functions];
+			uint32_t			num_hooks;
+			bool				is_complete;
+		};
+
+		module_layout get_module_layout(const dl_phdr_info& info)
+		{
+			const uintptr_t page_size = uintptr_t(sysconf(_SC_PAGESIZE));
+
+			module_layout layout = { UINTPTR_MAX, 0, 0, 0, nullptr };
+			for (uint32_t header_index = 0; header_index < info.dlpi_phnum; ++header_index)
+			{
+				const ElfW(Phdr)& header = info.dlpi_phdr[header_index];
+				const uintptr_t start = info.dlpi_addr + header.p_vaddr;
+				const uintptr_t end = start + header.p_memsz;
+
+				if (header.p_type == PT_LOAD)
+				{
+					layout.start = start < layout.start ? start : layout.start;
+					layout.end = end > layout.end ? end : layout.end;
+				}
+				else if (header.p_type == PT_DYNAMIC)
+					layout.dynamic = reinterpret_cast<const ElfW(Dyn)*>(start);
+				else if (header.p_type == PT_GNU_RELRO)
+				{
+					// The loader only protects the pages the segment covers entirely, the last partial page stays writable
+					layout.relro_start = start & ~(page_size - 1);
+					layout.relro_end = end & ~(page_size - 1);
+				}
+			}
+
+			return layout;
+		}
+
+		bool is_own_module(const module_layout& layout)
+		{
+			const uintptr_t own_function = reinterpret_cast<uintptr_t>(&patch_got);
+			return own_function >= layout.start && own_function < layout.end;
+		}
+
+		int parse_protection(const char* permissions)
+		{
+			int protection = PROT_NONE;
+			protection |= permissions[0] == 'r' ? PROT_READ : 0;
+			protection |= permissions[1] == 'w' ? PROT_WRITE : 0;
+			protection |= permissions[2] == 'x' ? PROT_EXEC : 0;
+			return protection;
+		}
+
+		// Reads the protection of a page from our maps, false when it is not mapped. Allocates nothing,
+		// we can run on a thread stopped anywhere.
+		bool get_page_protection(uintptr_t page, int& out_protection)
+		{
+			const int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				return false;
+
+			char buffer[4096];
+			size_t buffer_size = 0;
+			bool is_found = false;
+
+			while (!is_found)
+			{
+				const ssize_t num_read = read(fd, buffer + buffer_size, sizeof(buffer) - 1 - buffer_size);
+				if (num_read <= 0)
+					break;
+
+				buffer_size += size_t(num_read);
+				buffer[buffer_size] = '\0';
+
+				// Lines look like 'start-end perms offset dev inode path', the last one can be incomplete
+				char* line = buffer;
+				char* line_end;
+				while (!is_found && (line_end = std::strchr(line, '\n')) != nullptr)
+				{
+					char* cursor = line;
+					const uintptr_t start = uintptr_t(strtoull(cursor, &cursor, 16));
+					const uintptr_t end = uintptr_t(strtoull(cursor + 1, &cursor, 16));
+					if (page >= start && page < end && line_end - cursor >= 4)
+					{
+						out_protection = parse_protection(cursor + 1);
+						is_found = true;
+					}
+
+					line = line_end + 1;
+				}
+
+				// Keep the incomplete line, a line longer than the buffer is dropped
+				const size_t num_remaining = size_t(buffer + buffer_size - line);
+				buffer_size = num_remaining < sizeof(buffer) - 1 ? num_remaining : 0;
+				std::memmove(buffer, line, buffer_size);
+			}
+
+			close(fd);
+			return is_found;
+		}
+
+		void write_slot(const module_layout& layout, uintptr_t* slot, uintptr_t value)
+		{
+			const uintptr_t address = reinterpret_cast<uintptr_t>(slot);
+			const bool is_relro = address >= layout.relro_start && address < layout.relro_end;
+
+			const uintptr_t page_size = uintptr_t(sysconf(_SC_PAGESIZE));
+			void* page = reinterpret_cast<void*>(address & ~(page_size - 1));
+
+			// The loader made RELRO pages read-only but the program may have changed them since
+			int protection = PROT_READ | PROT_WRITE;
+			if (is_relro && !get_page_protection(uintptr_t(page), protection))
+				return;
+
+			const bool is_read_only = (protection & PROT_WRITE) == 0;
+			if (is_read_only && raw_mprotect(page, page_size, protection | PROT_WRITE) != 0)
+				return;
+
+			// Other threads load the slot concurrently, they must see either value
+			__atomic_store_n(slot, value, __ATOMIC_RELEASE);
+
+			if (is_read_only)
+				raw_mprotect(page, page_size, protection);
+		}
+
+		void patch_relocations(const dl_phdr_info& info, const module_layout& layout, const ElfW(Rela)* relocations, size_t relocations_size,
+			const ElfW(Sym)* symbols, const char* names, patch_context& context)
+		{
+			const ElfW(Rela)* relocations_end = relocations + relocations_size / sizeof(ElfW(Rela));
+			for (const ElfW(Rela)* relocation = relocations; relocation < relocations_end; ++relocation)
+			{
+				const uint32_t type = uint32_t(ELF64_R_TYPE(relocation->r_info));
+				if (type != k_jump_slot_relocation && type != k_global_data_relocation)
+					continue;
+
+				const char* name = names + symbols[ELF64_R_SYM(relocation->r_info)].st_name;
+				for (uint32_t hook_index = 0; hook_index < context.num_hooks; ++hook_index)
+				{
+					const hooked_function& hook = context.hooks[hook_index];
+					if (std::strcmp(name, hook.name) != 0)
+						continue;
+
+					uintptr_t* slot = reinterpret_cast<uintptr_t*>(info.dlpi_addr + relocation->r_offset);
+					const uintptr_t original = __atomic_load_n(slot, __ATOMIC_RELAXED);
+					if (original == hook.address)
+						break;
+
+					if (g_num_patched_slots == k_max_patched_slots)
+					{
+						context.is_complete = false;
+						break;
+					}
+
+					g_patched_slots[g_num_patched_slots++] = patched_slot{ slot, original, hook.address };
+					write_slot(layout, slot, hook.address);
+					break;
+				}
+			}
+		}
+
+		int patch_module(dl_phdr_info* info, size_t /*info_size*/, void* user_data)
+		{
+			patch_context& context = *static_cast<patch_context*>(user_data);
+
+			const module_layout layout = get_module_layout(*info);
+			if (layout.dynamic == nullptr || layout.start >= layout.end || is_own_module(layout))
+				return 0;
+
+			// The loader relocates the pointers of the dynamic section in place on most targets but not in the vDSO
+			const auto translate = [info](ElfW(Addr) pointer) { return pointer < info->dlpi_addr ? pointer + info->dlpi_addr : pointer; };
+
+			const ElfW(Sym)* symbols = nullptr;
+			const char* names = nullptr;
+			const ElfW(Rela)* plt_relocations = nullptr;
+			size_t plt_relocations_size = 0;
+			bool is_plt_rela = true;
+			const ElfW(Rela)* relocations = nullptr;
+			size_t relocations_size = 0;
+
+			for (const ElfW(Dyn)* entry = layout.dynamic; entry->d_tag != DT_NULL; ++entry)
+			{
+				switch (entry->d_tag)
+				{
+				case DT_SYMTAB:		symbols = reinterpret_cast<const ElfW(Sym)*>(translate(entry->d_un.d_ptr)); break;
+				case DT_STRTAB:		names = reinterpret_cast<const char*>(translate(entry->d_un.d_ptr)); break;
+				case DT_JMPREL:		plt_relocations = reinterpret_cast<const ElfW(Rela)*>(translate(entry->d_un.d_ptr)); break;
+				case DT_PLTRELSZ:	plt_relocations_size = size_t(entry->d_un.d_val); break;
+				case DT_PLTREL:		is_plt_rela = entry->d_un.d_val == DT_RELA; break;
+				case DT_RELA:		relocations = reinterpret_cast<const ElfW(Rela)*>(translate(entry->d_un.d_ptr)); break;
+				case DT_RELASZ:		relocations_size = size_t(entry->d_un.d_val); break;
+				default:			break;
+				}
+			}
+
+			if (symbols == nullptr || names == nullptr)
+				return 0;
+
+			if (plt_relocations != nullptr && is_plt_rela)
+				patch_relocations(*info, layout, plt_relocations, plt_relocations_size, symbols, names, context);
+
+			if (relocations != nullptr)
+				patch_relocations(*info, layout, relocations, relocations_size, symbols, names, context);
+
+			return 0;
+		}
+
+		int restore_module(dl_phdr_info* info, size_t /*info_size*/, void* /*user_data*/)
+		{
+			const module_layout layout = get_module_layout(*info);
+			if (layout.start >= layout.end)
+				return 0;
+
+			// Newest first, a module loaded where an unloaded one was patched reuses its slot addresses
+			for (uint32_t slot_index = g_num_patched_slots; slot_index-- != 0;)
+			{
+				const patched_slot& patched = g_patched_slots[slot_index];
+				const uintptr_t address = reinterpret_cast<uintptr_t>(patched.slot);
+				if (address < layout.start || address >= layout.end)
+					continue;
+
+				if (__atomic_load_n(patched.slot, __ATOMIC_RELAXED) == patched.hook)
+					write_slot(layout, patched.slot, patched.original);
+			}
+
+			return 0;
+		}
+
+		bool has_userfaultfd()
+		{
+			DIR* directory = opendir("/proc/self/fd");
+			if (directory == nullptr)
+				return false;
+
+			bool has_userfaultfd = false;
+			char path[64];
+			char target[64];
+			while (!has_userfaultfd)
+			{
+				const dirent* entry = readdir(directory);
+				if (entry == nullptr)
+					break;
+
+				if (entry->d_name[0] == '.' || snprintf(path, sizeof(path), "/proc/self/fd/%s", entry->d_name) >= int(sizeof(path)))
+					continue;
+
+				const ssize_t target_size = readlink(path, target, sizeof(target) - 1);
+				if (target_size > 0)
+				{
+					target[target_size] = '\0';
+					has_userfaultfd = std::strcmp(target, "anon_inode:[userfaultfd]") == 0;
+				}
+			}
+
+			closedir(directory);
+			return has_userfaultfd;
+		}
+	}
+
+	bool patch_got()
+	{
+		patch_context context;
+		get_hooked_functions(context.hooks);
+		context.num_hooks = 0;
+		context.is_complete = true;
+
+		for (const hooked_function& hook : context.hooks)
+		{
+			if (g_is_patching_ioctl || std::strcmp(hook.name, "ioctl") != 0)
+				context.hooks[context.num_hooks++] = hook;
+		}
+
+		// The loader lock is held while we walk, modules cannot be unloaded under us
+		dl_iterate_phdr(patch_module, &context);
+		return context.is_complete;
+	}
+
+	bool enable_ioctl_patching()
+	{
+		if (g_is_patching_ioctl || !has_userfaultfd())
+			return false;
+
+		g_is_patching_ioctl = true;
+		return true;
+	}
+
+	void restore_got()
+	{
+		dl_iterate_phdr(restore_module, nullptr);
+		g_num_patched_slots = 0;
+		g_is_patching_ioctl = false;
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Points the GOT slots that refer to the hooked functions in every loaded
+	// module but ours to our hooks. Slots already patched are skipped, call it
+	// again when modules are loaded. Returns false if some slots could not be
+	// patched. Only the drain thread patches.
+	////////////////////////////////////////////////////////////////////////////////
+	bool patch_got();
+
+	////////////////////////////////////////////////////////////////////////////////
+	// ioctl is only patched once the process created a userfaultfd. Returns true
+	// when one was found since the last call, patch_got must then be called again.
+	// Only the drain thread patches.
+	////////////////////////////////////////////////////////////////////////////////
+	bool enable_ioctl_patching();
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Restores the slots we patched in the modules that are still loaded. Threads
+	// that already loaded a hook from its slot can still be running it.
+	////////////////////////////////////////////////////////////////////////////////
+	void restore_got();
+}
@@ -0,0 +1,116 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "huge_page_sampler.h"
+
+#include "vmemprof/proc/smaps_poller.h"
+
+#include <cstdio>
+#include <new>
+
+namespace vmemprof
+{
+	namespace
+	{
+		// Samples written to the trace together
+		constexpr uint32_t k_batch_num_samples = 256;
+
+		// Constructed in place when sampling starts, the library constructor runs before the dynamic
+		// initializers of our globals
+		alignas(smaps_poller) uint8_t g_poller_storage[sizeof(smaps_poller)];
+		smaps_poller* g_poller = nullptr;
+
+		constexpr uint32_t k_huge_page_vm_flags = uint32_t(smaps_vm_flags::hugepage) | uint32_t(smaps_vm_flags::no_hugepage) | uint32_t(smaps_vm_flags::hugetlb);
+
+		// Most VMAs are file mappings that can never be backed by huge pages, they are skipped
+		bool is_huge_page_candidate(const smaps_entry& entry)
+		{
+			return entry.is_thp_eligible || entry.anon_huge_pages != 0 || (entry.vm_flags & k_huge_page_vm_flags) != 0;
+		}
+
+		huge_page_sample make_sample(const smaps_entry& entry, uint64_t timestamp, bool is_removed)
+		{
+			huge_page_sample sample;
+			sample.timestamp = timestamp;
+			sample.start = entry.start;
+			sample.end = entry.end;
+			sample.resident_bytes = entry.rss * 1024;
+			sample.anon_huge_bytes = entry.anon_huge_pages * 1024;
+			sample.hugetlb_bytes = (entry.private_hugetlb + entry.shared_hugetlb) * 1024;
+			sample.flags = 0;
+
+			if (is_removed)
+				sample.flags |= huge_page_sample_removed;
+			if (entry.is_thp_eligible)
+				sample.flags |= huge_page_sample_thp_eligible;
+			if ((entry.vm_flags & uint32_t(smaps_vm_flags::hugepage)) != 0)
+				sample.flags |= huge_page_sample_hugepage;
+			if ((entry.vm_flags & uint32_t(smaps_vm_flags::no_hugepage)) != 0)
+				sample.flags |= huge_page_sample_no_hugepage;
+			if ((entry.vm_flags & uint32_t(smaps_vm_flags::hugetlb)) != 0)
+				sample.flags |= huge_page_sample_hugetlb;
+
+			return sample;
+		}
+	}
+
+	bool start_huge_page_sampling()
+	{
+		if (g_poller == nullptr)
+			g_poller = new(g_poller_storage) smaps_poller();
+
+		return !g_poller->open("/proc/self/smaps").any();
+	}
+
+	void stop_huge_page_sampling()
+	{
+		if (g_poller != nullptr)
+			g_poller->close();
+	}
+
+	void sample_huge_pages(trace_writer& writer, uint64_t timestamp)
+	{
+		huge_page_sample samples[k_batch_num_samples];
+		uint32_t num_samples = 0;
+
+		const error_result result = g_poller->poll([&](const smaps_entry& entry, smaps_change change)
+			{
+				// A removed entry is the previous state of the VMA, it was written if it was a candidate then
+				if (!is_huge_page_candidate(entry))
+					return;
+
+				samples[num_samples++] = make_sample(entry, timestamp, change == smaps_change::removed);
+				if (num_samples == k_batch_num_samples)
+				{
+					writer.write_huge_page_samples(samples, num_samples);
+					num_samples = 0;
+				}
+			});
+
+		writer.write_huge_page_samples(samples, num_samples);
+
+		if (result.any())
+			fprintf(stderr, "vmemprof: %s\n", result.c_str());
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/trace/trace_writer.h"
+
+#include <cstdint>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Opens /proc/self/smaps. Returns false if it cannot be read.
+	////////////////////////////////////////////////////////////////////////////////
+	bool start_huge_page_sampling();
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Closes smaps. After a fork it must be reopened, it refers to the parent.
+	////////////////////////////////////////////////////////////////////////////////
+	void stop_huge_page_sampling();
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Polls smaps and writes a sample for every VMA that can be backed by huge
+	// pages and changed since the previous poll, and a removed sample for those
+	// that disappeared. The first poll writes every such VMA.
+	////////////////////////////////////////////////////////////////////////////////
+	void sample_huge_pages(trace_writer& writer, uint64_t timestamp);
+}
@@ -0,0 +1,424 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "interposer.h"
+#include "capture_runtime.h"
+#include "mapping_sampler.h"
+#include "raw_syscalls.h"
+#include "stack_unwinder.h"
+
+#include "vmemprof/core/compiler_utils.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/time_utils.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdint>
+#include <dlfcn.h>
+#include <linux/userfaultfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Interposed virtual memory entry points.
+//
+// Each hook forwards to the kernel then records the call if it changed the address space. Timestamps are
+// sampled after the call returns except for munmap where it is sampled before: a range
+// released by munmap can be reused by a concurrent mmap before munmap returns, sampling
+// early keeps the unmap ordered before the reuse. Every hook publishes when it was entered
+// until its event is recorded, see hook_scope.
+//
+// When mappings are sampled, only the calls that create mappings (mmap, brk and sbrk growth) are
+// sampled. Every other call is recorded: it can change a sampled mapping and telling which ones
+// would cost a lookup on every call.
+//
+// ioctl is hooked for userfaultfd: registering a range changes its VMA flags and UFFDIO_COPY,
+// UFFDIO_ZEROPAGE and UFFDIO_CONTINUE populate it from the handler thread instead of a page fault.
+// Every other request only pays for a compare.
+//
+// Only calls that go through the dynamic linker can be observed. glibc's malloc uses
+// internal aliases and is invisible here, allocators that call mmap (jemalloc, tcmalloc)
+// and application code are captured.
+//
+// When we are injected into a running process with dlopen our exports come after libc's
+// and are never picked, the GOT slots of every other module are patched to the hooks instead.
+
+namespace vmemprof
+{
+	namespace
+	{
+		using brk_func = int (*)(void*);
+		using sbrk_func = void* (*)(intptr_t);
+
+		// The program break is tracked by glibc in user space, we must forward to it instead of the kernel
+		std::atomic<brk_func> g_next_brk{ nullptr };
+		std::atomic<sbrk_func> g_next_sbrk{ nullptr };
+
+		VMEMPROF_NO_INLINE brk_func resolve_next_brk()
+		{
+			brk_func next = reinterpret_cast<brk_func>(dlsym(RTLD_NEXT, "brk"));
+			g_next_brk.store(next, std::memory_order_relaxed);
+			return next;
+		}
+
+		VMEMPROF_NO_INLINE sbrk_func resolve_next_sbrk()
+		{
+			sbrk_func next = reinterpret_cast<sbrk_func>(dlsym(RTLD_NEXT, "sbrk"));
+			g_next_sbrk.store(next, std::memory_order_relaxed);
+			return next;
+		}
+
+		VMEMPROF_FORCE_INLINE brk_func get_next_brk()
+		{
+			brk_func next = g_next_brk.load(std::memory_order_relaxed);
+			return VMEMPROF_LIKELY(next != nullptr) ? next : resolve_next_brk();
+		}
+
+		VMEMPROF_FORCE_INLINE sbrk_func get_next_sbrk()
+		{
+			sbrk_func next = g_next_sbrk.load(std::memory_order_relaxed);
+			return VMEMPROF_LIKELY(next != nullptr) ? next : resolve_next_sbrk();
+		}
+
+		VMEMPROF_FORCE_INLINE void capture(event_type type, uint64_t timestamp, uint64_t address, uint64_t size, uint64_t arg0, uint64_t arg1, uint32_t flags, uint32_t protection)
+		{
+			vm_event event;
+			event.timestamp = timestamp;
+			event.address = address;
+			event.size = size;
+			event.arg0 = arg0;
+			event.arg1 = arg1;
+			event.thread_id = get_thread_id();
+			event.stack_id = capture_stack_id();
+			event.flags = flags;
+			event.protection = protection;
+			event.type = type;
+
+			capture_event(event);
+		}
+
+		// Only the first 64 nodes of a node mask are recorded, max_node counts bits
+		VMEMPROF_FORCE_INLINE uint64_t get_first_nodes(const unsigned long* node_mask, unsigned long max_node)
+		{
+			if (node_mask == nullptr || max_node == 0)
+				return 0;
+
+			const uint64_t nodes = uint64_t(node_mask[0]);
+			return max_node < 64 ? nodes & ((uint64_t(1) << max_node) - 1) : nodes;
+		}
+
+		VMEMPROF_FORCE_INLINE void* hooked_mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset)
+		{
+			hook_scope scope;
+			void* result = raw_mmap(addr, length, prot, flags, fd, offset);
+			if (VMEMPROF_UNLIKELY(result == MAP_FAILED))
+				return result;
+
+			if (should_sample_mapping(length))
+				capture(event_type::mmap, get_timestamp_ns(), uint64_t(result), length, uint64_t(int64_t(fd)), uint64_t(offset), uint32_t(flags), uint32_t(prot));
+			else if ((flags & MAP_FIXED) != 0)
+			{
+				// The skipped mapping replaced whatever was recorded in its range
+				capture(event_type::munmap, get_timestamp_ns(), uint64_t(result), length, 0, 0, 0, 0);
+			}
+
+			return result;
+		}
+
+		VMEMPROF_FORCE_INLINE void* get_mremap_new_address(int flags, va_list args)
+		{
+			return (flags & MREMAP_FIXED) != 0 ? va_arg(args, void*) : nullptr;
+		}
+
+		VMEMPROF_FORCE_INLINE void* hooked_mremap(void* old_address, size_t old_size, size_t new_size, int flags, void* new_address)
+		{
+			hook_scope scope;
+			void* result = raw_mremap(old_address, old_size, new_size, flags, new_address);
+			if (VMEMPROF_LIKELY(result != MAP_FAILED))
+				capture(event_type::mremap, get_timestamp_ns(), uint64_t(result), new_size, uint64_t(old_address), old_size, uint32_t(flags), 0);
+
+			return result;
+		}
+
+		// Records the userfaultfd requests that change the address space or populate it
+		VMEMPROF_NO_INLINE void capture_uffd_ioctl(int fd, unsigned long request, const void* arg, int result)
+		{
+			// Handlers retry on EAGAIN, keep it for them
+			const int saved_errno = errno;
+
+			switch (request)
+			{
+			case UFFDIO_REGISTER:
+			{
+				const uffdio_register* args = static_cast<const uffdio_register*>(arg);
+				if (result == 0)
+					capture(event_type::uffd_register, get_timestamp_ns(), args->range.start, args->range.len, args->mode, uint64_t(int64_t(fd)), 0, 0);
+				break;
+			}
+			case UFFDIO_UNREGISTER:
+			{
+				const uffdio_range* args = static_cast<const uffdio_range*>(arg);
+				if (result == 0)
+					capture(event_type::uffd_unregister, get_timestamp_ns(), args->start, args->len, 0, uint64_t(int64_t(fd)), 0, 0);
+				break;
+			}
+			// A partial population fails with EAGAIN, the bytes it populated are still reported. Other
+			// failures can return before the kernel writes the count.
+			case UFFDIO_COPY:
+			{
+				const uffdio_copy* args = static_cast<const uffdio_copy*>(arg);
+				if ((result == 0 || saved_errno == EAGAIN) && args->copy > 0)
+					capture(event_type::uffd_populate, get_timestamp_ns(), args->dst, uint64_t(args->copy), uint64_t(uffd_populate_op::copy), uint64_t(int64_t(fd)), 0, 0);
+				break;
+			}
+			case UFFDIO_ZEROPAGE:
+			{
+				const uffdio_zeropage* args = static_cast<const uffdio_zeropage*>(arg);
+				if ((result == 0 || saved_errno == EAGAIN) && args->zeropage > 0)
+					capture(event_type::uffd_populate, get_timestamp_ns(), args->range.start, uint64_t(args->zeropage), uint64_t(uffd_populate_op::zeropage), uint64_t(int64_t(fd)), 0, 0);
+				break;
+			}
+#if defined(UFFDIO_CONTINUE)
+			case UFFDIO_CONTINUE:
+			{
+				const uffdio_continue* args = static_cast<const uffdio_continue*>(arg);
+				if ((result == 0 || saved_errno == EAGAIN) && args->mapped > 0)
+					capture(event_type::uffd_populate, get_timestamp_ns(), args->range.start, uint64_t(args->mapped), uint64_t(uffd_populate_op::cont), uint64_t(int64_t(fd)), 0, 0);
+				break;
+			}
+#endif
+			default:
+				break;
+			}
+
+			errno = saved_errno;
+		}
+
+		VMEMPROF_FORCE_INLINE int hooked_ioctl(int fd, unsigned long request, void* arg)
+		{
+			if (VMEMPROF_LIKELY(_IOC_TYPE(request) != UFFDIO))
+				return raw_ioctl(fd, request, arg);
+
+			hook_scope scope;
+			const int result = raw_ioctl(fd, request, arg);
+			capture_uffd_ioctl(fd, request, arg, result);
+			return result;
+		}
+
+		// The hooks are both exported and patched into other modules when we are injected. Patching needs
+		// our own definitions, the address of an exported function resolves to the first one in the global scope.
+		void* hook_mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset) noexcept
+		{
+			return hooked_mmap(addr, length, prot, flags, fd, offset);
+		}
+
+		int hook_munmap(void* addr, size_t length) noexcept
+		{
+			hook_scope scope;
+
+			const int result = raw_munmap(addr, length);
+			if (VMEMPROF_LIKELY(result == 0))
+				capture(event_type::munmap, scope.get_timestamp(), uint64_t(addr), length, 0, 0, 0, 0);
+
+			return result;
+		}
+
+		void* hook_mremap(void* old_address, size_t old_size, size_t new_size, int flags, ...) noexcept
+		{
+			va_list args;
+			va_start(args, flags);
+			void* new_address = get_mremap_new_address(flags, args);
+			va_end(args);
+
+			return hooked_mremap(old_address, old_size, new_size, flags, new_address);
+		}
+
+		int hook_mprotect(void* addr, size_t length, int prot) noexcept
+		{
+			hook_scope scope;
+			const int result = raw_mprotect(addr, length, prot);
+			if (VMEMPROF_LIKELY(result == 0))
+				capture(event_type::mprotect, get_timestamp_ns(), uint64_t(addr), length, 0, 0, 0, uint32_t(prot));
+			else if (errno == ENOMEM)
+				capture(event_type::mprotect, get_timestamp_ns(), uint64_t(addr), length, 0, 0, k_event_flag_partial, uint32_t(prot));
+
+			return result;
+		}
+
+		int hook_madvise(void* addr, size_t length, int advice) noexcept
+		{
+			hook_scope scope;
+			const int result = raw_madvise(addr, length, advice);
+			if (VMEMPROF_LIKELY(result == 0))
+				capture(event_type::madvise, get_timestamp_ns(), uint64_t(addr), length, uint64_t(advice), 0, 0, 0);
+			else if (errno == ENOMEM)
+				capture(event_type::madvise, get_timestamp_ns(), uint64_t(addr), length, uint64_t(advice), 0, k_event_flag_partial, 0);
+
+			return result;
+		}
+
+		int hook_brk(void* addr) noexcept
+		{
+			hook_scope scope;
+			void* old_break = get_next_sbrk()(0);
+
+			const int result = get_next_brk()(addr);
+			if (result == 0 && (uint64_t(addr) <= uint64_t(old_break) || should_sample_mapping(uint64_t(addr) - uint64_t(old_break))))
+				capture(event_type::brk, get_timestamp_ns(), uint64_t(addr), 0, uint64_t(old_break), 0, 0, 0);
+
+			return result;
+		}
+
+		void* hook_sbrk(intptr_t increment) noexcept
+		{
+			hook_scope scope;
+			void* old_break = get_next_sbrk()(increment);
+			if (old_break != reinterpret_cast<void*>(-1) && (increment < 0 || (increment > 0 && should_sample_mapping(uint64_t(increment)))))
+				capture(event_type::sbrk, get_timestamp_ns(), uint64_t(old_break) + uint64_t(increment), 0, uint64_t(old_break), 0, 0, 0);
+
+			return old_break;
+		}
+
+		int hook_ioctl(int fd, unsigned long request, ...) noexcept
+		{
+			// Every request we care about takes a pointer
+			va_list args;
+			va_start(args, request);
+			void* arg = va_arg(args, void*);
+			va_end(args);
+
+			return hooked_ioctl(fd, request, arg);
+		}
+
+		long hook_mbind(void* addr, unsigned long length, int mode, const unsigned long* node_mask, unsigned long max_node, unsigned flags) noexcept
+		{
+			hook_scope scope;
+			const long result = raw_mbind(addr, length, mode, node_mask, max_node, flags);
+			if (result == 0)
+				capture(event_type::mbind, get_timestamp_ns(), uint64_t(addr), length, uint64_t(uint32_t(mode)), get_first_nodes(node_mask, max_node), flags, 0);
+
+			return result;
+		}
+
+		long hook_set_mempolicy(int mode, const unsigned long* node_mask, unsigned long max_node) noexcept
+		{
+			hook_scope scope;
+			const long result = raw_set_mempolicy(mode, node_mask, max_node);
+			if (result == 0)
+				capture(event_type::set_mempolicy, get_timestamp_ns(), 0, 0, uint64_t(uint32_t(mode)), get_first_nodes(node_mask, max_node), 0, 0);
+
+			return result;
+		}
+	}
+
+	void get_hooked_functions(hooked_function (&out_functions)[k_num_hooked_functions])
+	{
+		const hooked_function functions[k_num_hooked_functions] =
+		{
+			{ "mmap", reinterpret_cast<uintptr_t>(&hook_mmap) },
+			{ "mmap64", reinterpret_cast<uintptr_t>(&hook_mmap) },
+			{ "munmap", reinterpret_cast<uintptr_t>(&hook_munmap) },
+			{ "mremap", reinterpret_cast<uintptr_t>(&hook_mremap) },
+			{ "mprotect", reinterpret_cast<uintptr_t>(&hook_mprotect) },
+			{ "madvise", reinterpret_cast<uintptr_t>(&hook_madvise) },
+			{ "brk", reinterpret_cast<uintptr_t>(&hook_brk) },
+			{ "sbrk", reinterpret_cast<uintptr_t>(&hook_sbrk) },
+			{ "mbind", reinterpret_cast<uintptr_t>(&hook_mbind) },
+			{ "set_mempolicy", reinterpret_cast<uintptr_t>(&hook_set_mempolicy) },
+			{ "ioctl", reinterpret_cast<uintptr_t>(&hook_ioctl) },
+		};
+
+		for (uint32_t function_index = 0; function_index < k_num_hooked_functions; ++function_index)
+			out_functions[function_index] = functions[function_index];
+	}
+}
+
+using namespace vmemprof;
+
+extern "C" VMEMPROF_EXPORT void* mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset) noexcept
+{
+	return hooked_mmap(addr, length, prot, flags, fd, offset);
+}
+
+extern "C" VMEMPROF_EXPORT void* mmap64(void* addr, size_t length, int prot, int flags, int fd, off64_t offset) noexcept
+{
+	return hooked_mmap(addr, length, prot, flags, fd, off_t(offset));
+}
+
+extern "C" VMEMPROF_EXPORT int munmap(void* addr, size_t length) noexcept
+{
+	return hook_munmap(addr, length);
+}
+
+extern "C" VMEMPROF_EXPORT void* mremap(void* old_address, size_t old_size, size_t new_size, int flags, ...) noexcept
+{
+	va_list args;
+	va_start(args, flags);
+	void* new_address = get_mremap_new_address(flags, args);
+	va_end(args);
+
+	return hooked_mremap(old_address, old_size, new_size, flags, new_address);
+}
+
+extern "C" VMEMPROF_EXPORT int mprotect(void* addr, size_t length, int prot) noexcept
+{
+	return hook_mprotect(addr, length, prot);
+}
+
+extern "C" VMEMPROF_EXPORT int madvise(void* addr, size_t length, int advice) noexcept
+{
+	return hook_madvise(addr, length, advice);
+}
+
+extern "C" VMEMPROF_EXPORT int brk(void* addr) noexcept
+{
+	return hook_brk(addr);
+}
+
+extern "C" VMEMPROF_EXPORT void* sbrk(intptr_t increment) noexcept
+{
+	return hook_sbrk(increment);
+}
+
+extern "C" VMEMPROF_EXPORT int ioctl(int fd, unsigned long request, ...) noexcept
+{
+	va_list args;
+	va_start(args, request);
+	void* arg = va_arg(args, void*);
+	va_end(args);
+
+	return hooked_ioctl(fd, request, arg);
+}
+
+// The NUMA policy calls are syscall wrappers provided by libnuma, ours take precedence
+extern "C" VMEMPROF_EXPORT long mbind(void* addr, unsigned long length, int mode, const unsigned long* node_mask, unsigned long max_node, unsigned flags) noexcept
+{
+	return hook_mbind(addr, length, mode, node_mask, max_node, flags);
+}
+
+extern "C" VMEMPROF_EXPORT long set_mempolicy(int mode, const unsigned long* node_mask, unsigned long max_node) noexcept
+{
+	return hook_set_mempolicy(mode, node_mask, max_node);
+}
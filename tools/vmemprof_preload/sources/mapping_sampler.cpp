@@ -0,0 +1,96 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "mapping_sampler.h"
+#include "capture_runtime.h"
+
+#include "vmemprof/core/time_utils.h"
+
+#include <cmath>
+#include <cstdint>
+
+namespace vmemprof
+{
+	thread_local int64_t t_bytes_until_sample = 0;
+
+	namespace
+	{
+		// The largest gap we draw, keeps the countdown far from overflowing
+		constexpr int64_t k_max_sample_gap = INT64_C(1) << 60;
+
+		uint64_t g_sampling_interval = 0;
+
+		// xorshift64* state of the calling thread, zero until its first sampled mapping
+		thread_local uint64_t t_random_state = 0;
+
+		uint64_t next_random()
+		{
+			uint64_t state = t_random_state;
+			state ^= state >> 12;
+			state ^= state << 25;
+			state ^= state >> 27;
+			t_random_state = state;
+			return state * 0x2545F4914F6CDD1DULL;
+		}
+
+		int64_t pick_sample_gap()
+		{
+			// Uniform in (0, 1], its negated log is exponentially distributed with a mean of 1
+			const double uniform = double((next_random() >> 11) + 1) * (1.0 / 9007199254740992.0);
+			const double gap = -std::log(uniform) * double(g_sampling_interval);
+			return gap < double(k_max_sample_gap) ? int64_t(gap) + 1 : k_max_sample_gap;
+		}
+	}
+
+	void set_sampling_interval(uint64_t sampling_interval)
+	{
+		g_sampling_interval = sampling_interval;
+	}
+
+	bool pick_sampled_mapping(uint64_t size)
+	{
+		if (g_sampling_interval == 0)
+			return true;
+
+		if (VMEMPROF_UNLIKELY(t_random_state == 0))
+		{
+			// Threads start at a random point between two samples, seeded apart by their id (splitmix64)
+			uint64_t seed = get_timestamp_ns() ^ (uint64_t(get_thread_id()) << 32);
+			seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBULL;
+			t_random_state = (seed ^ (seed >> 31)) | 1;
+
+			const int64_t bytes_until_sample = pick_sample_gap() - int64_t(size);
+			if (bytes_until_sample > 0)
+			{
+				t_bytes_until_sample = bytes_until_sample;
+				return false;
+			}
+		}
+
+		// Gaps are memoryless, the next one starts at the end of this mapping
+		t_bytes_until_sample = pick_sample_gap();
+		return true;
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/compiler_utils.h"
+
+#include <cstdint>
+
+namespace vmemprof
+{
+	// Bytes the calling thread can still map before its next sampled mapping
+	extern thread_local int64_t t_bytes_until_sample;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Sets the mean bytes between two sampled mappings, every mapping is recorded
+	// when it is zero. Set before capture starts, the value is read without
+	// synchronization by the hooks.
+	////////////////////////////////////////////////////////////////////////////////
+	void set_sampling_interval(uint64_t sampling_interval);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// The countdown of the calling thread ran out: returns true if the mapping is
+	// sampled and draws the distance to the next sample.
+	////////////////////////////////////////////////////////////////////////////////
+	bool pick_sampled_mapping(uint64_t size);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns true if a new mapping of 'size' bytes must be recorded.
+	//
+	// Sample points are spread over the bytes mapped by each thread with
+	// exponentially distributed gaps of mean sampling_interval, a mapping is
+	// recorded when a sample point falls in it. Unsampled mappings only
+	// decrement the countdown of the calling thread. Without sampling the
+	// countdown stays at zero and every mapping takes the slow path, which
+	// records it.
+	////////////////////////////////////////////////////////////////////////////////
+	VMEMPROF_FORCE_INLINE bool should_sample_mapping(uint64_t size)
+	{
+		const int64_t bytes_until_sample = t_bytes_until_sample - int64_t(size);
+		if (VMEMPROF_LIKELY(bytes_until_sample > 0))
+		{
+			t_bytes_until_sample = bytes_until_sample;
+			return false;
+		}
+
+		return pick_sampled_mapping(size);
+	}
+}
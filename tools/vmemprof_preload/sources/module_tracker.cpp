@@ -0,0 +1,214 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "module_tracker.h"
+
+#include "vmemprof/core/module_info.h"
+#include "vmemprof/trace/trace_writer.h"
+
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <link.h>
+#include <sys/auxv.h>
+#include <unistd.h>
+#include <vector>
+
+// Stacks hold raw return addresses, symbolizing them in the profiled process would cost
+// startup time and memory. We record the module map instead and symbolize offline.
+//
+// The dynamic linker counts the modules it loads and unloads, we walk its list again only
+// when these counters change. Build ids are read from the note segments already mapped.
+
+namespace vmemprof
+{
+	namespace
+	{
+		// Modules we wrote are remembered by their loaded range
+		constexpr uint32_t k_max_written_modules = 4096;
+
+		struct module_range
+		{
+			uint64_t	start;
+			uint64_t	end;
+		};
+
+		module_range g_written_modules[k_max_written_modules];
+		uint32_t g_num_written_modules = 0;
+
+		// Loader counters when we last walked its list
+		unsigned long long g_num_loader_adds = ~0ULL;
+		unsigned long long g_num_loader_subs = ~0ULL;
+
+		struct module_list
+		{
+			std::vector<module_info>	modules;
+			std::vector<size_t>			path_offsets;
+			std::vector<char>			paths;
+			uint64_t					timestamp;
+		};
+
+		bool has_loader_counters(size_t info_size)
+		{
+			return info_size >= offsetof(dl_phdr_info, dlpi_subs) + sizeof(dl_phdr_info::dlpi_subs);
+		}
+
+		int read_loader_counters(dl_phdr_info* info, size_t info_size, void* user_data)
+		{
+			bool& is_changed = *static_cast<bool*>(user_data);
+			is_changed = !has_loader_counters(info_size) || info->dlpi_adds != g_num_loader_adds || info->dlpi_subs != g_num_loader_subs;
+
+			if (has_loader_counters(info_size))
+			{
+				g_num_loader_adds = info->dlpi_adds;
+				g_num_loader_subs = info->dlpi_subs;
+			}
+
+			// The counters are the same for every module
+			return 1;
+		}
+
+		bool is_written(const module_range& range)
+		{
+			for (uint32_t module_index = 0; module_index < g_num_written_modules; ++module_index)
+			{
+				if (g_written_modules[module_index].start == range.start && g_written_modules[module_index].end == range.end)
+					return true;
+			}
+
+			return false;
+		}
+
+		void read_build_id(const dl_phdr_info& info, module_info& module)
+		{
+			for (uint32_t header_index = 0; header_index < info.dlpi_phnum; ++header_index)
+			{
+				const ElfW(Phdr)& header = info.dlpi_phdr[header_index];
+				if (header.p_type != PT_NOTE)
+					continue;
+
+				const uint8_t* note = reinterpret_cast<const uint8_t*>(info.dlpi_addr + header.p_vaddr);
+				const uint8_t* notes_end = note + header.p_memsz;
+
+				// Names and descriptors are padded to 4 bytes
+				while (note + sizeof(ElfW(Nhdr)) <= notes_end)
+				{
+					const ElfW(Nhdr)& note_header = *reinterpret_cast<const ElfW(Nhdr)*>(note);
+					const uint8_t* name = note + sizeof(ElfW(Nhdr));
+					const uint8_t* descriptor = name + ((note_header.n_namesz + 3) & ~3U);
+					const uint8_t* next_note = descriptor + ((note_header.n_descsz + 3) & ~3U);
+					if (next_note > notes_end)
+						break;
+
+					if (note_header.n_type == NT_GNU_BUILD_ID && note_header.n_namesz == 4 && std::memcmp(name, "GNU", 4) == 0 && note_header.n_descsz <= k_max_build_id_size)
+					{
+						module.build_id_size = note_header.n_descsz;
+						std::memcpy(module.build_id, descriptor, note_header.n_descsz);
+						return;
+					}
+
+					note = next_note;
+				}
+			}
+		}
+
+		int read_module(dl_phdr_info* info, size_t /*info_size*/, void* user_data)
+		{
+			module_list& list = *static_cast<module_list*>(user_data);
+
+			module_range range = { UINT64_MAX, 0 };
+			for (uint32_t header_index = 0; header_index < info->dlpi_phnum; ++header_index)
+			{
+				const ElfW(Phdr)& header = info->dlpi_phdr[header_index];
+				if (header.p_type != PT_LOAD)
+					continue;
+
+				const uint64_t start = info->dlpi_addr + header.p_vaddr;
+				const uint64_t end = start + header.p_memsz;
+				range.start = start < range.start ? start : range.start;
+				range.end = end > range.end ? end : range.end;
+			}
+
+			if (range.start >= range.end || is_written(range) || g_num_written_modules + list.modules.size() >= k_max_written_modules)
+				return 0;
+
+			module_info module;
+			std::memset(&module, 0, sizeof(module));
+			module.timestamp = list.timestamp;
+			module.load_address = info->dlpi_addr;
+			module.start = range.start;
+			module.end = range.end;
+			read_build_id(*info, module);
+
+			// The main executable is the first module and has no name. The vDSO has a name but no file.
+			char executable_path[PATH_MAX];
+			const char* path = info->dlpi_name != nullptr ? info->dlpi_name : "";
+			if (range.start == getauxval(AT_SYSINFO_EHDR))
+				path = "";
+			else if (path[0] == '\0' && list.modules.empty() && g_num_written_modules == 0)
+			{
+				const ssize_t path_length = readlink("/proc/self/exe", executable_path, sizeof(executable_path) - 1);
+				executable_path[path_length > 0 ? path_length : 0] = '\0';
+				path = executable_path;
+			}
+
+			// Names are owned by the loader, copy them before it releases its lock
+			module.path_length = uint32_t(std::strlen(path));
+			list.path_offsets.push_back(list.paths.size());
+			list.paths.insert(list.paths.end(), path, path + module.path_length);
+			list.modules.push_back(module);
+			return 0;
+		}
+	}
+
+	bool write_new_modules(trace_writer& writer, uint64_t timestamp)
+	{
+		bool is_changed = false;
+		dl_iterate_phdr(read_loader_counters, &is_changed);
+		if (!is_changed)
+			return false;
+
+		module_list list;
+		list.timestamp = timestamp;
+		dl_iterate_phdr(read_module, &list);
+
+		for (size_t module_index = 0; module_index < list.modules.size(); ++module_index)
+		{
+			module_info& module = list.modules[module_index];
+			module.path = list.paths.data() + list.path_offsets[module_index];
+
+			g_written_modules[g_num_written_modules++] = module_range{ module.start, module.end };
+		}
+
+		writer.write_modules(list.modules.data(), uint32_t(list.modules.size()));
+		return true;
+	}
+
+	void reset_written_modules()
+	{
+		g_num_written_modules = 0;
+		g_num_loader_adds = ~0ULL;
+		g_num_loader_subs = ~0ULL;
+	}
+}
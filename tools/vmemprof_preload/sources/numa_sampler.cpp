@@ -0,0 +1,214 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "numa_sampler.h"
+#include "raw_syscalls.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <unistd.h>
+
+namespace vmemprof
+{
+	namespace
+	{
+		// Pages looked up per move_pages call
+		constexpr uint32_t k_batch_num_pages = 1024;
+
+		// CPUs beyond this are reported on node 0
+		constexpr uint32_t k_max_cpus = 4096;
+
+		uint32_t g_stride_pages = 0;
+		uint32_t g_page_budget = 0;
+		uint32_t g_fake_nodes = 0;
+		uint64_t g_page_size = 0;
+
+		uint16_t g_cpu_nodes[k_max_cpus];
+		uint32_t g_num_cpus = 0;
+		uint32_t g_num_nodes = 0;
+
+		// Where the next tick resumes
+		uint64_t g_cursor = 0;
+
+		// Parses a sysfs CPU list such as '0-3,8-11' and assigns its CPUs to a node
+		void assign_cpu_list(const char* list, uint16_t node)
+		{
+			const char* cursor = list;
+			while (*cursor >= '0' && *cursor <= '9')
+			{
+				char* end;
+				const unsigned long first = strtoul(cursor, &end, 10);
+				unsigned long last = first;
+				if (*end == '-')
+					last = strtoul(end + 1, &end, 10);
+
+				for (unsigned long cpu = first; cpu <= last && cpu < k_max_cpus; ++cpu)
+				{
+					g_cpu_nodes[cpu] = node;
+					g_num_cpus = std::max(g_num_cpus, uint32_t(cpu + 1));
+				}
+
+				cursor = *end == ',' ? end + 1 : end;
+			}
+		}
+
+		void read_topology()
+		{
+			g_num_cpus = 0;
+			g_num_nodes = 0;
+
+			const long num_configured_cpus = sysconf(_SC_NPROCESSORS_CONF);
+			const uint32_t num_cpus = uint32_t(std::min<long>(std::max<long>(num_configured_cpus, 1), k_max_cpus));
+
+			if (g_fake_nodes != 0)
+			{
+				for (uint32_t cpu = 0; cpu < num_cpus; ++cpu)
+					g_cpu_nodes[cpu] = uint16_t(cpu % g_fake_nodes);
+
+				g_num_cpus = num_cpus;
+				g_num_nodes = g_fake_nodes;
+				return;
+			}
+
+			std::fill(g_cpu_nodes, g_cpu_nodes + k_max_cpus, uint16_t(0));
+
+			DIR* directory = opendir("/sys/devices/system/node");
+			if (directory != nullptr)
+			{
+				while (const dirent* entry = readdir(directory))
+				{
+					char* end;
+					if (entry->d_name[0] != 'n' || entry->d_name[1] != 'o' || entry->d_name[2] != 'd' || entry->d_name[3] != 'e')
+						continue;
+
+					const unsigned long node = strtoul(entry->d_name + 4, &end, 10);
+					if (end == entry->d_name + 4 || *end != '\0' || node > UINT16_MAX)
+						continue;
+
+					char path[128];
+					snprintf(path, sizeof(path), "/sys/devices/system/node/node%lu/cpulist", node);
+
+					FILE* file = fopen(path, "r");
+					if (file == nullptr)
+						continue;
+
+					char list[4096];
+					if (fgets(list, sizeof(list), file) != nullptr)
+						assign_cpu_list(list, uint16_t(node));
+					fclose(file);
+
+					g_num_nodes = std::max(g_num_nodes, uint32_t(node + 1));
+				}
+
+				closedir(directory);
+			}
+
+			// Without NUMA support in the kernel everything is on node 0
+			g_num_cpus = std::max(g_num_cpus, num_cpus);
+			g_num_nodes = std::max(g_num_nodes, 1U);
+		}
+	}
+
+	void start_numa_sampling(uint32_t stride_pages, uint32_t page_budget, uint32_t fake_nodes)
+	{
+		g_stride_pages = std::max(stride_pages, 1U);
+		g_page_budget = page_budget;
+		g_fake_nodes = fake_nodes;
+		g_page_size = uint64_t(sysconf(_SC_PAGESIZE));
+		g_cursor = 0;
+
+		read_topology();
+	}
+
+	void write_numa_topology(trace_writer& writer, uint64_t timestamp)
+	{
+		writer.write_numa_topology(timestamp, g_cpu_nodes, g_num_cpus, g_num_nodes, g_fake_nodes != 0 ? k_numa_topology_fake : 0);
+	}
+
+	uint32_t sample_numa_nodes(const address_space& space, uint64_t timestamp, numa_page_sample* out_samples, uint32_t max_samples)
+	{
+		const uint64_t stride = g_stride_pages * g_page_size;
+		uint64_t num_remaining_pages = g_page_budget;
+		uint32_t num_samples = 0;
+
+		void* pages[k_batch_num_pages];
+		int status[k_batch_num_pages];
+		uint32_t num_pages = 0;
+
+		const auto flush_batch = [&]()
+		{
+			// Without a node array move_pages only reports where the pages are
+			if (num_pages != 0 && raw_move_pages(0, num_pages, pages, nullptr, status, 0) == 0)
+			{
+				for (uint32_t page_index = 0; page_index < num_pages && num_samples < max_samples; ++page_index)
+				{
+					if (status[page_index] < 0)
+						continue;
+
+					const uint64_t address = uint64_t(pages[page_index]);
+					const uint32_t node = g_fake_nodes != 0 ? uint32_t((address >> 21) % g_fake_nodes) : uint32_t(status[page_index]);
+					out_samples[num_samples++] = numa_page_sample{ timestamp, address, node };
+				}
+			}
+
+			num_pages = 0;
+		};
+
+		const auto scan_range = [&](uint64_t range_start, uint64_t range_end)
+		{
+			space.for_each_region(range_start, range_end, [&](const vma_region& region)
+				{
+					// The grid starts at the region start so that small regions get sampled too, the same pages are sampled on every pass
+					const uint64_t first = std::max(region.start, range_start);
+					uint64_t address = region.start + (first - region.start + stride - 1) / stride * stride;
+					for (; address < region.end && num_remaining_pages != 0; address += stride)
+					{
+						pages[num_pages++] = reinterpret_cast<void*>(address);
+						num_remaining_pages--;
+
+						if (num_pages == k_batch_num_pages)
+							flush_batch();
+					}
+
+					g_cursor = std::min(address, region.end);
+					return num_remaining_pages != 0 && num_samples < max_samples;
+				});
+
+			return num_remaining_pages != 0 && num_samples < max_samples;
+		};
+
+		// Resume where the previous tick stopped and wrap around once at the end
+		const uint64_t tick_start = g_cursor;
+		if (num_remaining_pages != 0 && max_samples != 0 && scan_range(tick_start, UINT64_MAX))
+		{
+			g_cursor = 0;
+			scan_range(0, tick_start);
+		}
+
+		flush_batch();
+		return num_samples;
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/core/numa_sample.h"
+#include "vmemprof/trace/trace_writer.h"
+
+#include <cstdint>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Reads the CPU to node map of the machine from sysfs. With fake_nodes set,
+	// CPUs and present pages are spread over that many made up nodes instead, CPU
+	// c is on node c % fake_nodes and a page on the node of its 2 MB block modulo
+	// fake_nodes, so that remote placement can be tested on a single node box.
+	////////////////////////////////////////////////////////////////////////////////
+	void start_numa_sampling(uint32_t stride_pages, uint32_t page_budget, uint32_t fake_nodes);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Writes the topology read by start_numa_sampling, once per trace.
+	////////////////////////////////////////////////////////////////////////////////
+	void write_numa_topology(trace_writer& writer, uint64_t timestamp);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Looks up the node of one page every stride_pages in the tracked regions with
+	// move_pages, resuming from where the previous tick stopped. At most
+	// page_budget pages are looked up per tick. Returns the number of samples
+	// written, pages that are not present are skipped.
+	////////////////////////////////////////////////////////////////////////////////
+	uint32_t sample_numa_nodes(const address_space& space, uint64_t timestamp, numa_page_sample* out_samples, uint32_t max_samples);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/compiler_utils.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// The hooks forward to the kernel directly instead of resolving the next symbol with dlsym.
+// This avoids a lookup on first use (dlsym can itself allocate and recurse into us) and
+// keeps the forwarding cost to a single syscall instruction.
+
+namespace vmemprof
+{
+	VMEMPROF_FORCE_INLINE void* raw_mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset)
+	{
+		return reinterpret_cast<void*>(syscall(SYS_mmap, addr, length, prot, flags, fd, offset));
+	}
+
+	VMEMPROF_FORCE_INLINE int raw_munmap(void* addr, size_t length)
+	{
+		return int(syscall(SYS_munmap, addr, length));
+	}
+
+	VMEMPROF_FORCE_INLINE void* raw_mremap(void* old_address, size_t old_size, size_t new_size, int flags, void* new_address)
+	{
+		return reinterpret_cast<void*>(syscall(SYS_mremap, old_address, old_size, new_size, flags, new_address));
+	}
+
+	VMEMPROF_FORCE_INLINE int raw_mprotect(void* addr, size_t length, int prot)
+	{
+		return int(syscall(SYS_mprotect, addr, length, prot));
+	}
+
+	VMEMPROF_FORCE_INLINE int raw_madvise(void* addr, size_t length, int advice)
+	{
+		return int(syscall(SYS_madvise, addr, length, advice));
+	}
+
+	VMEMPROF_FORCE_INLINE int raw_ioctl(int fd, unsigned long request, void* arg)
+	{
+		return int(syscall(SYS_ioctl, fd, request, arg));
+	}
+
+	VMEMPROF_FORCE_INLINE long raw_mbind(void* addr, unsigned long length, int mode, const unsigned long* node_mask, unsigned long max_node, unsigned flags)
+	{
+		return syscall(SYS_mbind, addr, length, mode, node_mask, max_node, flags);
+	}
+
+	VMEMPROF_FORCE_INLINE long raw_set_mempolicy(int mode, const unsigned long* node_mask, unsigned long max_node)
+	{
+		return syscall(SYS_set_mempolicy, mode, node_mask, max_node);
+	}
+
+	VMEMPROF_FORCE_INLINE long raw_move_pages(int pid, unsigned long count, void** pages, const int* nodes, int* status, int flags)
+	{
+		return syscall(SYS_move_pages, pid, count, pages, nodes, status, flags);
+	}
+
+	VMEMPROF_FORCE_INLINE uint32_t raw_gettid()
+	{
+		return uint32_t(syscall(SYS_gettid));
+	}
+}
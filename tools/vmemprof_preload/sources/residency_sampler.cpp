@@ -0,0 +1,63 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "residency_sampler.h"
+
+#include "vmemprof/proc/residency_scanner.h"
+
+#include <new>
+
+namespace vmemprof
+{
+	namespace
+	{
+		// Constructed in place when sampling starts, the library constructor runs before the dynamic
+		// initializers of our globals
+		alignas(residency_scanner) uint8_t g_scanner_storage[sizeof(residency_scanner)];
+		residency_scanner* g_scanner = nullptr;
+	}
+
+	void start_residency_sampling(uint32_t page_budget)
+	{
+		stop_residency_sampling();
+
+		// Only fails for other processes, we fall back to mincore
+		g_scanner = new(g_scanner_storage) residency_scanner();
+		g_scanner->open(0, page_budget);
+	}
+
+	void stop_residency_sampling()
+	{
+		if (g_scanner == nullptr)
+			return;
+
+		g_scanner->~residency_scanner();
+		g_scanner = nullptr;
+	}
+
+	uint32_t sample_residency(const address_space& space, uint64_t timestamp, residency_sample* out_samples, uint32_t max_samples)
+	{
+		return g_scanner != nullptr ? g_scanner->sample(space, timestamp, out_samples, max_samples) : 0;
+	}
+}
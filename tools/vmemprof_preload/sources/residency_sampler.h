@@ -0,0 +1,52 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/analysis/address_space.h"
+#include "vmemprof/core/residency_sample.h"
+
+#include <cstdint>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// Opens /proc/self/pagemap, mincore is used instead when it cannot be read.
+	// At most page_budget pages are scanned per sampling tick.
+	////////////////////////////////////////////////////////////////////////////////
+	void start_residency_sampling(uint32_t page_budget);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Closes pagemap. After a fork it must be reopened, it refers to the parent.
+	////////////////////////////////////////////////////////////////////////////////
+	void stop_residency_sampling();
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Scans the regions of the tracked address space from where the previous tick
+	// stopped, wrapping around at the end. The scan stops once the page budget is
+	// spent or the output is full, regions larger than the budget are scanned over
+	// several ticks. Returns the number of samples written.
+	////////////////////////////////////////////////////////////////////////////////
+	uint32_t sample_residency(const address_space& space, uint64_t timestamp, residency_sample* out_samples, uint32_t max_samples);
+}
@@ -0,0 +1,249 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "stack_table.h"
+#include "raw_syscalls.h"
+
+#include "vmemprof/core/event.h"
+#include "vmemprof/trace/stack_codec.h"
+#include "vmemprof/trace/trace_writer.h"
+
+#include <atomic>
+#include <cstring>
+#include <sched.h>
+
+// Stacks are interned by every capturing thread, the table never blocks them.
+//
+// A thread inserting a stack first claims an empty slot, then allocates its id and frames,
+// publishes the entry and finally stores the id in the slot. Threads probing a claimed slot
+// wait for its id: the stack being inserted might be theirs. Slots are never removed.
+//
+// Ids are allocated in claim order but entries are published in any order, the drain
+// thread writes them in id order and waits for the ones still being filled. An entry that
+// stays unpublished for too long ends the drain's writes, the next drain resumes from it.
+
+namespace vmemprof
+{
+	namespace
+	{
+		// Open addressing, the table is kept at most half full
+		constexpr uint32_t k_num_slots = 1 << 20;
+		constexpr uint32_t k_max_stacks = k_num_slots / 2;
+
+		// Frames of every stack, reserved but only committed as they are written
+		constexpr uint64_t k_frame_pool_capacity = uint64_t(k_max_stacks) * 32;
+
+		// A slot being filled, its id is not known yet
+		constexpr uint32_t k_claimed_slot = ~0U;
+
+		// Entry states besides its number of frames
+		constexpr uint32_t k_unpublished_entry = 0;
+		constexpr uint32_t k_abandoned_entry = ~0U;
+
+		// A thread that dies or forks away while inserting never publishes its slot, we stop waiting eventually
+		constexpr uint32_t k_max_wait_iterations = 1 << 16;
+
+		struct stack_entry
+		{
+			uint64_t				hash;
+			uint64_t				first_frame;		// Offset in the frame pool
+			std::atomic<uint32_t>	num_frames;			// Published last
+			uint32_t				padding;
+		};
+
+		std::atomic<uint32_t>* g_slots = nullptr;		// Stack ids, zero when empty
+		stack_entry* g_entries = nullptr;				// Indexed by stack id
+		uint64_t* g_frame_pool = nullptr;
+
+		std::atomic<uint32_t> g_num_stacks{ 0 };
+		std::atomic<uint64_t> g_frame_pool_size{ 0 };
+
+		// Only touched by the drain thread
+		uint32_t g_num_written_stacks = 0;
+
+		uint64_t hash_frames(const uint64_t* frames, uint32_t num_frames)
+		{
+			// FNV-1a over 64 bit words
+			uint64_t hash = 0xCBF29CE484222325ULL;
+			for (uint32_t frame_index = 0; frame_index < num_frames; ++frame_index)
+				hash = (hash ^ frames[frame_index]) * 0x100000001B3ULL;
+
+			return hash ^ (hash >> 32);
+		}
+
+		void* reserve_memory(uint64_t size)
+		{
+			void* memory = raw_mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			return memory != MAP_FAILED ? memory : nullptr;
+		}
+
+		void wait(uint32_t iteration)
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			if (iteration < 64)
+			{
+				__builtin_ia32_pause();
+				return;
+			}
+#else
+			(void)iteration;
+#endif
+
+			sched_yield();
+		}
+
+		uint32_t insert_stack(std::atomic<uint32_t>& slot, uint64_t hash, const uint64_t* frames, uint32_t num_frames)
+		{
+			// Ids are only claimed while some are left, a counter running past the end would wrap around
+			uint32_t num_stacks = g_num_stacks.load(std::memory_order_relaxed);
+			do
+			{
+				if (num_stacks >= k_max_stacks)
+				{
+					// The table is full, waiting threads will find the slot empty again and fail the same way
+					slot.store(k_invalid_stack_id, std::memory_order_release);
+					return k_invalid_stack_id;
+				}
+			} while (!g_num_stacks.compare_exchange_weak(num_stacks, num_stacks + 1, std::memory_order_relaxed));
+
+			const uint32_t stack_id = num_stacks + 1;
+
+			stack_entry& entry = g_entries[stack_id];
+
+			const uint64_t first_frame = g_frame_pool_size.fetch_add(num_frames, std::memory_order_relaxed);
+			if (first_frame + num_frames > k_frame_pool_capacity)
+			{
+				// The id is already allocated, the drain thread skips it
+				entry.num_frames.store(k_abandoned_entry, std::memory_order_release);
+				slot.store(k_invalid_stack_id, std::memory_order_release);
+				return k_invalid_stack_id;
+			}
+
+			entry.hash = hash;
+			entry.first_frame = first_frame;
+			std::memcpy(g_frame_pool + first_frame, frames, num_frames * sizeof(uint64_t));
+			entry.num_frames.store(num_frames, std::memory_order_release);
+
+			slot.store(stack_id, std::memory_order_release);
+			return stack_id;
+		}
+	}
+
+	bool initialize_stack_table()
+	{
+		if (g_slots != nullptr)
+			return true;
+
+		g_slots = static_cast<std::atomic<uint32_t>*>(reserve_memory(k_num_slots * sizeof(std::atomic<uint32_t>)));
+		g_entries = static_cast<stack_entry*>(reserve_memory((k_max_stacks + 1) * sizeof(stack_entry)));
+		g_frame_pool = static_cast<uint64_t*>(reserve_memory(k_frame_pool_capacity * sizeof(uint64_t)));
+		return g_slots != nullptr && g_entries != nullptr && g_frame_pool != nullptr;
+	}
+
+	uint32_t intern_stack(const uint64_t* frames, uint32_t num_frames)
+	{
+		if (g_frame_pool == nullptr || num_frames == 0)
+			return k_invalid_stack_id;
+
+		if (num_frames > k_max_stack_frames)
+			num_frames = k_max_stack_frames;
+
+		const uint64_t hash = hash_frames(frames, num_frames);
+		uint32_t slot_index = uint32_t(hash) & (k_num_slots - 1);
+		uint32_t wait_iteration = 0;
+
+		while (true)
+		{
+			std::atomic<uint32_t>& slot = g_slots[slot_index];
+			uint32_t stack_id = slot.load(std::memory_order_acquire);
+
+			if (stack_id == k_invalid_stack_id)
+			{
+				if (slot.compare_exchange_strong(stack_id, k_claimed_slot, std::memory_order_acquire, std::memory_order_acquire))
+					return insert_stack(slot, hash, frames, num_frames);
+
+				// Lost the race, look at the same slot again
+				continue;
+			}
+
+			if (stack_id == k_claimed_slot)
+			{
+				if (++wait_iteration == k_max_wait_iterations)
+					return k_invalid_stack_id;
+
+				wait(wait_iteration);
+				continue;
+			}
+
+			// The slot id is stored after its entry is published
+			const stack_entry& entry = g_entries[stack_id];
+			if (entry.hash == hash && entry.num_frames.load(std::memory_order_relaxed) == num_frames && std::memcmp(g_frame_pool + entry.first_frame, frames, num_frames * sizeof(uint64_t)) == 0)
+				return stack_id;
+
+			slot_index = (slot_index + 1) & (k_num_slots - 1);
+		}
+	}
+
+	void write_new_stacks(trace_writer& writer)
+	{
+		const uint32_t num_stacks = g_num_stacks.load(std::memory_order_acquire);
+
+		for (uint32_t stack_id = g_num_written_stacks + 1; stack_id <= num_stacks; ++stack_id)
+		{
+			const stack_entry& entry = g_entries[stack_id];
+
+			// The inserting thread is between its id allocation and its publication
+			uint32_t num_frames = entry.num_frames.load(std::memory_order_acquire);
+			for (uint32_t wait_iteration = 0; num_frames == k_unpublished_entry && wait_iteration < k_max_wait_iterations; ++wait_iteration)
+			{
+				wait(wait_iteration);
+				num_frames = entry.num_frames.load(std::memory_order_acquire);
+			}
+
+			// Still being filled, it and the stacks after it are written by a later drain
+			if (num_frames == k_unpublished_entry)
+				return;
+
+			if (num_frames != k_abandoned_entry)
+				writer.write_stack(stack_id, g_frame_pool + entry.first_frame, num_frames);
+
+			g_num_written_stacks = stack_id;
+		}
+	}
+
+	void abandon_unpublished_stacks()
+	{
+		const uint32_t num_stacks = g_num_stacks.load(std::memory_order_acquire);
+		for (uint32_t stack_id = 1; stack_id <= num_stacks; ++stack_id)
+		{
+			uint32_t num_frames = k_unpublished_entry;
+			g_entries[stack_id].num_frames.compare_exchange_strong(num_frames, k_abandoned_entry, std::memory_order_relaxed);
+		}
+	}
+
+	void reset_written_stacks()
+	{
+		g_num_written_stacks = 0;
+	}
+}
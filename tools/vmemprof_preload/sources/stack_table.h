@@ -0,0 +1,64 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+
+namespace vmemprof
+{
+	class trace_writer;
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Reserves the stack table storage. Storage is reserved up front and committed
+	// as it is used.
+	////////////////////////////////////////////////////////////////////////////////
+	bool initialize_stack_table();
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns the id of a callstack (leaf first), adding it the first time it is
+	// seen. Ids are dense and start at 1, k_invalid_stack_id is returned when the
+	// table is full. Lock-free, any thread can intern stacks concurrently.
+	////////////////////////////////////////////////////////////////////////////////
+	uint32_t intern_stack(const uint64_t* frames, uint32_t num_frames);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Writes the stacks interned since the previous call, they must be written
+	// before the entries that reference them. A stack whose insertion does not
+	// complete in time and those after it wait for the next call, the entries
+	// can then come first. Only the drain thread writes stacks.
+	////////////////////////////////////////////////////////////////////////////////
+	void write_new_stacks(trace_writer& writer);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Gives up on the stacks still being inserted, used in a forked child where
+	// the inserting threads are gone.
+	////////////////////////////////////////////////////////////////////////////////
+	void abandon_unpublished_stacks();
+
+	////////////////////////////////////////////////////////////////////////////////
+	// A forked child writes a new trace, every stack is written again.
+	////////////////////////////////////////////////////////////////////////////////
+	void reset_written_stacks();
+}
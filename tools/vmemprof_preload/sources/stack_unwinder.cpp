@@ -0,0 +1,246 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "stack_unwinder.h"
+#include "capture_runtime.h"
+#include "stack_table.h"
+
+#include "vmemprof/core/event.h"
+#include "vmemprof/trace/stack_codec.h"
+
+#include <cstdint>
+#include <link.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined(VMEMPROF_USE_LIBUNWIND)
+	#define UNW_LOCAL_ONLY
+	#include <libunwind.h>
+#else
+	#include <unwind.h>
+#endif
+
+// Calling backtrace() on every hook is too expensive, it unwinds with the DWARF unwind
+// tables. We walk the frame pointer chain instead: two loads per frame.
+//
+// Code built without frame pointers uses the frame pointer register for other values, a
+// chain can point anywhere. Every frame record must be within the stack of the calling
+// thread and further up than the previous one. The C runtime is usually built without
+// frame pointers and most chains end with garbage, a chain that breaks after a few frames
+// is assumed to have reached it. When it breaks right away the caller has no frame pointer
+// and we unwind again with libunwind when available or the compiler's unwinder.
+// Functions that omit their frame without breaking the chain are silently skipped.
+
+// Top of the main thread's stack, set by the dynamic linker
+extern "C" void* __libc_stack_end;
+
+namespace vmemprof
+{
+	namespace
+	{
+		stack_capture_mode g_stack_capture_mode = stack_capture_mode::none;
+
+		// Executable range of our own library, its frames are skipped
+		uintptr_t g_own_code_start = 0;
+		uintptr_t g_own_code_end = 0;
+
+		// Top of the calling thread's stack, zero until first queried, ~0 when unknown
+		thread_local uintptr_t t_stack_end = 0;
+
+		constexpr uintptr_t k_unknown_stack_end = ~uintptr_t(0);
+
+		// Sanity limit on the distance between a frame and the top of its stack
+		constexpr uintptr_t k_max_stack_size = uintptr_t(1) << 30;
+
+		// A chain that breaks with fewer frames is considered missing
+		constexpr uint32_t k_min_frame_pointer_frames = 2;
+
+		int find_own_code_range(dl_phdr_info* info, size_t /*size*/, void* /*user_data*/)
+		{
+			const uintptr_t own_function = reinterpret_cast<uintptr_t>(&capture_stack_id);
+
+			for (uint32_t header_index = 0; header_index < info->dlpi_phnum; ++header_index)
+			{
+				const ElfW(Phdr)& header = info->dlpi_phdr[header_index];
+				if (header.p_type != PT_LOAD || (header.p_flags & PF_X) == 0)
+					continue;
+
+				const uintptr_t start = info->dlpi_addr + header.p_vaddr;
+				const uintptr_t end = start + header.p_memsz;
+				if (own_function >= start && own_function < end)
+				{
+					g_own_code_start = start;
+					g_own_code_end = end;
+					return 1;
+				}
+			}
+
+			return 0;
+		}
+
+		VMEMPROF_FORCE_INLINE bool is_own_code(uintptr_t address)
+		{
+			return address >= g_own_code_start && address < g_own_code_end;
+		}
+
+		uintptr_t get_stack_end()
+		{
+			uintptr_t stack_end = t_stack_end;
+			if (VMEMPROF_LIKELY(stack_end != 0))
+				return stack_end;
+
+			// Querying the stack attributes allocates, which can deadlock inside an allocator. glibc places
+			// the thread descriptor right above the stack of the threads it creates, the main thread has its own.
+			if (get_thread_id() == uint32_t(getpid()))
+				stack_end = reinterpret_cast<uintptr_t>(__libc_stack_end);
+			else
+				stack_end = uintptr_t(pthread_self());
+
+			const uintptr_t stack_pointer = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+			if (stack_end <= stack_pointer || stack_end - stack_pointer > k_max_stack_size)
+				stack_end = k_unknown_stack_end;
+
+			t_stack_end = stack_end;
+			return stack_end;
+		}
+
+		VMEMPROF_FORCE_INLINE void add_frame(uintptr_t return_address, uint64_t* frames, uint32_t& num_frames)
+		{
+			// Leading frames are inside our hooks
+			if (num_frames != 0 || !is_own_code(return_address))
+				frames[num_frames++] = return_address;
+		}
+
+#if !defined(VMEMPROF_USE_LIBUNWIND)
+		struct unwind_state
+		{
+			uint64_t* frames;
+			uint32_t num_frames;
+		};
+
+		_Unwind_Reason_Code on_unwind_frame(_Unwind_Context* context, void* user_data)
+		{
+			unwind_state& state = *static_cast<unwind_state*>(user_data);
+
+			const uintptr_t return_address = _Unwind_GetIP(context);
+			if (return_address == 0)
+				return _URC_END_OF_STACK;
+
+			add_frame(return_address, state.frames, state.num_frames);
+			return state.num_frames < k_max_stack_frames ? _URC_NO_REASON : _URC_END_OF_STACK;
+		}
+#endif
+
+		VMEMPROF_NO_INLINE uint32_t unwind_stack(uint64_t* frames)
+		{
+			// The unwinder can take locks and allocate, anything it maps is ignored
+			t_is_capture_disabled = true;
+
+#if defined(VMEMPROF_USE_LIBUNWIND)
+			void* return_addresses[k_max_stack_frames];
+			const int num_return_addresses = unw_backtrace(return_addresses, int(k_max_stack_frames));
+
+			uint32_t num_frames = 0;
+			for (int address_index = 0; address_index < num_return_addresses; ++address_index)
+				add_frame(reinterpret_cast<uintptr_t>(return_addresses[address_index]), frames, num_frames);
+#else
+			unwind_state state{ frames, 0 };
+			_Unwind_Backtrace(on_unwind_frame, &state);
+
+			const uint32_t num_frames = state.num_frames;
+#endif
+
+			t_is_capture_disabled = false;
+			return num_frames;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Walks the frame pointer chain from the given frame.
+		// Returns false if the caller does not appear to maintain frame pointers.
+		////////////////////////////////////////////////////////////////////////////////
+		VMEMPROF_FORCE_INLINE bool walk_frame_pointers(uintptr_t frame, uint64_t* frames, uint32_t& num_frames)
+		{
+			const uintptr_t stack_end = get_stack_end();
+			if (stack_end == k_unknown_stack_end)
+				return false;
+
+			// A frame record holds the caller's frame followed by the return address
+			while (num_frames < k_max_stack_frames)
+			{
+				const uintptr_t* record = reinterpret_cast<const uintptr_t*>(frame);
+				const uintptr_t caller_frame = record[0];
+				const uintptr_t return_address = record[1];
+
+				if (return_address == 0)
+					return true;
+
+				add_frame(return_address, frames, num_frames);
+
+				// The entry points of the process and of its threads clear the frame pointer
+				if (caller_frame == 0)
+					return true;
+
+				if (caller_frame <= frame || caller_frame > stack_end - 2 * sizeof(uintptr_t) || (caller_frame & (sizeof(uintptr_t) - 1)) != 0)
+					return num_frames >= k_min_frame_pointer_frames;
+
+				frame = caller_frame;
+			}
+
+			return true;
+		}
+	}
+
+	bool initialize_stack_capture(stack_capture_mode mode)
+	{
+		if (mode == stack_capture_mode::none)
+			return true;
+
+		dl_iterate_phdr(find_own_code_range, nullptr);
+
+		if (!initialize_stack_table())
+			return false;
+
+		g_stack_capture_mode = mode;
+		return true;
+	}
+
+	VMEMPROF_NO_INLINE uint32_t capture_stack_id()
+	{
+		const stack_capture_mode mode = g_stack_capture_mode;
+		if (mode == stack_capture_mode::none || t_is_capture_disabled)
+			return k_invalid_stack_id;
+
+		uint64_t frames[k_max_stack_frames];
+		uint32_t num_frames = 0;
+
+		bool is_complete = false;
+		if (mode == stack_capture_mode::frame_pointers)
+			is_complete = walk_frame_pointers(reinterpret_cast<uintptr_t>(__builtin_frame_address(0)), frames, num_frames);
+
+		if (!is_complete)
+			num_frames = unwind_stack(frames);
+
+		return intern_stack(frames, num_frames);
+	}
+}
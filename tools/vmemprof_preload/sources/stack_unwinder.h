@@ -0,0 +1,60 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/compiler_utils.h"
+
+#include <cstdint>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// How the callstack of virtual memory calls is captured.
+	////////////////////////////////////////////////////////////////////////////////
+	enum class stack_capture_mode
+	{
+		// Events carry no stack
+		none,
+
+		// Walks the frame pointer chain, falls back to the unwinder when it is broken
+		frame_pointers,
+
+		// Always unwinds with the unwind tables, slower but works without frame pointers
+		unwinder,
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Sets up stack capture. Called once before capture starts.
+	////////////////////////////////////////////////////////////////////////////////
+	bool initialize_stack_capture(stack_capture_mode mode);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Captures the callstack of our caller's caller and returns its interned id.
+	// Frames inside our library are skipped, the first frame returned is the
+	// call site of the hooked function. Returns k_invalid_stack_id when stacks
+	// are not captured.
+	////////////////////////////////////////////////////////////////////////////////
+	VMEMPROF_NO_INLINE uint32_t capture_stack_id();
+}
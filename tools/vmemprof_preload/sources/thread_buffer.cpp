@@ -0,0 +1,115 @@
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "thread_buffer.h"
+#include "raw_syscalls.h"
+
+#include <new>
+
+namespace vmemprof
+{
+	namespace
+	{
+		std::atomic<thread_buffer*> g_thread_buffer_list{ nullptr };
+
+		size_t get_thread_buffer_size(uint32_t capacity)
+		{
+			const size_t header_size = (sizeof(thread_buffer) + VMEMPROF_CACHE_LINE_SIZE - 1) & ~size_t(VMEMPROF_CACHE_LINE_SIZE - 1);
+			return header_size + size_t(capacity) * sizeof(vm_event);
+		}
+
+		thread_buffer* allocate_thread_buffer(uint32_t capacity)
+		{
+			// Header and storage live in a single mapping that the capture hooks never observe
+			const size_t buffer_size = get_thread_buffer_size(capacity);
+			const size_t header_size = buffer_size - size_t(capacity) * sizeof(vm_event);
+
+			void* memory = raw_mmap(nullptr, buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (memory == MAP_FAILED)
+				return nullptr;
+
+			thread_buffer* buffer = new(memory) thread_buffer();
+			buffer->ring.initialize(reinterpret_cast<vm_event*>(static_cast<uint8_t*>(memory) + header_size), capacity);
+			buffer->is_owned.store(true, std::memory_order_relaxed);
+			return buffer;
+		}
+	}
+
+	thread_buffer* acquire_thread_buffer(uint32_t capacity)
+	{
+		for (thread_buffer* buffer = g_thread_buffer_list.load(std::memory_order_acquire); buffer != nullptr; buffer = buffer->next)
+		{
+			bool is_owned = buffer->is_owned.load(std::memory_order_relaxed);
+			if (!is_owned && buffer->is_owned.compare_exchange_strong(is_owned, true, std::memory_order_acquire))
+				return buffer;
+		}
+
+		thread_buffer* buffer = allocate_thread_buffer(capacity);
+		if (buffer == nullptr)
+			return nullptr;
+
+		thread_buffer* head = g_thread_buffer_list.load(std::memory_order_relaxed);
+		do
+		{
+			buffer->next = head;
+		} while (!g_thread_buffer_list.compare_exchange_weak(head, buffer, std::memory_order_release, std::memory_order_relaxed));
+
+		return buffer;
+	}
+
+	void release_thread_buffer(thread_buffer* buffer)
+	{
+		buffer->is_owned.store(false, std::memory_order_release);
+	}
+
+	thread_buffer* get_thread_buffer_list()
+	{
+		return g_thread_buffer_list.load(std::memory_order_acquire);
+	}
+
+	void reset_thread_buffers()
+	{
+		for (thread_buffer* buffer = get_thread_buffer_list(); buffer != nullptr; buffer = buffer->next)
+		{
+			buffer->ring.reset();
+			buffer->num_dropped.store(0, std::memory_order_relaxed);
+			buffer->num_dropped_reported = 0;
+			buffer->hook_timestamp.store(0, std::memory_order_relaxed);
+			buffer->is_owned.store(false, std::memory_order_relaxed);
+		}
+	}
+
+	void discard_thread_buffer_events()
+	{
+		vm_event events[64];
+		for (thread_buffer* buffer = get_thread_buffer_list(); buffer != nullptr; buffer = buffer->next)
+		{
+			// Popping is how the consumer empties a ring without racing its owner
+			while (buffer->ring.pop(events, 64) != 0)
+				continue;
+
+			buffer->num_dropped_reported = buffer->num_dropped.load(std::memory_order_relaxed);
+		}
+	}
+}
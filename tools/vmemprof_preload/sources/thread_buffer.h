@@ -0,0 +1,100 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// The MIT License (MIT)
+//
+// Copyright (c) 2020 Nicholas Frechette & vmemprof contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vmemprof/core/compiler_utils.h"
+#include "vmemprof/core/event.h"
+#include "vmemprof/core/spsc_ring_buffer.h"
+
+#include <atomic>
+#include <cstdint>
+
+namespace vmemprof
+{
+	////////////////////////////////////////////////////////////////////////////////
+	// The capture buffer owned by a single application thread.
+	//
+	// The owning thread is the only producer and the drain thread the only consumer.
+	// When the ring is full the event is dropped and counted, the application thread
+	// never waits on the drain thread.
+	////////////////////////////////////////////////////////////////////////////////
+	// Published in hook_timestamp while the owner reads the time it entered a hook
+	constexpr uint64_t k_hook_timestamp_pending = UINT64_MAX;
+
+	struct thread_buffer
+	{
+		spsc_ring_buffer<vm_event>		ring;
+
+		// Only incremented by the owner, read by the drain thread
+		alignas(VMEMPROF_CACHE_LINE_SIZE) std::atomic<uint64_t> num_dropped{ 0 };
+
+		// When the owner entered the hook that is about to record an event, zero outside of hooks
+		std::atomic<uint64_t>			hook_timestamp{ 0 };
+
+		// Last drop count reported by the drain thread
+		uint64_t						num_dropped_reported = 0;
+
+		// Buffers return to the registry when their thread exits, they are only freed on detach
+		std::atomic<bool>				is_owned{ false };
+		thread_buffer*					next = nullptr;
+
+		VMEMPROF_FORCE_INLINE void record(const vm_event& event)
+		{
+			if (VMEMPROF_UNLIKELY(!ring.try_push(event)))
+				num_dropped.store(num_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns a buffer for the calling thread, reusing one released by an exited
+	// thread when possible. Returns nullptr if memory could not be allocated.
+	// The registry is a lock-free list that only grows, the number of buffers is
+	// bounded by the peak number of threads that captured events concurrently.
+	////////////////////////////////////////////////////////////////////////////////
+	thread_buffer* acquire_thread_buffer(uint32_t capacity);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns a buffer to the registry, pending events are still drained.
+	////////////////////////////////////////////////////////////////////////////////
+	void release_thread_buffer(thread_buffer* buffer);
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Returns the first registered buffer, iterate with 'next'.
+	////////////////////////////////////////////////////////////////////////////////
+	thread_buffer* get_thread_buffer_list();
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Discards the content of every buffer and releases them, used in the child
+	// after a fork where the only surviving thread is the forking thread.
+	////////////////////////////////////////////////////////////////////////////////
+	void reset_thread_buffers();
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Pops and discards the events left in every buffer when we attach again,
+	// they belong to the previous capture. Threads keep their buffers, only the
+	// drain thread may pop and it must not be running.
+	////////////////////////////////////////////////////////////////////////////////
+	void discard_thread_buffer_events();
+}